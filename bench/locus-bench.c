@@ -0,0 +1,549 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "locus.h"
+#include "locus-ui.h"
+
+/* Renders fixed scenes headless and prints one JSON line per scene. The
+ * first frame is compared against --reference; a missing one is skipped. */
+
+#define BENCH_SAMPLES_MAX 100000
+#define BENCH_BLOCK 4
+
+typedef struct {
+    const char *name;
+    void (*setup)(LocusUI* ui);
+    void (*draw)(LocusUI* ui, float width, float height, int frame);
+} BenchScene;
+
+typedef struct {
+    LocusBackend backend;
+    const char *scene;
+    const char *font;
+    const char *reference;
+    int frames;
+    int warmup;
+    int width;
+    int height;
+    float scale;
+    int update;
+    int tolerance;
+    double threshold;
+} BenchOptions;
+
+typedef struct {
+    LocusUI ui;
+    const BenchScene *scene;
+    int frame;
+} BenchState;
+
+/* Allocations are counted by interposing the allocator; GL calls by
+ * interposing the entry points the renderer uses and forwarding them to
+ * the real driver. */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static atomic_ulong alloc_count;
+static atomic_ulong gl_calls;
+static atomic_ulong gl_draws;
+
+void *malloc(size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+#define BENCH_GL(name, params, args)                                    \
+    void name params {                                                  \
+        static void (*real) params;                                     \
+        if (!real) {                                                    \
+            real = (void (*) params)dlsym(RTLD_NEXT, #name);            \
+        }                                                               \
+        atomic_fetch_add_explicit(&gl_calls, 1, memory_order_relaxed);  \
+        real args;                                                      \
+    }
+
+#define BENCH_GL_DRAW(name, params, args)                               \
+    void name params {                                                  \
+        static void (*real) params;                                     \
+        if (!real) {                                                    \
+            real = (void (*) params)dlsym(RTLD_NEXT, #name);            \
+        }                                                               \
+        atomic_fetch_add_explicit(&gl_calls, 1, memory_order_relaxed);  \
+        atomic_fetch_add_explicit(&gl_draws, 1, memory_order_relaxed);  \
+        real args;                                                      \
+    }
+
+BENCH_GL_DRAW(glDrawArrays, (GLenum mode, GLint first, GLsizei count), (mode, first, count))
+BENCH_GL_DRAW(glDrawElements, (GLenum mode, GLsizei count, GLenum type, const void *indices),
+              (mode, count, type, indices))
+BENCH_GL(glUseProgram, (GLuint program), (program))
+BENCH_GL(glBindTexture, (GLenum target, GLuint texture), (target, texture))
+BENCH_GL(glBindBuffer, (GLenum target, GLuint buffer), (target, buffer))
+BENCH_GL(glBufferData, (GLenum target, GLsizeiptr size, const void *data, GLenum usage),
+         (target, size, data, usage))
+BENCH_GL(glBufferSubData, (GLenum target, GLintptr offset, GLsizeiptr size, const void *data),
+         (target, offset, size, data))
+BENCH_GL(glTexImage2D, (GLenum target, GLint level, GLint internalformat, GLsizei width,
+                        GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels),
+         (target, level, internalformat, width, height, border, format, type, pixels))
+BENCH_GL(glTexSubImage2D, (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width,
+                           GLsizei height, GLenum format, GLenum type, const void *pixels),
+         (target, level, xoffset, yoffset, width, height, format, type, pixels))
+BENCH_GL(glScissor, (GLint x, GLint y, GLsizei width, GLsizei height), (x, y, width, height))
+BENCH_GL(glEnable, (GLenum cap), (cap))
+BENCH_GL(glDisable, (GLenum cap), (cap))
+BENCH_GL(glBlendFunc, (GLenum sfactor, GLenum dfactor), (sfactor, dfactor))
+BENCH_GL(glUniform4fv, (GLint location, GLsizei count, const GLfloat *value), (location, count, value))
+BENCH_GL(glVertexAttribPointer, (GLuint index, GLint size, GLenum type, GLboolean normalized,
+                                 GLsizei stride, const void *pointer),
+         (index, size, type, normalized, stride, pointer))
+
+/* Scenes are deterministic: positions come from a fixed seed and the
+ * animation only depends on the frame number. */
+
+static uint32_t lcg(uint32_t *state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static float lcg_float(uint32_t *state) {
+    return (lcg(state) & 0xffff) / 65535.0f;
+}
+
+static void draw_rounded_rects(LocusUI* ui, float width, float height, int frame) {
+    uint32_t seed = 1;
+    float shift = (frame % 120) * 0.5f;
+
+    for (int i = 0; i < 2000; i++) {
+        float w = 12 + lcg_float(&seed) * 60;
+        float h = 12 + lcg_float(&seed) * 40;
+        float x = lcg_float(&seed) * (width - w) + shift * (i % 3 - 1);
+        float y = lcg_float(&seed) * (height - h);
+        float r = lcg_float(&seed) * 255, g = lcg_float(&seed) * 255, b = lcg_float(&seed) * 255;
+        locus_rectangle(ui, x, y, w, h, r, g, b, 0.6f + lcg_float(&seed) * 0.4f, fminf(w, h) * 0.25f);
+    }
+}
+
+static void draw_text_list(LocusUI* ui, float width, float height, int frame) {
+    char label[64];
+    float offset = (float)(frame % 40);
+
+    for (int i = 0; i * 40 - offset < height; i++) {
+        float y = i * 40 - offset;
+        locus_rectangle(ui, 0, y, width, 39, 30 + (i % 2) * 12, 30, 36, 1.0f, 0);
+        snprintf(label, sizeof(label), "List item %d", i);
+        locus_text(ui, label, 16, y + 26, 18, 235, 235, 240, 1.0f);
+        snprintf(label, sizeof(label), "%d KiB", (i * 37) % 1000);
+        locus_text(ui, label, width - 96, y + 26, 14, 150, 150, 160, 1.0f);
+    }
+}
+
+static void setup_icon_grid(LocusUI* ui) {
+    unsigned char rgba[64 * 64 * 4];
+    char key[32];
+
+    for (int n = 0; n < 16; n++) {
+        for (int y = 0; y < 64; y++) {
+            for (int x = 0; x < 64; x++) {
+                unsigned char *p = &rgba[(y * 64 + x) * 4];
+                float dx = x - 31.5f, dy = y - 31.5f;
+                int inside = dx * dx + dy * dy < 30.0f * 30.0f;
+                p[0] = (unsigned char)(n * 16);
+                p[1] = (unsigned char)(x * 4);
+                p[2] = (unsigned char)(y * 4);
+                p[3] = inside ? 255 : 0;
+            }
+        }
+        snprintf(key, sizeof(key), "bench-icon-%d", n);
+        locus_texture_insert_rgba(ui, key, 64, 1.0f, rgba, 64, 64);
+    }
+}
+
+static void draw_icon_grid(LocusUI* ui, float width, float height, int frame) {
+    char key[32];
+    int columns = width >= 96 ? (int)(width / 96) : 1;
+    int rows = (int)ceilf(height / 104);
+    int index = frame % 16;
+
+    for (int i = 0; i < rows * columns; i++) {
+        float x = (i % columns) * 96 + 16, y = (i / columns) * 104 + 8;
+        snprintf(key, sizeof(key), "bench-icon-%d", (i + index) % 16);
+        const LocusTexture* tex = locus_texture_lookup(ui, key, 64, 1.0f);
+        if (tex) {
+            locus_draw_texture(ui, tex, x, y, 64, 64);
+        }
+        locus_text(ui, key + 6, x, y + 84, 12, 220, 220, 220, 1.0f);
+    }
+}
+
+static void setup_image_wall(LocusUI* ui) {
+    static const int sizes[4][2] = { { 640, 400 }, { 400, 640 }, { 512, 512 }, { 800, 300 } };
+    char key[32];
+
+    for (int n = 0; n < 4; n++) {
+        int w = sizes[n][0], h = sizes[n][1];
+        unsigned char *rgba = malloc((size_t)w * h * 4);
+        if (!rgba) {
+            return;
+        }
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                unsigned char *p = &rgba[((size_t)y * w + x) * 4];
+                p[0] = (unsigned char)(x * 255 / w);
+                p[1] = (unsigned char)(y * 255 / h);
+                p[2] = (unsigned char)(((x / 32 + y / 32) & 1) * 128 + n * 32);
+                p[3] = 255;
+            }
+        }
+        snprintf(key, sizeof(key), "bench-image-%d", n);
+        locus_texture_insert_rgba(ui, key, w, 1.0f, rgba, w, h);
+        free(rgba);
+    }
+}
+
+static void draw_image_wall(LocusUI* ui, float width, float height, int frame) {
+    static const int sizes[4] = { 640, 400, 512, 800 };
+    char key[32];
+    float offset = (float)(frame % 150);
+
+    for (int i = 0; (i / 3) * 150 - offset < height; i++) {
+        float x = (i % 3) * (width / 3), y = (i / 3) * 150 - offset;
+        snprintf(key, sizeof(key), "bench-image-%d", i % 4);
+        const LocusTexture* tex = locus_texture_lookup(ui, key, sizes[i % 4], 1.0f);
+        if (tex) {
+            locus_draw_texture(ui, tex, x + 4, y + 4, width / 3 - 8, 142);
+        }
+    }
+}
+
+static const BenchScene scenes[] = {
+    { "rounded_rects", NULL, draw_rounded_rects },
+    { "text_list", NULL, draw_text_list },
+    { "icon_grid", setup_icon_grid, draw_icon_grid },
+    { "image_wall", setup_image_wall, draw_image_wall },
+};
+
+static void draw(LocusSurface *surface, void *data) {
+    BenchState *state = data;
+    locus_ui_begin_frame(&state->ui, surface->width, surface->height, surface->scale);
+    state->scene->draw(&state->ui, surface->width, surface->height, state->frame);
+    locus_ui_end_frame(&state->ui);
+}
+
+static const char *find_font(const char *font) {
+    static const char *paths[] = {
+        "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf",
+        "/usr/share/fonts/TTF/DejaVuSans.ttf",
+        "/usr/share/fonts/dejavu/DejaVuSans.ttf",
+    };
+
+    if (font) {
+        return font;
+    }
+    if (getenv("LOCUS_FONT")) {
+        return getenv("LOCUS_FONT");
+    }
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        if (access(paths[i], R_OK) == 0) {
+            return paths[i];
+        }
+    }
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int write_ppm(const char *path, const uint32_t *pixels, int width, int height) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return 0;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for (int i = 0; i < width * height; i++) {
+        unsigned char rgb[3] = { pixels[i] >> 16, pixels[i] >> 8, pixels[i] };
+        fwrite(rgb, 1, 3, file);
+    }
+    fclose(file);
+    return 1;
+}
+
+static unsigned char *read_ppm(const char *path, int width, int height) {
+    FILE *file = fopen(path, "rb");
+    int w, h, max;
+    if (!file) {
+        return NULL;
+    }
+    if (fscanf(file, "P6 %d %d %d", &w, &h, &max) != 3 || w != width || h != height || max != 255) {
+        fprintf(stderr, "Reference %s does not match the frame size\n", path);
+        fclose(file);
+        return NULL;
+    }
+    fgetc(file);
+    unsigned char *rgb = malloc((size_t)width * height * 3);
+    if (rgb && fread(rgb, 3, (size_t)width * height, file) != (size_t)width * height) {
+        free(rgb);
+        rgb = NULL;
+    }
+    fclose(file);
+    return rgb;
+}
+
+/* Fraction of BENCH_BLOCK blocks whose average colour is beyond the
+ * tolerance, or -1 without a usable reference. */
+static double diff_reference(const char *path, const uint32_t *pixels, int width, int height,
+                             int tolerance) {
+    unsigned char *rgb = read_ppm(path, width, height);
+    if (!rgb) {
+        return -1.0;
+    }
+
+    size_t mismatched = 0, blocks = 0;
+    for (int by = 0; by < height; by += BENCH_BLOCK) {
+        for (int bx = 0; bx < width; bx += BENCH_BLOCK) {
+            int sum[3] = { 0, 0, 0 }, count = 0;
+            for (int y = by; y < by + BENCH_BLOCK && y < height; y++) {
+                for (int x = bx; x < bx + BENCH_BLOCK && x < width; x++) {
+                    uint32_t p = pixels[y * width + x];
+                    const unsigned char *r = &rgb[(y * width + x) * 3];
+                    sum[0] += (int)((p >> 16) & 0xff) - r[0];
+                    sum[1] += (int)((p >> 8) & 0xff) - r[1];
+                    sum[2] += (int)(p & 0xff) - r[2];
+                    count++;
+                }
+            }
+            for (int c = 0; c < 3; c++) {
+                if (abs(sum[c]) > tolerance * count) {
+                    mismatched++;
+                    break;
+                }
+            }
+            blocks++;
+        }
+    }
+    free(rgb);
+    return (double)mismatched / blocks;
+}
+
+static int run_scene(const BenchOptions *options, const BenchScene *scene) {
+    Locus app;
+    BenchState state = { .scene = scene };
+    const char *backend_name;
+    int status = 1;
+
+    if (!locus_init_headless(&app, options->width, options->height, options->backend)) {
+        return 0;
+    }
+    locus_set_timing(&app, 1);
+    backend_name = app.backend == LOCUS_BACKEND_SHM ? "shm" : "egl";
+
+    LocusSurface *surface = locus_surface_create_headless(&app, options->width, options->height,
+                                                          options->scale);
+    if (!surface) {
+        locus_cleanup(&app);
+        return 0;
+    }
+    if (app.backend == LOCUS_BACKEND_SHM) {
+        locus_setup_ui_software(&state.ui);
+        state.ui.app = &app;
+    } else {
+        locus_setup_ui(&state.ui);
+    }
+    const char *font = find_font(options->font);
+    int font_index = font ? locus_font_load(&state.ui, "bench", font) : -1;
+    if (font_index >= 0) {
+        locus_font_set_default(&state.ui, font_index);
+    }
+    if (scene->setup) {
+        scene->setup(&state.ui);
+    }
+    locus_surface_set_draw_callback(surface, draw, &state);
+
+    int frames = options->frames < BENCH_SAMPLES_MAX ? options->frames : BENCH_SAMPLES_MAX;
+    uint64_t *samples = calloc(frames, sizeof(*samples));
+    uint32_t *pixels = malloc((size_t)surface->buffer_width * surface->buffer_height * sizeof(*pixels));
+    if (!samples || !pixels) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        free(samples);
+        free(pixels);
+        locus_cleanup_ui(&state.ui);
+        locus_cleanup(&app);
+        return 0;
+    }
+
+    for (int i = 0; i < options->warmup; i++) {
+        state.frame = i;
+        locus_surface_render_offscreen(surface);
+    }
+
+    unsigned long allocs = atomic_load(&alloc_count);
+    unsigned long calls = atomic_load(&gl_calls);
+    unsigned long draws = atomic_load(&gl_draws);
+    uint64_t total = 0;
+    for (int i = 0; i < frames; i++) {
+        state.frame = options->warmup + i;
+        uint64_t start = locus_now_ns();
+        locus_surface_render_offscreen(surface);
+        samples[i] = locus_now_ns() - start;
+        total += samples[i];
+    }
+    allocs = atomic_load(&alloc_count) - allocs;
+    calls = atomic_load(&gl_calls) - calls;
+    draws = atomic_load(&gl_draws) - draws;
+
+    LocusTimingStats gpu = { 0 };
+    locus_timing_stats(&app, LOCUS_TIMING_GPU, &gpu);
+    qsort(samples, frames, sizeof(*samples), compare_u64);
+
+    state.frame = 0;
+    locus_surface_render_offscreen(surface);
+    locus_surface_read_pixels(surface, pixels);
+
+    const char *result = "none";
+    double mismatch = 0.0;
+    if (options->reference) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s-%s.ppm", options->reference, scene->name, backend_name);
+        if (options->update) {
+            result = write_ppm(path, pixels, surface->buffer_width, surface->buffer_height) ? "updated" : "error";
+        } else {
+            mismatch = diff_reference(path, pixels, surface->buffer_width, surface->buffer_height,
+                                      options->tolerance);
+            result = mismatch < 0 ? "skipped" : (mismatch > options->threshold ? "fail" : "pass");
+        }
+        if (strcmp(result, "skipped") == 0) {
+            fprintf(stderr, "No reference for %s, image check skipped\n", path);
+        }
+        if (strcmp(result, "fail") == 0 || strcmp(result, "error") == 0) {
+            status = 0;
+        }
+    }
+
+    printf("{\"scene\":\"%s\",\"backend\":\"%s\",\"width\":%d,\"height\":%d,\"scale\":%.2f,"
+           "\"frames\":%d,\"mean_ms\":%.3f,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"gpu_p50_ms\":%.3f,"
+           "\"allocs_per_frame\":%.1f,\"gl_calls_per_frame\":%.1f,\"draw_calls_per_frame\":%.1f,"
+           "\"text\":%s,\"reference\":\"%s\",\"mismatch\":%.5f}\n",
+           scene->name, backend_name, surface->buffer_width, surface->buffer_height, surface->scale,
+           frames, frames ? total / 1e6 / frames : 0.0,
+           frames ? samples[(frames - 1) * 50 / 100] / 1e6 : 0.0,
+           frames ? samples[(frames - 1) * 99 / 100] / 1e6 : 0.0,
+           gpu.count ? gpu.p50 / 1e6 : 0.0,
+           frames ? (double)allocs / frames : 0.0, frames ? (double)calls / frames : 0.0,
+           frames ? (double)draws / frames : 0.0, font_index >= 0 ? "true" : "false", result,
+           mismatch > 0 ? mismatch : 0.0);
+    fflush(stdout);
+
+    free(samples);
+    free(pixels);
+    locus_cleanup_ui(&state.ui);
+    locus_cleanup(&app);
+    return status;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [--backend egl|shm] [--scene NAME] [--frames N] [--warmup N]\n"
+            "          [--size WxH] [--scale S] [--font PATH] [--reference DIR]\n"
+            "          [--update-reference] [--tolerance N] [--threshold F]\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options = {
+        .backend = LOCUS_BACKEND_AUTO,
+        .frames = 300,
+        .warmup = 30,
+        .width = 800,
+        .height = 600,
+        .scale = 1.0f,
+        .tolerance = 8,
+        .threshold = 0.01,
+    };
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--update-reference") == 0) {
+            options.update = 1;
+            continue;
+        }
+        if (!value) {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+        if (strcmp(arg, "--backend") == 0) {
+            options.backend = strcmp(value, "shm") == 0 ? LOCUS_BACKEND_SHM : LOCUS_BACKEND_EGL;
+        } else if (strcmp(arg, "--scene") == 0) {
+            options.scene = value;
+        } else if (strcmp(arg, "--frames") == 0) {
+            options.frames = atoi(value);
+        } else if (strcmp(arg, "--warmup") == 0) {
+            options.warmup = atoi(value);
+        } else if (strcmp(arg, "--size") == 0) {
+            if (sscanf(value, "%dx%d", &options.width, &options.height) != 2) {
+                usage(argv[0]);
+                return 2;
+            }
+        } else if (strcmp(arg, "--scale") == 0) {
+            options.scale = strtof(value, NULL);
+        } else if (strcmp(arg, "--font") == 0) {
+            options.font = value;
+        } else if (strcmp(arg, "--reference") == 0) {
+            options.reference = value;
+        } else if (strcmp(arg, "--tolerance") == 0) {
+            options.tolerance = atoi(value);
+        } else if (strcmp(arg, "--threshold") == 0) {
+            options.threshold = strtod(value, NULL);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (options.frames < 1 || options.width < 1 || options.height < 1 || options.scale <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    int failed = 0, found = 0;
+    for (size_t i = 0; i < sizeof(scenes) / sizeof(scenes[0]); i++) {
+        if (options.scene && strcmp(options.scene, scenes[i].name) != 0) {
+            continue;
+        }
+        found = 1;
+        if (!run_scene(&options, &scenes[i])) {
+            failed = 1;
+        }
+    }
+    if (!found) {
+        fprintf(stderr, "Unknown scene %s\n", options.scene);
+        return 2;
+    }
+    return failed;
+}
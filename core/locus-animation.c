@@ -0,0 +1,230 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "locus-private.h"
+
+#define LOCUS_SPRING_STEP_MS 4.0f
+#define LOCUS_SPRING_MAX_STEP_MS 64
+
+/* Tweens and springs on float properties, all stepped by one frame hook
+ * with the frame's presentation time. The hook exists only while something
+ * is animating, so a settled UI requests no frames at all. */
+
+float locus_ease(LocusEasing easing, float t) {
+    t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+    switch (easing) {
+    case LOCUS_EASE_IN:
+        return t * t * t;
+    case LOCUS_EASE_OUT:
+        t = 1.0f - t;
+        return 1.0f - t * t * t;
+    case LOCUS_EASE_IN_OUT:
+        if (t < 0.5f) {
+            return 4.0f * t * t * t;
+        }
+        t = 2.0f - 2.0f * t;
+        return 1.0f - t * t * t * 0.5f;
+    case LOCUS_EASE_OUT_BACK:
+        t -= 1.0f;
+        return 1.0f + t * t * (2.70158f * t + 1.70158f);
+    case LOCUS_EASE_LINEAR:
+    default:
+        return t;
+    }
+}
+
+/* Semi-implicit Euler in small fixed steps, which stays stable for stiff
+ * springs at any frame rate. Returns 1 once the spring has come to rest. */
+static int step_spring(LocusAnimation *animation, float *value, float dt) {
+    float x = *value, v = animation->velocity;
+    float rest = fabsf(animation->to - animation->from) * 0.001f;
+    rest = rest > 0.001f ? rest : 0.001f;
+
+    while (dt > 0.0f) {
+        float h = (dt < LOCUS_SPRING_STEP_MS ? dt : LOCUS_SPRING_STEP_MS) / 1000.0f;
+        float a = -animation->stiffness * (x - animation->to) - animation->damping * v;
+        v += a * h;
+        x += v * h;
+        dt -= LOCUS_SPRING_STEP_MS;
+    }
+
+    animation->velocity = v;
+    if (fabsf(x - animation->to) < rest && fabsf(v) < rest * 10.0f) {
+        *value = animation->to;
+        animation->velocity = 0.0f;
+        return 1;
+    }
+    *value = x;
+    return 0;
+}
+
+static int step_animation(LocusAnimation *animation, uint32_t time) {
+    if (animation->start == 0) {
+        animation->start = animation->last = time ? time : 1;
+    }
+
+    if (animation->stiffness > 0.0f) {
+        int32_t dt = (int32_t)(time - animation->last);
+        dt = dt < 0 ? 0 : (dt > LOCUS_SPRING_MAX_STEP_MS ? LOCUS_SPRING_MAX_STEP_MS : dt);
+        animation->last = time;
+        return step_spring(animation, animation->value, (float)dt);
+    }
+
+    int32_t elapsed = (int32_t)(time - animation->start);
+    float t = animation->duration ? (float)elapsed / animation->duration : 1.0f;
+    *animation->value = animation->from + (animation->to - animation->from) * locus_ease(animation->easing, t);
+    return t >= 1.0f;
+}
+
+static void compact_animations(Locus *app) {
+    int n = 0;
+    for (int i = 0; i < app->animation_count; i++) {
+        if (app->animations[i].id) {
+            app->animations[n++] = app->animations[i];
+        }
+    }
+    app->animation_count = n;
+}
+
+/* Callbacks may start or cancel animations, so the array is indexed anew
+ * after each of them; animations started here run from the next frame. */
+static void animation_frame(Locus *app, uint32_t time, void *data) {
+    int count = app->animation_count;
+
+    for (int i = 0; i < count; i++) {
+        LocusAnimation *animation = &app->animations[i];
+        if (!animation->id) {
+            continue;
+        }
+
+        int finished = step_animation(animation, time);
+        float value = *animation->value;
+        if (finished) {
+            animation->id = 0;
+        }
+        if (animation->update) {
+            animation->update(app, value, animation->data);
+        } else {
+            locus_damage_all(app);
+        }
+        animation = &app->animations[i];
+        if (finished && animation->done) {
+            animation->done(app, 1, animation->data);
+        }
+    }
+
+    compact_animations(app);
+    if (app->animation_count == 0) {
+        locus_remove_frame_hook(app, app->animation_hook);
+        app->animation_hook = 0;
+        return;
+    }
+    locus_schedule_frame(app);
+}
+
+static void finish_animation(Locus *app, int index) {
+    LocusAnimation *animation = &app->animations[index];
+    animation->id = 0;
+    if (animation->done) {
+        animation->done(app, 0, animation->data);
+    }
+}
+
+/* An animation of a value that is already animating replaces the old one,
+ * which reports that it did not finish; a spring keeps its velocity. */
+static LocusAnimation *add_animation(Locus *app, float *value, float to) {
+    float velocity = 0.0f;
+    for (int i = 0; i < app->animation_count; i++) {
+        if (app->animations[i].id && app->animations[i].value == value) {
+            velocity = app->animations[i].velocity;
+            finish_animation(app, i);
+        }
+    }
+
+    if (app->animation_count == app->animation_capacity) {
+        int capacity = app->animation_capacity ? app->animation_capacity * 2 : 8;
+        LocusAnimation *animations = realloc(app->animations, capacity * sizeof *animations);
+        if (!animations) {
+            fprintf(stderr, "Failed to allocate animation\n");
+            return NULL;
+        }
+        app->animations = animations;
+        app->animation_capacity = capacity;
+    }
+    if (!app->animation_hook) {
+        app->animation_hook = locus_add_frame_hook(app, animation_frame, NULL);
+        if (!app->animation_hook) {
+            return NULL;
+        }
+    }
+
+    LocusAnimation *animation = &app->animations[app->animation_count++];
+    *animation = (LocusAnimation){ 0 };
+    animation->id = ++app->next_timer_id;
+    animation->value = value;
+    animation->from = *value;
+    animation->to = to;
+    animation->velocity = velocity;
+    locus_schedule_frame(app);
+    return animation;
+}
+
+int locus_animate(Locus *app, float *value, float to, uint32_t duration_ms, LocusEasing easing) {
+    LocusAnimation *animation = add_animation(app, value, to);
+    if (!animation) {
+        return 0;
+    }
+    animation->duration = duration_ms;
+    animation->easing = easing;
+    return animation->id;
+}
+
+/* stiffness and damping are per second squared and per second; critical
+ * damping is 2 * sqrt(stiffness). */
+int locus_animate_spring(Locus *app, float *value, float to, float stiffness, float damping) {
+    LocusAnimation *animation = add_animation(app, value, to);
+    if (!animation) {
+        return 0;
+    }
+    animation->stiffness = stiffness > 0.0f ? stiffness : 1.0f;
+    animation->damping = damping > 0.0f ? damping : 0.0f;
+    return animation->id;
+}
+
+/* Without an update callback each step damages the whole target surface. */
+void locus_animation_set_callbacks(Locus *app, int id, void (*update)(Locus *app, float value, void *data),
+                                   void (*done)(Locus *app, int finished, void *data), void *data) {
+    for (int i = 0; i < app->animation_count; i++) {
+        if (app->animations[i].id == id) {
+            app->animations[i].update = update;
+            app->animations[i].done = done;
+            app->animations[i].data = data;
+        }
+    }
+}
+
+void locus_animation_cancel(Locus *app, int id) {
+    for (int i = 0; i < app->animation_count; i++) {
+        if (app->animations[i].id == id) {
+            finish_animation(app, i);
+        }
+    }
+}
+
+int locus_animating(Locus *app) {
+    int count = 0;
+    for (int i = 0; i < app->animation_count; i++) {
+        count += app->animations[i].id != 0;
+    }
+    return count;
+}
+
+void locus_animation_cleanup(Locus *app) {
+    if (app->animation_hook) {
+        locus_remove_frame_hook(app, app->animation_hook);
+        app->animation_hook = 0;
+    }
+    free(app->animations);
+    app->animations = NULL;
+    app->animation_count = app->animation_capacity = 0;
+}
@@ -0,0 +1,365 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "locus.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define LOCUS_CANVAS_SSE2 1
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LOCUS_CANVAS_AVX2 1
+#endif
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LOCUS_CANVAS_NEON 1
+#endif
+
+#define LOCUS_CANVAS_SPAN 64
+
+/* All kernels work on premultiplied ARGB8888, so source-over is
+ * dst = src + dst * (255 - src.a) / 255 on every channel. */
+static inline uint32_t div255_pair(uint32_t x) {
+    x += 0x00800080;
+    return ((x + ((x >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+}
+
+static inline uint32_t scale_pixel(uint32_t p, uint32_t alpha) {
+    uint32_t rb = div255_pair((p & 0x00ff00ff) * alpha);
+    uint32_t ag = div255_pair(((p >> 8) & 0x00ff00ff) * alpha);
+    return rb | (ag << 8);
+}
+
+static inline uint32_t over(uint32_t src, uint32_t dst) {
+    return src + scale_pixel(dst, 255 - (src >> 24));
+}
+
+static void blend_row_scalar(uint32_t *dst, const uint32_t *src, int count) {
+    for (int i = 0; i < count; i++) {
+        uint32_t a = src[i] >> 24;
+        if (a == 255) {
+            dst[i] = src[i];
+        } else if (a != 0) {
+            dst[i] = over(src[i], dst[i]);
+        }
+    }
+}
+
+#ifdef LOCUS_CANVAS_SSE2
+static inline __m128i over_sse2(__m128i s, __m128i d) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c255 = _mm_set1_epi16(255);
+    const __m128i c128 = _mm_set1_epi16(128);
+
+    __m128i a = _mm_srli_epi32(s, 24);
+    a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+    __m128i inv_lo = _mm_sub_epi16(c255, _mm_unpacklo_epi32(a, a));
+    __m128i inv_hi = _mm_sub_epi16(c255, _mm_unpackhi_epi32(a, a));
+
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inv_lo), c128);
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inv_hi), c128);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+    return _mm_adds_epu8(s, _mm_packus_epi16(lo, hi));
+}
+
+static void blend_row_sse2(uint32_t *dst, const uint32_t *src, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), over_sse2(s, d));
+    }
+    blend_row_scalar(dst + i, src + i, count - i);
+}
+
+static void fill_row(uint32_t *dst, uint32_t color, int count) {
+    __m128i c = _mm_set1_epi32((int)color);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128((__m128i *)(dst + i), c);
+    }
+    for (; i < count; i++) {
+        dst[i] = color;
+    }
+}
+#endif
+
+#ifdef LOCUS_CANVAS_AVX2
+__attribute__((target("avx2")))
+static void blend_row_avx2(uint32_t *dst, const uint32_t *src, int count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c255 = _mm256_set1_epi16(255);
+    const __m256i c128 = _mm256_set1_epi16(128);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+
+        __m256i a = _mm256_srli_epi32(s, 24);
+        a = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+        __m256i inv_lo = _mm256_sub_epi16(c255, _mm256_unpacklo_epi32(a, a));
+        __m256i inv_hi = _mm256_sub_epi16(c255, _mm256_unpackhi_epi32(a, a));
+
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), inv_lo), c128);
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), inv_hi), c128);
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi)));
+    }
+    blend_row_sse2(dst + i, src + i, count - i);
+}
+#endif
+
+#ifdef LOCUS_CANVAS_NEON
+static void blend_row_neon(uint32_t *dst, const uint32_t *src, int count) {
+    static const uint8_t alpha_index[16] = { 3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15 };
+    const uint8x16_t index = vld1q_u8(alpha_index);
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        uint8x16_t s = vreinterpretq_u8_u32(vld1q_u32(src + i));
+        uint8x16_t d = vreinterpretq_u8_u32(vld1q_u32(dst + i));
+        uint8x16_t inv = vmvnq_u8(vqtbl1q_u8(s, index));
+
+        uint16x8_t lo = vmull_u8(vget_low_u8(d), vget_low_u8(inv));
+        uint16x8_t hi = vmull_high_u8(d, inv);
+        uint8x16_t r = vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)),
+                                   vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+        vst1q_u32(dst + i, vreinterpretq_u32_u8(vqaddq_u8(s, r)));
+    }
+    blend_row_scalar(dst + i, src + i, count - i);
+}
+
+static void fill_row(uint32_t *dst, uint32_t color, int count) {
+    uint32x4_t c = vdupq_n_u32(color);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_u32(dst + i, c);
+    }
+    for (; i < count; i++) {
+        dst[i] = color;
+    }
+}
+#endif
+
+#if !defined(LOCUS_CANVAS_SSE2) && !defined(LOCUS_CANVAS_NEON)
+static void fill_row(uint32_t *dst, uint32_t color, int count) {
+    for (int i = 0; i < count; i++) {
+        dst[i] = color;
+    }
+}
+#endif
+
+static void (*blend_row_impl)(uint32_t *dst, const uint32_t *src, int count);
+
+static void blend_row(uint32_t *dst, const uint32_t *src, int count) {
+    if (!blend_row_impl) {
+#if defined(LOCUS_CANVAS_AVX2)
+        blend_row_impl = __builtin_cpu_supports("avx2") ? blend_row_avx2 : blend_row_sse2;
+#elif defined(LOCUS_CANVAS_SSE2)
+        blend_row_impl = blend_row_sse2;
+#elif defined(LOCUS_CANVAS_NEON)
+        blend_row_impl = blend_row_neon;
+#else
+        blend_row_impl = blend_row_scalar;
+#endif
+    }
+    blend_row_impl(dst, src, count);
+}
+
+static void blend_solid_row(uint32_t *dst, uint32_t color, int count) {
+    uint32_t span[LOCUS_CANVAS_SPAN];
+    int n = count < LOCUS_CANVAS_SPAN ? count : LOCUS_CANVAS_SPAN;
+
+    if ((color >> 24) == 255) {
+        fill_row(dst, color, count);
+        return;
+    }
+    if (color == 0) {
+        return;
+    }
+
+    fill_row(span, color, n);
+    for (int i = 0; i < count; i += LOCUS_CANVAS_SPAN) {
+        blend_row(dst + i, span, count - i < LOCUS_CANVAS_SPAN ? count - i : LOCUS_CANVAS_SPAN);
+    }
+}
+
+uint32_t locus_canvas_rgba(unsigned char red, unsigned char green, unsigned char blue,
+                           unsigned char alpha) {
+    uint32_t p = ((uint32_t)red << 16) | ((uint32_t)green << 8) | blue;
+    return (scale_pixel(p, alpha) & 0x00ffffff) | ((uint32_t)alpha << 24);
+}
+
+/* Converts RGBA8 as produced by stb_image and nanosvg. */
+void locus_canvas_premultiply(uint32_t *dst, const unsigned char *rgba, int count) {
+    for (int i = 0; i < count; i++) {
+        const unsigned char *p = rgba + i * 4;
+        dst[i] = locus_canvas_rgba(p[0], p[1], p[2], p[3]);
+    }
+}
+
+/* Clips a rectangle to the canvas clip; returns 0 if nothing is left. */
+static int clip_rect(const LocusCanvas *canvas, int *x0, int *y0, int *x1, int *y1) {
+    int cx0 = canvas->clip.x > 0 ? canvas->clip.x : 0;
+    int cy0 = canvas->clip.y > 0 ? canvas->clip.y : 0;
+    int cx1 = canvas->clip.x + canvas->clip.width;
+    int cy1 = canvas->clip.y + canvas->clip.height;
+    cx1 = cx1 < canvas->width ? cx1 : canvas->width;
+    cy1 = cy1 < canvas->height ? cy1 : canvas->height;
+
+    *x0 = *x0 > cx0 ? *x0 : cx0;
+    *y0 = *y0 > cy0 ? *y0 : cy0;
+    *x1 = *x1 < cx1 ? *x1 : cx1;
+    *y1 = *y1 < cy1 ? *y1 : cy1;
+    return *x1 > *x0 && *y1 > *y0;
+}
+
+static uint32_t *canvas_row(LocusCanvas *canvas, int y) {
+    return canvas->pixels + (size_t)y * canvas->stride;
+}
+
+void locus_canvas_clear(LocusCanvas *canvas, uint32_t color) {
+    int x0 = 0, y0 = 0, x1 = canvas->width, y1 = canvas->height;
+    if (!clip_rect(canvas, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+    for (int y = y0; y < y1; y++) {
+        fill_row(canvas_row(canvas, y) + x0, color, x1 - x0);
+    }
+}
+
+void locus_canvas_fill_rect(LocusCanvas *canvas, int x, int y, int width, int height, uint32_t color) {
+    int x0 = x, y0 = y, x1 = x + width, y1 = y + height;
+    if (!clip_rect(canvas, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+    for (int row = y0; row < y1; row++) {
+        blend_solid_row(canvas_row(canvas, row) + x0, color, x1 - x0);
+    }
+}
+
+static void blend_coverage(uint32_t *dst, uint32_t color, float coverage) {
+    if (coverage <= 0.0f) {
+        return;
+    }
+    uint32_t src = coverage >= 1.0f ? color : scale_pixel(color, (uint32_t)(coverage * 255.0f + 0.5f));
+    *dst = over(src, *dst);
+}
+
+/* Edges are snapped to whole pixels; only the corner arcs get
+ * antialiased coverage, the straight runs go through the row kernels. */
+void locus_canvas_fill_rounded_rect(LocusCanvas *canvas, float x, float y, float width, float height,
+                                    float radius, uint32_t color) {
+    float max_radius = (width < height ? width : height) * 0.5f;
+    float r = radius < max_radius ? radius : max_radius;
+    if (r < 0.5f) {
+        locus_canvas_fill_rect(canvas, (int)lroundf(x), (int)lroundf(y),
+                               (int)lroundf(x + width) - (int)lroundf(x),
+                               (int)lroundf(y + height) - (int)lroundf(y), color);
+        return;
+    }
+
+    int x0 = (int)lroundf(x), y0 = (int)lroundf(y);
+    int x1 = (int)lroundf(x + width), y1 = (int)lroundf(y + height);
+    int rx0 = x0, rx1 = x1;
+    if (!clip_rect(canvas, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+
+    int corner = (int)ceilf(r);
+    float top = y + r, bottom = y + height - r;
+    float left = x + r, right = x + width - r;
+
+    for (int py = y0; py < y1; py++) {
+        uint32_t *row = canvas_row(canvas, py);
+        float cy = py + 0.5f;
+        float dy = cy < top ? top - cy : (cy > bottom ? cy - bottom : 0.0f);
+        if (dy <= 0.0f) {
+            blend_solid_row(row + x0, color, x1 - x0);
+            continue;
+        }
+
+        int inner0 = rx0 + corner > x0 ? rx0 + corner : x0;
+        int inner1 = rx1 - corner < x1 ? rx1 - corner : x1;
+        if (inner1 < inner0) {
+            inner0 = inner1 = (x0 + x1) / 2;
+        }
+
+        for (int px = x0; px < inner0; px++) {
+            float dx = left - (px + 0.5f);
+            dx = dx > 0.0f ? dx : 0.0f;
+            blend_coverage(&row[px], color, r - sqrtf(dx * dx + dy * dy) + 0.5f);
+        }
+        if (inner1 > inner0) {
+            blend_solid_row(row + inner0, color, inner1 - inner0);
+        }
+        for (int px = inner1; px < x1; px++) {
+            float dx = (px + 0.5f) - right;
+            dx = dx > 0.0f ? dx : 0.0f;
+            blend_coverage(&row[px], color, r - sqrtf(dx * dx + dy * dy) + 0.5f);
+        }
+    }
+}
+
+/* Nearest-neighbour scaled source-over of a premultiplied image, faded by
+ * alpha (255 is opaque); rows that need no scaling or fading are blended
+ * straight from the source. */
+void locus_canvas_blit(LocusCanvas *canvas, int x, int y, int width, int height,
+                       const uint32_t *src, int src_width, int src_height, int src_stride,
+                       uint32_t alpha) {
+    int x0 = x, y0 = y, x1 = x + width, y1 = y + height;
+    if (width <= 0 || height <= 0 || alpha == 0 || !clip_rect(canvas, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+
+    uint32_t *span = NULL;
+    uint32_t step = (uint32_t)(((uint64_t)src_width << 16) / width);
+    if (src_width != width || alpha < 255) {
+        span = malloc((x1 - x0) * sizeof *span);
+        if (!span) {
+            fprintf(stderr, "Failed to allocate blit span\n");
+            return;
+        }
+    }
+
+    for (int py = y0; py < y1; py++) {
+        int sy = (int)((int64_t)(py - y) * src_height / height);
+        const uint32_t *src_row = src + (size_t)sy * src_stride;
+        uint32_t *dst = canvas_row(canvas, py) + x0;
+
+        if (!span) {
+            blend_row(dst, src_row + (x0 - x), x1 - x0);
+            continue;
+        }
+
+        uint32_t sx = (uint32_t)(x0 - x) * step + step / 2;
+        for (int i = 0; i < x1 - x0; i++, sx += step) {
+            span[i] = alpha < 255 ? scale_pixel(src_row[sx >> 16], alpha) : src_row[sx >> 16];
+        }
+        blend_row(dst, span, x1 - x0);
+    }
+    free(span);
+}
+
+void locus_canvas_blend_mask(LocusCanvas *canvas, int x, int y, const unsigned char *mask,
+                             int width, int height, int mask_stride, uint32_t color) {
+    int x0 = x, y0 = y, x1 = x + width, y1 = y + height;
+    if (!clip_rect(canvas, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+
+    for (int py = y0; py < y1; py++) {
+        const unsigned char *m = mask + (size_t)(py - y) * mask_stride + (x0 - x);
+        uint32_t *dst = canvas_row(canvas, py) + x0;
+        for (int i = 0; i < x1 - x0; i++) {
+            if (m[i] == 255) {
+                dst[i] = over(color, dst[i]);
+            } else if (m[i] != 0) {
+                dst[i] = over(scale_pixel(color, m[i]), dst[i]);
+            }
+        }
+    }
+}
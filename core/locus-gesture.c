@@ -0,0 +1,404 @@
+#include <math.h>
+#include <string.h>
+#include "locus-private.h"
+
+#define LOCUS_GESTURE_SLOP 10.0
+#define LOCUS_GESTURE_LONG_PRESS_MS 500
+#define LOCUS_GESTURE_TAP_MS 300
+#define LOCUS_GESTURE_FLING_VELOCITY 300.0
+#define LOCUS_VELOCITY_WINDOW_MS 100
+#define LOCUS_PREDICT_WINDOW_MS 50
+#define LOCUS_PREDICT_MAX_MS 50
+
+enum {
+    GESTURE_IDLE,
+    GESTURE_POSSIBLE,
+    GESTURE_LONG_PRESS,
+    GESTURE_SWIPE,
+    GESTURE_PINCH,
+    GESTURE_WAIT_RELEASE,
+};
+
+static void emit(Locus *app, LocusGestureType type, LocusGesturePhase phase,
+                 int fingers, double x, double y, uint32_t time, LocusGesture *gesture) {
+    gesture->type = type;
+    gesture->phase = phase;
+    gesture->fingers = fingers;
+    gesture->x = x;
+    gesture->y = y;
+    gesture->time = time;
+    if (app->gesture_callback) {
+        app->gesture_callback(app, gesture, app->gesture_data);
+    }
+}
+
+static void add_sample(LocusGestureState *state, uint32_t time, double x, double y) {
+    LocusTouchSample *sample = &state->samples[state->sample_head];
+    sample->time = time;
+    sample->x = x;
+    sample->y = y;
+    state->sample_head = (state->sample_head + 1) % LOCUS_VELOCITY_SAMPLES;
+    if (state->sample_count < LOCUS_VELOCITY_SAMPLES) {
+        state->sample_count++;
+    }
+}
+
+/* Least-squares slope of position over time for the samples of a ring
+ * buffer that fall inside the window before now, in pixels per second. */
+void locus_velocity_fit(const LocusTouchSample *samples, int count, int head, uint32_t now,
+                        uint32_t window, double *vx, double *vy) {
+    double st = 0, sx = 0, sy = 0, stt = 0, stx = 0, sty = 0;
+    int n = 0;
+
+    *vx = *vy = 0;
+    for (int i = 0; i < count; i++) {
+        int index = (head - 1 - i + LOCUS_VELOCITY_SAMPLES) % LOCUS_VELOCITY_SAMPLES;
+        const LocusTouchSample *sample = &samples[index];
+        if ((int32_t)(now - sample->time) > (int32_t)window) {
+            break;
+        }
+        double t = -(double)(int32_t)(now - sample->time) / 1000.0;
+        st += t;
+        sx += sample->x;
+        sy += sample->y;
+        stt += t * t;
+        stx += t * sample->x;
+        sty += t * sample->y;
+        n++;
+    }
+
+    double denom = n * stt - st * st;
+    if (n < 2 || denom <= 1e-9) {
+        return;
+    }
+    *vx = (n * stx - st * sx) / denom;
+    *vy = (n * sty - st * sy) / denom;
+}
+
+static void estimate_velocity(const LocusGestureState *state, uint32_t now, double *vx, double *vy) {
+    locus_velocity_fit(state->samples, state->sample_count, state->sample_head, now,
+                       LOCUS_VELOCITY_WINDOW_MS, vx, vy);
+}
+
+static const LocusTouchPoint *active_point(Locus *app, int32_t id) {
+    const LocusTouchFrame *frame = &app->touch_frame;
+    for (int i = 0; i < frame->count; i++) {
+        if (frame->points[i].id == id && frame->points[i].active) {
+            return &frame->points[i];
+        }
+    }
+    return NULL;
+}
+
+int locus_touch_velocity(Locus *app, int32_t id, double *vx, double *vy) {
+    const LocusTouchPoint *point = active_point(app, id);
+    if (!point) {
+        return 0;
+    }
+
+    locus_velocity_fit(point->recent, point->recent_count, point->recent_head, point->time,
+                       LOCUS_VELOCITY_WINDOW_MS, vx, vy);
+    return 1;
+}
+
+/* Extrapolates a touch point to time (the next presentation when 0), on
+ * the locus_now_ms clock. The horizon is capped to avoid overshooting. */
+int locus_touch_predict(Locus *app, int32_t id, uint32_t time, double *x, double *y) {
+    const LocusTouchPoint *point = active_point(app, id);
+    if (!point) {
+        return 0;
+    }
+
+    *x = point->x;
+    *y = point->y;
+    if (time == 0) {
+        time = locus_next_frame_time(app);
+    }
+
+    int32_t horizon = (int32_t)(time - point->received);
+    if (horizon <= 0 || horizon > LOCUS_PREDICT_MAX_MS) {
+        return 1;
+    }
+
+    double vx, vy;
+    locus_velocity_fit(point->recent, point->recent_count, point->recent_head, point->time,
+                       LOCUS_PREDICT_WINDOW_MS, &vx, &vy);
+    *x += vx * horizon / 1000.0;
+    *y += vy * horizon / 1000.0;
+    return 1;
+}
+
+static void cancel_long_press(Locus *app) {
+    if (app->gesture.long_press_timer) {
+        locus_remove_timer(app, app->gesture.long_press_timer);
+        app->gesture.long_press_timer = 0;
+    }
+}
+
+static void long_press_fired(Locus *app, void *data) {
+    LocusGestureState *state = &app->gesture;
+    LocusGesture gesture = {0};
+
+    state->long_press_timer = 0;
+    if (state->state != GESTURE_POSSIBLE) {
+        return;
+    }
+
+    state->state = GESTURE_LONG_PRESS;
+    gesture.scale = 1.0;
+    emit(app, LOCUS_GESTURE_LONG_PRESS, LOCUS_GESTURE_BEGIN, 1,
+         state->last_x, state->last_y, state->start_time + state->long_press_ms, &gesture);
+}
+
+static int active_points(const LocusTouchFrame *frame, const LocusTouchPoint **points, int max) {
+    int n = 0;
+    for (int i = 0; i < frame->count && n < max; i++) {
+        if (frame->points[i].state != LOCUS_TOUCH_UP) {
+            points[n++] = &frame->points[i];
+        }
+    }
+    return n;
+}
+
+static const LocusTouchPoint *find_point(const LocusTouchFrame *frame, int32_t id) {
+    for (int i = 0; i < frame->count; i++) {
+        if (frame->points[i].id == id) {
+            return &frame->points[i];
+        }
+    }
+    return NULL;
+}
+
+static void begin_pinch(Locus *app, const LocusTouchPoint *a, const LocusTouchPoint *b,
+                        int fingers, uint32_t time) {
+    LocusGestureState *state = &app->gesture;
+    LocusGesture gesture = {0};
+
+    if (state->state == GESTURE_SWIPE) {
+        gesture.scale = 1.0;
+        emit(app, LOCUS_GESTURE_SWIPE, LOCUS_GESTURE_CANCEL, 1, state->last_x, state->last_y, time, &gesture);
+    } else if (state->state == GESTURE_LONG_PRESS) {
+        gesture.scale = 1.0;
+        emit(app, LOCUS_GESTURE_LONG_PRESS, LOCUS_GESTURE_CANCEL, 1, state->last_x, state->last_y, time, &gesture);
+    }
+    cancel_long_press(app);
+
+    state->state = GESTURE_PINCH;
+    state->pinch_a = a->id;
+    state->pinch_b = b->id;
+    state->start_distance = hypot(b->x - a->x, b->y - a->y);
+    state->start_angle = atan2(b->y - a->y, b->x - a->x);
+    state->last_center_x = (a->x + b->x) / 2;
+    state->last_center_y = (a->y + b->y) / 2;
+    state->last_scale = 1.0;
+    state->last_rotation = 0.0;
+
+    memset(&gesture, 0, sizeof(gesture));
+    gesture.scale = 1.0;
+    emit(app, LOCUS_GESTURE_PINCH, LOCUS_GESTURE_BEGIN, fingers,
+         state->last_center_x, state->last_center_y, time, &gesture);
+}
+
+/* Continues the pinch with a new pair of contacts after one of the tracked
+ * ones was lifted. The baseline is chosen so that scale, rotation and the
+ * centre carry on from their last values instead of jumping. */
+static void rebase_pinch(Locus *app, const LocusTouchPoint *a, const LocusTouchPoint *b) {
+    LocusGestureState *state = &app->gesture;
+    double distance = hypot(b->x - a->x, b->y - a->y);
+
+    state->pinch_a = a->id;
+    state->pinch_b = b->id;
+    state->start_distance = state->last_scale > 0 ? distance / state->last_scale : distance;
+    state->start_angle = atan2(b->y - a->y, b->x - a->x) - state->last_rotation;
+    state->last_center_x = (a->x + b->x) / 2;
+    state->last_center_y = (a->y + b->y) / 2;
+}
+
+static void update_pinch(Locus *app, const LocusTouchPoint *a, const LocusTouchPoint *b,
+                         int fingers, uint32_t time) {
+    LocusGestureState *state = &app->gesture;
+    LocusGesture gesture = {0};
+    double cx = (a->x + b->x) / 2;
+    double cy = (a->y + b->y) / 2;
+    double distance = hypot(b->x - a->x, b->y - a->y);
+    double rotation = atan2(b->y - a->y, b->x - a->x) - state->start_angle;
+
+    while (rotation > M_PI) {
+        rotation -= 2 * M_PI;
+    }
+    while (rotation < -M_PI) {
+        rotation += 2 * M_PI;
+    }
+
+    gesture.scale = state->start_distance > 0 ? distance / state->start_distance : 1.0;
+    gesture.rotation = rotation;
+    gesture.dx = cx - state->last_center_x;
+    gesture.dy = cy - state->last_center_y;
+    state->last_center_x = cx;
+    state->last_center_y = cy;
+    state->last_scale = gesture.scale;
+    state->last_rotation = rotation;
+    add_sample(state, time, cx, cy);
+
+    emit(app, LOCUS_GESTURE_PINCH, LOCUS_GESTURE_UPDATE, fingers, cx, cy, time, &gesture);
+}
+
+static void end_pinch(Locus *app, uint32_t time) {
+    LocusGestureState *state = &app->gesture;
+    LocusGesture gesture = {0};
+
+    gesture.scale = state->last_scale;
+    gesture.rotation = state->last_rotation;
+    estimate_velocity(state, time, &gesture.vx, &gesture.vy);
+    emit(app, LOCUS_GESTURE_PINCH, LOCUS_GESTURE_END, 2,
+         state->last_center_x, state->last_center_y, time, &gesture);
+    state->state = GESTURE_WAIT_RELEASE;
+}
+
+static void single_finger(Locus *app, const LocusTouchPoint *point, uint32_t time) {
+    LocusGestureState *state = &app->gesture;
+    LocusGesture gesture = {0};
+
+    gesture.scale = 1.0;
+    if (point->state == LOCUS_TOUCH_DOWN && state->state == GESTURE_IDLE) {
+        state->state = GESTURE_POSSIBLE;
+        state->primary = point->id;
+        state->start_x = state->last_x = point->x;
+        state->start_y = state->last_y = point->y;
+        state->start_time = point->down_time;
+        state->sample_count = state->sample_head = 0;
+        add_sample(state, point->time, point->x, point->y);
+        cancel_long_press(app);
+        state->long_press_timer = locus_add_timer(app, state->long_press_ms, 0, long_press_fired, NULL);
+        return;
+    }
+
+    if (point->id != state->primary || point->state != LOCUS_TOUCH_MOTION) {
+        return;
+    }
+
+    add_sample(state, point->time, point->x, point->y);
+    gesture.dx = point->x - state->last_x;
+    gesture.dy = point->y - state->last_y;
+    state->last_x = point->x;
+    state->last_y = point->y;
+
+    if (state->state == GESTURE_POSSIBLE &&
+        hypot(point->x - state->start_x, point->y - state->start_y) > state->slop) {
+        cancel_long_press(app);
+        state->state = GESTURE_SWIPE;
+        gesture.dx = point->x - state->start_x;
+        gesture.dy = point->y - state->start_y;
+        emit(app, LOCUS_GESTURE_SWIPE, LOCUS_GESTURE_BEGIN, 1, point->x, point->y, time, &gesture);
+    } else if (state->state == GESTURE_SWIPE) {
+        emit(app, LOCUS_GESTURE_SWIPE, LOCUS_GESTURE_UPDATE, 1, point->x, point->y, time, &gesture);
+    } else if (state->state == GESTURE_LONG_PRESS) {
+        emit(app, LOCUS_GESTURE_LONG_PRESS, LOCUS_GESTURE_UPDATE, 1, point->x, point->y, time, &gesture);
+    }
+}
+
+static void release(Locus *app, const LocusTouchPoint *point, uint32_t time) {
+    LocusGestureState *state = &app->gesture;
+    LocusGesture gesture = {0};
+
+    cancel_long_press(app);
+    gesture.scale = 1.0;
+    if (point && point->id == state->primary) {
+        add_sample(state, point->time, point->x, point->y);
+    }
+
+    switch (state->state) {
+    case GESTURE_POSSIBLE:
+        if (time - state->start_time <= state->tap_ms) {
+            emit(app, LOCUS_GESTURE_TAP, LOCUS_GESTURE_END, 1, state->start_x, state->start_y, time, &gesture);
+        }
+        break;
+    case GESTURE_LONG_PRESS:
+        emit(app, LOCUS_GESTURE_LONG_PRESS, LOCUS_GESTURE_END, 1, state->last_x, state->last_y, time, &gesture);
+        break;
+    case GESTURE_SWIPE:
+        estimate_velocity(state, time, &gesture.vx, &gesture.vy);
+        gesture.dx = state->last_x - state->start_x;
+        gesture.dy = state->last_y - state->start_y;
+        emit(app, LOCUS_GESTURE_SWIPE, LOCUS_GESTURE_END, 1, state->last_x, state->last_y, time, &gesture);
+        if (hypot(gesture.vx, gesture.vy) >= state->fling_velocity) {
+            emit(app, LOCUS_GESTURE_FLING, LOCUS_GESTURE_END, 1, state->last_x, state->last_y, time, &gesture);
+        }
+        break;
+    default:
+        break;
+    }
+    state->state = GESTURE_IDLE;
+}
+
+void locus_gesture_init(Locus *app) {
+    LocusGestureState *state = &app->gesture;
+    memset(state, 0, sizeof(*state));
+    state->slop = LOCUS_GESTURE_SLOP;
+    state->long_press_ms = LOCUS_GESTURE_LONG_PRESS_MS;
+    state->tap_ms = LOCUS_GESTURE_TAP_MS;
+    state->fling_velocity = LOCUS_GESTURE_FLING_VELOCITY;
+}
+
+void locus_gesture_reset(Locus *app) {
+    LocusGestureState *state = &app->gesture;
+    LocusGesture gesture = {0};
+
+    cancel_long_press(app);
+    gesture.scale = 1.0;
+    switch (state->state) {
+    case GESTURE_LONG_PRESS:
+        emit(app, LOCUS_GESTURE_LONG_PRESS, LOCUS_GESTURE_CANCEL, 1, state->last_x, state->last_y, 0, &gesture);
+        break;
+    case GESTURE_SWIPE:
+        emit(app, LOCUS_GESTURE_SWIPE, LOCUS_GESTURE_CANCEL, 1, state->last_x, state->last_y, 0, &gesture);
+        break;
+    case GESTURE_PINCH:
+        emit(app, LOCUS_GESTURE_PINCH, LOCUS_GESTURE_CANCEL, 2,
+             state->last_center_x, state->last_center_y, 0, &gesture);
+        break;
+    default:
+        break;
+    }
+    state->state = GESTURE_IDLE;
+    state->sample_count = state->sample_head = 0;
+}
+
+void locus_gesture_process(Locus *app, const LocusTouchFrame *frame) {
+    LocusGestureState *state = &app->gesture;
+    const LocusTouchPoint *points[LOCUS_MAX_TOUCH_POINTS];
+    int active = active_points(frame, points, LOCUS_MAX_TOUCH_POINTS);
+
+    if (active >= 2) {
+        if (state->state != GESTURE_PINCH && state->state != GESTURE_WAIT_RELEASE) {
+            begin_pinch(app, points[0], points[1], active, frame->time);
+        } else if (state->state == GESTURE_PINCH) {
+            const LocusTouchPoint *a = find_point(frame, state->pinch_a);
+            const LocusTouchPoint *b = find_point(frame, state->pinch_b);
+            if (!a || !b || a->state == LOCUS_TOUCH_UP || b->state == LOCUS_TOUCH_UP) {
+                a = points[0];
+                b = points[1];
+                rebase_pinch(app, a, b);
+            }
+            update_pinch(app, a, b, active, frame->time);
+        }
+        return;
+    }
+
+    if (state->state == GESTURE_PINCH) {
+        end_pinch(app, frame->time);
+    }
+
+    if (active == 0) {
+        if (state->state == GESTURE_WAIT_RELEASE) {
+            state->state = GESTURE_IDLE;
+        } else if (state->state != GESTURE_IDLE) {
+            release(app, find_point(frame, state->primary), frame->time);
+        }
+        return;
+    }
+
+    if (state->state != GESTURE_WAIT_RELEASE) {
+        single_finger(app, points[0], frame->time);
+    }
+}
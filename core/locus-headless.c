@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "locus-private.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+/* Initialises Locus without a Wayland connection, rendering into EGL
+ * pbuffers or plain memory. */
+int locus_init_headless(Locus *app, int width, int height, LocusBackend backend) {
+    memset(app, 0, sizeof(Locus));
+    app->startup_ns = locus_now_ns();
+    app->running = 1;
+    app->render_wake_fd = -1;
+    app->main_wake_fd = -1;
+    app->presentation_clock = CLOCK_MONOTONIC;
+    app->width = width;
+    app->height = height;
+    if (getenv("LOCUS_TIMING") || getenv("LOCUS_TRACE")) {
+        locus_set_timing(app, 1);
+    }
+
+    backend = locus_resolve_backend(backend);
+    if (backend != LOCUS_BACKEND_SHM) {
+        if (locus_egl_init(app, EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, EGL_PBUFFER_BIT)) {
+            app->backend = LOCUS_BACKEND_EGL;
+            locus_startup_mark(app, LOCUS_STARTUP_EGL);
+            return 1;
+        }
+        if (backend == LOCUS_BACKEND_EGL) {
+            return 0;
+        }
+    }
+
+    app->backend = LOCUS_BACKEND_SHM;
+    return 1;
+}
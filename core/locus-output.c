@@ -0,0 +1,355 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-egl.h>
+#include "locus-private.h"
+
+static void output_logical_size(const LocusOutput *output, int *width, int *height) {
+    int scale = output->scale > 0 ? output->scale : 1;
+    int w = output->mode_width / scale;
+    int h = output->mode_height / scale;
+
+    if (output->transform & WL_OUTPUT_TRANSFORM_90) {
+        *width = h;
+        *height = w;
+    } else {
+        *width = w;
+        *height = h;
+    }
+}
+
+static void buffer_size(LocusSurface *surface, int *width, int *height) {
+    float scale = locus_surface_scale(surface);
+    if (surface->viewport) {
+        *width = (int)lround(surface->width * scale);
+        *height = (int)lround(surface->height * scale);
+    } else {
+        *width = surface->width * (int)scale;
+        *height = surface->height * (int)scale;
+    }
+}
+
+static LocusOutput *find_output(Locus *app, struct wl_output *wl_output) {
+    for (int i = 0; i < app->output_count; i++) {
+        if (app->outputs[i]->output == wl_output) {
+            return app->outputs[i];
+        }
+    }
+    return NULL;
+}
+
+/* Picks the buffer scale for the surface: the compositor's fractional
+ * preference when available, otherwise the largest integer scale among the
+ * outputs the surface is on, and refreshes the frame pacing to match. */
+void locus_output_update(LocusSurface *surface) {
+    Locus *app = surface->app;
+    LocusOutput *primary = locus_output_primary(app);
+    int32_t best_scale = primary ? primary->scale : 1;
+    int32_t refresh = primary ? primary->refresh : 0;
+
+    for (int i = 0; i < surface->entered_count; i++) {
+        LocusOutput *output = find_output(app, surface->entered[i]);
+        if (!output) {
+            continue;
+        }
+        if (i == 0 || output->scale > best_scale) {
+            best_scale = output->scale;
+        }
+        if (i == 0 || output->refresh > refresh) {
+            refresh = output->refresh;
+        }
+    }
+
+    if (refresh > 0) {
+        surface->refresh = refresh;
+    }
+
+    float scale = best_scale > 0 ? (float)best_scale : 1.0f;
+    if (surface->viewport && surface->fixed_scale > 0.0f) {
+        scale = surface->fixed_scale;
+    } else if (surface->viewport && surface->preferred_scale) {
+        scale = surface->preferred_scale / 120.0f;
+    } else if (!surface->viewport && app->compositor_version < 3) {
+        scale = 1.0f;
+    }
+
+    if (app->render_running) {
+        pthread_mutex_lock(&app->render_lock);
+    }
+    float current = surface->resize_pending ? surface->next_scale : surface->scale;
+    if (scale != current) {
+        surface->next_scale = scale;
+        surface->resize_pending = 1;
+    }
+    if (app->render_running) {
+        pthread_mutex_unlock(&app->render_lock);
+    }
+
+    if (scale != current) {
+        surface->redraw = 1;
+        surface->frame_requested = 1;
+    }
+}
+
+/* Commits a pending scale together with a buffer of the new size. Runs on
+ * whichever thread renders; returns 1 if the buffer size changed. */
+int locus_output_apply(LocusSurface *surface, int resized) {
+    Locus *app = surface->app;
+
+    if (app->render_running) {
+        pthread_mutex_lock(&app->render_lock);
+    }
+    int pending = surface->resize_pending;
+    float scale = surface->next_scale;
+    surface->resize_pending = 0;
+    if (app->render_running) {
+        pthread_mutex_unlock(&app->render_lock);
+    }
+
+    int rescaled = pending && scale != surface->scale;
+    if (!rescaled && !resized) {
+        return 0;
+    }
+
+    if (rescaled) {
+        surface->scale = scale;
+        if (!surface->viewport) {
+            wl_surface_set_buffer_scale(surface->surface, (int32_t)scale);
+        }
+    }
+    buffer_size(surface, &surface->buffer_width, &surface->buffer_height);
+    if (surface->egl_window) {
+        wl_egl_window_resize(surface->egl_window, surface->buffer_width, surface->buffer_height, 0, 0);
+    }
+    return 1;
+}
+
+static void surface_forget_output(LocusSurface *surface, struct wl_output *wl_output) {
+    for (int i = 0; i < surface->entered_count; i++) {
+        if (surface->entered[i] == wl_output) {
+            surface->entered[i] = surface->entered[--surface->entered_count];
+            return;
+        }
+    }
+}
+
+static void update_surfaces(Locus *app) {
+    for (int i = 0; i < app->surface_count; i++) {
+        locus_output_update(app->surfaces[i]);
+    }
+}
+
+static void handle_geometry(void *data, struct wl_output *wl_output,
+                            int32_t x, int32_t y, int32_t physical_width,
+                            int32_t physical_height, int32_t subpixel,
+                            const char *make, const char *model,
+                            int32_t transform) {
+    LocusOutput *output = data;
+    output->x = x;
+    output->y = y;
+    output->physical_width = physical_width;
+    output->physical_height = physical_height;
+    output->transform = transform;
+}
+
+static void handle_mode(void *data, struct wl_output *wl_output,
+                        uint32_t flags, int32_t width, int32_t height,
+                        int32_t refresh) {
+    LocusOutput *output = data;
+    if (flags & WL_OUTPUT_MODE_CURRENT) {
+        output->mode_width = width;
+        output->mode_height = height;
+        output->refresh = refresh;
+    }
+}
+
+static void handle_done(void *data, struct wl_output *wl_output) {
+    LocusOutput *output = data;
+    Locus *app = output->app;
+
+    output->done = 1;
+    if (output == locus_output_primary(app)) {
+        output_logical_size(output, &app->screen_width, &app->screen_height);
+        app->refresh = output->refresh;
+    }
+    update_surfaces(app);
+}
+
+static void handle_scale(void *data, struct wl_output *wl_output, int32_t factor) {
+    LocusOutput *output = data;
+    output->scale = factor;
+}
+
+static const struct wl_output_listener output_listener = {
+    .geometry = handle_geometry,
+    .mode = handle_mode,
+    .done = handle_done,
+    .scale = handle_scale,
+};
+
+void locus_output_bind(Locus *app, struct wl_registry *registry, uint32_t name, uint32_t version) {
+    if (app->output_count == app->output_capacity) {
+        int capacity = app->output_capacity ? app->output_capacity * 2 : 4;
+        LocusOutput **outputs = realloc(app->outputs, capacity * sizeof *outputs);
+        if (!outputs) {
+            fprintf(stderr, "Failed to allocate output\n");
+            return;
+        }
+        app->outputs = outputs;
+        app->output_capacity = capacity;
+    }
+
+    LocusOutput *output = calloc(1, sizeof *output);
+    if (!output) {
+        fprintf(stderr, "Failed to allocate output\n");
+        return;
+    }
+
+    output->app = app;
+    output->name = name;
+    output->version = version < 3 ? version : 3;
+    output->scale = 1;
+    output->output = wl_registry_bind(registry, name, &wl_output_interface, output->version);
+    wl_output_add_listener(output->output, &output_listener, output);
+    app->outputs[app->output_count++] = output;
+
+    if (!app->output) {
+        app->output = output->output;
+    }
+}
+
+static void destroy_output(LocusOutput *output) {
+    if (output->version >= 3) {
+        wl_output_release(output->output);
+    } else {
+        wl_output_destroy(output->output);
+    }
+    free(output);
+}
+
+int locus_output_remove(Locus *app, uint32_t name) {
+    for (int i = 0; i < app->output_count; i++) {
+        LocusOutput *output = app->outputs[i];
+        if (output->name != name) {
+            continue;
+        }
+
+        memmove(&app->outputs[i], &app->outputs[i + 1],
+                (app->output_count - i - 1) * sizeof *app->outputs);
+        app->output_count--;
+
+        if (app->output == output->output) {
+            app->output = app->output_count ? app->outputs[0]->output : NULL;
+            if (app->output_count && app->outputs[0]->done) {
+                output_logical_size(app->outputs[0], &app->screen_width, &app->screen_height);
+                app->refresh = app->outputs[0]->refresh;
+            }
+        }
+        for (int j = 0; j < app->surface_count; j++) {
+            surface_forget_output(app->surfaces[j], output->output);
+        }
+        destroy_output(output);
+        update_surfaces(app);
+        return 1;
+    }
+    return 0;
+}
+
+LocusOutput *locus_output_primary(Locus *app) {
+    for (int i = 0; i < app->output_count; i++) {
+        if (app->outputs[i]->output == app->output) {
+            return app->outputs[i];
+        }
+    }
+    return NULL;
+}
+
+static void surface_handle_enter(void *data, struct wl_surface *wl_surface, struct wl_output *wl_output) {
+    LocusSurface *surface = data;
+    if (surface->entered_count < LOCUS_MAX_OUTPUTS && find_output(surface->app, wl_output)) {
+        surface->entered[surface->entered_count++] = wl_output;
+        locus_output_update(surface);
+    }
+}
+
+static void surface_handle_leave(void *data, struct wl_surface *wl_surface, struct wl_output *wl_output) {
+    LocusSurface *surface = data;
+    surface_forget_output(surface, wl_output);
+    locus_output_update(surface);
+}
+
+static const struct wl_surface_listener surface_listener = {
+    .enter = surface_handle_enter,
+    .leave = surface_handle_leave,
+};
+
+static void handle_preferred_scale(void *data, struct wp_fractional_scale_v1 *fractional_scale,
+                                   uint32_t scale) {
+    LocusSurface *surface = data;
+    surface->preferred_scale = scale;
+    locus_output_update(surface);
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+    .preferred_scale = handle_preferred_scale,
+};
+
+/* Hooks a freshly created surface up for scale tracking. Must run before
+ * its EGL window is created so the first buffer already has the native
+ * size. */
+void locus_output_attach_surface(LocusSurface *surface) {
+    Locus *app = surface->app;
+    LocusOutput *primary = locus_output_primary(app);
+
+    wl_surface_add_listener(surface->surface, &surface_listener, surface);
+
+    /* Subsurfaces always get a viewport when there is one, so that the
+     * compositor can scale their buffers. */
+    if (app->viewporter && (app->fractional_scale_manager || surface->subsurface)) {
+        surface->viewport = wp_viewporter_get_viewport(app->viewporter, surface->surface);
+        wp_viewport_set_destination(surface->viewport, surface->width, surface->height);
+    }
+    if (app->fractional_scale_manager && surface->viewport) {
+        surface->fractional_scale = wp_fractional_scale_manager_v1_get_fractional_scale(
+            app->fractional_scale_manager, surface->surface);
+        wp_fractional_scale_v1_add_listener(surface->fractional_scale, &fractional_scale_listener, surface);
+    }
+
+    surface->scale = 1.0f;
+    if (primary && primary->scale > 1 && (surface->viewport || app->compositor_version >= 3)) {
+        surface->scale = (float)primary->scale;
+        if (!surface->viewport) {
+            wl_surface_set_buffer_scale(surface->surface, primary->scale);
+        }
+    }
+    buffer_size(surface, &surface->buffer_width, &surface->buffer_height);
+}
+
+void locus_output_cleanup(Locus *app) {
+    if (app->fractional_scale_manager) {
+        wp_fractional_scale_manager_v1_destroy(app->fractional_scale_manager);
+        app->fractional_scale_manager = NULL;
+    }
+    if (app->viewporter) {
+        wp_viewporter_destroy(app->viewporter);
+        app->viewporter = NULL;
+    }
+    for (int i = 0; i < app->output_count; i++) {
+        destroy_output(app->outputs[i]);
+    }
+    free(app->outputs);
+    app->outputs = NULL;
+    app->output_count = app->output_capacity = 0;
+    app->output = NULL;
+}
+
+float locus_scale(Locus *app) {
+    LocusSurface *surface = locus_target_surface(app);
+    LocusOutput *primary = locus_output_primary(app);
+
+    if (surface) {
+        return locus_surface_scale(surface);
+    }
+    return primary && primary->scale > 0 ? (float)primary->scale : 1.0f;
+}
@@ -0,0 +1,39 @@
+#ifndef LOCUS_PRIVATE_H
+#define LOCUS_PRIVATE_H
+
+#include "locus.h"
+
+/* Entry points shared between the library's own sources; not installed. */
+
+LocusBackend locus_resolve_backend(LocusBackend backend);
+int locus_egl_init(Locus *app, EGLenum platform, void *native_display, EGLint surface_type);
+void locus_animation_cleanup(Locus *app);
+void locus_output_bind(Locus *app, struct wl_registry *registry, uint32_t name, uint32_t version);
+int locus_output_remove(Locus *app, uint32_t name);
+void locus_output_attach_surface(LocusSurface *surface);
+void locus_output_update(LocusSurface *surface);
+int locus_output_apply(LocusSurface *surface, int resized);
+void locus_output_cleanup(Locus *app);
+void locus_surface_render(LocusSurface *surface);
+void locus_surface_take_damage(LocusSurface *surface, LocusFrameDamage *damage);
+void locus_surface_render_damage(LocusSurface *surface, const LocusFrameDamage *damage,
+                                 struct wl_event_queue *queue);
+void locus_timing_begin(LocusSurface *surface, const LocusFrameDamage *damage, LocusFrameTiming *frame);
+void locus_timing_draw_done(LocusSurface *surface, LocusFrameTiming *frame, struct wl_event_queue *queue);
+void locus_timing_end(LocusSurface *surface, LocusFrameTiming *frame);
+void locus_timing_release(Locus *app);
+void locus_timing_cleanup(Locus *app);
+int locus_render_thread_start(Locus *app);
+void locus_render_thread_stop(Locus *app);
+void locus_render_thread_submit(Locus *app, LocusSurface *surface);
+LocusShmBuffer *locus_shm_acquire(LocusSurface *surface, struct wl_event_queue *queue, int *age);
+void locus_shm_attach(LocusSurface *surface, LocusShmBuffer *buffer);
+void locus_shm_release_buffers(LocusSurface *surface, int all);
+void locus_flush_touch(Locus *app);
+void locus_velocity_fit(const LocusTouchSample *samples, int count, int head, uint32_t now,
+                        uint32_t window, double *vx, double *vy);
+void locus_gesture_init(Locus *app);
+void locus_gesture_process(Locus *app, const LocusTouchFrame *frame);
+void locus_gesture_reset(Locus *app);
+
+#endif
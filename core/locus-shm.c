@@ -0,0 +1,182 @@
+#ifdef WITH_WAYLAND_SHM
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "locus-private.h"
+
+
+static int create_memfd(size_t size) {
+    int fd = memfd_create("locus-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create shm file: %s\n", strerror(errno));
+        return -1;
+    }
+
+    int ret;
+    do {
+        ret = ftruncate(fd, size);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to size shm file: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
+    return fd;
+}
+
+static void destroy_buffer(LocusShmBuffer *buffer) {
+    if (buffer->buffer) {
+        wl_buffer_destroy(buffer->buffer);
+    }
+    if (buffer->pixels) {
+        munmap(buffer->pixels, buffer->size);
+    }
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
+    LocusShmBuffer *buffer = data;
+    buffer->busy = 0;
+    if (buffer->orphaned) {
+        destroy_buffer(buffer);
+        free(buffer);
+    }
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+/* The pool inherits the wl_shm proxy's event queue, which routes release
+ * events to the rendering thread. */
+static int create_buffer(LocusSurface *surface, LocusShmBuffer *buffer, struct wl_event_queue *queue) {
+    Locus *app = surface->app;
+    int width = surface->buffer_width;
+    int height = surface->buffer_height;
+    int stride = width * 4;
+    size_t size = (size_t)stride * height;
+
+    int fd = create_memfd(size);
+    if (fd < 0) {
+        return 0;
+    }
+
+    void *pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (pixels == MAP_FAILED) {
+        fprintf(stderr, "Failed to map shm buffer: %s\n", strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    struct wl_shm *shm = app->shm;
+    if (queue) {
+        shm = wl_proxy_create_wrapper(app->shm);
+        wl_proxy_set_queue((struct wl_proxy *)shm, queue);
+    }
+    struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
+    buffer->buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride, WL_SHM_FORMAT_ARGB8888);
+    wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+    wl_shm_pool_destroy(pool);
+    if (queue) {
+        wl_proxy_wrapper_destroy(shm);
+    }
+    close(fd);
+
+    buffer->pixels = pixels;
+    buffer->size = size;
+    buffer->width = width;
+    buffer->height = height;
+    buffer->busy = 0;
+    buffer->frame = 0;
+    return 1;
+}
+
+/* 2 for double buffering, 3 for triple buffering. */
+void locus_set_shm_buffers(Locus *app, int count) {
+    if (count < 2) {
+        count = 2;
+    }
+    app->shm_buffer_target = count < LOCUS_SHM_MAX_BUFFERS ? count : LOCUS_SHM_MAX_BUFFERS;
+}
+
+/* Reports the age like EGL_EXT_buffer_age. Returns NULL while the
+ * compositor holds every buffer. */
+LocusShmBuffer *locus_shm_acquire(LocusSurface *surface, struct wl_event_queue *queue, int *age) {
+    Locus *app = surface->app;
+    int target = app->shm_buffer_target ? app->shm_buffer_target : 2;
+    LocusShmBuffer *buffer = NULL;
+
+    for (int i = 0; i < surface->shm_buffer_count; i++) {
+        LocusShmBuffer *candidate = &surface->shm_buffers[i];
+        if (!candidate->busy && (!buffer || candidate->frame > buffer->frame)) {
+            buffer = candidate;
+        }
+    }
+
+    if (!buffer && surface->shm_buffer_count < target) {
+        buffer = &surface->shm_buffers[surface->shm_buffer_count++];
+    }
+    if (!buffer) {
+        return NULL;
+    }
+
+    if (buffer->buffer &&
+        (buffer->width != surface->buffer_width || buffer->height != surface->buffer_height)) {
+        destroy_buffer(buffer);
+    }
+    if (!buffer->buffer && !create_buffer(surface, buffer, queue)) {
+        return NULL;
+    }
+
+    *age = buffer->frame ? (int)(surface->shm_frame + 1 - buffer->frame) : 0;
+
+    surface->shm_current = buffer;
+    surface->canvas.pixels = buffer->pixels;
+    surface->canvas.width = buffer->width;
+    surface->canvas.height = buffer->height;
+    surface->canvas.stride = buffer->width;
+    surface->canvas.clip = (LocusRect){ 0, 0, buffer->width, buffer->height };
+    return buffer;
+}
+
+void locus_shm_attach(LocusSurface *surface, LocusShmBuffer *buffer) {
+    wl_surface_attach(surface->surface, buffer->buffer, 0, 0);
+    buffer->busy = 1;
+    buffer->frame = ++surface->shm_frame;
+    surface->shm_current = NULL;
+    surface->canvas.pixels = NULL;
+}
+
+/* Held buffers are moved onto the default queue, since the render queue
+ * may be about to go away. */
+void locus_shm_release_buffers(LocusSurface *surface, int all) {
+    for (int i = 0; i < surface->shm_buffer_count; i++) {
+        LocusShmBuffer *buffer = &surface->shm_buffers[i];
+        LocusShmBuffer *orphan = NULL;
+        if (!all && buffer->buffer && buffer->busy) {
+            orphan = malloc(sizeof(*orphan));
+        }
+        if (orphan) {
+            *orphan = *buffer;
+            orphan->orphaned = 1;
+            wl_proxy_set_queue((struct wl_proxy *)orphan->buffer, NULL);
+            wl_buffer_set_user_data(orphan->buffer, orphan);
+            memset(buffer, 0, sizeof(*buffer));
+        } else {
+            destroy_buffer(buffer);
+        }
+    }
+    surface->shm_buffer_count = 0;
+    surface->shm_current = NULL;
+    surface->canvas.pixels = NULL;
+}
+
+#endif
@@ -0,0 +1,1038 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wayland-egl.h>
+#include "locus-private.h"
+
+static __thread LocusSurface *drawing;
+
+static void lock_render(Locus *app) {
+    if (app->render_running) {
+        pthread_mutex_lock(&app->render_lock);
+    }
+}
+
+static void unlock_render(Locus *app) {
+    if (app->render_running) {
+        pthread_mutex_unlock(&app->render_lock);
+    }
+}
+
+/* Configures are only recorded here; a burst of them collapses into the
+ * latest, which is applied and acked right before the frame that is drawn
+ * at its size (see apply_configure). Nothing blocks on the compositor. */
+static void queue_configure(LocusSurface *surface, uint32_t serial, int width, int height,
+                            uint32_t states) {
+    Locus *app = surface->app;
+
+    lock_render(app);
+    if (width > 0 && height > 0) {
+        surface->next_width = width;
+        surface->next_height = height;
+    } else if (!surface->configure_pending) {
+        surface->next_width = surface->width;
+        surface->next_height = surface->height;
+    }
+    surface->next_states = states;
+    surface->configure_serial = serial;
+    surface->configure_pending = 1;
+    unlock_render(app);
+
+    surface->configured = 1;
+    app->configured = 1;
+    if (surface->egl_surface || app->backend == LOCUS_BACKEND_SHM) {
+        surface->redraw = 1;
+    }
+    if (surface->configure_callback) {
+        surface->configure_callback(surface, surface->next_width, surface->next_height, states,
+                                    surface->configure_data);
+    }
+}
+
+static void handle_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial) {
+    LocusSurface *surface = data;
+    queue_configure(surface, serial, surface->toplevel_width, surface->toplevel_height,
+                    surface->toplevel_states);
+}
+
+static void handle_xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
+                                          int32_t width, int32_t height, struct wl_array *states) {
+    LocusSurface *surface = data;
+    uint32_t *state;
+
+    surface->toplevel_width = width;
+    surface->toplevel_height = height;
+    surface->toplevel_states = 0;
+    wl_array_for_each(state, states) {
+        switch (*state) {
+        case XDG_TOPLEVEL_STATE_MAXIMIZED:
+            surface->toplevel_states |= LOCUS_SURFACE_MAXIMIZED;
+            break;
+        case XDG_TOPLEVEL_STATE_FULLSCREEN:
+            surface->toplevel_states |= LOCUS_SURFACE_FULLSCREEN;
+            break;
+        case XDG_TOPLEVEL_STATE_RESIZING:
+            surface->toplevel_states |= LOCUS_SURFACE_RESIZING;
+            break;
+        case XDG_TOPLEVEL_STATE_ACTIVATED:
+            surface->toplevel_states |= LOCUS_SURFACE_ACTIVATED;
+            break;
+        }
+    }
+}
+
+/* The shell objects stay alive until locus_surface_destroy(); a closed
+ * surface is only skipped by the render loop. Closing the legacy primary
+ * surface without a close callback still ends locus_run(). */
+static void surface_closed(LocusSurface *surface) {
+    surface->closed = 1;
+    if (surface->close_callback) {
+        surface->close_callback(surface, surface->close_data);
+    } else if (surface == surface->app->primary) {
+        surface->app->running = 0;
+    }
+}
+
+static void handle_xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel) {
+    surface_closed(data);
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+    .configure = handle_xdg_toplevel_configure,
+    .close = handle_xdg_toplevel_close,
+};
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+    .configure = handle_configure,
+};
+
+static void handle_layer_surface_configure(void *data,
+                                           struct zwlr_layer_surface_v1 *layer_surface,
+                                           uint32_t serial, uint32_t width, uint32_t height) {
+    queue_configure(data, serial, (int)width, (int)height, 0);
+}
+
+static void handle_layer_surface_closed(void *data,
+                                        struct zwlr_layer_surface_v1 *layer_surface) {
+    surface_closed(data);
+}
+
+static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
+    .configure = handle_layer_surface_configure,
+    .closed = handle_layer_surface_closed,
+};
+
+static int add_surface(Locus *app, LocusSurface *surface) {
+    lock_render(app);
+    if (app->surface_count == app->surface_capacity) {
+        int capacity = app->surface_capacity ? app->surface_capacity * 2 : 4;
+        LocusSurface **surfaces = realloc(app->surfaces, capacity * sizeof *surfaces);
+        if (!surfaces) {
+            unlock_render(app);
+            fprintf(stderr, "Failed to allocate surface\n");
+            return 0;
+        }
+        app->surfaces = surfaces;
+        app->surface_capacity = capacity;
+    }
+    app->surfaces[app->surface_count++] = surface;
+    unlock_render(app);
+    return 1;
+}
+
+static LocusSurface *surface_new(Locus *app, int width, int height) {
+    LocusSurface *surface = calloc(1, sizeof *surface);
+    if (!surface) {
+        fprintf(stderr, "Failed to allocate surface\n");
+        return NULL;
+    }
+
+    surface->app = app;
+    surface->width = width > 0 ? width : app->width;
+    surface->height = height > 0 ? height : app->height;
+    surface->refresh = app->refresh;
+    surface->swap_interval = -1;
+    surface->surface = wl_compositor_create_surface(app->compositor);
+    return surface;
+}
+
+/* Surfaces share the display's EGL context. With the render thread the
+ * swap interval is applied there on the first frame instead. */
+static void surface_create_renderer(LocusSurface *surface) {
+    Locus *app = surface->app;
+
+    locus_output_attach_surface(surface);
+    if (app->backend == LOCUS_BACKEND_SHM) {
+        wl_surface_commit(surface->surface);
+        add_surface(app, surface);
+        return;
+    }
+
+    surface->egl_window = wl_egl_window_create(surface->surface, surface->buffer_width,
+                                               surface->buffer_height);
+    surface->egl_surface = eglCreateWindowSurface(app->egl_display, app->egl_config,
+                                                  (EGLNativeWindowType)surface->egl_window, NULL);
+    if (!app->render_running) {
+        eglMakeCurrent(app->egl_display, surface->egl_surface, surface->egl_surface, app->egl_context);
+        eglSwapInterval(app->egl_display, app->swap_interval);
+        surface->swap_interval = app->swap_interval;
+    }
+
+    wl_surface_commit(surface->surface);
+    add_surface(app, surface);
+}
+
+LocusSurface *locus_surface_create_window(Locus *app, const char *title, int width, int height) {
+    LocusSurface *surface = surface_new(app, width, height);
+    if (!surface) {
+        return NULL;
+    }
+
+    surface->xdg_surface = xdg_wm_base_get_xdg_surface(app->xdg_wm_base, surface->surface);
+    xdg_surface_add_listener(surface->xdg_surface, &xdg_surface_listener, surface);
+    surface->xdg_toplevel = xdg_surface_get_toplevel(surface->xdg_surface);
+    xdg_toplevel_add_listener(surface->xdg_toplevel, &xdg_toplevel_listener, surface);
+
+    xdg_toplevel_set_title(surface->xdg_toplevel, title);
+
+    surface_create_renderer(surface);
+    return surface;
+}
+
+LocusSurface *locus_surface_create_layer(Locus *app, const char *title, uint32_t layer,
+                                         uint32_t anchor, int exclusive, int width, int height) {
+    if (!app->layer_shell) {
+        fprintf(stderr, "zwlr_layer_shell_v1 not available\n");
+        return NULL;
+    }
+
+    LocusSurface *surface = surface_new(app, width, height);
+    if (!surface) {
+        return NULL;
+    }
+
+    surface->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
+        app->layer_shell, surface->surface, NULL, layer, title);
+
+    zwlr_layer_surface_v1_set_size(surface->layer_surface, surface->width, surface->height);
+    zwlr_layer_surface_v1_set_anchor(surface->layer_surface, anchor);
+    if (exclusive) {
+        zwlr_layer_surface_v1_set_exclusive_zone(surface->layer_surface, surface->height);
+    }
+
+    zwlr_layer_surface_v1_add_listener(surface->layer_surface, &layer_surface_listener, surface);
+
+    surface_create_renderer(surface);
+    return surface;
+}
+
+/* Desynchronized, so a layer is only redrawn when it has damage of its
+ * own. Layers take no input. */
+LocusSurface *locus_surface_create_subsurface(LocusSurface *parent, int x, int y, int width, int height) {
+    Locus *app = parent->app;
+    if (!app->subcompositor || !parent->surface) {
+        fprintf(stderr, "wl_subcompositor not available\n");
+        return NULL;
+    }
+
+    LocusSurface *surface = surface_new(app, width > 0 ? width : parent->width,
+                                        height > 0 ? height : parent->height);
+    if (!surface) {
+        return NULL;
+    }
+
+    surface->parent = parent;
+    surface->configured = 1;
+    surface->redraw = 1;
+    surface->subsurface = wl_subcompositor_get_subsurface(app->subcompositor, surface->surface,
+                                                          parent->surface);
+    wl_subsurface_set_position(surface->subsurface, x, y);
+    wl_subsurface_set_desync(surface->subsurface);
+
+    struct wl_region *region = wl_compositor_create_region(app->compositor);
+    wl_surface_set_input_region(surface->surface, region);
+    wl_region_destroy(region);
+
+    surface_create_renderer(surface);
+    locus_surface_schedule_frame(parent);
+    return surface;
+}
+
+/* Position and stacking belong to the parent's state and take effect
+ * with its next commit. */
+void locus_surface_set_position(LocusSurface *surface, int x, int y) {
+    if (surface->subsurface) {
+        wl_subsurface_set_position(surface->subsurface, x, y);
+        locus_surface_schedule_frame(surface->parent);
+    }
+}
+
+void locus_surface_place_above(LocusSurface *surface, LocusSurface *sibling) {
+    if (surface->subsurface) {
+        wl_subsurface_place_above(surface->subsurface, sibling->surface);
+        locus_surface_schedule_frame(surface->parent);
+    }
+}
+
+void locus_surface_place_below(LocusSurface *surface, LocusSurface *sibling) {
+    if (surface->subsurface) {
+        wl_subsurface_place_below(surface->subsurface, sibling->surface);
+        locus_surface_schedule_frame(surface->parent);
+    }
+}
+
+/* Subsurfaces have no configure of their own; a new size is applied like
+ * one, right before the next frame. */
+void locus_surface_set_size(LocusSurface *surface, int width, int height) {
+    Locus *app = surface->app;
+    if (!surface->subsurface) {
+        fprintf(stderr, "Only subsurfaces can be resized directly\n");
+        return;
+    }
+
+    lock_render(app);
+    surface->next_width = width;
+    surface->next_height = height;
+    surface->next_states = surface->states;
+    surface->configure_pending = 1;
+    unlock_render(app);
+    surface->redraw = 1;
+}
+
+/* Pins the buffer to scale times the surface size; 0 follows the
+ * outputs again. */
+void locus_surface_set_content_scale(LocusSurface *surface, float scale) {
+    if (!surface->viewport) {
+        fprintf(stderr, "wp_viewporter not available\n");
+        return;
+    }
+    surface->fixed_scale = scale > 0.0f ? scale : 0.0f;
+    locus_output_update(surface);
+}
+
+static void update_opaque_region(LocusSurface *surface) {
+    struct wl_region *region = NULL;
+    if (surface->opaque) {
+        region = wl_compositor_create_region(surface->app->compositor);
+        wl_region_add(region, 0, 0, surface->width, surface->height);
+    }
+    wl_surface_set_opaque_region(surface->surface, region);
+    if (region) {
+        wl_region_destroy(region);
+    }
+}
+
+/* An opaque layer lets the compositor skip blending it and what is below
+ * it; layers are otherwise cleared to transparent. */
+void locus_surface_set_opaque(LocusSurface *surface, int opaque) {
+    surface->opaque = opaque;
+    if (surface->surface) {
+        update_opaque_region(surface);
+        locus_surface_damage_all(surface);
+    }
+}
+
+static float clear_alpha(LocusSurface *surface) {
+    return surface->subsurface && !surface->opaque ? 0.0f : 1.0f;
+}
+
+static void set_primary(Locus *app, LocusSurface *surface) {
+    app->primary = surface;
+    app->surface = surface ? surface->surface : NULL;
+    app->egl_window = surface ? surface->egl_window : NULL;
+    app->egl_surface = surface ? surface->egl_surface : NULL;
+    app->xdg_surface = surface ? surface->xdg_surface : NULL;
+    app->xdg_toplevel = surface ? surface->xdg_toplevel : NULL;
+    app->layer_surface = surface ? surface->layer_surface : NULL;
+}
+
+void locus_create_window(Locus *app, const char *title) {
+    LocusSurface *surface = locus_surface_create_window(app, title, app->width, app->height);
+    if (surface) {
+        set_primary(app, surface);
+    }
+}
+
+void locus_create_layer_surface(Locus *app, const char *title, uint32_t layer,
+                                uint32_t anchor, int exclusive) {
+    LocusSurface *surface = locus_surface_create_layer(app, title, layer, anchor, exclusive,
+                                                       app->width, app->height);
+    if (surface) {
+        set_primary(app, surface);
+    }
+}
+
+void locus_surface_destroy(LocusSurface *surface) {
+    Locus *app = surface->app;
+
+    for (int i = app->surface_count - 1; i >= 0; i--) {
+        if (i < app->surface_count && app->surfaces[i]->parent == surface) {
+            locus_surface_destroy(app->surfaces[i]);
+        }
+    }
+
+    lock_render(app);
+    while (app->render_running && surface->rendering) {
+        pthread_cond_wait(&app->render_cond, &app->render_lock);
+    }
+    for (int i = 0; i < app->surface_count; i++) {
+        if (app->surfaces[i] == surface) {
+            memmove(&app->surfaces[i], &app->surfaces[i + 1],
+                    (app->surface_count - i - 1) * sizeof *app->surfaces);
+            app->surface_count--;
+            break;
+        }
+    }
+    unlock_render(app);
+    for (int i = 0; i < app->touch_frame.count; i++) {
+        if (app->touch_frame.points[i].surface == surface) {
+            app->touch_frame.points[i].surface = NULL;
+        }
+    }
+    if (app->primary == surface) {
+        set_primary(app, NULL);
+    }
+
+    if (surface->frame_callback) {
+        wl_callback_destroy(surface->frame_callback);
+    }
+    if (surface->headless) {
+        free(surface->canvas.pixels);
+        surface->canvas.pixels = NULL;
+    }
+#ifdef WITH_WAYLAND_SHM
+    locus_shm_release_buffers(surface, 1);
+#endif
+    if (surface->egl_surface) {
+        if (!app->render_running) {
+            eglMakeCurrent(app->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, app->egl_context);
+        }
+        eglDestroySurface(app->egl_display, surface->egl_surface);
+    }
+    if (surface->egl_window) {
+        wl_egl_window_destroy(surface->egl_window);
+    }
+    if (surface->fractional_scale) {
+        wp_fractional_scale_v1_destroy(surface->fractional_scale);
+    }
+    if (surface->viewport) {
+        wp_viewport_destroy(surface->viewport);
+    }
+    if (surface->xdg_toplevel) {
+        xdg_toplevel_destroy(surface->xdg_toplevel);
+    }
+    if (surface->xdg_surface) {
+        xdg_surface_destroy(surface->xdg_surface);
+    }
+    if (surface->layer_surface) {
+        zwlr_layer_surface_v1_destroy(surface->layer_surface);
+    }
+    if (surface->subsurface) {
+        wl_subsurface_destroy(surface->subsurface);
+        locus_surface_schedule_frame(surface->parent);
+    }
+    if (surface->surface) {
+        wl_surface_destroy(surface->surface);
+    }
+    free(surface);
+}
+
+void locus_surface_set_draw_callback(LocusSurface *surface,
+                                     void (*callback)(LocusSurface *surface, void *data), void *data) {
+    surface->draw_callback = callback;
+    surface->draw_data = data;
+}
+
+void locus_surface_set_close_callback(LocusSurface *surface,
+                                      void (*callback)(LocusSurface *surface, void *data), void *data) {
+    surface->close_callback = callback;
+    surface->close_data = data;
+}
+
+void locus_surface_set_configure_callback(LocusSurface *surface,
+                                          void (*callback)(LocusSurface *surface, int width, int height,
+                                                           uint32_t states, void *data),
+                                          void *data) {
+    surface->configure_callback = callback;
+    surface->configure_data = data;
+}
+
+uint32_t locus_surface_states(LocusSurface *surface) {
+    lock_render(surface->app);
+    uint32_t states = surface->states;
+    unlock_render(surface->app);
+    return states;
+}
+
+void locus_surface_request_redraw(LocusSurface *surface) {
+    surface->redraw = 1;
+}
+
+void locus_surface_schedule_frame(LocusSurface *surface) {
+    surface->frame_requested = 1;
+}
+
+float locus_surface_scale(LocusSurface *surface) {
+    return surface->scale > 0 ? surface->scale : 1.0f;
+}
+
+LocusCanvas *locus_surface_canvas(LocusSurface *surface) {
+    return surface && surface->canvas.pixels ? &surface->canvas : NULL;
+}
+
+LocusCanvas *locus_canvas(Locus *app) {
+    return locus_surface_canvas(locus_target_surface(app));
+}
+
+/* The surface that app-level calls such as locus_damage() act on: the one
+ * this thread is drawing while inside a draw callback, the primary one
+ * otherwise. */
+LocusSurface *locus_target_surface(Locus *app) {
+    return drawing && drawing->app == app ? drawing : app->primary;
+}
+
+static LocusRect rect_union(LocusRect a, LocusRect b) {
+    if (a.width <= 0 || a.height <= 0) {
+        return b;
+    }
+    if (b.width <= 0 || b.height <= 0) {
+        return a;
+    }
+
+    int x1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    int y1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+    LocusRect r;
+    r.x = a.x < b.x ? a.x : b.x;
+    r.y = a.y < b.y ? a.y : b.y;
+    r.width = x1 - r.x;
+    r.height = y1 - r.y;
+    return r;
+}
+
+static LocusRect rect_clip(LocusRect r, int width, int height) {
+    int x1 = r.x + r.width < width ? r.x + r.width : width;
+    int y1 = r.y + r.height < height ? r.y + r.height : height;
+    r.x = r.x > 0 ? r.x : 0;
+    r.y = r.y > 0 ? r.y : 0;
+    r.width = x1 > r.x ? x1 - r.x : 0;
+    r.height = y1 > r.y ? y1 - r.y : 0;
+    return r;
+}
+
+void locus_surface_damage(LocusSurface *surface, int x, int y, int width, int height) {
+    LocusRect rect = rect_clip((LocusRect){ x, y, width, height }, surface->width, surface->height);
+    if (rect.width <= 0 || rect.height <= 0) {
+        return;
+    }
+
+    if (surface->damage_all) {
+        return;
+    }
+
+    if (surface->damage_count == LOCUS_MAX_DAMAGE_RECTS) {
+        LocusRect *last = &surface->damage[LOCUS_MAX_DAMAGE_RECTS - 1];
+        *last = rect_union(*last, rect);
+        return;
+    }
+    surface->damage[surface->damage_count++] = rect;
+}
+
+void locus_surface_damage_all(LocusSurface *surface) {
+    surface->damage_all = 1;
+}
+
+void locus_damage(Locus *app, int x, int y, int width, int height) {
+    LocusSurface *surface = locus_target_surface(app);
+    if (surface) {
+        locus_surface_damage(surface, x, y, width, height);
+    }
+}
+
+void locus_damage_all(Locus *app) {
+    LocusSurface *surface = locus_target_surface(app);
+    if (surface) {
+        locus_surface_damage_all(surface);
+    }
+}
+
+void locus_schedule_frame(Locus *app) {
+    LocusSurface *surface = locus_target_surface(app);
+    if (surface) {
+        surface->frame_requested = 1;
+    }
+}
+
+/* Asking for the repaint rect is how a draw callback says it limits its
+ * drawing to it; the GL backend only repaints partially for those. */
+LocusRect locus_repaint_rect(Locus *app) {
+    LocusSurface *surface = locus_target_surface(app);
+    if (!surface) {
+        return (LocusRect){ 0, 0, 0, 0 };
+    }
+    surface->repaint_queried = 1;
+    return surface->repaint;
+}
+
+static void frame_handle_done(void *data, struct wl_callback *callback, uint32_t time) {
+    LocusSurface *surface = data;
+    Locus *app = surface->app;
+
+    wl_callback_destroy(callback);
+    lock_render(app);
+    surface->frame_callback = NULL;
+    surface->frame_pending = 0;
+    surface->frame_time = time;
+    surface->frame_done = locus_now_ms();
+    unlock_render(app);
+
+    if (app->render_running) {
+        uint64_t one = 1;
+        if (write(app->main_wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            fprintf(stderr, "Failed to wake main loop\n");
+        }
+    }
+}
+
+static const struct wl_callback_listener frame_listener = {
+    .done = frame_handle_done,
+};
+
+static LocusRect damage_bounds(const LocusFrameDamage *damage) {
+    LocusRect bounds = { 0, 0, 0, 0 };
+    for (int i = 0; i < damage->damage_count; i++) {
+        bounds = rect_union(bounds, damage->damage[i]);
+    }
+    return bounds;
+}
+
+/* Only the damage accumulated since the buffer's age needs repainting. */
+static void compute_repaint(LocusSurface *surface, LocusFrameDamage *damage, int age) {
+    LocusRect full = { 0, 0, surface->width, surface->height };
+
+    if (damage->redraw || damage->damage_all || damage->damage_count == 0) {
+        damage->damage_all = 1;
+        surface->repaint = full;
+        return;
+    }
+
+    if (age <= 0 || age - 1 > surface->damage_history_count) {
+        surface->repaint = full;
+        return;
+    }
+
+    surface->repaint = damage_bounds(damage);
+    for (int i = 0; i < age - 1; i++) {
+        surface->repaint = rect_union(surface->repaint, surface->damage_history[i]);
+    }
+}
+
+static void push_damage_history(LocusSurface *surface, const LocusFrameDamage *damage) {
+    LocusRect full = { 0, 0, surface->width, surface->height };
+    LocusRect frame = damage->damage_all ? full : damage_bounds(damage);
+
+    memmove(&surface->damage_history[1], &surface->damage_history[0],
+            (LOCUS_DAMAGE_HISTORY - 1) * sizeof(surface->damage_history[0]));
+    surface->damage_history[0] = frame;
+    if (surface->damage_history_count < LOCUS_DAMAGE_HISTORY) {
+        surface->damage_history_count++;
+    }
+}
+
+/* Damage is tracked in surface coordinates; the buffer is scale times
+ * larger, so round outwards to whole buffer pixels. */
+static LocusRect buffer_rect(LocusSurface *surface, LocusRect r) {
+    float scale = locus_surface_scale(surface);
+    int x0 = (int)floorf(r.x * scale);
+    int y0 = (int)floorf(r.y * scale);
+    int x1 = (int)ceilf((r.x + r.width) * scale);
+    int y1 = (int)ceilf((r.y + r.height) * scale);
+    return rect_clip((LocusRect){ x0, y0, x1 - x0, y1 - y0 }, surface->buffer_width, surface->buffer_height);
+}
+
+static int egl_buffer_age(LocusSurface *surface) {
+    Locus *app = surface->app;
+    EGLint age = 0;
+    if (app->has_buffer_age) {
+        eglQuerySurface(app->egl_display, surface->egl_surface, EGL_BUFFER_AGE_EXT, &age);
+    }
+    return age;
+}
+
+#ifdef WITH_WAYLAND_SHM
+static void present_shm(LocusSurface *surface, const LocusFrameDamage *damage) {
+    Locus *app = surface->app;
+    int count = damage->damage_all ? 1 : damage->damage_count;
+
+    locus_shm_attach(surface, surface->shm_current);
+    for (int i = 0; i < count; i++) {
+        LocusRect r = damage->damage_all ? (LocusRect){ 0, 0, surface->width, surface->height }
+                                         : damage->damage[i];
+        if (app->compositor_version >= 4) {
+            LocusRect b = buffer_rect(surface, r);
+            wl_surface_damage_buffer(surface->surface, b.x, b.y, b.width, b.height);
+        } else {
+            wl_surface_damage(surface->surface, r.x, r.y, r.width, r.height);
+        }
+    }
+    wl_surface_commit(surface->surface);
+}
+#endif
+
+static void swap_with_damage(LocusSurface *surface, const LocusFrameDamage *damage) {
+    Locus *app = surface->app;
+    EGLint rects[LOCUS_MAX_DAMAGE_RECTS * 4];
+    int count = damage->damage_all ? 1 : damage->damage_count;
+
+#ifdef WITH_WAYLAND_SHM
+    if (surface->shm_current) {
+        present_shm(surface, damage);
+        return;
+    }
+#endif
+
+    for (int i = 0; i < count; i++) {
+        LocusRect r = damage->damage_all ? (LocusRect){ 0, 0, surface->width, surface->height }
+                                         : damage->damage[i];
+        LocusRect b = buffer_rect(surface, r);
+        if (app->swap_buffers_with_damage) {
+            rects[i * 4 + 0] = b.x;
+            rects[i * 4 + 1] = surface->buffer_height - (b.y + b.height);
+            rects[i * 4 + 2] = b.width;
+            rects[i * 4 + 3] = b.height;
+        } else if (app->compositor_version >= 4) {
+            wl_surface_damage_buffer(surface->surface, b.x, b.y, b.width, b.height);
+        } else {
+            wl_surface_damage(surface->surface, r.x, r.y, r.width, r.height);
+        }
+    }
+
+    EGLBoolean ok;
+    if (app->swap_buffers_with_damage) {
+        ok = app->swap_buffers_with_damage(app->egl_display, surface->egl_surface, rects, count);
+    } else {
+        ok = eglSwapBuffers(app->egl_display, surface->egl_surface);
+    }
+
+    if (ok == EGL_FALSE) {
+        fprintf(stderr, "Failed to swap buffers\n");
+    }
+}
+
+static void request_frame_callback(LocusSurface *surface, struct wl_event_queue *queue) {
+    struct wl_surface *target = surface->surface;
+    if (queue) {
+        target = wl_proxy_create_wrapper(surface->surface);
+        wl_proxy_set_queue((struct wl_proxy *)target, queue);
+    }
+
+    struct wl_callback *callback = wl_surface_frame(target);
+    wl_callback_add_listener(callback, &frame_listener, surface);
+    if (queue) {
+        wl_proxy_wrapper_destroy(target);
+    }
+
+    lock_render(surface->app);
+    surface->frame_callback = callback;
+    surface->frame_pending = 1;
+    unlock_render(surface->app);
+}
+
+/* Damage does not set frame_requested: damage added by a frame hook is
+ * drawn in the same frame and must not cause another. */
+void locus_surface_take_damage(LocusSurface *surface, LocusFrameDamage *damage) {
+    damage->redraw = surface->redraw;
+    damage->frame_requested = surface->frame_requested;
+    damage->damage_all = surface->damage_all;
+    damage->damage_count = surface->damage_count;
+    memcpy(damage->damage, surface->damage, surface->damage_count * sizeof(LocusRect));
+    damage->dispatch_ns = surface->app->dispatch_ns;
+
+    surface->redraw = 0;
+    surface->damage_all = 0;
+    surface->damage_count = 0;
+}
+
+void locus_surface_render(LocusSurface *surface) {
+    LocusFrameDamage damage;
+    surface->ready = 0;
+    locus_surface_take_damage(surface, &damage);
+    locus_surface_render_damage(surface, &damage, NULL);
+}
+
+static void draw_surface(LocusSurface *surface) {
+    Locus *app = surface->app;
+
+    drawing = surface;
+    if (surface->draw_callback) {
+        surface->draw_callback(surface, surface->draw_data);
+    } else if (surface == app->primary && app->draw_callback) {
+        app->draw_callback(app);
+    } else {
+        fprintf(stderr, "Draw callback not set\n");
+    }
+    drawing = NULL;
+}
+
+/* Takes the latest configure on whichever thread renders and acks it
+ * ahead of the commit that carries the new size. Returns 1 if the size
+ * changed. */
+static int apply_configure(LocusSurface *surface) {
+    Locus *app = surface->app;
+
+    lock_render(app);
+    int pending = surface->configure_pending;
+    uint32_t serial = surface->configure_serial;
+    int width = surface->next_width, height = surface->next_height;
+    if (pending) {
+        surface->states = surface->next_states;
+    }
+    surface->configure_pending = 0;
+    unlock_render(app);
+
+    if (!pending) {
+        return 0;
+    }
+
+    int resized = width > 0 && height > 0 && (width != surface->width || height != surface->height);
+    if (resized) {
+        surface->width = width;
+        surface->height = height;
+        if (surface->viewport) {
+            wp_viewport_set_destination(surface->viewport, width, height);
+        }
+        if (surface->opaque) {
+            update_opaque_region(surface);
+        }
+    }
+    if (surface->xdg_surface) {
+        xdg_surface_ack_configure(surface->xdg_surface, serial);
+    } else if (surface->layer_surface) {
+        zwlr_layer_surface_v1_ack_configure(surface->layer_surface, serial);
+    }
+    return resized;
+}
+
+/* Same flow as the EGL path, with the clear and scissor done on the
+ * canvas. When the compositor still holds every buffer the frame is
+ * dropped and redone in full once the frame callback comes back. */
+static void render_shm(LocusSurface *surface, LocusFrameDamage *damage, struct wl_event_queue *queue) {
+#ifdef WITH_WAYLAND_SHM
+    LocusFrameTiming timing;
+    int age = 0;
+
+    if (locus_output_apply(surface, apply_configure(surface))) {
+        damage->damage_all = 1;
+    }
+
+    LocusShmBuffer *buffer = locus_shm_acquire(surface, queue, &age);
+    if (!buffer) {
+        lock_render(surface->app);
+        surface->redraw = 1;
+        unlock_render(surface->app);
+        request_frame_callback(surface, queue);
+        wl_surface_commit(surface->surface);
+        return;
+    }
+
+    locus_timing_begin(surface, damage, &timing);
+    compute_repaint(surface, damage, age);
+    surface->canvas.clip = buffer_rect(surface, surface->repaint);
+    locus_canvas_clear(&surface->canvas, clear_alpha(surface) > 0.0f ? 0xff000000 : 0);
+
+    draw_surface(surface);
+
+    locus_timing_draw_done(surface, &timing, queue);
+    request_frame_callback(surface, queue);
+    swap_with_damage(surface, damage);
+    locus_timing_end(surface, &timing);
+    push_damage_history(surface, damage);
+#endif
+}
+
+/* Offscreen surface for the headless mode: a pbuffer on EGL, a plain pixel
+ * buffer on the shm backend. It is drawn with
+ * locus_surface_render_offscreen() rather than by locus_run(). */
+LocusSurface *locus_surface_create_headless(Locus *app, int width, int height, float scale) {
+    LocusSurface *surface = calloc(1, sizeof *surface);
+    if (!surface) {
+        fprintf(stderr, "Failed to allocate surface\n");
+        return NULL;
+    }
+
+    surface->app = app;
+    surface->headless = 1;
+    surface->configured = 1;
+    surface->width = width > 0 ? width : app->width;
+    surface->height = height > 0 ? height : app->height;
+    surface->scale = scale > 0 ? scale : 1.0f;
+    surface->buffer_width = (int)lround(surface->width * surface->scale);
+    surface->buffer_height = (int)lround(surface->height * surface->scale);
+    surface->refresh = app->refresh;
+    surface->swap_interval = -1;
+
+    if (app->backend == LOCUS_BACKEND_SHM) {
+        surface->canvas.pixels = calloc((size_t)surface->buffer_width * surface->buffer_height,
+                                        sizeof(uint32_t));
+        surface->canvas.width = surface->buffer_width;
+        surface->canvas.height = surface->buffer_height;
+        surface->canvas.stride = surface->buffer_width;
+        surface->canvas.clip = (LocusRect){ 0, 0, surface->buffer_width, surface->buffer_height };
+        if (!surface->canvas.pixels) {
+            fprintf(stderr, "Failed to allocate headless canvas\n");
+            free(surface);
+            return NULL;
+        }
+    } else {
+        EGLint attribs[] = {
+            EGL_WIDTH, surface->buffer_width,
+            EGL_HEIGHT, surface->buffer_height,
+            EGL_NONE
+        };
+        surface->egl_surface = eglCreatePbufferSurface(app->egl_display, app->egl_config, attribs);
+        if (surface->egl_surface == EGL_NO_SURFACE) {
+            fprintf(stderr, "Failed to create pbuffer surface\n");
+            free(surface);
+            return NULL;
+        }
+        eglMakeCurrent(app->egl_display, surface->egl_surface, surface->egl_surface, app->egl_context);
+    }
+
+    if (!add_surface(app, surface)) {
+        locus_surface_destroy(surface);
+        return NULL;
+    }
+    if (!app->primary) {
+        set_primary(app, surface);
+    }
+    return surface;
+}
+
+/* Renders one full frame and waits for the GPU, so that the time taken is
+ * that of the whole frame. */
+void locus_surface_render_offscreen(LocusSurface *surface) {
+    Locus *app = surface->app;
+    LocusFrameDamage damage;
+    LocusFrameTiming timing;
+
+    locus_surface_take_damage(surface, &damage);
+    damage.damage_all = 1;
+    locus_timing_begin(surface, &damage, &timing);
+    compute_repaint(surface, &damage, 0);
+
+    if (app->backend == LOCUS_BACKEND_SHM) {
+        surface->canvas.clip = (LocusRect){ 0, 0, surface->buffer_width, surface->buffer_height };
+        locus_canvas_clear(&surface->canvas, 0xff000000);
+        draw_surface(surface);
+        locus_timing_draw_done(surface, &timing, NULL);
+    } else {
+        eglMakeCurrent(app->egl_display, surface->egl_surface, surface->egl_surface, app->egl_context);
+        glViewport(0, 0, surface->buffer_width, surface->buffer_height);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draw_surface(surface);
+        locus_timing_draw_done(surface, &timing, NULL);
+        glFinish();
+    }
+    locus_timing_end(surface, &timing);
+}
+
+/* Copies the last frame as premultiplied ARGB8888, top row first, into
+ * buffer_width * buffer_height pixels. */
+int locus_surface_read_pixels(LocusSurface *surface, uint32_t *pixels) {
+    Locus *app = surface->app;
+    int width = surface->buffer_width;
+    int height = surface->buffer_height;
+
+    if (app->backend == LOCUS_BACKEND_SHM) {
+        if (!surface->canvas.pixels) {
+            return 0;
+        }
+        for (int y = 0; y < height; y++) {
+            memcpy(pixels + (size_t)y * width, surface->canvas.pixels + (size_t)y * surface->canvas.stride,
+                   width * sizeof(uint32_t));
+        }
+        return 1;
+    }
+
+    unsigned char *rgba = malloc((size_t)width * height * 4);
+    if (!rgba) {
+        fprintf(stderr, "Failed to allocate readback buffer\n");
+        return 0;
+    }
+    eglMakeCurrent(app->egl_display, surface->egl_surface, surface->egl_surface, app->egl_context);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+
+    for (int y = 0; y < height; y++) {
+        const unsigned char *row = rgba + (size_t)(height - 1 - y) * width * 4;
+        uint32_t *dst = pixels + (size_t)y * width;
+        for (int x = 0; x < width; x++) {
+            const unsigned char *p = row + x * 4;
+            dst[x] = ((uint32_t)p[3] << 24) | ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+        }
+    }
+    free(rgba);
+    return 1;
+}
+
+void locus_surface_render_damage(LocusSurface *surface, const LocusFrameDamage *submitted,
+                                 struct wl_event_queue *queue) {
+    Locus *app = surface->app;
+    LocusFrameDamage frame = *submitted;
+    LocusFrameDamage *damage = &frame;
+    LocusFrameTiming timing;
+
+    if (!damage->redraw && !damage->damage_all && damage->damage_count == 0) {
+        if (damage->frame_requested) {
+            request_frame_callback(surface, queue);
+            wl_surface_commit(surface->surface);
+        }
+        return;
+    }
+
+    if (app->backend == LOCUS_BACKEND_SHM) {
+        render_shm(surface, damage, queue);
+        return;
+    }
+
+    eglMakeCurrent(app->egl_display, surface->egl_surface, surface->egl_surface, app->egl_context);
+    if (surface->swap_interval != app->swap_interval) {
+        eglSwapInterval(app->egl_display, app->swap_interval);
+        surface->swap_interval = app->swap_interval;
+    }
+    if (locus_output_apply(surface, apply_configure(surface))) {
+        damage->damage_all = 1;
+    }
+
+    /* NanoVG turns GL_SCISSOR_TEST off when it renders, so the callback has
+     * to clip its drawing itself. */
+    locus_timing_begin(surface, damage, &timing);
+    compute_repaint(surface, damage, surface->partial_repaint ? egl_buffer_age(surface) : 0);
+    glViewport(0, 0, surface->buffer_width, surface->buffer_height);
+    int partial = surface->repaint.width < surface->width || surface->repaint.height < surface->height;
+    if (partial) {
+        LocusRect b = buffer_rect(surface, surface->repaint);
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(b.x, surface->buffer_height - (b.y + b.height), b.width, b.height);
+    }
+
+    glClearColor(0.0f, 0.0f, 0.0f, clear_alpha(surface));
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    surface->repaint_queried = 0;
+    draw_surface(surface);
+
+    if (partial) {
+        glDisable(GL_SCISSOR_TEST);
+    }
+    surface->partial_repaint = surface->repaint_queried;
+
+    locus_timing_draw_done(surface, &timing, queue);
+    request_frame_callback(surface, queue);
+    swap_with_damage(surface, damage);
+    locus_timing_end(surface, &timing);
+    push_damage_history(surface, damage);
+}
@@ -0,0 +1,334 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "locus-private.h"
+
+#define LOCUS_SNAPSHOT_FRESH 4
+
+typedef struct {
+    LocusSurface *surface;
+    LocusFrameDamage damage;
+} LocusRenderJob;
+
+int locus_snapshot_init(LocusSnapshot *snapshot, size_t size) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->data = calloc(3, size);
+    if (!snapshot->data) {
+        fprintf(stderr, "Failed to allocate snapshot\n");
+        return 0;
+    }
+    snapshot->size = size;
+    snapshot->back = 0;
+    snapshot->middle = 1;
+    snapshot->front = 2;
+    return 1;
+}
+
+void *locus_snapshot_back(LocusSnapshot *snapshot) {
+    return snapshot->data + snapshot->back * snapshot->size;
+}
+
+/* Swaps the filled back buffer with the shared middle one and flags it as
+ * fresh. The writer must fill the whole buffer again before the next
+ * publish, since the buffer it gets back holds older contents. */
+void locus_snapshot_publish(LocusSnapshot *snapshot) {
+    int old = __atomic_exchange_n(&snapshot->middle, snapshot->back | LOCUS_SNAPSHOT_FRESH,
+                                  __ATOMIC_ACQ_REL);
+    snapshot->back = old & ~LOCUS_SNAPSHOT_FRESH;
+}
+
+const void *locus_snapshot_front(LocusSnapshot *snapshot, int *fresh) {
+    int is_fresh = 0;
+    if (__atomic_load_n(&snapshot->middle, __ATOMIC_ACQUIRE) & LOCUS_SNAPSHOT_FRESH) {
+        int old = __atomic_exchange_n(&snapshot->middle, snapshot->front, __ATOMIC_ACQ_REL);
+        snapshot->front = old & ~LOCUS_SNAPSHOT_FRESH;
+        is_fresh = 1;
+    }
+    if (fresh) {
+        *fresh = is_fresh;
+    }
+    return snapshot->data + snapshot->front * snapshot->size;
+}
+
+void locus_snapshot_free(LocusSnapshot *snapshot) {
+    free(snapshot->data);
+    snapshot->data = NULL;
+    snapshot->size = 0;
+}
+
+void locus_set_swap_interval(Locus *app, int interval) {
+    app->swap_interval = interval;
+}
+
+void locus_set_render_delay(Locus *app, uint32_t delay_ms) {
+    app->render_delay = delay_ms;
+}
+
+void locus_set_threaded(Locus *app, int threaded) {
+    app->threaded = threaded;
+}
+
+static void wake_fd(int fd) {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "Failed to signal render thread\n");
+    }
+}
+
+static void drain_fd(int fd) {
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "Failed to read render thread eventfd\n");
+    }
+}
+
+static void merge_damage(LocusFrameDamage *dst, const LocusFrameDamage *src) {
+    dst->redraw |= src->redraw;
+    dst->frame_requested |= src->frame_requested;
+    dst->damage_all |= src->damage_all;
+    dst->dispatch_ns += src->dispatch_ns;
+    for (int i = 0; i < src->damage_count && !dst->damage_all; i++) {
+        if (dst->damage_count == LOCUS_MAX_DAMAGE_RECTS) {
+            dst->damage_all = 1;
+            break;
+        }
+        dst->damage[dst->damage_count++] = src->damage[i];
+    }
+}
+
+/* Called on the main thread once frame hooks have run: hands the damage
+ * collected since the last frame to the render thread. The surface counts
+ * as pending until the render thread's frame callback comes back. */
+void locus_render_thread_submit(Locus *app, LocusSurface *surface) {
+    LocusFrameDamage damage;
+
+    surface->ready = 0;
+    locus_surface_take_damage(surface, &damage);
+    if (!damage.redraw && !damage.frame_requested && !damage.damage_all && damage.damage_count == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&app->render_lock);
+    if (surface->submit_pending) {
+        merge_damage(&surface->submitted, &damage);
+    } else {
+        surface->submitted = damage;
+    }
+    surface->submit_pending = 1;
+    surface->frame_pending = 1;
+    pthread_mutex_unlock(&app->render_lock);
+
+    wake_fd(app->render_wake_fd);
+}
+
+static int collect_jobs(Locus *app, LocusRenderJob **jobs, int *capacity) {
+    int count = 0;
+
+    if (*capacity < app->surface_count) {
+        LocusRenderJob *resized = realloc(*jobs, app->surface_count * sizeof **jobs);
+        if (!resized) {
+            fprintf(stderr, "Failed to allocate render jobs\n");
+            return 0;
+        }
+        *jobs = resized;
+        *capacity = app->surface_count;
+    }
+
+    for (int i = 0; i < app->surface_count; i++) {
+        LocusSurface *surface = app->surfaces[i];
+        if (!surface->submit_pending) {
+            continue;
+        }
+        (*jobs)[count].surface = surface;
+        (*jobs)[count].damage = surface->submitted;
+        surface->submit_pending = 0;
+        surface->rendering = 1;
+        count++;
+    }
+    return count;
+}
+
+/* The connection is gone, so no frame callback will ever come back; the
+ * main loop is stopped instead of waiting on them forever. */
+static void render_failed(Locus *app) {
+    pthread_mutex_lock(&app->render_lock);
+    app->render_quit = 1;
+    pthread_mutex_unlock(&app->render_lock);
+    __atomic_store_n(&app->running, 0, __ATOMIC_RELEASE);
+    wake_fd(app->main_wake_fd);
+}
+
+/* Renders submitted frames and dispatches the render queue, which carries
+ * only the frame callbacks created here. Reading from the display fd is
+ * shared with the main thread through prepare_read/read_events. */
+static void *render_main(void *data) {
+    Locus *app = data;
+    LocusRenderJob *jobs = NULL;
+    int capacity = 0;
+    struct pollfd fds[2];
+
+    for (;;) {
+        while (wl_display_prepare_read_queue(app->display, app->render_queue) != 0) {
+            wl_display_dispatch_queue_pending(app->display, app->render_queue);
+        }
+        wl_display_flush(app->display);
+
+        fds[0].fd = wl_display_get_fd(app->display);
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = app->render_wake_fd;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+
+        if (poll(fds, 2, -1) < 0) {
+            wl_display_cancel_read(app->display);
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Render thread poll failed: %s\n", strerror(errno));
+            render_failed(app);
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            if (wl_display_read_events(app->display) < 0) {
+                fprintf(stderr, "Render thread lost the Wayland connection: %s\n", strerror(errno));
+                render_failed(app);
+                break;
+            }
+        } else {
+            wl_display_cancel_read(app->display);
+        }
+        wl_display_dispatch_queue_pending(app->display, app->render_queue);
+
+        if (!(fds[1].revents & POLLIN)) {
+            continue;
+        }
+        drain_fd(app->render_wake_fd);
+
+        pthread_mutex_lock(&app->render_lock);
+        if (app->render_quit) {
+            pthread_mutex_unlock(&app->render_lock);
+            break;
+        }
+        int count = collect_jobs(app, &jobs, &capacity);
+        pthread_mutex_unlock(&app->render_lock);
+
+        for (int i = 0; i < count; i++) {
+            locus_surface_render_damage(jobs[i].surface, &jobs[i].damage, app->render_queue);
+        }
+
+        pthread_mutex_lock(&app->render_lock);
+        for (int i = 0; i < count; i++) {
+            jobs[i].surface->rendering = 0;
+        }
+        pthread_cond_broadcast(&app->render_cond);
+        pthread_mutex_unlock(&app->render_lock);
+    }
+
+    free(jobs);
+    if (app->egl_context) {
+        eglMakeCurrent(app->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+    return NULL;
+}
+
+static void main_wake(Locus *app, int fd, short revents, void *data) {
+    drain_fd(fd);
+}
+
+int locus_render_thread_start(Locus *app) {
+    if (app->render_running) {
+        return 1;
+    }
+
+    app->render_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    app->main_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    app->render_queue = wl_display_create_queue(app->display);
+    if (app->render_wake_fd < 0 || app->main_wake_fd < 0 || !app->render_queue) {
+        fprintf(stderr, "Failed to set up render thread\n");
+        locus_render_thread_stop(app);
+        return 0;
+    }
+
+    pthread_mutex_init(&app->render_lock, NULL);
+    pthread_cond_init(&app->render_cond, NULL);
+    app->render_quit = 0;
+
+    /* The context can only be current on one thread at a time. */
+    if (app->egl_context) {
+        eglMakeCurrent(app->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+    app->render_running = 1;
+    if (pthread_create(&app->render_thread, NULL, render_main, app) != 0) {
+        fprintf(stderr, "Failed to start render thread\n");
+        app->render_running = 0;
+        pthread_cond_destroy(&app->render_cond);
+        pthread_mutex_destroy(&app->render_lock);
+        locus_render_thread_stop(app);
+        if (app->egl_context) {
+            EGLSurface current = app->primary ? app->primary->egl_surface : EGL_NO_SURFACE;
+            eglMakeCurrent(app->egl_display, current, current, app->egl_context);
+        }
+        return 0;
+    }
+
+    locus_add_fd(app, app->main_wake_fd, POLLIN, main_wake, NULL);
+    return 1;
+}
+
+void locus_render_thread_stop(Locus *app) {
+    if (app->render_running) {
+        pthread_mutex_lock(&app->render_lock);
+        app->render_quit = 1;
+        pthread_mutex_unlock(&app->render_lock);
+        wake_fd(app->render_wake_fd);
+        pthread_join(app->render_thread, NULL);
+
+        app->render_running = 0;
+        pthread_cond_destroy(&app->render_cond);
+        pthread_mutex_destroy(&app->render_lock);
+
+        /* Releases already read for the render queue mark their buffers
+         * free before the remaining ones are handed to the main queue. */
+        wl_display_dispatch_queue_pending(app->display, app->render_queue);
+        for (int i = 0; i < app->surface_count; i++) {
+            LocusSurface *surface = app->surfaces[i];
+            if (surface->frame_callback) {
+                wl_callback_destroy(surface->frame_callback);
+                surface->frame_callback = NULL;
+            }
+            if (surface->submit_pending) {
+                surface->redraw = 1;
+                surface->submit_pending = 0;
+            }
+            surface->frame_pending = 0;
+#ifdef WITH_WAYLAND_SHM
+            locus_shm_release_buffers(surface, 0);
+#endif
+        }
+        locus_timing_release(app);
+
+        if (app->egl_context) {
+            EGLSurface current = app->primary ? app->primary->egl_surface : EGL_NO_SURFACE;
+            eglMakeCurrent(app->egl_display, current, current, app->egl_context);
+        }
+    }
+
+    if (app->main_wake_fd >= 0) {
+        locus_remove_fd(app, app->main_wake_fd);
+        close(app->main_wake_fd);
+    }
+    if (app->render_wake_fd >= 0) {
+        close(app->render_wake_fd);
+    }
+    if (app->render_queue) {
+        wl_event_queue_destroy(app->render_queue);
+    }
+    app->main_wake_fd = app->render_wake_fd = -1;
+    app->render_queue = NULL;
+}
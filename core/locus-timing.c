@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "locus-private.h"
+#include <GLES2/gl2ext.h>
+
+#define LOCUS_TIMING_FRAMES 256
+#define LOCUS_TIMING_QUERIES 4
+#define LOCUS_TIMING_FEEDBACK 8
+
+typedef struct {
+    Locus *app;
+    struct wp_presentation_feedback *feedback;
+    uint64_t frame;
+} LocusFeedback;
+
+/* The ring is written by whichever thread renders and read through the
+ * API from the main thread, hence the lock. Queries and feedback objects
+ * are only touched by the rendering thread. */
+struct LocusTiming {
+    pthread_mutex_t lock;
+    LocusFrameTiming frames[LOCUS_TIMING_FRAMES];
+    uint64_t frame_count;
+    int gpu_checked;
+    GLuint queries[LOCUS_TIMING_QUERIES];
+    uint64_t query_frames[LOCUS_TIMING_QUERIES];
+    int query_active;
+    PFNGLGENQUERIESEXTPROC gen_queries;
+    PFNGLDELETEQUERIESEXTPROC delete_queries;
+    PFNGLBEGINQUERYEXTPROC begin_query;
+    PFNGLENDQUERYEXTPROC end_query;
+    PFNGLGETQUERYOBJECTUIVEXTPROC get_query_uiv;
+    PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_ui64v;
+    LocusFeedback feedback[LOCUS_TIMING_FEEDBACK];
+};
+
+uint64_t locus_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Can be turned on before locus_run(); $LOCUS_TIMING or $LOCUS_TRACE do
+ * it from the environment. */
+void locus_set_timing(Locus *app, int enabled) {
+    if (!enabled || app->timing) {
+        return;
+    }
+    app->timing = calloc(1, sizeof(*app->timing));
+    if (!app->timing) {
+        fprintf(stderr, "Failed to allocate frame timing\n");
+        return;
+    }
+    pthread_mutex_init(&app->timing->lock, NULL);
+}
+
+static LocusFrameTiming *find_frame(LocusTiming *timing, uint64_t frame) {
+    LocusFrameTiming *entry = &timing->frames[frame % LOCUS_TIMING_FRAMES];
+    return entry->frame == frame ? entry : NULL;
+}
+
+static void set_phase(LocusTiming *timing, uint64_t frame, LocusTimingPhase phase, uint64_t value) {
+    pthread_mutex_lock(&timing->lock);
+    LocusFrameTiming *entry = find_frame(timing, frame);
+    if (entry) {
+        entry->phase[phase] = value;
+    }
+    pthread_mutex_unlock(&timing->lock);
+}
+
+static void init_gpu(LocusTiming *timing) {
+    timing->gpu_checked = 1;
+
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "GL_EXT_disjoint_timer_query")) {
+        return;
+    }
+    timing->gen_queries = (PFNGLGENQUERIESEXTPROC)eglGetProcAddress("glGenQueriesEXT");
+    timing->delete_queries = (PFNGLDELETEQUERIESEXTPROC)eglGetProcAddress("glDeleteQueriesEXT");
+    timing->begin_query = (PFNGLBEGINQUERYEXTPROC)eglGetProcAddress("glBeginQueryEXT");
+    timing->end_query = (PFNGLENDQUERYEXTPROC)eglGetProcAddress("glEndQueryEXT");
+    timing->get_query_uiv = (PFNGLGETQUERYOBJECTUIVEXTPROC)eglGetProcAddress("glGetQueryObjectuivEXT");
+    timing->get_query_ui64v = (PFNGLGETQUERYOBJECTUI64VEXTPROC)eglGetProcAddress("glGetQueryObjectui64vEXT");
+    if (!timing->gen_queries || !timing->delete_queries || !timing->begin_query ||
+        !timing->end_query || !timing->get_query_uiv || !timing->get_query_ui64v) {
+        timing->gen_queries = NULL;
+        return;
+    }
+    timing->gen_queries(LOCUS_TIMING_QUERIES, timing->queries);
+}
+
+/* Results come in a frame or two later; a disjoint event (clock change,
+ * GPU reset) makes every result in flight meaningless. */
+static void collect_gpu(LocusTiming *timing) {
+    int disjoint = -1;
+
+    for (int i = 0; i < LOCUS_TIMING_QUERIES; i++) {
+        if (!timing->query_frames[i]) {
+            continue;
+        }
+        GLuint available = 0;
+        timing->get_query_uiv(timing->queries[i], GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+        if (!available) {
+            continue;
+        }
+        if (disjoint < 0) {
+            GLint value = 0;
+            glGetIntegerv(GL_GPU_DISJOINT_EXT, &value);
+            disjoint = value != 0;
+        }
+        if (!disjoint) {
+            GLuint64 elapsed = 0;
+            timing->get_query_ui64v(timing->queries[i], GL_QUERY_RESULT_EXT, &elapsed);
+            set_phase(timing, timing->query_frames[i], LOCUS_TIMING_GPU, elapsed);
+        }
+        timing->query_frames[i] = 0;
+    }
+}
+
+void locus_timing_begin(LocusSurface *surface, const LocusFrameDamage *damage, LocusFrameTiming *frame) {
+    Locus *app = surface->app;
+    LocusTiming *timing = app->timing;
+
+    memset(frame, 0, sizeof(*frame));
+    if (!timing) {
+        return;
+    }
+
+    pthread_mutex_lock(&timing->lock);
+    frame->frame = ++timing->frame_count;
+    pthread_mutex_unlock(&timing->lock);
+    frame->start = locus_now_ns();
+    frame->phase[LOCUS_TIMING_DISPATCH] = damage->dispatch_ns;
+
+    if (app->backend != LOCUS_BACKEND_EGL) {
+        return;
+    }
+    if (!timing->gpu_checked) {
+        init_gpu(timing);
+    }
+    if (!timing->gen_queries) {
+        return;
+    }
+    collect_gpu(timing);
+    for (int i = 0; i < LOCUS_TIMING_QUERIES; i++) {
+        if (!timing->query_frames[i]) {
+            timing->begin_query(GL_TIME_ELAPSED_EXT, timing->queries[i]);
+            timing->query_frames[i] = frame->frame;
+            timing->query_active = 1;
+            break;
+        }
+    }
+}
+
+static void feedback_sync_output(void *data, struct wp_presentation_feedback *feedback,
+                                 struct wl_output *output) {
+}
+
+static void feedback_presented(void *data, struct wp_presentation_feedback *feedback,
+                               uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+                               uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags) {
+    LocusFeedback *slot = data;
+    LocusTiming *timing = slot->app->timing;
+    uint64_t presented = (((uint64_t)tv_sec_hi << 32) | tv_sec_lo) * 1000000000ULL + tv_nsec;
+
+    if (slot->app->presentation_clock != CLOCK_MONOTONIC) {
+        struct timespec ts;
+        clock_gettime(slot->app->presentation_clock, &ts);
+        uint64_t now = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        presented = presented - now + locus_now_ns();
+    }
+
+    pthread_mutex_lock(&timing->lock);
+    LocusFrameTiming *entry = find_frame(timing, slot->frame);
+    if (entry) {
+        uint64_t swapped = entry->start + entry->phase[LOCUS_TIMING_TOTAL] -
+                           entry->phase[LOCUS_TIMING_DISPATCH];
+        entry->phase[LOCUS_TIMING_PRESENT] = presented > swapped ? presented - swapped : 0;
+        entry->presented = 1;
+    }
+    pthread_mutex_unlock(&timing->lock);
+
+    wp_presentation_feedback_destroy(feedback);
+    slot->feedback = NULL;
+}
+
+static void feedback_discarded(void *data, struct wp_presentation_feedback *feedback) {
+    LocusFeedback *slot = data;
+    LocusTiming *timing = slot->app->timing;
+
+    pthread_mutex_lock(&timing->lock);
+    LocusFrameTiming *entry = find_frame(timing, slot->frame);
+    if (entry) {
+        entry->presented = -1;
+    }
+    pthread_mutex_unlock(&timing->lock);
+
+    wp_presentation_feedback_destroy(feedback);
+    slot->feedback = NULL;
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+    .sync_output = feedback_sync_output,
+    .presented = feedback_presented,
+    .discarded = feedback_discarded,
+};
+
+static void request_feedback(LocusSurface *surface, uint64_t frame, struct wl_event_queue *queue) {
+    Locus *app = surface->app;
+    LocusFeedback *slot = NULL;
+
+    for (int i = 0; i < LOCUS_TIMING_FEEDBACK && !slot; i++) {
+        if (!app->timing->feedback[i].feedback) {
+            slot = &app->timing->feedback[i];
+        }
+    }
+    if (!slot) {
+        return;
+    }
+
+    struct wp_presentation *presentation = app->presentation;
+    if (queue) {
+        presentation = wl_proxy_create_wrapper(app->presentation);
+        wl_proxy_set_queue((struct wl_proxy *)presentation, queue);
+    }
+    slot->app = app;
+    slot->frame = frame;
+    slot->feedback = wp_presentation_feedback(presentation, surface->surface);
+    wp_presentation_feedback_add_listener(slot->feedback, &feedback_listener, slot);
+    if (queue) {
+        wl_proxy_wrapper_destroy(presentation);
+    }
+}
+
+/* Called between drawing and the swap, while the feedback request can
+ * still go with the commit. */
+void locus_timing_draw_done(LocusSurface *surface, LocusFrameTiming *frame, struct wl_event_queue *queue) {
+    LocusTiming *timing = surface->app->timing;
+    if (!frame->frame) {
+        return;
+    }
+
+    frame->phase[LOCUS_TIMING_DRAW] = locus_now_ns() - frame->start;
+    if (timing->query_active) {
+        timing->end_query(GL_TIME_ELAPSED_EXT);
+        timing->query_active = 0;
+    }
+    if (surface->app->presentation) {
+        request_feedback(surface, frame->frame, queue);
+    }
+}
+
+void locus_timing_end(LocusSurface *surface, LocusFrameTiming *frame) {
+    LocusTiming *timing = surface->app->timing;
+    if (!surface->app->startup[LOCUS_STARTUP_FIRST_FRAME]) {
+        locus_startup_mark(surface->app, LOCUS_STARTUP_FIRST_FRAME);
+    }
+    if (!frame->frame) {
+        return;
+    }
+
+    uint64_t elapsed = locus_now_ns() - frame->start;
+    frame->phase[LOCUS_TIMING_SWAP] = elapsed - frame->phase[LOCUS_TIMING_DRAW];
+    frame->phase[LOCUS_TIMING_TOTAL] = frame->phase[LOCUS_TIMING_DISPATCH] + elapsed;
+
+    pthread_mutex_lock(&timing->lock);
+    LocusFrameTiming *entry = &timing->frames[frame->frame % LOCUS_TIMING_FRAMES];
+    uint64_t gpu = entry->frame == frame->frame ? entry->phase[LOCUS_TIMING_GPU] : 0;
+    *entry = *frame;
+    entry->phase[LOCUS_TIMING_GPU] = gpu;
+    pthread_mutex_unlock(&timing->lock);
+}
+
+/* The breakdown is printed once the first frame is out when timing is on. */
+void locus_startup_mark(Locus *app, LocusStartupPhase phase) {
+    app->startup[phase] = locus_now_ns() - app->startup_ns;
+    if (phase == LOCUS_STARTUP_FIRST_FRAME && app->timing) {
+        locus_startup_report(app, stderr);
+    }
+}
+
+void locus_startup_report(Locus *app, FILE *out) {
+    static const char *names[LOCUS_STARTUP_PHASES] = {
+        "connect", "egl", "registry", "outputs", "first frame",
+    };
+    uint64_t last = 0;
+
+    fprintf(out, "locus startup:");
+    for (int i = 0; i < LOCUS_STARTUP_PHASES; i++) {
+        if (app->startup[i]) {
+            fprintf(out, " %s %.2fms", names[i], (app->startup[i] - last) / 1e6);
+            last = app->startup[i];
+        }
+    }
+    fprintf(out, ", total %.2fms\n", last / 1e6);
+}
+
+/* Drops the feedback objects in flight, whose events may be routed to a
+ * queue that is about to go away. */
+void locus_timing_release(Locus *app) {
+    if (!app->timing) {
+        return;
+    }
+    for (int i = 0; i < LOCUS_TIMING_FEEDBACK; i++) {
+        if (app->timing->feedback[i].feedback) {
+            wp_presentation_feedback_destroy(app->timing->feedback[i].feedback);
+            app->timing->feedback[i].feedback = NULL;
+        }
+    }
+}
+
+/* Copies up to max completed frames, oldest first. */
+int locus_timing_frames(Locus *app, LocusFrameTiming *frames, int max) {
+    LocusTiming *timing = app->timing;
+    int count = 0;
+    if (!timing) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&timing->lock);
+    uint64_t last = timing->frame_count;
+    uint64_t first = last > (uint64_t)max ? last - max + 1 : 1;
+    if (last >= LOCUS_TIMING_FRAMES && first <= last - LOCUS_TIMING_FRAMES) {
+        first = last - LOCUS_TIMING_FRAMES + 1;
+    }
+    for (uint64_t i = first; i <= last && count < max; i++) {
+        LocusFrameTiming *entry = find_frame(timing, i);
+        if (entry && entry->phase[LOCUS_TIMING_TOTAL]) {
+            frames[count++] = *entry;
+        }
+    }
+    pthread_mutex_unlock(&timing->lock);
+    return count;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Percentiles over the frames in the ring that have the phase measured. */
+int locus_timing_stats(Locus *app, LocusTimingPhase phase, LocusTimingStats *stats) {
+    LocusFrameTiming frames[LOCUS_TIMING_FRAMES];
+    uint64_t values[LOCUS_TIMING_FRAMES];
+    int count = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    int n = locus_timing_frames(app, frames, LOCUS_TIMING_FRAMES);
+    for (int i = 0; i < n; i++) {
+        if (frames[i].phase[phase]) {
+            values[count++] = frames[i].phase[phase];
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    qsort(values, count, sizeof(values[0]), compare_u64);
+    stats->count = count;
+    stats->p50 = values[(count - 1) * 50 / 100];
+    stats->p99 = values[(count - 1) * 99 / 100];
+    stats->max = values[count - 1];
+    return count;
+}
+
+static void write_event(FILE *file, int *first, const char *name, int tid, uint64_t ts, uint64_t dur,
+                        uint64_t frame) {
+    if (!dur) {
+        return;
+    }
+    fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+            "\"args\":{\"frame\":%llu}}",
+            *first ? "" : ",", name, tid, ts / 1000.0, dur / 1000.0, (unsigned long long)frame);
+    *first = 0;
+}
+
+/* Writes the frames in the ring in the Chrome trace event format, for
+ * chrome://tracing or Perfetto. Dispatch is shown as ending where the
+ * frame starts and GPU work as starting with the draw. */
+int locus_timing_write_trace(Locus *app, const char *path) {
+    LocusFrameTiming frames[LOCUS_TIMING_FRAMES];
+    static const char *threads[] = { "main", "render", "gpu", "display" };
+    int n = locus_timing_frames(app, frames, LOCUS_TIMING_FRAMES);
+    int first = 1;
+
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open trace file %s\n", path);
+        return 0;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (int i = 0; i < 4; i++) {
+        fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", i + 1, threads[i]);
+        first = 0;
+    }
+    for (int i = 0; i < n; i++) {
+        const LocusFrameTiming *f = &frames[i];
+        const uint64_t *p = f->phase;
+        uint64_t swapped = f->start + p[LOCUS_TIMING_TOTAL] - p[LOCUS_TIMING_DISPATCH];
+        write_event(file, &first, "dispatch", 1, f->start - p[LOCUS_TIMING_DISPATCH],
+                    p[LOCUS_TIMING_DISPATCH], f->frame);
+        write_event(file, &first, "draw", 2, f->start, p[LOCUS_TIMING_DRAW], f->frame);
+        write_event(file, &first, "swap", 2, swapped - p[LOCUS_TIMING_SWAP], p[LOCUS_TIMING_SWAP], f->frame);
+        write_event(file, &first, "gpu", 3, f->start, p[LOCUS_TIMING_GPU], f->frame);
+        write_event(file, &first, "present", 4, swapped, p[LOCUS_TIMING_PRESENT], f->frame);
+    }
+    fprintf(file, "\n]}\n");
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Failed to write trace file %s\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+/* Needs the GL context current, like the rest of locus_cleanup(). */
+void locus_timing_cleanup(Locus *app) {
+    LocusTiming *timing = app->timing;
+    if (!timing) {
+        return;
+    }
+
+    const char *trace = getenv("LOCUS_TRACE");
+    if (trace && *trace) {
+        locus_timing_write_trace(app, trace);
+    }
+
+    locus_timing_release(app);
+    if (timing->gen_queries && app->egl_context) {
+        if (timing->query_active) {
+            timing->end_query(GL_TIME_ELAPSED_EXT);
+        }
+        timing->delete_queries(LOCUS_TIMING_QUERIES, timing->queries);
+    }
+    pthread_mutex_destroy(&timing->lock);
+    free(timing);
+    app->timing = NULL;
+}
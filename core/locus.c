@@ -1,8 +1,11 @@
-#include "locus.h"
+#include "locus-private.h"
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
+#include <errno.h>
+#include <math.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,53 +22,39 @@ static const struct xdg_wm_base_listener xdg_wm_base_listener = {
     .ping = handle_ping,
 };
 
-static void handle_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial) {
-    Locus *app = data;
-    xdg_surface_ack_configure(xdg_surface, serial);
-    app->configured = 1;
-    if (app->egl_surface) {
-        app->redraw = 1;
+static LocusTouchPoint *touch_point(Locus *app, int32_t id, int create) {
+    LocusTouchFrame *frame = &app->touch_frame;
+    for (int i = 0; i < frame->count; i++) {
+        if (frame->points[i].id == id && frame->points[i].active) {
+            return &frame->points[i];
+        }
     }
-}
 
-static void handle_xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
-                                          int32_t width, int32_t height, struct wl_array *states) {
-    Locus *app = data;
-    if (width > 0 && height > 0) {
-        if (app->egl_window) {
-            app->redraw = 1;
-        }
+    if (!create || frame->count == LOCUS_MAX_TOUCH_POINTS) {
+        return NULL;
     }
-}
 
-static void handle_xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel) {
-    Locus *app = data;
-    app->xdg_toplevel = NULL;
-    wl_egl_window_destroy(app->egl_window);
-    app->running = 0;
+    LocusTouchPoint *point = &frame->points[frame->count++];
+    memset(point, 0, sizeof(*point));
+    point->id = id;
+    point->state = LOCUS_TOUCH_NONE;
+    return point;
 }
 
-static void handle_geometry(void *data, struct wl_output *output,
-                            int32_t x, int32_t y, int32_t physical_width,
-                            int32_t physical_height, int32_t subpixel,
-                            const char *make, const char *model,
-                            int32_t transform) {
-}
+static void record_sample(LocusTouchPoint *point, uint32_t time, double x, double y) {
+    LocusTouchSample sample = { time, x, y };
 
-static void handle_mode(void *data, struct wl_output *output,
-                        uint32_t flags, int32_t width, int32_t height,
-                        int32_t refresh) {
-    Locus *app = data;
-    if (flags & WL_OUTPUT_MODE_CURRENT) {
-        app->screen_width = width;
-        app->screen_height = height;
+    if (point->history_count == LOCUS_TOUCH_HISTORY) {
+        memmove(point->history, point->history + 1, (LOCUS_TOUCH_HISTORY - 1) * sizeof(sample));
+        point->history_count--;
     }
-}
-
-static void handle_done(void *data, struct wl_output *output) {
-}
+    point->history[point->history_count++] = sample;
 
-static void handle_scale(void *data, struct wl_output *output, int32_t factor) {
+    point->recent[point->recent_head] = sample;
+    point->recent_head = (point->recent_head + 1) % LOCUS_VELOCITY_SAMPLES;
+    if (point->recent_count < LOCUS_VELOCITY_SAMPLES) {
+        point->recent_count++;
+    }
 }
 
 static void touch_handle_down(void *data, struct wl_touch *wl_touch,
@@ -73,49 +62,198 @@ static void touch_handle_down(void *data, struct wl_touch *wl_touch,
                               struct wl_surface *surface, int32_t id,
                               wl_fixed_t x, wl_fixed_t y) {
     Locus *app = data;
-    double touch_x = wl_fixed_to_double(x);
-    double touch_y = wl_fixed_to_double(y);
-
-    app->active_touches++;
+    LocusTouchPoint *point = touch_point(app, id, 1);
+    if (!point) {
+        return;
+    }
 
-    if(app->active_touches == 1 && app->touch_callback) {
-        app->touch_callback(id, touch_x, touch_y, 0);
+    point->active = 1;
+    point->surface = NULL;
+    for (int i = 0; i < app->surface_count; i++) {
+        if (app->surfaces[i]->surface == surface) {
+            point->surface = app->surfaces[i];
+        }
     }
+    point->state = LOCUS_TOUCH_DOWN;
+    point->x = point->start_x = wl_fixed_to_double(x);
+    point->y = point->start_y = wl_fixed_to_double(y);
+    point->down_time = point->time = time;
+    point->received = (uint32_t)locus_now_ms();
+    record_sample(point, time, point->x, point->y);
+    app->touch_frame.time = time;
+    app->touch_dirty = 1;
 }
 
 static void touch_handle_up(void *data, struct wl_touch *wl_touch,
                             uint32_t serial, uint32_t time, int32_t id) {
     Locus *app = data;
-    
-    if (app->active_touches > 0) {
-        app->active_touches--;
+    LocusTouchPoint *point = touch_point(app, id, 0);
+    if (!point) {
+        return;
     }
 
-    if(app->active_touches == 0 && app->touch_callback) {
-        app->touch_callback(id, 0, 0, 1);
-    }
+    point->state = LOCUS_TOUCH_UP;
+    point->time = time;
+    point->received = (uint32_t)locus_now_ms();
+    app->touch_frame.time = time;
+    app->touch_dirty = 1;
 }
 
 static void touch_handle_motion(void *data, struct wl_touch *wl_touch,
                                 uint32_t time, int32_t id, wl_fixed_t x,
                                 wl_fixed_t y) {
     Locus *app = data;
-    double touch_x = wl_fixed_to_double(x);
-    double touch_y = wl_fixed_to_double(y);
-    if(app->active_touches == 1 && app->touch_callback) {
-        app->touch_callback(id, touch_x, touch_y, 2);
+    LocusTouchPoint *point = touch_point(app, id, 0);
+    if (!point) {
+        return;
+    }
+
+    point->x = wl_fixed_to_double(x);
+    point->y = wl_fixed_to_double(y);
+    point->time = time;
+    point->received = (uint32_t)locus_now_ms();
+    record_sample(point, time, point->x, point->y);
+    if (point->state == LOCUS_TOUCH_NONE) {
+        point->state = LOCUS_TOUCH_MOTION;
+    }
+    app->touch_frame.time = time;
+    app->touch_dirty = 1;
+}
+
+/* Reproduces the single-finger callback contract of touch_callback from a
+ * batched frame: down for the first finger, motion while exactly one finger
+ * is down, up when the last finger lifts. */
+static void deliver_legacy_touch(Locus *app, const LocusTouchFrame *frame) {
+    for (int i = 0; i < frame->count; i++) {
+        const LocusTouchPoint *point = &frame->points[i];
+        if (point->state == LOCUS_TOUCH_DOWN) {
+            app->active_touches++;
+            if (app->active_touches == 1) {
+                app->touch_callback(point->id, point->x, point->y, LOCUS_TOUCH_DOWN);
+            }
+        }
+    }
+
+    for (int i = 0; i < frame->count; i++) {
+        const LocusTouchPoint *point = &frame->points[i];
+        if (point->state == LOCUS_TOUCH_MOTION && app->active_touches == 1) {
+            app->touch_callback(point->id, point->x, point->y, LOCUS_TOUCH_MOTION);
+        }
+    }
+
+    for (int i = 0; i < frame->count; i++) {
+        const LocusTouchPoint *point = &frame->points[i];
+        if (point->state == LOCUS_TOUCH_UP) {
+            if (app->active_touches > 0) {
+                app->active_touches--;
+            }
+            if (app->active_touches == 0) {
+                app->touch_callback(point->id, 0, 0, LOCUS_TOUCH_UP);
+            }
+        }
     }
 }
 
+static void deliver_touch_frame(Locus *app) {
+    LocusTouchFrame *frame = &app->touch_frame;
+
+    frame->active = 0;
+    for (int i = 0; i < frame->count; i++) {
+        frame->active += frame->points[i].state != LOCUS_TOUCH_UP;
+    }
+
+    if (app->touch_callback) {
+        deliver_legacy_touch(app, frame);
+    }
+    if (app->touch_frame_callback) {
+        app->touch_frame_callback(app, frame, app->touch_frame_data);
+    }
+    locus_gesture_process(app, frame);
+
+    int n = 0;
+    for (int i = 0; i < frame->count; i++) {
+        if (frame->points[i].state != LOCUS_TOUCH_UP) {
+            frame->points[i].state = LOCUS_TOUCH_NONE;
+            frame->points[i].history_count = 0;
+            frame->points[n++] = frame->points[i];
+        }
+    }
+    frame->count = n;
+    app->touch_dirty = 0;
+    app->touch_pending = 0;
+}
+
+/* Frames that only carry motion are held until the next repaint so that
+ * several digitizer reports per display frame reach the app as one update;
+ * down and up are delivered immediately along with any held motion. */
 static void touch_handle_frame(void *data, struct wl_touch *wl_touch) {
+    Locus *app = data;
+    LocusTouchFrame *frame = &app->touch_frame;
+    if (!app->touch_dirty) {
+        return;
+    }
+
+    if (app->touch_coalesce) {
+        int motion_only = 1;
+        for (int i = 0; i < frame->count; i++) {
+            int state = frame->points[i].state;
+            if (state != LOCUS_TOUCH_MOTION && state != LOCUS_TOUCH_NONE) {
+                motion_only = 0;
+            }
+        }
+        if (motion_only) {
+            app->touch_pending = 1;
+            locus_schedule_frame(app);
+            for (int i = 0; i < frame->count; i++) {
+                if (frame->points[i].surface) {
+                    locus_surface_schedule_frame(frame->points[i].surface);
+                }
+            }
+            return;
+        }
+    }
+
+    deliver_touch_frame(app);
+}
+
+void locus_flush_touch(Locus *app) {
+    if (app->touch_pending) {
+        deliver_touch_frame(app);
+    }
 }
 
 static void touch_handle_cancel(void *data, struct wl_touch *wl_touch) {
     Locus *app = data;
+    LocusTouchFrame *frame = &app->touch_frame;
+
     app->active_touches = 0;
+    for (int i = 0; i < frame->count; i++) {
+        frame->points[i].state = LOCUS_TOUCH_CANCEL;
+        frame->points[i].active = 0;
+    }
+    frame->active = 0;
+    frame->cancelled = 1;
+
     if (app->touch_callback) {
-        app->touch_callback(-1, 0, 0, 3);
+        app->touch_callback(-1, 0, 0, LOCUS_TOUCH_CANCEL);
     }
+    if (app->touch_frame_callback) {
+        app->touch_frame_callback(app, frame, app->touch_frame_data);
+    }
+    locus_gesture_reset(app);
+
+    frame->count = 0;
+    frame->cancelled = 0;
+    app->touch_dirty = 0;
+    app->touch_pending = 0;
+}
+
+static void touch_handle_shape(void *data, struct wl_touch *wl_touch,
+                               int32_t id, wl_fixed_t major, wl_fixed_t minor) {
+}
+
+static void touch_handle_orientation(void *data, struct wl_touch *wl_touch,
+                                     int32_t id, wl_fixed_t orientation) {
 }
 
 static const struct wl_touch_listener touch_listener = {
@@ -124,6 +262,8 @@ static const struct wl_touch_listener touch_listener = {
     .motion = touch_handle_motion,
     .frame = touch_handle_frame,
     .cancel = touch_handle_cancel,
+    .shape = touch_handle_shape,
+    .orientation = touch_handle_orientation,
 };
 
 static void handle_seat_capabilities(void *data, struct wl_seat *seat, 
@@ -140,61 +280,26 @@ static void handle_seat_name(void *data, struct wl_seat *seat,
                              const char *name) {
 }
 
-static const struct wl_output_listener output_listener = {
-    .geometry = handle_geometry,
-    .mode = handle_mode,
-    .done = handle_done,
-    .scale = handle_scale,
-};
-
 static const struct wl_seat_listener seat_listener = {
     .capabilities = handle_seat_capabilities,
     .name = handle_seat_name,
 };
 
-static void handle_layer_surface_configure(void *data, 
-                                           struct zwlr_layer_surface_v1 *layer_surface,
-                                           uint32_t serial, uint32_t width, uint32_t height) {
+static void handle_presentation_clock(void *data, struct wp_presentation *presentation, uint32_t clk_id) {
     Locus *app = data;
-    zwlr_layer_surface_v1_ack_configure(layer_surface, serial);
-
-    if (width > 0 && height > 0) {
-        if (app->egl_window) {
-            app->redraw = 1;
-        }
-    }
-    app->configured = 1;
-    wl_display_roundtrip(app->display);
-    wl_surface_commit(app->surface);
-}
-
-static void handle_layer_surface_closed(void *data,
-                                        struct zwlr_layer_surface_v1 *layer_surface) {
-    Locus *app = data;
-    app->layer_surface = NULL;
-    wl_egl_window_destroy(app->egl_window);
-    app->running = 0;
+    app->presentation_clock = (clockid_t)clk_id;
 }
 
-static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
-    .configure = handle_layer_surface_configure,
-    .closed = handle_layer_surface_closed,
-};
-
-static const struct xdg_toplevel_listener xdg_toplevel_listener = {
-    .configure = handle_xdg_toplevel_configure,
-    .close = handle_xdg_toplevel_close,
-};
-
-static const struct xdg_surface_listener xdg_surface_listener = {
-    .configure = handle_configure,
+static const struct wp_presentation_listener presentation_listener = {
+    .clock_id = handle_presentation_clock,
 };
 
-static void init_egl(Locus *app) {
-    EGLint major, minor, count, n;
-    EGLConfig *configs;
+/* surface_type is EGL_WINDOW_BIT for Wayland surfaces and EGL_PBUFFER_BIT
+ * for the headless mode. */
+int locus_egl_init(Locus *app, EGLenum platform, void *native_display, EGLint surface_type) {
+    EGLint major, minor, n;
     EGLint config_attribs[] = {
-        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+        EGL_SURFACE_TYPE, surface_type,
         EGL_RED_SIZE, 8,
         EGL_GREEN_SIZE, 8,
         EGL_BLUE_SIZE, 8,
@@ -212,21 +317,46 @@ static void init_egl(Locus *app) {
         (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
 
     if (get_platform_display) {
-        app->egl_display = get_platform_display(EGL_PLATFORM_WAYLAND_EXT, app->display, NULL);
+        app->egl_display = get_platform_display(platform, native_display, NULL);
     } else {
-        app->egl_display = eglGetDisplay((EGLNativeDisplayType)app->display);
+        app->egl_display = eglGetDisplay((EGLNativeDisplayType)native_display);
     }
 
-    eglInitialize(app->egl_display, &major, &minor);
-    eglGetConfigs(app->egl_display, NULL, 0, &count);
-    configs = calloc(count, sizeof *configs);
-
-    eglChooseConfig(app->egl_display, config_attribs, configs, count, &n);
-    app->egl_config = configs[0];
+    if (app->egl_display == EGL_NO_DISPLAY || !eglInitialize(app->egl_display, &major, &minor)) {
+        fprintf(stderr, "Failed to initialize EGL\n");
+        app->egl_display = NULL;
+        return 0;
+    }
+    /* eglChooseConfig sorts its matches, so only the best one is asked for. */
+    if (!eglChooseConfig(app->egl_display, config_attribs, &app->egl_config, 1, &n) || n == 0) {
+        fprintf(stderr, "No suitable EGL config\n");
+        eglTerminate(app->egl_display);
+        app->egl_display = NULL;
+        return 0;
+    }
 
     app->egl_context = eglCreateContext(app->egl_display, app->egl_config, 
                                         EGL_NO_CONTEXT, context_attribs);
-    free(configs);
+    if (app->egl_context == EGL_NO_CONTEXT) {
+        fprintf(stderr, "Failed to create EGL context\n");
+        eglTerminate(app->egl_display);
+        app->egl_display = NULL;
+        app->egl_context = NULL;
+        return 0;
+    }
+
+    const char *extensions = eglQueryString(app->egl_display, EGL_EXTENSIONS);
+    if (extensions) {
+        app->has_buffer_age = strstr(extensions, "EGL_EXT_buffer_age") != NULL;
+        if (strstr(extensions, "EGL_KHR_swap_buffers_with_damage")) {
+            app->swap_buffers_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+                eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+        } else if (strstr(extensions, "EGL_EXT_swap_buffers_with_damage")) {
+            app->swap_buffers_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+                eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+        }
+    }
+    return 1;
 }
 
 static void registry_global(void *data, struct wl_registry *registry,
@@ -234,10 +364,25 @@ static void registry_global(void *data, struct wl_registry *registry,
     Locus *app = data;
 
     if (strcmp(interface, wl_compositor_interface.name) == 0) {
-        app->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 1);
+        app->compositor_version = version < 4 ? version : 4;
+        app->compositor = wl_registry_bind(registry, name, &wl_compositor_interface,
+                                           app->compositor_version);
+#ifdef WITH_WAYLAND_SHM
+    } else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        app->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+#endif
     } else if (strcmp(interface, wl_output_interface.name) == 0) {
-        app->output= wl_registry_bind(registry, name, &wl_output_interface, 2);
-        wl_output_add_listener(app->output, &output_listener, app);
+        locus_output_bind(app, registry, name, version);
+    } else if (strcmp(interface, wp_fractional_scale_manager_v1_interface.name) == 0) {
+        app->fractional_scale_manager = wl_registry_bind(registry, name,
+                                                         &wp_fractional_scale_manager_v1_interface, 1);
+    } else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+        app->subcompositor = wl_registry_bind(registry, name, &wl_subcompositor_interface, 1);
+    } else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+        app->viewporter = wl_registry_bind(registry, name, &wp_viewporter_interface, 1);
+    } else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+        app->presentation = wl_registry_bind(registry, name, &wp_presentation_interface, 1);
+        wp_presentation_add_listener(app->presentation, &presentation_listener, app);
     } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
         app->xdg_wm_base = wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
         xdg_wm_base_add_listener(app->xdg_wm_base, &xdg_wm_base_listener, app);
@@ -250,7 +395,8 @@ static void registry_global(void *data, struct wl_registry *registry,
 }
 
 static void registry_global_remove(void *data, struct wl_registry *registry, uint32_t name) {
-
+    Locus *app = data;
+    locus_output_remove(app, name);
 }
 
 static const struct wl_registry_listener registry_listener = {
@@ -258,19 +404,73 @@ static const struct wl_registry_listener registry_listener = {
     .global_remove = registry_global_remove,
 };
 
+/* LOCUS_BACKEND_AUTO honours $LOCUS_BACKEND ("egl" or "shm") and falls
+ * back to wl_shm when EGL cannot be brought up. */
+LocusBackend locus_resolve_backend(LocusBackend backend) {
+    const char *env = getenv("LOCUS_BACKEND");
+    if (backend == LOCUS_BACKEND_AUTO && env) {
+        backend = strcmp(env, "shm") == 0 ? LOCUS_BACKEND_SHM : LOCUS_BACKEND_EGL;
+    }
+    return backend;
+}
+
+static int init_shm(Locus *app) {
+#ifdef WITH_WAYLAND_SHM
+    if (!app->shm) {
+        fprintf(stderr, "wl_shm not available\n");
+        return 0;
+    }
+    app->backend = LOCUS_BACKEND_SHM;
+    return 1;
+#else
+    fprintf(stderr, "Built without wl_shm support\n");
+    return 0;
+#endif
+}
+
 int locus_init(Locus *app, int width_percent, int height_percent) {
+    return locus_init_backend(app, width_percent, height_percent, LOCUS_BACKEND_AUTO);
+}
+
+int locus_init_backend(Locus *app, int width_percent, int height_percent, LocusBackend backend) {
     memset(app, 0, sizeof(Locus));
+    app->startup_ns = locus_now_ns();
     app->running = 1;
+    app->touch_coalesce = 1;
+    app->render_wake_fd = -1;
+    app->main_wake_fd = -1;
+    app->presentation_clock = CLOCK_MONOTONIC;
+    locus_gesture_init(app);
+    if (getenv("LOCUS_TIMING") || getenv("LOCUS_TRACE")) {
+        locus_set_timing(app, 1);
+    }
 
     app->display = wl_display_connect(NULL);
     if (!app->display) {
         fprintf(stderr, "Failed to connect to Wayland display\n");
         return 0;
     }
+    locus_startup_mark(app, LOCUS_STARTUP_CONNECT);
 
     app->registry = wl_display_get_registry(app->display);
     wl_registry_add_listener(app->registry, &registry_listener, app);
+    wl_display_flush(app->display);
+
+    /* EGL only needs the connection, so it comes up while the compositor
+     * answers the registry request; EGL keeps its own roundtrips on a
+     * private queue. */
+    backend = locus_resolve_backend(backend);
+    if (backend != LOCUS_BACKEND_SHM) {
+        if (locus_egl_init(app, EGL_PLATFORM_WAYLAND_EXT, app->display, EGL_WINDOW_BIT)) {
+            app->backend = LOCUS_BACKEND_EGL;
+        } else if (backend == LOCUS_BACKEND_EGL) {
+            return 0;
+        }
+        locus_startup_mark(app, LOCUS_STARTUP_EGL);
+    }
+
     wl_display_roundtrip(app->display);
+    locus_startup_mark(app, LOCUS_STARTUP_REGISTRY);
 
     if (!app->compositor || !app->xdg_wm_base) {
         fprintf(stderr, "Failed to bind Wayland interfaces\n");
@@ -282,6 +482,7 @@ int locus_init(Locus *app, int width_percent, int height_percent) {
         return 0;
     }
     wl_display_roundtrip(app->display);
+    locus_startup_mark(app, LOCUS_STARTUP_OUTPUTS);
     if (app->screen_width == 0 || app->screen_height == 0) {
         fprintf(stderr, "Failed to retrieve dimensions\n");
         return 0;
@@ -289,113 +490,441 @@ int locus_init(Locus *app, int width_percent, int height_percent) {
     app->width = (app->screen_width * width_percent) / 100;
     app->height = (app->screen_height * height_percent) / 100;
 
-    init_egl(app);
+    return app->egl_context ? 1 : init_shm(app);
+}
+
+void locus_set_draw_callback(Locus *app, void (*draw_callback)(void *data)) {
+    app->draw_callback = draw_callback;
+}
+
+void locus_set_touch_callback(Locus *app,
+                              void (*touch_callback)(int32_t id, double x,
+                                                     double y, int32_t state)) {
+    app->touch_callback = touch_callback;
+}
+
+uint64_t locus_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int locus_add_fd(Locus *app, int fd, short events,
+                 void (*callback)(Locus *app, int fd, short revents, void *data), void *data) {
+    if (app->watch_count == app->watch_capacity) {
+        int capacity = app->watch_capacity ? app->watch_capacity * 2 : 4;
+        LocusWatch *watches = realloc(app->watches, capacity * sizeof *watches);
+        if (!watches) {
+            fprintf(stderr, "Failed to allocate fd watch\n");
+            return 0;
+        }
+        app->watches = watches;
+        app->watch_capacity = capacity;
+    }
+
+    LocusWatch *watch = &app->watches[app->watch_count++];
+    watch->fd = fd;
+    watch->events = events;
+    watch->callback = callback;
+    watch->data = data;
     return 1;
 }
 
-void locus_create_window(Locus *app, const char *title) {
-    app->surface = wl_compositor_create_surface(app->compositor);
-    app->xdg_surface = xdg_wm_base_get_xdg_surface(app->xdg_wm_base, app->surface);
-    xdg_surface_add_listener(app->xdg_surface, &xdg_surface_listener, app);
-    app->xdg_toplevel = xdg_surface_get_toplevel(app->xdg_surface);
-    xdg_toplevel_add_listener(app->xdg_toplevel, &xdg_toplevel_listener, app);
+void locus_remove_fd(Locus *app, int fd) {
+    for (int i = 0; i < app->watch_count; i++) {
+        if (app->watches[i].fd == fd) {
+            app->watches[i].fd = -1;
+        }
+    }
+}
 
-    xdg_toplevel_set_title(app->xdg_toplevel, title);
+int locus_add_timer(Locus *app, uint32_t interval_ms, int repeat,
+                    void (*callback)(Locus *app, void *data), void *data) {
+    if (app->timer_count == app->timer_capacity) {
+        int capacity = app->timer_capacity ? app->timer_capacity * 2 : 4;
+        LocusTimer *timers = realloc(app->timers, capacity * sizeof *timers);
+        if (!timers) {
+            fprintf(stderr, "Failed to allocate timer\n");
+            return 0;
+        }
+        app->timers = timers;
+        app->timer_capacity = capacity;
+    }
 
-    app->egl_window = wl_egl_window_create(app->surface, app->width, app->height);
-    app->egl_surface = eglCreateWindowSurface(app->egl_display, app->egl_config, 
-                                              (EGLNativeWindowType)app->egl_window, NULL);
-    eglMakeCurrent(app->egl_display, app->egl_surface, app->egl_surface, app->egl_context);
+    LocusTimer *timer = &app->timers[app->timer_count++];
+    timer->id = ++app->next_timer_id;
+    timer->deadline = locus_now_ms() + interval_ms;
+    timer->interval = interval_ms;
+    timer->repeat = repeat;
+    timer->callback = callback;
+    timer->data = data;
+    return timer->id;
+}
+
+void locus_remove_timer(Locus *app, int id) {
+    for (int i = 0; i < app->timer_count; i++) {
+        if (app->timers[i].id == id) {
+            app->timers[i].id = 0;
+        }
+    }
+}
 
-    wl_surface_commit(app->surface);
+void locus_request_redraw(Locus *app) {
+    LocusSurface *surface = locus_target_surface(app);
+    if (surface) {
+        surface->redraw = 1;
+    }
 }
 
-void locus_create_layer_surface(Locus *app, const char *title, uint32_t layer, 
-                                uint32_t anchor, int exclusive) {
-    app->surface = wl_compositor_create_surface(app->compositor);
-    app->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
-        app->layer_shell, app->surface, NULL, layer, title);
+int locus_add_frame_hook(Locus *app, void (*callback)(Locus *app, uint32_t time, void *data),
+                         void *data) {
+    if (app->frame_hook_count == app->frame_hook_capacity) {
+        int capacity = app->frame_hook_capacity ? app->frame_hook_capacity * 2 : 4;
+        LocusFrameHook *hooks = realloc(app->frame_hooks, capacity * sizeof *hooks);
+        if (!hooks) {
+            fprintf(stderr, "Failed to allocate frame hook\n");
+            return 0;
+        }
+        app->frame_hooks = hooks;
+        app->frame_hook_capacity = capacity;
+    }
+
+    LocusFrameHook *hook = &app->frame_hooks[app->frame_hook_count++];
+    hook->id = ++app->next_timer_id;
+    hook->callback = callback;
+    hook->data = data;
+    return hook->id;
+}
 
-    zwlr_layer_surface_v1_set_size(app->layer_surface, app->width, app->height);
-    zwlr_layer_surface_v1_set_anchor(app->layer_surface, anchor);
-    if (exclusive) {
-        zwlr_layer_surface_v1_set_exclusive_zone(app->layer_surface, app->height);
+void locus_remove_frame_hook(Locus *app, int id) {
+    for (int i = 0; i < app->frame_hook_count; i++) {
+        if (app->frame_hooks[i].id == id) {
+            app->frame_hooks[i].id = 0;
+        }
     }
+}
 
-    zwlr_layer_surface_v1_add_listener(app->layer_surface, &layer_surface_listener, app);
+static void run_frame_hooks(Locus *app) {
+    uint32_t time = locus_next_frame_time(app);
+    int count = app->frame_hook_count;
 
-    app->egl_window = wl_egl_window_create(app->surface, app->width, app->height);
-    app->egl_surface = eglCreateWindowSurface(app->egl_display, app->egl_config, 
-                                              (EGLNativeWindowType)app->egl_window, NULL);
-    eglMakeCurrent(app->egl_display, app->egl_surface, app->egl_surface, app->egl_context);
+    for (int i = 0; i < count; i++) {
+        LocusFrameHook hook = app->frame_hooks[i];
+        if (hook.id) {
+            hook.callback(app, time, hook.data);
+        }
+    }
 
-    wl_surface_commit(app->surface);
+    int n = 0;
+    for (int i = 0; i < app->frame_hook_count; i++) {
+        if (app->frame_hooks[i].id) {
+            app->frame_hooks[n++] = app->frame_hooks[i];
+        }
+    }
+    app->frame_hook_count = n;
 }
 
-void locus_set_draw_callback(Locus *app, void (*draw_callback)(void *data)) {
-    app->draw_callback = draw_callback;
+uint32_t locus_frame_interval_us(Locus *app) {
+    LocusSurface *surface = locus_target_surface(app);
+    int32_t refresh = surface && surface->refresh > 0 ? surface->refresh : app->refresh;
+
+    if (refresh <= 0) {
+        return 16667;
+    }
+    return (uint32_t)(1000000000ULL / (uint32_t)refresh);
 }
 
-void locus_set_touch_callback(Locus *app,
-                              void (*touch_callback)(int32_t id, double x,
-                                                     double y, int32_t state)) {
-    app->touch_callback = touch_callback;
+uint32_t locus_next_frame_time(Locus *app) {
+    LocusSurface *surface = locus_target_surface(app);
+    uint32_t interval = locus_frame_interval_us(app) / 1000;
+    uint32_t now = (uint32_t)locus_now_ms();
+
+    if (!surface || !surface->frame_done) {
+        return now + interval;
+    }
+
+    uint32_t next = (uint32_t)surface->frame_done + interval;
+    while ((int32_t)(next - now) <= 0) {
+        next += interval;
+    }
+    return next;
+}
+
+static void compact_watches(Locus *app) {
+    int n = 0;
+    for (int i = 0; i < app->watch_count; i++) {
+        if (app->watches[i].fd >= 0) {
+            app->watches[n++] = app->watches[i];
+        }
+    }
+    app->watch_count = n;
+}
+
+static void compact_timers(Locus *app) {
+    int n = 0;
+    for (int i = 0; i < app->timer_count; i++) {
+        if (app->timers[i].id) {
+            app->timers[n++] = app->timers[i];
+        }
+    }
+    app->timer_count = n;
+}
+
+static int surface_wants_frame(LocusSurface *surface);
+
+static int next_timeout(Locus *app) {
+    uint64_t now = locus_now_ms();
+    uint64_t deadline = UINT64_MAX;
+    for (int i = 0; i < app->timer_count; i++) {
+        if (app->timers[i].id && app->timers[i].deadline < deadline) {
+            deadline = app->timers[i].deadline;
+        }
+    }
+
+    if (app->render_delay) {
+        for (int i = 0; i < app->surface_count; i++) {
+            LocusSurface *surface = app->surfaces[i];
+            uint64_t ready_at = __atomic_load_n(&surface->frame_done, __ATOMIC_ACQUIRE) + app->render_delay;
+            if (surface_wants_frame(surface) && ready_at < deadline) {
+                deadline = ready_at;
+            }
+        }
+    }
+
+    if (deadline == UINT64_MAX) {
+        return -1;
+    }
+    return deadline <= now ? 0 : (int)(deadline - now);
+}
+
+static void dispatch_timers(Locus *app) {
+    uint64_t now = locus_now_ms();
+    int count = app->timer_count;
+
+    for (int i = 0; i < count; i++) {
+        LocusTimer timer = app->timers[i];
+        if (!timer.id || timer.deadline > now) {
+            continue;
+        }
+
+        if (timer.repeat && timer.interval > 0) {
+            app->timers[i].deadline = now + timer.interval;
+        } else {
+            app->timers[i].id = 0;
+        }
+        timer.callback(app, timer.data);
+    }
+    compact_timers(app);
+}
+
+void locus_set_touch_frame_callback(Locus *app,
+                                    void (*callback)(Locus *app, const LocusTouchFrame *frame, void *data),
+                                    void *data) {
+    app->touch_frame_callback = callback;
+    app->touch_frame_data = data;
+}
+
+void locus_set_touch_coalescing(Locus *app, int enabled) {
+    app->touch_coalesce = enabled;
+    if (!enabled) {
+        locus_flush_touch(app);
+    }
+}
+
+void locus_set_gesture_callback(Locus *app,
+                                void (*callback)(Locus *app, const LocusGesture *gesture, void *data),
+                                void *data) {
+    app->gesture_callback = callback;
+    app->gesture_data = data;
+}
+
+static void take_redraw(Locus *app) {
+    if (!app->redraw) {
+        return;
+    }
+    for (int i = 0; i < app->surface_count; i++) {
+        app->surfaces[i]->redraw = 1;
+    }
+    app->redraw = 0;
+}
+
+static int surface_wants_frame(LocusSurface *surface) {
+    return (surface->redraw || surface->frame_requested ||
+            surface->damage_all || surface->damage_count) &&
+           !__atomic_load_n(&surface->frame_pending, __ATOMIC_ACQUIRE) &&
+           (surface->egl_surface || surface->app->backend == LOCUS_BACKEND_SHM) && !surface->closed;
+}
+
+/* With a render delay, input and frame hooks are sampled that long after
+ * the frame callback instead of right away, closer to the next vblank. */
+static int surface_ready(LocusSurface *surface, uint64_t now) {
+    uint64_t done = __atomic_load_n(&surface->frame_done, __ATOMIC_ACQUIRE);
+    return surface_wants_frame(surface) && done + surface->app->render_delay <= now;
+}
+
+/* Held touch motion and frame hooks run once per iteration, shared by all
+ * surfaces whose frame callback has come back; each of those is then
+ * repainted with its own damage. */
+static void render_surfaces(Locus *app) {
+    uint64_t now = locus_now_ms();
+    int any = 0;
+
+    take_redraw(app);
+    for (int i = 0; i < app->surface_count; i++) {
+        any |= surface_ready(app->surfaces[i], now);
+    }
+    if (!any) {
+        return;
+    }
+
+    uint64_t started = app->timing ? locus_now_ns() : 0;
+    locus_flush_touch(app);
+    take_redraw(app);
+    for (int i = 0; i < app->surface_count; i++) {
+        LocusSurface *surface = app->surfaces[i];
+        surface->ready = surface_ready(surface, now);
+        if (surface->ready) {
+            surface->frame_requested = 0;
+        }
+    }
+
+    run_frame_hooks(app);
+    take_redraw(app);
+    if (app->timing) {
+        app->dispatch_ns += locus_now_ns() - started;
+    }
+    for (int i = 0; i < app->surface_count; i++) {
+        if (!app->surfaces[i]->ready) {
+            continue;
+        }
+        if (app->render_running) {
+            locus_render_thread_submit(app, app->surfaces[i]);
+        } else {
+            locus_surface_render(app->surfaces[i]);
+        }
+    }
+    app->dispatch_ns = 0;
 }
 
 void locus_run(Locus *app) {
+    struct pollfd *fds = NULL;
+    int fds_capacity = 0;
 
     while (!app->configured) {
-        wl_display_dispatch(app->display);
+        if (wl_display_dispatch(app->display) < 0) {
+            fprintf(stderr, "Wayland connection lost\n");
+            return;
+        }
+    }
+
+    if (app->threaded && !locus_render_thread_start(app)) {
+        fprintf(stderr, "Falling back to rendering on the main thread\n");
     }
 
-    app->redraw = 1; 
-    while (app->running) {
+    app->redraw = 1;
+    while (__atomic_load_n(&app->running, __ATOMIC_ACQUIRE)) {
+        render_surfaces(app);
 
-        if (wl_display_prepare_read(app->display) != 0) {
+        while (wl_display_prepare_read(app->display) != 0) {
             wl_display_dispatch_pending(app->display);
-        } else {
-            wl_display_flush(app->display);
-            struct timespec ts = {0, 16667000};
-            nanosleep(&ts, NULL);
         }
 
-        if (app->redraw) {
-            eglMakeCurrent(app->egl_display, app->egl_surface, app->egl_surface, app->egl_context);
-
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        if (wl_display_flush(app->display) < 0 && errno != EAGAIN) {
+            wl_display_cancel_read(app->display);
+            fprintf(stderr, "Failed to flush Wayland display\n");
+            break;
+        }
 
-            if (app->draw_callback) {
-                app->draw_callback(app);
-            } else {
-                fprintf(stderr, "Draw callback not set\n");
+        compact_watches(app);
+        if (fds_capacity < app->watch_count + 1) {
+            fds_capacity = app->watch_count + 1;
+            struct pollfd *resized = realloc(fds, fds_capacity * sizeof *fds);
+            if (!resized) {
+                wl_display_cancel_read(app->display);
+                fprintf(stderr, "Failed to allocate poll set\n");
+                break;
             }
+            fds = resized;
+        }
 
-            wl_surface_damage(app->surface, 0, 0, app->width, app->height);
+        fds[0].fd = wl_display_get_fd(app->display);
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        int nfds = 1;
+        for (int i = 0; i < app->watch_count; i++) {
+            fds[nfds].fd = app->watches[i].fd;
+            fds[nfds].events = app->watches[i].events;
+            fds[nfds].revents = 0;
+            nfds++;
+        }
 
-            if (eglSwapBuffers(app->egl_display, app->egl_surface) == EGL_FALSE) {
-                fprintf(stderr, "Failed to swap buffers\n");
+        if (poll(fds, nfds, next_timeout(app)) < 0) {
+            wl_display_cancel_read(app->display);
+            if (errno == EINTR) {
+                continue;
             }
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            break;
+        }
+        uint64_t woke = app->timing ? locus_now_ns() : 0;
 
-            wl_surface_commit(app->surface);
+        if (fds[0].revents & POLLIN) {
+            if (wl_display_read_events(app->display) < 0) {
+                fprintf(stderr, "Failed to read Wayland events\n");
+                break;
+            }
+        } else {
+            wl_display_cancel_read(app->display);
+        }
+
+        if (fds[0].revents & (POLLERR | POLLHUP)) {
+            fprintf(stderr, "Wayland connection lost\n");
+            break;
+        }
+
+        if (wl_display_dispatch_pending(app->display) < 0) {
+            fprintf(stderr, "Failed to dispatch Wayland events\n");
+            break;
+        }
+
+        int watch_count = app->watch_count;
+        for (int i = 0; i < watch_count && i + 1 < nfds; i++) {
+            LocusWatch watch = app->watches[i];
+            if (watch.fd >= 0 && watch.fd == fds[i + 1].fd && fds[i + 1].revents) {
+                watch.callback(app, watch.fd, fds[i + 1].revents, watch.data);
+            }
+        }
 
-            app->redraw = 0; 
+        dispatch_timers(app);
+        if (app->timing) {
+            app->dispatch_ns += locus_now_ns() - woke;
         }
-        wl_display_read_events(app->display);
-        wl_display_dispatch_pending(app->display);
     }
+
+    locus_render_thread_stop(app);
+    free(fds);
 }
 
 
 void locus_cleanup(Locus *app) {
-    if (app->egl_surface) {
-        eglDestroySurface(app->egl_display, app->egl_surface);
-        app->egl_surface = NULL;
-    }
-    if (app->egl_window) {
-        wl_egl_window_destroy(app->egl_window);
-        app->egl_window = NULL;
+    locus_timing_cleanup(app);
+    while (app->surface_count > 0) {
+        locus_surface_destroy(app->surfaces[app->surface_count - 1]);
     }
+    free(app->surfaces);
+    app->surfaces = NULL;
+    app->surface_capacity = 0;
+    locus_output_cleanup(app);
+    free(app->watches);
+    app->watches = NULL;
+    app->watch_count = app->watch_capacity = 0;
+    free(app->timers);
+    app->timers = NULL;
+    app->timer_count = app->timer_capacity = 0;
+    locus_animation_cleanup(app);
+    free(app->frame_hooks);
+    app->frame_hooks = NULL;
+    app->frame_hook_count = app->frame_hook_capacity = 0;
     if (app->egl_context) {
         eglDestroyContext(app->egl_display, app->egl_context);
         app->egl_context = NULL;
@@ -404,26 +933,24 @@ void locus_cleanup(Locus *app) {
         eglTerminate(app->egl_display);
         app->egl_display = NULL;
     }
-    if (app->xdg_toplevel) {
-        xdg_toplevel_destroy(app->xdg_toplevel);
-        app->xdg_toplevel = NULL;
+#ifdef WITH_WAYLAND_SHM
+    if (app->shm) {
+        wl_shm_destroy(app->shm);
+        app->shm = NULL;
     }
-    if (app->xdg_surface) {
-        xdg_surface_destroy(app->xdg_surface);
-        app->xdg_surface = NULL;
-    }
-    if (app->layer_surface) {
-        zwlr_layer_surface_v1_destroy(app->layer_surface);
-        app->layer_surface = NULL;
-    }
-    if (app->surface) {
-        wl_surface_destroy(app->surface);
-        app->surface = NULL;
+#endif
+    if (app->presentation) {
+        wp_presentation_destroy(app->presentation);
+        app->presentation = NULL;
     }
     if (app->xdg_wm_base) {
         xdg_wm_base_destroy(app->xdg_wm_base);
         app->xdg_wm_base = NULL;
     }
+    if (app->subcompositor) {
+        wl_subcompositor_destroy(app->subcompositor);
+        app->subcompositor = NULL;
+    }
     if (app->compositor) {
         wl_compositor_destroy(app->compositor);
         app->compositor = NULL;
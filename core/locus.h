@@ -1,23 +1,350 @@
 #ifndef LOCUS_H
 #define LOCUS_H
 
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
 #include <wayland-client.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GLES2/gl2.h>
 #include "proto/wlr-layer-shell-unstable-v1-client-protocol.h"
 #include "proto/xdg-shell-client-protocol.h"
+#include "proto/fractional-scale-v1-client-protocol.h"
+#include "proto/viewporter-client-protocol.h"
+#include "proto/presentation-time-client-protocol.h"
+
+#define LOCUS_MAX_DAMAGE_RECTS 16
+#define LOCUS_DAMAGE_HISTORY 4
+#define LOCUS_MAX_TOUCH_POINTS 10
+#define LOCUS_VELOCITY_SAMPLES 16
+#define LOCUS_TOUCH_HISTORY 32
+#define LOCUS_MAX_OUTPUTS 8
+#define LOCUS_SHM_MAX_BUFFERS 4
 
 typedef struct Locus Locus;
+typedef struct LocusWatch LocusWatch;
+typedef struct LocusTimer LocusTimer;
+typedef struct LocusFrameHook LocusFrameHook;
+typedef struct LocusAnimation LocusAnimation;
+typedef struct LocusOutput LocusOutput;
+typedef struct LocusSurface LocusSurface;
+typedef struct LocusCanvas LocusCanvas;
+typedef struct LocusTiming LocusTiming;
+
+typedef struct {
+    int x, y, width, height;
+} LocusRect;
+
+typedef enum {
+    LOCUS_BACKEND_AUTO,
+    LOCUS_BACKEND_EGL,
+    LOCUS_BACKEND_SHM,
+} LocusBackend;
+
+/* xdg_toplevel states of a window, as of the frame being drawn. */
+typedef enum {
+    LOCUS_SURFACE_MAXIMIZED = 1 << 0,
+    LOCUS_SURFACE_FULLSCREEN = 1 << 1,
+    LOCUS_SURFACE_RESIZING = 1 << 2,
+    LOCUS_SURFACE_ACTIVATED = 1 << 3,
+} LocusSurfaceState;
+
+/* CPU render target of the shm backend: premultiplied ARGB8888 pixels in
+ * buffer coordinates. Drawing is limited to clip. */
+struct LocusCanvas {
+    uint32_t *pixels;
+    int width, height;
+    int stride;
+    LocusRect clip;
+};
+
+typedef struct {
+    struct wl_buffer *buffer;
+    uint32_t *pixels;
+    size_t size;
+    int width, height;
+    int busy;
+    int orphaned;
+    uint64_t frame;
+} LocusShmBuffer;
+
+enum {
+    LOCUS_TOUCH_DOWN = 0,
+    LOCUS_TOUCH_UP = 1,
+    LOCUS_TOUCH_MOTION = 2,
+    LOCUS_TOUCH_CANCEL = 3,
+    LOCUS_TOUCH_NONE = 4,
+};
+
+typedef struct {
+    uint32_t time;
+    double x, y;
+} LocusTouchSample;
+
+typedef struct {
+    int32_t id;
+    LocusSurface *surface;
+    int active;
+    int state;
+    double x, y;
+    double start_x, start_y;
+    uint32_t down_time;
+    uint32_t time;
+    uint32_t received;
+    LocusTouchSample history[LOCUS_TOUCH_HISTORY];
+    int history_count;
+    LocusTouchSample recent[LOCUS_VELOCITY_SAMPLES];
+    int recent_count, recent_head;
+} LocusTouchPoint;
+
+typedef struct {
+    LocusTouchPoint points[LOCUS_MAX_TOUCH_POINTS];
+    int count;
+    int active;
+    int cancelled;
+    uint32_t time;
+} LocusTouchFrame;
+
+typedef enum {
+    LOCUS_GESTURE_TAP,
+    LOCUS_GESTURE_LONG_PRESS,
+    LOCUS_GESTURE_SWIPE,
+    LOCUS_GESTURE_PINCH,
+    LOCUS_GESTURE_FLING,
+} LocusGestureType;
+
+typedef enum {
+    LOCUS_GESTURE_BEGIN,
+    LOCUS_GESTURE_UPDATE,
+    LOCUS_GESTURE_END,
+    LOCUS_GESTURE_CANCEL,
+} LocusGesturePhase;
+
+typedef struct {
+    LocusGestureType type;
+    LocusGesturePhase phase;
+    int fingers;
+    double x, y;
+    double dx, dy;
+    double scale;
+    double rotation;
+    double vx, vy;
+    uint32_t time;
+} LocusGesture;
+
+typedef struct {
+    int state;
+    int32_t primary;
+    int32_t pinch_a, pinch_b;
+    double start_x, start_y;
+    double last_x, last_y;
+    uint32_t start_time;
+    double start_distance, start_angle;
+    double last_center_x, last_center_y;
+    double last_scale, last_rotation;
+    int long_press_timer;
+    LocusTouchSample samples[LOCUS_VELOCITY_SAMPLES];
+    int sample_count, sample_head;
+    double slop;
+    uint32_t long_press_ms;
+    uint32_t tap_ms;
+    double fling_velocity;
+} LocusGestureState;
+
+struct LocusFrameHook {
+    int id;
+    void (*callback)(Locus *app, uint32_t time, void *data);
+    void *data;
+};
+
+typedef enum {
+    LOCUS_EASE_LINEAR,
+    LOCUS_EASE_IN,
+    LOCUS_EASE_OUT,
+    LOCUS_EASE_IN_OUT,
+    LOCUS_EASE_OUT_BACK,
+} LocusEasing;
+
+/* A tween when stiffness is 0, otherwise a damped spring towards to. */
+struct LocusAnimation {
+    int id;
+    float *value;
+    float from, to;
+    float velocity;
+    uint32_t start, last, duration;
+    LocusEasing easing;
+    float stiffness, damping;
+    void (*update)(Locus *app, float value, void *data);
+    void (*done)(Locus *app, int finished, void *data);
+    void *data;
+};
+
+struct LocusWatch {
+    int fd;
+    short events;
+    void (*callback)(Locus *app, int fd, short revents, void *data);
+    void *data;
+};
+
+struct LocusTimer {
+    int id;
+    uint64_t deadline;
+    uint32_t interval;
+    int repeat;
+    void (*callback)(Locus *app, void *data);
+    void *data;
+};
+
+struct LocusOutput {
+    Locus *app;
+    struct wl_output *output;
+    uint32_t name;
+    uint32_t version;
+    int32_t x, y;
+    int32_t physical_width, physical_height;
+    int32_t transform;
+    int32_t mode_width, mode_height;
+    int32_t refresh;
+    int32_t scale;
+    int done;
+};
+
+typedef struct {
+    int redraw;
+    int frame_requested;
+    int damage_all;
+    int damage_count;
+    LocusRect damage[LOCUS_MAX_DAMAGE_RECTS];
+    uint64_t dispatch_ns;
+} LocusFrameDamage;
+
+typedef enum {
+    LOCUS_TIMING_DISPATCH,
+    LOCUS_TIMING_DRAW,
+    LOCUS_TIMING_GPU,
+    LOCUS_TIMING_SWAP,
+    LOCUS_TIMING_PRESENT,
+    LOCUS_TIMING_TOTAL,
+    LOCUS_TIMING_PHASES,
+} LocusTimingPhase;
+
+/* Durations in nanoseconds, 0 when not measured. Total is dispatch
+ * through the end of the swap. */
+typedef struct {
+    uint64_t frame;
+    uint64_t start;
+    uint64_t phase[LOCUS_TIMING_PHASES];
+    int presented;
+} LocusFrameTiming;
+
+typedef struct {
+    int count;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t max;
+} LocusTimingStats;
+
+/* Startup marks, in nanoseconds since init began. EGL comes before the
+ * registry because its initialisation overlaps the first roundtrip. */
+typedef enum {
+    LOCUS_STARTUP_CONNECT,
+    LOCUS_STARTUP_EGL,
+    LOCUS_STARTUP_REGISTRY,
+    LOCUS_STARTUP_OUTPUTS,
+    LOCUS_STARTUP_FIRST_FRAME,
+    LOCUS_STARTUP_PHASES,
+} LocusStartupPhase;
+
+/* Lock-free triple buffer for handing state from the main thread to the
+ * render thread: the writer fills back() and publishes it, the reader
+ * always gets the newest published buffer. */
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    int back;
+    int front;
+    int middle;
+} LocusSnapshot;
+
+struct LocusSurface {
+    Locus *app;
+    struct wl_surface *surface;
+    struct wl_egl_window *egl_window;
+    EGLSurface egl_surface;
+    struct xdg_surface *xdg_surface;
+    struct xdg_toplevel *xdg_toplevel;
+    struct zwlr_layer_surface_v1 *layer_surface;
+    struct wl_subsurface *subsurface;
+    LocusSurface *parent;
+    struct wp_fractional_scale_v1 *fractional_scale;
+    struct wp_viewport *viewport;
+    float fixed_scale;
+    int opaque;
+    struct wl_output *entered[LOCUS_MAX_OUTPUTS];
+    int entered_count;
+    uint32_t preferred_scale;
+    float scale;
+    int32_t refresh;
+    int width, height;
+    int buffer_width, buffer_height;
+    float next_scale;
+    int resize_pending;
+    int toplevel_width, toplevel_height;
+    uint32_t toplevel_states;
+    int next_width, next_height;
+    uint32_t next_states;
+    uint32_t configure_serial;
+    int configure_pending;
+    uint32_t states;
+    int swap_interval;
+    int configured;
+    int closed;
+    int headless;
+    int redraw;
+    int ready;
+    int frame_requested;
+    struct wl_callback *frame_callback;
+    int frame_pending;
+    uint32_t frame_time;
+    uint64_t frame_done;
+    LocusFrameDamage submitted;
+    int submit_pending;
+    int rendering;
+    LocusShmBuffer shm_buffers[LOCUS_SHM_MAX_BUFFERS];
+    int shm_buffer_count;
+    LocusShmBuffer *shm_current;
+    uint64_t shm_frame;
+    LocusCanvas canvas;
+    LocusRect damage[LOCUS_MAX_DAMAGE_RECTS];
+    int damage_count;
+    int damage_all;
+    LocusRect damage_history[LOCUS_DAMAGE_HISTORY];
+    int damage_history_count;
+    LocusRect repaint;
+    int repaint_queried;
+    int partial_repaint;
+    void (*draw_callback)(LocusSurface *surface, void *data);
+    void *draw_data;
+    void (*close_callback)(LocusSurface *surface, void *data);
+    void *close_data;
+    void (*configure_callback)(LocusSurface *surface, int width, int height, uint32_t states, void *data);
+    void *configure_data;
+};
 
 struct Locus {
     struct wl_display *display;
     struct wl_registry *registry;
     struct wl_compositor *compositor;
+    struct wl_subcompositor *subcompositor;
     struct wl_surface *surface;
     struct wl_output *output;
     struct wl_seat *seat;
     struct wl_touch *touch;
     struct wl_egl_window *egl_window;
+    LocusBackend backend;
+    struct wl_shm *shm;
+    int shm_buffer_target;
     EGLDisplay egl_display;
     EGLContext egl_context;
     EGLConfig egl_config;
@@ -29,19 +356,161 @@ struct Locus {
     struct zwlr_layer_surface_v1 *layer_surface;
     int width, height;
     int screen_width, screen_height;
+    LocusOutput **outputs;
+    int output_count, output_capacity;
+    struct wp_fractional_scale_manager_v1 *fractional_scale_manager;
+    struct wp_viewporter *viewporter;
+    struct wp_presentation *presentation;
+    clockid_t presentation_clock;
+    LocusSurface **surfaces;
+    int surface_count, surface_capacity;
+    LocusSurface *primary;
     int configured;
     int running;
     int redraw;
     int active_touches;
+    LocusTouchFrame touch_frame;
+    int touch_dirty;
+    int touch_pending;
+    int touch_coalesce;
+    void (*touch_frame_callback)(Locus *app, const LocusTouchFrame *frame, void *data);
+    void *touch_frame_data;
+    LocusGestureState gesture;
+    void (*gesture_callback)(Locus *app, const LocusGesture *gesture, void *data);
+    void *gesture_data;
+    int32_t refresh;
+    LocusWatch *watches;
+    int watch_count, watch_capacity;
+    LocusTimer *timers;
+    int timer_count, timer_capacity;
+    int next_timer_id;
+    LocusFrameHook *frame_hooks;
+    int frame_hook_count, frame_hook_capacity;
+    LocusAnimation *animations;
+    int animation_count, animation_capacity;
+    int animation_hook;
+    uint32_t compositor_version;
+    int has_buffer_age;
+    PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC swap_buffers_with_damage;
+    int swap_interval;
+    uint32_t render_delay;
+    int threaded;
+    int render_running;
+    int render_quit;
+    pthread_t render_thread;
+    pthread_mutex_t render_lock;
+    pthread_cond_t render_cond;
+    struct wl_event_queue *render_queue;
+    int render_wake_fd;
+    int main_wake_fd;
+    LocusTiming *timing;
+    uint64_t dispatch_ns;
+    uint64_t startup_ns;
+    uint64_t startup[LOCUS_STARTUP_PHASES];
     void (*draw_callback)(void *data);
     void (*touch_callback)(int32_t id, double x, double y, int32_t state);
 };
 
 int locus_init(Locus *app, int width, int height);
+int locus_init_backend(Locus *app, int width, int height, LocusBackend backend);
+int locus_init_headless(Locus *app, int width, int height, LocusBackend backend);
 void locus_create_window(Locus *app, const char *title);
 void locus_create_layer_surface(Locus *app, const char *title, uint32_t layer, uint32_t anchor, int exclusive);
 void locus_set_draw_callback(Locus *app, void (*draw_callback)(void *data));
 void locus_set_touch_callback(Locus *app, void (*touch_callback)(int32_t id, double x, double y, int32_t state));
+int locus_add_fd(Locus *app, int fd, short events,
+                 void (*callback)(Locus *app, int fd, short revents, void *data), void *data);
+void locus_remove_fd(Locus *app, int fd);
+int locus_add_timer(Locus *app, uint32_t interval_ms, int repeat,
+                    void (*callback)(Locus *app, void *data), void *data);
+void locus_remove_timer(Locus *app, int id);
+void locus_request_redraw(Locus *app);
+void locus_schedule_frame(Locus *app);
+int locus_add_frame_hook(Locus *app, void (*callback)(Locus *app, uint32_t time, void *data),
+                         void *data);
+void locus_remove_frame_hook(Locus *app, int id);
+float locus_ease(LocusEasing easing, float t);
+int locus_animate(Locus *app, float *value, float to, uint32_t duration_ms, LocusEasing easing);
+int locus_animate_spring(Locus *app, float *value, float to, float stiffness, float damping);
+void locus_animation_set_callbacks(Locus *app, int id, void (*update)(Locus *app, float value, void *data),
+                                   void (*done)(Locus *app, int finished, void *data), void *data);
+void locus_animation_cancel(Locus *app, int id);
+int locus_animating(Locus *app);
+void locus_damage(Locus *app, int x, int y, int width, int height);
+void locus_damage_all(Locus *app);
+LocusRect locus_repaint_rect(Locus *app);
+uint32_t locus_frame_interval_us(Locus *app);
+uint32_t locus_next_frame_time(Locus *app);
+void locus_set_touch_frame_callback(Locus *app,
+                                    void (*callback)(Locus *app, const LocusTouchFrame *frame, void *data),
+                                    void *data);
+void locus_set_gesture_callback(Locus *app,
+                                void (*callback)(Locus *app, const LocusGesture *gesture, void *data),
+                                void *data);
+LocusOutput *locus_output_primary(Locus *app);
+float locus_scale(Locus *app);
+LocusSurface *locus_surface_create_window(Locus *app, const char *title, int width, int height);
+LocusSurface *locus_surface_create_layer(Locus *app, const char *title, uint32_t layer,
+                                         uint32_t anchor, int exclusive, int width, int height);
+LocusSurface *locus_surface_create_subsurface(LocusSurface *parent, int x, int y, int width, int height);
+LocusSurface *locus_surface_create_headless(Locus *app, int width, int height, float scale);
+void locus_surface_render_offscreen(LocusSurface *surface);
+int locus_surface_read_pixels(LocusSurface *surface, uint32_t *pixels);
+void locus_surface_destroy(LocusSurface *surface);
+void locus_surface_set_draw_callback(LocusSurface *surface,
+                                     void (*callback)(LocusSurface *surface, void *data), void *data);
+void locus_surface_set_close_callback(LocusSurface *surface,
+                                      void (*callback)(LocusSurface *surface, void *data), void *data);
+void locus_surface_set_position(LocusSurface *surface, int x, int y);
+void locus_surface_place_above(LocusSurface *surface, LocusSurface *sibling);
+void locus_surface_place_below(LocusSurface *surface, LocusSurface *sibling);
+void locus_surface_set_size(LocusSurface *surface, int width, int height);
+void locus_surface_set_content_scale(LocusSurface *surface, float scale);
+void locus_surface_set_opaque(LocusSurface *surface, int opaque);
+void locus_surface_set_configure_callback(LocusSurface *surface,
+                                          void (*callback)(LocusSurface *surface, int width, int height,
+                                                           uint32_t states, void *data),
+                                          void *data);
+uint32_t locus_surface_states(LocusSurface *surface);
+void locus_surface_request_redraw(LocusSurface *surface);
+void locus_surface_schedule_frame(LocusSurface *surface);
+void locus_surface_damage(LocusSurface *surface, int x, int y, int width, int height);
+void locus_surface_damage_all(LocusSurface *surface);
+float locus_surface_scale(LocusSurface *surface);
+uint64_t locus_now_ms(void);
+uint64_t locus_now_ns(void);
+void locus_set_timing(Locus *app, int enabled);
+int locus_timing_frames(Locus *app, LocusFrameTiming *frames, int max);
+int locus_timing_stats(Locus *app, LocusTimingPhase phase, LocusTimingStats *stats);
+int locus_timing_write_trace(Locus *app, const char *path);
+void locus_startup_mark(Locus *app, LocusStartupPhase phase);
+void locus_startup_report(Locus *app, FILE *out);
+void locus_set_swap_interval(Locus *app, int interval);
+void locus_set_render_delay(Locus *app, uint32_t delay_ms);
+void locus_set_threaded(Locus *app, int threaded);
+int locus_snapshot_init(LocusSnapshot *snapshot, size_t size);
+void *locus_snapshot_back(LocusSnapshot *snapshot);
+void locus_snapshot_publish(LocusSnapshot *snapshot);
+const void *locus_snapshot_front(LocusSnapshot *snapshot, int *fresh);
+void locus_snapshot_free(LocusSnapshot *snapshot);
+LocusSurface *locus_target_surface(Locus *app);
+void locus_set_shm_buffers(Locus *app, int count);
+LocusCanvas *locus_canvas(Locus *app);
+LocusCanvas *locus_surface_canvas(LocusSurface *surface);
+uint32_t locus_canvas_rgba(unsigned char red, unsigned char green, unsigned char blue, unsigned char alpha);
+void locus_canvas_premultiply(uint32_t *dst, const unsigned char *rgba, int count);
+void locus_canvas_clear(LocusCanvas *canvas, uint32_t color);
+void locus_canvas_fill_rect(LocusCanvas *canvas, int x, int y, int width, int height, uint32_t color);
+void locus_canvas_fill_rounded_rect(LocusCanvas *canvas, float x, float y, float width, float height,
+                                    float radius, uint32_t color);
+void locus_canvas_blit(LocusCanvas *canvas, int x, int y, int width, int height,
+                       const uint32_t *src, int src_width, int src_height, int src_stride,
+                       uint32_t alpha);
+void locus_canvas_blend_mask(LocusCanvas *canvas, int x, int y, const unsigned char *mask,
+                             int width, int height, int mask_stride, uint32_t color);
+void locus_set_touch_coalescing(Locus *app, int enabled);
+int locus_touch_predict(Locus *app, int32_t id, uint32_t time, double *x, double *y);
+int locus_touch_velocity(Locus *app, int32_t id, double *vx, double *vy);
 void locus_run(Locus *app);
 void locus_cleanup(Locus *app);
 
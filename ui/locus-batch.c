@@ -0,0 +1,698 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GLES2/gl2.h>
+#include <nanovg.h>
+#define NANOVG_GLES2
+#include "nanovg_gl.h"
+#include "locus.h"
+#include "locus-ui-private.h"
+
+/* Quads are grouped by texture and scissor; a quad may only join an
+ * earlier group if no group in between overlaps it, to keep paint order. */
+
+#define LOCUS_BATCH_MAX_QUADS 4096
+#define LOCUS_BATCH_LOOKBACK 8
+#define LOCUS_ATLAS_SIZE 1024
+
+enum {
+    LOCUS_BATCH_SOLID,
+    LOCUS_BATCH_IMAGE,
+    LOCUS_BATCH_MASK,
+    LOCUS_BATCH_PREMULTIPLIED,
+};
+
+typedef struct {
+    float x, y, u, v;
+    float lx, ly, hw, hh;
+    float radius, mode;
+    unsigned char color[4];
+} LocusBatchVertex;
+
+typedef struct {
+    GLuint texture;
+    int scissor[4];
+    int bounds[4];
+    int count;
+    int first;
+    int fill;
+} LocusBatchGroup;
+
+struct LocusBatch {
+    GLuint program;
+    GLint view;
+    GLuint vbo, ibo;
+    GLuint atlas;
+    int atlas_x, atlas_y, shelf_height;
+    uint32_t atlas_generation;
+    LocusBatchVertex* vertices;
+    unsigned short* indices;
+    int* quad_groups;
+    LocusBatchGroup* groups;
+    int quad_count;
+    int group_count;
+    GLint viewport[4];
+    int frame_scissor[4];
+    int partial;
+    GLint saved_viewport[4];
+    int saved_frame_scissor[4];
+    int saved_partial;
+    int nvg_dirty;
+    unsigned long draw_calls;
+    unsigned long quads;
+};
+
+static const char* vertex_source =
+    "uniform vec2 u_view;\n"
+    "attribute vec4 a_pos;\n"
+    "attribute vec4 a_rect;\n"
+    "attribute vec2 a_params;\n"
+    "attribute vec4 a_color;\n"
+    "varying vec2 v_uv;\n"
+    "varying vec4 v_rect;\n"
+    "varying vec2 v_params;\n"
+    "varying vec4 v_color;\n"
+    "void main() {\n"
+    "    v_uv = a_pos.zw;\n"
+    "    v_rect = a_rect;\n"
+    "    v_params = a_params;\n"
+    "    v_color = a_color;\n"
+    "    gl_Position = vec4(2.0 * a_pos.x / u_view.x - 1.0, 1.0 - 2.0 * a_pos.y / u_view.y, 0.0, 1.0);\n"
+    "}\n";
+
+static const char* fragment_source =
+    "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+    "precision highp float;\n"
+    "#else\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "uniform sampler2D u_texture;\n"
+    "varying vec2 v_uv;\n"
+    "varying vec4 v_rect;\n"
+    "varying vec2 v_params;\n"
+    "varying vec4 v_color;\n"
+    "void main() {\n"
+    "    vec4 color = v_color;\n"
+    "    if (v_params.y > 1.5 && v_params.y < 2.5) {\n"
+    "        color *= texture2D(u_texture, v_uv).a;\n"
+    "    } else {\n"
+    "        vec2 q = abs(v_rect.xy) - v_rect.zw + v_params.x;\n"
+    "        float d = length(max(q, 0.0)) + min(max(q.x, q.y), 0.0) - v_params.x;\n"
+    "        color *= clamp(0.5 - d, 0.0, 1.0);\n"
+    "        if (v_params.y > 2.5) {\n"
+    "            color *= texture2D(u_texture, v_uv);\n"
+    "        } else if (v_params.y > 0.5) {\n"
+    "            vec4 t = texture2D(u_texture, v_uv);\n"
+    "            color *= vec4(t.rgb * t.a, t.a);\n"
+    "        }\n"
+    "    }\n"
+    "    gl_FragColor = color;\n"
+    "}\n";
+
+static GLuint compile_shader(GLenum type, const char* source) {
+    GLuint shader = glCreateShader(type);
+    GLint status = 0;
+
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        char log[512];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        fprintf(stderr, "Failed to compile batch shader: %s\n", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+static GLuint create_program(void) {
+    GLuint program = locus_program_cache_load(vertex_source, fragment_source);
+    if (program) {
+        return program;
+    }
+
+    GLuint vertex = compile_shader(GL_VERTEX_SHADER, vertex_source);
+    GLuint fragment = compile_shader(GL_FRAGMENT_SHADER, fragment_source);
+    GLint status = 0;
+
+    if (vertex && fragment) {
+        program = glCreateProgram();
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        glBindAttribLocation(program, 0, "a_pos");
+        glBindAttribLocation(program, 1, "a_rect");
+        glBindAttribLocation(program, 2, "a_params");
+        glBindAttribLocation(program, 3, "a_color");
+        glLinkProgram(program);
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (!status) {
+            char log[512];
+            glGetProgramInfoLog(program, sizeof(log), NULL, log);
+            fprintf(stderr, "Failed to link batch shader: %s\n", log);
+            glDeleteProgram(program);
+            program = 0;
+        } else {
+            locus_program_cache_store(program, vertex_source, fragment_source);
+        }
+    }
+
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+    return program;
+}
+
+/* Needs the GL context of the NanoVG renderer to be current. */
+LocusBatch* locus_batch_create(void) {
+    LocusBatch* batch = calloc(1, sizeof(*batch));
+    if (batch == NULL) {
+        fprintf(stderr, "Failed to allocate draw batch\n");
+        return NULL;
+    }
+
+    batch->vertices = malloc(LOCUS_BATCH_MAX_QUADS * 4 * sizeof(*batch->vertices));
+    batch->indices = malloc(LOCUS_BATCH_MAX_QUADS * 6 * sizeof(*batch->indices));
+    batch->quad_groups = malloc(LOCUS_BATCH_MAX_QUADS * sizeof(*batch->quad_groups));
+    batch->groups = malloc(LOCUS_BATCH_MAX_QUADS * sizeof(*batch->groups));
+    if (!batch->vertices || !batch->indices || !batch->quad_groups || !batch->groups) {
+        fprintf(stderr, "Failed to allocate draw batch\n");
+        locus_batch_destroy(batch);
+        return NULL;
+    }
+
+    batch->program = create_program();
+    if (batch->program == 0) {
+        locus_batch_destroy(batch);
+        return NULL;
+    }
+    glUseProgram(batch->program);
+    glUniform1i(glGetUniformLocation(batch->program, "u_texture"), 0);
+    batch->view = glGetUniformLocation(batch->program, "u_view");
+    glUseProgram(0);
+
+    glGenBuffers(1, &batch->vbo);
+    glGenBuffers(1, &batch->ibo);
+
+    glGenTextures(1, &batch->atlas);
+    glBindTexture(GL_TEXTURE_2D, batch->atlas);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, LOCUS_ATLAS_SIZE, LOCUS_ATLAS_SIZE, 0, GL_ALPHA,
+                 GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    batch->atlas_generation = 1;
+    return batch;
+}
+
+void locus_batch_destroy(LocusBatch* batch) {
+    if (batch == NULL) {
+        return;
+    }
+    if (batch->program) {
+        glDeleteProgram(batch->program);
+    }
+    if (batch->vbo) {
+        glDeleteBuffers(1, &batch->vbo);
+    }
+    if (batch->ibo) {
+        glDeleteBuffers(1, &batch->ibo);
+    }
+    if (batch->atlas) {
+        glDeleteTextures(1, &batch->atlas);
+    }
+    free(batch->vertices);
+    free(batch->indices);
+    free(batch->quad_groups);
+    free(batch->groups);
+    free(batch);
+}
+
+/* Called by locus_ui_begin_frame() once ui->scissor holds the repaint
+ * area; the core has already set the viewport to the buffer. */
+void locus_batch_begin(LocusUI* ui) {
+    LocusBatch* batch = ui->batch;
+    const int* s = ui->scissor;
+
+    glGetIntegerv(GL_VIEWPORT, batch->viewport);
+    memcpy(batch->frame_scissor, s, sizeof(batch->frame_scissor));
+    batch->partial = s[0] > 0 || s[1] > 0 || s[0] + s[2] < batch->viewport[2] ||
+                     s[1] + s[3] < batch->viewport[3];
+    batch->quad_count = 0;
+    batch->group_count = 0;
+    batch->nvg_dirty = 0;
+    batch->draw_calls = 0;
+    batch->quads = 0;
+}
+
+static void set_scissor(LocusBatch* batch, const int* s) {
+    glScissor(s[0], batch->viewport[3] - (s[1] + s[3]), s[2], s[3]);
+}
+
+void locus_batch_flush(LocusUI* ui) {
+    LocusBatch* batch = ui->batch;
+    if (batch == NULL || batch->quad_count == 0) {
+        return;
+    }
+
+    int first = 0;
+    for (int i = 0; i < batch->group_count; i++) {
+        batch->groups[i].first = first;
+        batch->groups[i].fill = 0;
+        first += batch->groups[i].count * 6;
+    }
+    for (int i = 0; i < batch->quad_count; i++) {
+        LocusBatchGroup* group = &batch->groups[batch->quad_groups[i]];
+        unsigned short* index = batch->indices + group->first + group->fill * 6;
+        unsigned short base = (unsigned short)(i * 4);
+        index[0] = base;
+        index[1] = base + 1;
+        index[2] = base + 2;
+        index[3] = base;
+        index[4] = base + 2;
+        index[5] = base + 3;
+        group->fill++;
+    }
+
+    glUseProgram(batch->program);
+    glUniform2f(batch->view, (float)batch->viewport[2], (float)batch->viewport[3]);
+    glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+    glBufferData(GL_ARRAY_BUFFER, batch->quad_count * 4 * sizeof(*batch->vertices), batch->vertices,
+                 GL_STREAM_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, first * sizeof(*batch->indices), batch->indices,
+                 GL_STREAM_DRAW);
+
+    GLsizei stride = sizeof(LocusBatchVertex);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, (const void*)offsetof(LocusBatchVertex, x));
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (const void*)offsetof(LocusBatchVertex, lx));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (const void*)offsetof(LocusBatchVertex, radius));
+    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (const void*)offsetof(LocusBatchVertex, color));
+    for (GLuint i = 0; i < 4; i++) {
+        glEnableVertexAttribArray(i);
+    }
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_STENCIL_TEST);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glEnable(GL_SCISSOR_TEST);
+    glActiveTexture(GL_TEXTURE0);
+
+    GLuint bound = 0;
+    for (int i = 0; i < batch->group_count; i++) {
+        LocusBatchGroup* group = &batch->groups[i];
+        if (group->texture && group->texture != bound) {
+            glBindTexture(GL_TEXTURE_2D, group->texture);
+            bound = group->texture;
+        }
+        set_scissor(batch, group->scissor);
+        glDrawElements(GL_TRIANGLES, group->count * 6, GL_UNSIGNED_SHORT,
+                       (const void*)(group->first * sizeof(*batch->indices)));
+    }
+    batch->draw_calls += batch->group_count;
+    batch->quads += batch->quad_count;
+
+    for (GLuint i = 0; i < 4; i++) {
+        glDisableVertexAttribArray(i);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+    if (batch->partial) {
+        set_scissor(batch, batch->frame_scissor);
+    } else {
+        glDisable(GL_SCISSOR_TEST);
+    }
+
+    batch->quad_count = 0;
+    batch->group_count = 0;
+}
+
+/* Called before a draw that has to go through NanoVG: draws what is
+ * batched so far and loads the current state into NanoVG. */
+void locus_batch_begin_nvg(LocusUI* ui) {
+    if (!ui->batching) {
+        return;
+    }
+    locus_batch_flush(ui);
+    ui->batch->nvg_dirty = 1;
+
+    const float* t = ui->xform;
+    const int* s = ui->scissor;
+    float ratio = ui->pixel_ratio;
+    nvgResetTransform(ui->vg);
+    nvgScissor(ui->vg, s[0] / ratio, s[1] / ratio, s[2] / ratio, s[3] / ratio);
+    nvgTransform(ui->vg, t[0], t[1], t[2], t[3], t[4], t[5]);
+}
+
+/* Redirects batching to a render target of width x height pixels that the
+ * caller has bound, until locus_batch_pop_target(). */
+void locus_batch_push_target(LocusUI* ui, int width, int height) {
+    LocusBatch* batch = ui->batch;
+    if (!ui->batching) {
+        return;
+    }
+    locus_batch_flush(ui);
+    memcpy(batch->saved_viewport, batch->viewport, sizeof(batch->viewport));
+    memcpy(batch->saved_frame_scissor, batch->frame_scissor, sizeof(batch->frame_scissor));
+    batch->saved_partial = batch->partial;
+
+    batch->viewport[0] = batch->viewport[1] = 0;
+    batch->viewport[2] = width;
+    batch->viewport[3] = height;
+    batch->frame_scissor[0] = batch->frame_scissor[1] = 0;
+    batch->frame_scissor[2] = width;
+    batch->frame_scissor[3] = height;
+    batch->partial = 0;
+    batch->nvg_dirty = 0;
+}
+
+void locus_batch_pop_target(LocusUI* ui) {
+    LocusBatch* batch = ui->batch;
+    if (!ui->batching) {
+        return;
+    }
+    locus_batch_flush(ui);
+    memcpy(batch->viewport, batch->saved_viewport, sizeof(batch->viewport));
+    memcpy(batch->frame_scissor, batch->saved_frame_scissor, sizeof(batch->frame_scissor));
+    batch->partial = batch->saved_partial;
+    batch->nvg_dirty = 0;
+}
+
+/* NanoVG only renders at nvgEndFrame(), so whatever it was given since
+ * the last flush has to reach GL before the next batched quad. */
+static void finish_nvg(LocusUI* ui) {
+    nvgEndFrame(ui->vg);
+    nvgBeginFrame(ui->vg, ui->frame_width, ui->frame_height, ui->pixel_ratio);
+    ui->batch->nvg_dirty = 0;
+}
+
+static int overlaps(const int* a, const int* b) {
+    return a[0] < b[2] && b[0] < a[2] && a[1] < b[3] && b[1] < a[3];
+}
+
+/* Assigns a quad covering the device-space box to a group and returns its
+ * vertices, or NULL if the scissor hides it. */
+static LocusBatchVertex* add_quad(LocusUI* ui, GLuint texture, float x0, float y0, float x1, float y1) {
+    LocusBatch* batch = ui->batch;
+    const int* s = ui->scissor;
+    int bounds[4] = { (int)floorf(x0), (int)floorf(y0), (int)ceilf(x1), (int)ceilf(y1) };
+
+    bounds[0] = bounds[0] > s[0] ? bounds[0] : s[0];
+    bounds[1] = bounds[1] > s[1] ? bounds[1] : s[1];
+    bounds[2] = bounds[2] < s[0] + s[2] ? bounds[2] : s[0] + s[2];
+    bounds[3] = bounds[3] < s[1] + s[3] ? bounds[3] : s[1] + s[3];
+    if (bounds[0] >= bounds[2] || bounds[1] >= bounds[3]) {
+        return NULL;
+    }
+
+    if (batch->nvg_dirty) {
+        finish_nvg(ui);
+    }
+    if (batch->quad_count == LOCUS_BATCH_MAX_QUADS) {
+        locus_batch_flush(ui);
+    }
+
+    int index = -1;
+    int stop = batch->group_count - LOCUS_BATCH_LOOKBACK;
+    for (int i = batch->group_count - 1; i >= 0 && i >= stop; i--) {
+        LocusBatchGroup* group = &batch->groups[i];
+        if (memcmp(group->scissor, s, sizeof(group->scissor)) == 0 &&
+            (texture == 0 || group->texture == 0 || group->texture == texture)) {
+            index = i;
+            break;
+        }
+        if (overlaps(group->bounds, bounds)) {
+            break;
+        }
+    }
+
+    LocusBatchGroup* group;
+    if (index < 0) {
+        index = batch->group_count++;
+        group = &batch->groups[index];
+        group->texture = 0;
+        memcpy(group->scissor, s, sizeof(group->scissor));
+        memcpy(group->bounds, bounds, sizeof(group->bounds));
+        group->count = 0;
+    } else {
+        group = &batch->groups[index];
+        group->bounds[0] = bounds[0] < group->bounds[0] ? bounds[0] : group->bounds[0];
+        group->bounds[1] = bounds[1] < group->bounds[1] ? bounds[1] : group->bounds[1];
+        group->bounds[2] = bounds[2] > group->bounds[2] ? bounds[2] : group->bounds[2];
+        group->bounds[3] = bounds[3] > group->bounds[3] ? bounds[3] : group->bounds[3];
+    }
+    if (texture) {
+        group->texture = texture;
+    }
+    group->count++;
+
+    batch->quad_groups[batch->quad_count] = index;
+    return &batch->vertices[batch->quad_count++ * 4];
+}
+
+/* Emits the shape x0,y0-x1,y1 in device pixels, grown by pad so that the
+ * anti-aliased edge fits. u0,v0-u1,v1 map the unpadded corners. */
+static void emit_quad(LocusUI* ui, GLuint texture, int mode, float x0, float y0, float x1, float y1,
+                      float radius, float u0, float v0, float u1, float v1, float pad,
+                      const unsigned char* color) {
+    LocusBatchVertex* v = add_quad(ui, texture, x0 - pad, y0 - pad, x1 + pad, y1 + pad);
+    if (v == NULL) {
+        return;
+    }
+
+    float cx = (x0 + x1) * 0.5f, cy = (y0 + y1) * 0.5f;
+    float hw = (x1 - x0) * 0.5f, hh = (y1 - y0) * 0.5f;
+    float du = hw > 0.0f ? (u1 - u0) / (x1 - x0) : 0.0f;
+    float dv = hh > 0.0f ? (v1 - v0) / (y1 - y0) : 0.0f;
+    const float corners[4][2] = {
+        { x0 - pad, y0 - pad },
+        { x1 + pad, y0 - pad },
+        { x1 + pad, y1 + pad },
+        { x0 - pad, y1 + pad },
+    };
+
+    for (int i = 0; i < 4; i++) {
+        float x = corners[i][0], y = corners[i][1];
+        v[i].x = x;
+        v[i].y = y;
+        v[i].u = u0 + (x - x0) * du;
+        v[i].v = v0 + (y - y0) * dv;
+        v[i].lx = x - cx;
+        v[i].ly = y - cy;
+        v[i].hw = hw;
+        v[i].hh = hh;
+        v[i].radius = radius;
+        v[i].mode = (float)mode;
+        memcpy(v[i].color, color, 4);
+    }
+}
+
+/* Only scale and translation keep quads axis aligned; anything else is
+ * left to NanoVG. */
+static int device_scale(LocusUI* ui, float* sx, float* sy) {
+    const float* t = ui->xform;
+    if (!ui->batching || t[1] != 0.0f || t[2] != 0.0f || t[0] <= 0.0f || t[3] <= 0.0f) {
+        return 0;
+    }
+    *sx = t[0] * ui->pixel_ratio;
+    *sy = t[3] * ui->pixel_ratio;
+    return 1;
+}
+
+static unsigned char clamp_byte(float value) {
+    return value <= 0.0f ? 0 : (value >= 255.0f ? 255 : (unsigned char)value);
+}
+
+int locus_batch_rect(LocusUI* ui, float x, float y, float width, float height,
+                     float red, float green, float blue, float alpha, float radius) {
+    float sx, sy;
+    if (!device_scale(ui, &sx, &sy)) {
+        return 0;
+    }
+    if (width <= 0.0f || height <= 0.0f) {
+        return 1;
+    }
+
+    /* Premultiplied, with NanoVG's rounding of nvgRGBA(). */
+    unsigned char a = clamp_byte((float)(int)(alpha * 255));
+    unsigned char color[4] = {
+        clamp_byte(clamp_byte(red) * a / 255.0f),
+        clamp_byte(clamp_byte(green) * a / 255.0f),
+        clamp_byte(clamp_byte(blue) * a / 255.0f),
+        a,
+    };
+    if (a == 0) {
+        return 1;
+    }
+
+    float max_radius = (width < height ? width : height) * 0.5f;
+    radius = radius < 0.0f ? 0.0f : (radius > max_radius ? max_radius : radius);
+    float x0 = (ui->xform[0] * x + ui->xform[4]) * ui->pixel_ratio;
+    float y0 = (ui->xform[3] * y + ui->xform[5]) * ui->pixel_ratio;
+    emit_quad(ui, 0, LOCUS_BATCH_SOLID, x0, y0, x0 + width * sx, y0 + height * sy,
+              radius * (sx < sy ? sx : sy), 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, color);
+    return 1;
+}
+
+/* Scales the texture to cover the rectangle like locus_draw_texture()
+ * does on NanoVG; the overflow is cropped through the texture coordinates
+ * instead of a scissor. */
+int locus_batch_texture(LocusUI* ui, const LocusTexture* tex, float x, float y,
+                        float width, float height) {
+    float sx, sy;
+    if (tex->gl_texture == 0 || !device_scale(ui, &sx, &sy)) {
+        return 0;
+    }
+
+    float iw = width, ih = height, ix = 0.0f, iy = 0.0f;
+    if (tex->width * height != tex->height * width) {
+        if (tex->width < tex->height) {
+            ih = iw * tex->height / tex->width;
+            iy = -(ih - height) * 0.5f;
+        } else {
+            iw = ih * tex->width / tex->height;
+            ix = -(iw - width) * 0.5f;
+        }
+    }
+
+    unsigned char a = clamp_byte((float)(int)(ui->alpha * 255));
+    unsigned char white[4] = { a, a, a, a };
+    float x0 = (ui->xform[0] * x + ui->xform[4]) * ui->pixel_ratio;
+    float y0 = (ui->xform[3] * y + ui->xform[5]) * ui->pixel_ratio;
+    float v0 = -iy / ih, v1 = (height - iy) / ih;
+    if (tex->flags & LOCUS_TEXTURE_FLIPPED) {
+        v0 = 1.0f - v0;
+        v1 = 1.0f - v1;
+    }
+    int mode = tex->flags & LOCUS_TEXTURE_PREMULTIPLIED ? LOCUS_BATCH_PREMULTIPLIED : LOCUS_BATCH_IMAGE;
+    emit_quad(ui, tex->gl_texture, mode, x0, y0, x0 + width * sx, y0 + height * sy, 0.0f,
+              -ix / iw, v0, (width - ix) / iw, v1, 1.0f, white);
+    return 1;
+}
+
+int locus_batch_text(LocusUI* ui, int font, const char* text, float x, float y,
+                     float fontSize, float red, float green, float blue, float alpha) {
+    float sx, sy;
+    if (ui->fonts[font].soft == NULL || !device_scale(ui, &sx, &sy)) {
+        return 0;
+    }
+    locus_soft_text(ui, font, text, x, y, fontSize, red, green, blue, alpha);
+    return 1;
+}
+
+/* Glyphs are packed into shelves of the alpha atlas; when it is full the
+ * batch is drawn and the atlas starts over under a new generation, which
+ * invalidates every placement made before. */
+static int place_glyph(LocusBatch* batch, LocusGlyph* glyph) {
+    int width = glyph->width + 1, height = glyph->height + 1;
+    if (width > LOCUS_ATLAS_SIZE || height > LOCUS_ATLAS_SIZE) {
+        return 0;
+    }
+    if (batch->atlas_x + width > LOCUS_ATLAS_SIZE) {
+        batch->atlas_x = 0;
+        batch->atlas_y += batch->shelf_height;
+        batch->shelf_height = 0;
+    }
+    if (batch->atlas_y + height > LOCUS_ATLAS_SIZE) {
+        return 0;
+    }
+
+    glyph->atlas_x = batch->atlas_x;
+    glyph->atlas_y = batch->atlas_y;
+    batch->atlas_x += width;
+    batch->shelf_height = height > batch->shelf_height ? height : batch->shelf_height;
+    return 1;
+}
+
+static int upload_glyph(LocusUI* ui, LocusGlyph* glyph) {
+    LocusBatch* batch = ui->batch;
+    if (glyph->atlas_generation == batch->atlas_generation) {
+        return 1;
+    }
+
+    if (!place_glyph(batch, glyph)) {
+        locus_batch_flush(ui);
+        batch->atlas_generation++;
+        batch->atlas_x = batch->atlas_y = batch->shelf_height = 0;
+        if (!place_glyph(batch, glyph)) {
+            return 0;
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, batch->atlas);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, glyph->atlas_x, glyph->atlas_y, glyph->width, glyph->height,
+                    GL_ALPHA, GL_UNSIGNED_BYTE, glyph->mask);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glyph->atlas_generation = batch->atlas_generation;
+    return 1;
+}
+
+/* x and y are the device pixel position of the mask, color is
+ * premultiplied ARGB as for the canvas. */
+void locus_batch_glyph(LocusUI* ui, LocusGlyph* glyph, int x, int y, uint32_t color) {
+    if (!upload_glyph(ui, glyph)) {
+        return;
+    }
+
+    unsigned char rgba[4] = {
+        (unsigned char)(color >> 16),
+        (unsigned char)(color >> 8),
+        (unsigned char)color,
+        (unsigned char)(color >> 24),
+    };
+    float scale = 1.0f / LOCUS_ATLAS_SIZE;
+    emit_quad(ui, ui->batch->atlas, LOCUS_BATCH_MASK, x, y, x + glyph->width, y + glyph->height, 0.0f,
+              glyph->atlas_x * scale, glyph->atlas_y * scale, (glyph->atlas_x + glyph->width) * scale,
+              (glyph->atlas_y + glyph->height) * scale, 0.0f, rgba);
+}
+
+/* For apps that mix their own NanoVG calls with LocusUI: call before them
+ * so that they land on top of what was drawn so far instead of on top of
+ * the whole frame. */
+void locus_ui_flush(LocusUI* ui) {
+    locus_batch_begin_nvg(ui);
+}
+
+/* Off by default; only frames begun with locus_ui_begin_frame() batch.
+ * Not to be called within a frame. */
+void locus_ui_set_batching(LocusUI* ui, int enabled) {
+    if (ui->vg == NULL || !enabled == !ui->batch) {
+        return;
+    }
+
+    if (enabled) {
+        ui->batch = locus_batch_create();
+        if (ui->batch == NULL) {
+            return;
+        }
+        for (int i = 0; i < ui->font_count; i++) {
+            if (ui->fonts[i].data && ui->fonts[i].soft == NULL) {
+                locus_soft_font_init(ui, &ui->fonts[i]);
+            }
+        }
+    } else {
+        locus_batch_destroy(ui->batch);
+        ui->batch = NULL;
+    }
+    locus_text_cache_clear(ui);
+}
+
+/* Draw calls and quads of the last frame. */
+void locus_ui_batch_stats(LocusUI* ui, unsigned long* draw_calls, unsigned long* quads) {
+    if (draw_calls) {
+        *draw_calls = ui->batch ? ui->batch->draw_calls : 0;
+    }
+    if (quads) {
+        *quads = ui->batch ? ui->batch->quads : 0;
+    }
+}
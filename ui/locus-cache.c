@@ -0,0 +1,175 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include "locus-ui-private.h"
+
+#define LOCUS_PROGRAM_CACHE_MAGIC "LOCUSPRG"
+
+/* Files under $XDG_CACHE_HOME/locus are replaced atomically and ignored
+ * when they don't validate. */
+
+int locus_cache_path(const char* name, char* path, size_t size, int create) {
+    const char* cache_home = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    char dir[PATH_MAX];
+
+    if (cache_home && cache_home[0]) {
+        snprintf(dir, sizeof(dir), "%s/locus", cache_home);
+        if (create) {
+            mkdir(cache_home, 0700);
+        }
+    } else if (home) {
+        snprintf(dir, sizeof(dir), "%s/.cache/locus", home);
+        if (create) {
+            char parent[PATH_MAX];
+            snprintf(parent, sizeof(parent), "%s/.cache", home);
+            mkdir(parent, 0700);
+        }
+    } else {
+        return 0;
+    }
+
+    if (create && mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        return 0;
+    }
+    snprintf(path, size, "%s/%s", dir, name);
+    return 1;
+}
+
+typedef struct {
+    PFNGLGETPROGRAMBINARYOESPROC get_binary;
+    PFNGLPROGRAMBINARYOESPROC program_binary;
+    int checked;
+} ProgramBinary;
+
+static ProgramBinary program_binary;
+
+/* GL_OES_get_program_binary is only used when the driver offers at least
+ * one binary format. */
+static int binary_supported(void) {
+    if (!program_binary.checked) {
+        const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+        GLint formats = 0;
+
+        program_binary.checked = 1;
+        if (getenv("LOCUS_NO_PROGRAM_CACHE") || !extensions ||
+            !strstr(extensions, "GL_OES_get_program_binary")) {
+            return 0;
+        }
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+        if (formats > 0) {
+            program_binary.get_binary = (PFNGLGETPROGRAMBINARYOESPROC)eglGetProcAddress("glGetProgramBinaryOES");
+            program_binary.program_binary = (PFNGLPROGRAMBINARYOESPROC)eglGetProcAddress("glProgramBinaryOES");
+        }
+    }
+    return program_binary.get_binary && program_binary.program_binary;
+}
+
+/* Binaries are only valid for the driver that produced them, so the key
+ * covers the renderer and driver version as well as the sources. */
+static int program_path(const char* vertex, const char* fragment, char* path, size_t size, int create) {
+    const char* strings[] = {
+        (const char*)glGetString(GL_VENDOR),
+        (const char*)glGetString(GL_RENDERER),
+        (const char*)glGetString(GL_VERSION),
+        vertex,
+        fragment,
+    };
+    uint64_t hash = 0;
+    char name[64];
+
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+        hash = locus_hash_string(strings[i] ? strings[i] : "", hash);
+        hash = locus_hash_bytes("\n", 1, hash);
+    }
+    snprintf(name, sizeof(name), "program-%016llx.bin", (unsigned long long)hash);
+    return locus_cache_path(name, path, size, create);
+}
+
+/* Returns a linked program from the cache, or 0 when there is none or the
+ * driver rejects it. */
+unsigned int locus_program_cache_load(const char* vertex, const char* fragment) {
+    char path[PATH_MAX];
+    if (!binary_supported() || !program_path(vertex, fragment, path, sizeof(path), 0)) {
+        return 0;
+    }
+
+    FILE* in = fopen(path, "rb");
+    if (in == NULL) {
+        return 0;
+    }
+
+    char magic[8];
+    uint32_t header[2];
+    void* data = NULL;
+    if (fread(magic, sizeof(magic), 1, in) == 1 && memcmp(magic, LOCUS_PROGRAM_CACHE_MAGIC, 8) == 0 &&
+        fread(header, sizeof(header), 1, in) == 1 && header[1] > 0 && header[1] < 64 * 1024 * 1024) {
+        data = malloc(header[1]);
+        if (data && fread(data, header[1], 1, in) != 1) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(in);
+    if (data == NULL) {
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    GLint status = 0;
+    program_binary.program_binary(program, header[0], data, (GLint)header[1]);
+    free(data);
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status) {
+        glDeleteProgram(program);
+        unlink(path);
+        return 0;
+    }
+    return program;
+}
+
+void locus_program_cache_store(unsigned int program, const char* vertex, const char* fragment) {
+    char path[PATH_MAX];
+    char tmp[PATH_MAX + 8];
+    GLint length = 0;
+
+    if (!binary_supported() || !program_path(vertex, fragment, path, sizeof(path), 1)) {
+        return;
+    }
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    void* data = malloc(length);
+    if (data == NULL) {
+        return;
+    }
+    GLenum format = 0;
+    GLsizei written = 0;
+    program_binary.get_binary(program, length, &written, &format, data);
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = written > 0 ? mkstemp(tmp) : -1;
+    if (fd < 0) {
+        free(data);
+        return;
+    }
+
+    uint32_t header[2] = { format, (uint32_t)written };
+    int ok = write(fd, LOCUS_PROGRAM_CACHE_MAGIC, 8) == 8 &&
+             write(fd, header, sizeof(header)) == sizeof(header) &&
+             write(fd, data, written) == written;
+    free(data);
+    if (close(fd) != 0 || !ok || rename(tmp, path) < 0) {
+        unlink(tmp);
+    }
+}
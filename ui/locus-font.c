@@ -0,0 +1,310 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <nanovg.h>
+#include "locus-ui-private.h"
+
+#define LOCUS_DEFAULT_FONT "/home/droidian/.local/share/fonts/MonofurNerdFont-Regular.ttf"
+#define LOCUS_TEXT_RUN_MAX_AGE 120
+#define LOCUS_TEXT_RUN_MAX (LOCUS_TEXT_CACHE_SIZE * 4)
+
+static unsigned char* map_file(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return data;
+}
+
+int locus_font_load(LocusUI* ui, const char* name, const char* path) {
+    int existing = locus_font_find(ui, name);
+    if (existing >= 0) {
+        return existing;
+    }
+
+    if (ui->font_count == LOCUS_MAX_FONTS) {
+        fprintf(stderr, "Error: Too many fonts, cannot load '%s'\n", name);
+        return -1;
+    }
+
+    size_t size = 0;
+    unsigned char* data = map_file(path, &size);
+    if (data == NULL) {
+        fprintf(stderr, "Error: Failed to map font '%s'\n", path);
+        return -1;
+    }
+
+    LocusFont* font = &ui->fonts[ui->font_count];
+    memset(font, 0, sizeof(*font));
+    font->data = data;
+    font->size = size;
+
+    if (ui->vg) {
+        font->handle = nvgCreateFontMem(ui->vg, name, data, (int)size, 0);
+        if (font->handle >= 0 && ui->batch) {
+            locus_soft_font_init(ui, font);
+        }
+    } else {
+        font->handle = locus_soft_font_init(ui, font) ? 0 : -1;
+    }
+    if (font->handle < 0) {
+        fprintf(stderr, "Error: Failed to load font '%s'\n", path);
+        munmap(data, size);
+        font->data = NULL;
+        return -1;
+    }
+
+    snprintf(font->name, sizeof(font->name), "%s", name);
+    return ui->font_count++;
+}
+
+int locus_font_find(LocusUI* ui, const char* name) {
+    for (int i = 0; i < ui->font_count; i++) {
+        if (strcmp(ui->fonts[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void locus_font_set_default(LocusUI* ui, int font) {
+    if (font >= 0 && font < ui->font_count) {
+        ui->default_font = font;
+    }
+}
+
+int locus_font_default(LocusUI* ui) {
+    if (ui->default_font == -1) {
+        const char* path = getenv("LOCUS_FONT");
+        int font = locus_font_load(ui, "default", path ? path : LOCUS_DEFAULT_FONT);
+        ui->default_font = font < 0 ? -2 : font;
+    }
+    return ui->default_font < 0 ? -1 : ui->default_font;
+}
+
+static void free_run(LocusTextRun* run) {
+    free(run->text);
+    free(run->glyph_x);
+    free(run->glyph_offset);
+    free(run);
+}
+
+static LocusTextRun* build_run(LocusUI* ui, int font, const char* text, float fontSize, uint64_t hash) {
+    size_t len = strlen(text);
+    LocusTextRun* run = calloc(1, sizeof(*run));
+    if (run == NULL) {
+        return NULL;
+    }
+
+    run->hash = hash;
+    run->font = font;
+    run->size = fontSize;
+    run->text = strdup(text);
+
+    run->glyph_x = malloc((len + 1) * sizeof(*run->glyph_x));
+    run->glyph_offset = malloc((len + 1) * sizeof(*run->glyph_offset));
+    if (run->text == NULL || run->glyph_x == NULL || run->glyph_offset == NULL) {
+        free_run(run);
+        return NULL;
+    }
+
+    if (!ui->vg || (ui->batch && ui->fonts[font].soft)) {
+        locus_soft_layout(ui, run);
+        return run;
+    }
+
+    NVGglyphPosition* positions = malloc((len + 1) * sizeof(*positions));
+    if (positions == NULL) {
+        free_run(run);
+        return NULL;
+    }
+
+    nvgFontFaceId(ui->vg, ui->fonts[font].handle);
+    nvgFontSize(ui->vg, fontSize);
+    nvgTextAlign(ui->vg, NVG_ALIGN_LEFT | NVG_ALIGN_BASELINE);
+
+    run->advance = nvgTextBounds(ui->vg, 0, 0, text, NULL, run->bounds);
+    run->glyph_count = nvgTextGlyphPositions(ui->vg, 0, 0, text, NULL, positions, (int)len + 1);
+    for (int i = 0; i < run->glyph_count; i++) {
+        run->glyph_x[i] = positions[i].x;
+        run->glyph_offset[i] = (int)(positions[i].str - text);
+    }
+    free(positions);
+    return run;
+}
+
+/* Bounds the cache for apps whose frame counter doesn't advance; a run
+ * that was just returned is never dropped. */
+static void evict_runs(LocusUI* ui) {
+    for (int i = 0; i < LOCUS_TEXT_CACHE_SIZE; i++) {
+        LocusTextRun** link = &ui->text_buckets[i];
+        while (*link) {
+            LocusTextRun* run = *link;
+            if (ui->text_lookups - run->last_lookup > LOCUS_TEXT_RUN_MAX / 2) {
+                *link = run->next;
+                free_run(run);
+                ui->text_run_count--;
+            } else {
+                link = &run->next;
+            }
+        }
+    }
+}
+
+static LocusTextRun* find_run(LocusUI* ui, int font, const char* text, float fontSize) {
+    if (font < 0 || font >= ui->font_count || text == NULL) {
+        return NULL;
+    }
+
+    ui->text_lookups++;
+    uint64_t hash = locus_hash_string(text, locus_hash_bytes(&fontSize, sizeof(fontSize), (uint64_t)font));
+    LocusTextRun** bucket = &ui->text_buckets[hash % LOCUS_TEXT_CACHE_SIZE];
+
+    for (LocusTextRun* run = *bucket; run != NULL; run = run->next) {
+        if (run->hash == hash && run->font == font && run->size == fontSize &&
+            strcmp(run->text, text) == 0) {
+            run->last_used = ui->frame;
+            run->last_lookup = ui->text_lookups;
+            ui->text_hits++;
+            return run;
+        }
+    }
+
+    ui->text_misses++;
+    if (ui->text_run_count >= LOCUS_TEXT_RUN_MAX) {
+        evict_runs(ui);
+    }
+    LocusTextRun* run = build_run(ui, font, text, fontSize, hash);
+    if (run == NULL) {
+        fprintf(stderr, "Error: Could not allocate text run\n");
+        return NULL;
+    }
+
+    run->last_used = ui->frame;
+    run->last_lookup = ui->text_lookups;
+    run->next = *bucket;
+    *bucket = run;
+    ui->text_run_count++;
+    return run;
+}
+
+const LocusTextRun* locus_text_run(LocusUI* ui, int font, const char* text, float fontSize) {
+    return find_run(ui, font, text, fontSize);
+}
+
+float locus_text_measure(LocusUI* ui, int font, const char* text, float fontSize, float* bounds) {
+    const LocusTextRun* run = locus_text_run(ui, font, text, fontSize);
+    if (run == NULL) {
+        return 0.0f;
+    }
+
+    if (bounds) {
+        memcpy(bounds, run->bounds, sizeof(run->bounds));
+    }
+    return run->advance;
+}
+
+void locus_text_font(LocusUI* ui, int font, const char* text, float x, float y,
+                     float fontSize, float red, float green, float blue, float alpha) {
+    alpha *= ui->alpha;
+    if (alpha <= 0.0f) {
+        return;
+    }
+    LocusTextRun* run = find_run(ui, font, text, fontSize);
+    if (run == NULL || !locus_ui_visible(ui, x + run->bounds[0], y + run->bounds[1],
+                                         run->bounds[2] - run->bounds[0],
+                                         run->bounds[3] - run->bounds[1])) {
+        return;
+    }
+    if (!ui->vg) {
+        locus_soft_text(ui, font, text, x, y, fontSize, red, green, blue, alpha);
+        return;
+    }
+    if (locus_batch_text(ui, font, text, x, y, fontSize, red, green, blue, alpha)) {
+        return;
+    }
+
+    locus_batch_begin_nvg(ui);
+    nvgBeginPath(ui->vg);
+    nvgFontFaceId(ui->vg, ui->fonts[font].handle);
+    nvgFontSize(ui->vg, fontSize);
+    nvgTextAlign(ui->vg, NVG_ALIGN_LEFT | NVG_ALIGN_BASELINE);
+    nvgFillColor(ui->vg, nvgRGBA(red, green, blue, (int)(alpha * 255)));
+    nvgText(ui->vg, x, y, text, NULL);
+}
+
+void locus_text_cache_stats(LocusUI* ui, unsigned long* hits, unsigned long* misses, int* entries) {
+    if (hits) {
+        *hits = ui->text_hits;
+    }
+    if (misses) {
+        *misses = ui->text_misses;
+    }
+    if (entries) {
+        *entries = ui->text_run_count;
+    }
+}
+
+void locus_text_cache_trim(LocusUI* ui) {
+    locus_text_layout_trim(ui);
+    if (ui->text_run_count <= LOCUS_TEXT_CACHE_SIZE) {
+        return;
+    }
+
+    for (int i = 0; i < LOCUS_TEXT_CACHE_SIZE; i++) {
+        LocusTextRun** link = &ui->text_buckets[i];
+        while (*link) {
+            LocusTextRun* run = *link;
+            if (ui->frame - run->last_used > LOCUS_TEXT_RUN_MAX_AGE) {
+                *link = run->next;
+                free_run(run);
+                ui->text_run_count--;
+            } else {
+                link = &run->next;
+            }
+        }
+    }
+}
+
+void locus_text_cache_clear(LocusUI* ui) {
+    locus_text_layout_clear(ui);
+    for (int i = 0; i < LOCUS_TEXT_CACHE_SIZE; i++) {
+        LocusTextRun* run = ui->text_buckets[i];
+        while (run) {
+            LocusTextRun* next = run->next;
+            free_run(run);
+            run = next;
+        }
+        ui->text_buckets[i] = NULL;
+    }
+    ui->text_run_count = 0;
+}
+
+void locus_font_cleanup(LocusUI* ui) {
+    locus_text_cache_clear(ui);
+    for (int i = 0; i < ui->font_count; i++) {
+        munmap(ui->fonts[i].data, ui->fonts[i].size);
+        ui->fonts[i].data = NULL;
+        locus_soft_font_free(&ui->fonts[i]);
+    }
+    ui->font_count = 0;
+    ui->default_font = -1;
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include "locus.h"
+#include "locus-ui.h"
+
+#define LOCUS_HUD_TEXT_HEIGHT 16.0f
+#define LOCUS_HUD_BAR_WIDTH 2.0f
+#define LOCUS_HUD_BAR_STEP 3.0f
+
+/* Frame-time graph from locus_timing_frames(), spanning twice the
+ * refresh budget. The app has to damage the area for it to update. */
+void locus_timing_hud(LocusUI* ui, float x, float y, float width, float height) {
+    LocusFrameTiming frames[256];
+    char label[96];
+
+    if (ui->app == NULL || ui->app->timing == NULL) {
+        return;
+    }
+
+    locus_rectangle(ui, x, y, width, height, 0, 0, 0, 0.6f, 4.0f);
+
+    LocusTimingStats total, gpu;
+    locus_timing_stats(ui->app, LOCUS_TIMING_TOTAL, &total);
+    locus_timing_stats(ui->app, LOCUS_TIMING_GPU, &gpu);
+    if (gpu.count) {
+        snprintf(label, sizeof(label), "p50 %.1f  p99 %.1f  gpu %.1f ms", total.p50 / 1e6,
+                 total.p99 / 1e6, gpu.p50 / 1e6);
+    } else {
+        snprintf(label, sizeof(label), "p50 %.1f  p99 %.1f ms", total.p50 / 1e6, total.p99 / 1e6);
+    }
+    locus_text(ui, label, x + 4.0f, y + LOCUS_HUD_TEXT_HEIGHT - 4.0f, 12.0f, 255, 255, 255, 0.9f);
+
+    float graph_x = x + 4.0f;
+    float graph_bottom = y + height - 4.0f;
+    float graph_height = height - LOCUS_HUD_TEXT_HEIGHT - 8.0f;
+    int max = (int)((width - 8.0f) / LOCUS_HUD_BAR_STEP);
+    if (graph_height <= 0.0f || max <= 0) {
+        return;
+    }
+    if (max > 256) {
+        max = 256;
+    }
+
+    double budget = locus_frame_interval_us(ui->app) * 1000.0;
+    float scale = graph_height / (float)(budget * 2.0);
+    locus_rectangle(ui, graph_x, graph_bottom - (float)budget * scale, width - 8.0f, 1.0f,
+                    255, 255, 255, 0.4f, 0.0f);
+
+    int count = locus_timing_frames(ui->app, frames, max);
+    for (int i = 0; i < count; i++) {
+        const uint64_t* phase = frames[i].phase;
+        float bar_x = graph_x + i * LOCUS_HUD_BAR_STEP;
+        float bar = phase[LOCUS_TIMING_TOTAL] * scale;
+        bar = bar < graph_height ? bar : graph_height;
+
+        if (phase[LOCUS_TIMING_TOTAL] <= budget * 0.75) {
+            locus_rectangle(ui, bar_x, graph_bottom - bar, LOCUS_HUD_BAR_WIDTH, bar, 80, 200, 120, 0.9f, 0.0f);
+        } else if (phase[LOCUS_TIMING_TOTAL] <= budget) {
+            locus_rectangle(ui, bar_x, graph_bottom - bar, LOCUS_HUD_BAR_WIDTH, bar, 230, 190, 60, 0.9f, 0.0f);
+        } else {
+            locus_rectangle(ui, bar_x, graph_bottom - bar, LOCUS_HUD_BAR_WIDTH, bar, 230, 70, 60, 0.9f, 0.0f);
+        }
+
+        if (phase[LOCUS_TIMING_GPU]) {
+            float tick = phase[LOCUS_TIMING_GPU] * scale;
+            tick = tick < graph_height ? tick : graph_height;
+            locus_rectangle(ui, bar_x, graph_bottom - tick - 1.0f, LOCUS_HUD_BAR_WIDTH, 2.0f,
+                            90, 170, 255, 1.0f, 0.0f);
+        }
+    }
+}
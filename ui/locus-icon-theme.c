@@ -0,0 +1,946 @@
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "locus-ui-private.h"
+
+#define LOCUS_ICON_CACHE_MAGIC "LOCUS-ICON-CACHE 2"
+#define LOCUS_ICON_RESOLVED_MAGIC "LOCUS-ICON-RESOLVED 2"
+#define LOCUS_ICON_MAX_BASES 32
+
+/* Flat SVG directories searched before any theme, in this order. */
+static const char* legacy_dirs[] = {
+    "/home/droidian/temp/Fluent-grey-dark/scalable/apps",
+    "/home/droidian/temp/McMojave-circle-blue-light/apps/scalable",
+    "/home/droidian/temp/McMojave-circle-blue-dark/apps/symbolic",
+    "/home/droidian/temp/McMojave-circle-blue-dark/actions/symbolic",
+    "/home/droidian/temp/Fluent-grey-dark/symbolic/apps",
+    "/home/droidian/temp/Fluent-grey-dark/symbolic/actions",
+    "/usr/share/icons/hicolor/scalable/apps",
+};
+
+typedef struct {
+    char* bases[LOCUS_ICON_MAX_BASES];
+    int count;
+} BaseDirs;
+
+static void add_base(BaseDirs* bases, const char* dir, const char* suffix) {
+    if (bases->count == LOCUS_ICON_MAX_BASES || dir == NULL || dir[0] == '\0') {
+        return;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", dir, suffix);
+    for (int i = 0; i < bases->count; i++) {
+        if (strcmp(bases->bases[i], path) == 0) {
+            return;
+        }
+    }
+    bases->bases[bases->count++] = strdup(path);
+}
+
+static void add_base_list(BaseDirs* bases, const char* list, const char* suffix) {
+    char* copy = strdup(list);
+    char* saveptr = NULL;
+    for (char* dir = strtok_r(copy, ":", &saveptr); dir; dir = strtok_r(NULL, ":", &saveptr)) {
+        add_base(bases, dir, suffix);
+    }
+    free(copy);
+}
+
+static void collect_bases(BaseDirs* bases) {
+    const char* home = getenv("HOME");
+    const char* extra = getenv("LOCUS_ICON_PATH");
+    const char* data_home = getenv("XDG_DATA_HOME");
+    const char* data_dirs = getenv("XDG_DATA_DIRS");
+    char path[PATH_MAX];
+
+    bases->count = 0;
+    if (extra) {
+        add_base_list(bases, extra, "");
+    }
+    if (home) {
+        add_base(bases, home, "/.icons");
+    }
+    if (data_home && data_home[0]) {
+        add_base(bases, data_home, "/icons");
+    } else if (home) {
+        snprintf(path, sizeof(path), "%s/.local/share", home);
+        add_base(bases, path, "/icons");
+    }
+    add_base_list(bases, data_dirs && data_dirs[0] ? data_dirs : "/usr/local/share:/usr/share", "/icons");
+}
+
+static void free_bases(BaseDirs* bases) {
+    for (int i = 0; i < bases->count; i++) {
+        free(bases->bases[i]);
+    }
+    bases->count = 0;
+}
+
+static char* trim(char* str) {
+    while (*str == ' ' || *str == '\t') {
+        str++;
+    }
+    char* end = str + strlen(str);
+    while (end > str && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) {
+        *--end = '\0';
+    }
+    return str;
+}
+
+static int add_theme(LocusIconTheme* theme, const char* name) {
+    for (int i = 0; i < theme->theme_count; i++) {
+        if (strcmp(theme->themes[i], name) == 0) {
+            return i;
+        }
+    }
+
+    char** themes = realloc(theme->themes, (theme->theme_count + 1) * sizeof(*themes));
+    if (themes == NULL) {
+        return -1;
+    }
+    theme->themes = themes;
+    theme->themes[theme->theme_count] = strdup(name);
+    return theme->theme_count++;
+}
+
+static int add_stamp(LocusIconTheme* theme, const char* path) {
+    if (theme->stamp_count == theme->stamp_capacity) {
+        int capacity = theme->stamp_capacity ? theme->stamp_capacity * 2 : 64;
+        LocusIconStamp* stamps = realloc(theme->stamps, capacity * sizeof(*stamps));
+        if (stamps == NULL) {
+            return 0;
+        }
+        theme->stamps = stamps;
+        theme->stamp_capacity = capacity;
+    }
+
+    LocusIconStamp* stamp = &theme->stamps[theme->stamp_count++];
+    struct stat st;
+    stamp->path = strdup(path);
+    if (stat(path, &st) == 0) {
+        stamp->mtime_sec = st.st_mtim.tv_sec;
+        stamp->mtime_nsec = st.st_mtim.tv_nsec;
+        return 1;
+    }
+    stamp->mtime_sec = 0;
+    stamp->mtime_nsec = 0;
+    return 0;
+}
+
+static int add_dir(LocusIconTheme* theme, const LocusIconDir* dir) {
+    if (theme->dir_count == theme->dir_capacity) {
+        int capacity = theme->dir_capacity ? theme->dir_capacity * 2 : 64;
+        LocusIconDir* dirs = realloc(theme->dirs, capacity * sizeof(*dirs));
+        if (dirs == NULL) {
+            return -1;
+        }
+        theme->dirs = dirs;
+        theme->dir_capacity = capacity;
+    }
+
+    theme->dirs[theme->dir_count] = *dir;
+    return theme->dir_count++;
+}
+
+static int add_entry(LocusIconTheme* theme, const char* name, size_t len, int dir, int svg) {
+    if (theme->entry_count == theme->entry_capacity) {
+        int capacity = theme->entry_capacity ? theme->entry_capacity * 2 : 1024;
+        LocusIconEntry* entries = realloc(theme->entries, capacity * sizeof(*entries));
+        if (entries == NULL) {
+            return 0;
+        }
+        theme->entries = entries;
+        theme->entry_capacity = capacity;
+    }
+
+    LocusIconEntry* entry = &theme->entries[theme->entry_count++];
+    entry->name = strndup(name, len);
+    entry->hash = locus_hash_bytes(name, len, 0);
+    entry->dir = dir;
+    entry->svg = svg;
+    entry->next = -1;
+    return 1;
+}
+
+static void scan_dir(LocusIconTheme* theme, int dir, int png) {
+    DIR* d = opendir(theme->dirs[dir].path);
+    if (d == NULL) {
+        return;
+    }
+
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        if (len > 4 && strcmp(ent->d_name + len - 4, ".svg") == 0) {
+            add_entry(theme, ent->d_name, len - 4, dir, 1);
+        } else if (png && len > 4 && strcmp(ent->d_name + len - 4, ".png") == 0) {
+            add_entry(theme, ent->d_name, len - 4, dir, 0);
+        }
+    }
+    closedir(d);
+}
+
+/* Parses index.theme of a theme found under base, adding its inherited themes
+ * to the chain and its size directories to the index. */
+static void load_theme_dirs(LocusIconTheme* theme, BaseDirs* bases, int theme_index) {
+    const char* name = theme->themes[theme_index];
+    char path[PATH_MAX];
+    FILE* index = NULL;
+
+    for (int i = 0; i < bases->count && index == NULL; i++) {
+        snprintf(path, sizeof(path), "%s/%s/index.theme", bases->bases[i], name);
+        index = fopen(path, "r");
+    }
+
+    char line[4096];
+    char section[256] = "";
+    char* directories = NULL;
+    LocusIconDir* subdirs = NULL;
+    int subdir_count = 0;
+    LocusIconDir* current = NULL;
+
+    while (index && fgets(line, sizeof(line), index)) {
+        char* str = trim(line);
+        if (str[0] == '#' || str[0] == '\0') {
+            continue;
+        }
+
+        if (str[0] == '[') {
+            char* end = strchr(str, ']');
+            if (end) {
+                *end = '\0';
+            }
+            snprintf(section, sizeof(section), "%s", str + 1);
+            current = NULL;
+            if (strcmp(section, "Icon Theme") != 0) {
+                LocusIconDir* resized = realloc(subdirs, (subdir_count + 1) * sizeof(*subdirs));
+                if (resized) {
+                    subdirs = resized;
+                    current = &subdirs[subdir_count++];
+                    memset(current, 0, sizeof(*current));
+                    current->path = strdup(section);
+                    current->theme = theme_index;
+                    current->type = LOCUS_ICON_DIR_THRESHOLD;
+                    current->threshold = 2;
+                    current->scale = 1;
+                    current->min_size = current->max_size = -1;
+                }
+            }
+            continue;
+        }
+
+        char* eq = strchr(str, '=');
+        if (eq == NULL) {
+            continue;
+        }
+        *eq = '\0';
+        char* key = trim(str);
+        char* value = trim(eq + 1);
+
+        if (strcmp(section, "Icon Theme") == 0) {
+            if (strcmp(key, "Inherits") == 0) {
+                char* saveptr = NULL;
+                for (char* parent = strtok_r(value, ",", &saveptr); parent;
+                     parent = strtok_r(NULL, ",", &saveptr)) {
+                    parent = trim(parent);
+                    if (strcmp(parent, "hicolor") != 0) {
+                        add_theme(theme, parent);
+                    }
+                }
+            } else if (strcmp(key, "Directories") == 0 || strcmp(key, "ScaledDirectories") == 0) {
+                size_t len = directories ? strlen(directories) : 0;
+                char* joined = realloc(directories, len + strlen(value) + 2);
+                if (joined) {
+                    directories = joined;
+                    snprintf(directories + len, strlen(value) + 2, "%s%s", len ? "," : "", value);
+                }
+            }
+        } else if (current) {
+            if (strcmp(key, "Size") == 0) {
+                current->size = atoi(value);
+            } else if (strcmp(key, "Scale") == 0) {
+                current->scale = atoi(value);
+            } else if (strcmp(key, "MinSize") == 0) {
+                current->min_size = atoi(value);
+            } else if (strcmp(key, "MaxSize") == 0) {
+                current->max_size = atoi(value);
+            } else if (strcmp(key, "Threshold") == 0) {
+                current->threshold = atoi(value);
+            } else if (strcmp(key, "Type") == 0) {
+                if (strcmp(value, "Fixed") == 0) {
+                    current->type = LOCUS_ICON_DIR_FIXED;
+                } else if (strcmp(value, "Scalable") == 0) {
+                    current->type = LOCUS_ICON_DIR_SCALABLE;
+                }
+            }
+        }
+    }
+    if (index) {
+        fclose(index);
+    }
+
+    char* saveptr = NULL;
+    for (char* subdir = directories ? strtok_r(directories, ",", &saveptr) : NULL; subdir;
+         subdir = strtok_r(NULL, ",", &saveptr)) {
+        subdir = trim(subdir);
+        LocusIconDir* info = NULL;
+        for (int i = 0; i < subdir_count; i++) {
+            if (strcmp(subdirs[i].path, subdir) == 0) {
+                info = &subdirs[i];
+                break;
+            }
+        }
+        if (info == NULL) {
+            continue;
+        }
+
+        if (info->min_size < 0) {
+            info->min_size = info->size;
+        }
+        if (info->max_size < 0) {
+            info->max_size = info->size;
+        }
+
+        for (int i = 0; i < bases->count; i++) {
+            struct stat st;
+            snprintf(path, sizeof(path), "%s/%s", bases->bases[i], name);
+            if (stat(path, &st) < 0) {
+                continue;
+            }
+
+            snprintf(path, sizeof(path), "%s/%s/%s", bases->bases[i], name, subdir);
+            if (!add_stamp(theme, path)) {
+                continue;
+            }
+
+            LocusIconDir dir = *info;
+            dir.path = strdup(path);
+            int index_dir = add_dir(theme, &dir);
+            if (index_dir >= 0) {
+                scan_dir(theme, index_dir, 1);
+            } else {
+                free(dir.path);
+            }
+        }
+    }
+
+    for (int i = 0; i < subdir_count; i++) {
+        free(subdirs[i].path);
+    }
+    free(subdirs);
+    free(directories);
+}
+
+static void build_index(LocusIconTheme* theme, BaseDirs* bases) {
+    char path[PATH_MAX];
+    int legacy_count = sizeof(legacy_dirs) / sizeof(legacy_dirs[0]);
+
+    for (int i = 0; i < legacy_count; i++) {
+        LocusIconDir legacy = {
+            .theme = i - legacy_count,
+            .type = LOCUS_ICON_DIR_SCALABLE,
+            .scale = 1,
+            .max_size = INT_MAX,
+        };
+        if (add_stamp(theme, legacy_dirs[i])) {
+            legacy.path = strdup(legacy_dirs[i]);
+            int dir = add_dir(theme, &legacy);
+            if (dir >= 0) {
+                scan_dir(theme, dir, 0);
+            } else {
+                free(legacy.path);
+            }
+        }
+    }
+
+    add_theme(theme, theme->theme);
+    for (int t = 0; t < theme->theme_count; t++) {
+        for (int i = 0; i < bases->count; i++) {
+            snprintf(path, sizeof(path), "%s/%s", bases->bases[i], theme->themes[t]);
+            add_stamp(theme, path);
+        }
+        load_theme_dirs(theme, bases, t);
+        if (t == theme->theme_count - 1) {
+            add_theme(theme, "hicolor");
+        }
+    }
+
+    LocusIconDir pixmaps = {
+        .theme = theme->theme_count,
+        .type = LOCUS_ICON_DIR_SCALABLE,
+        .scale = 1,
+        .max_size = INT_MAX,
+    };
+    if (add_stamp(theme, "/usr/share/pixmaps")) {
+        pixmaps.path = strdup("/usr/share/pixmaps");
+        int dir = add_dir(theme, &pixmaps);
+        if (dir >= 0) {
+            scan_dir(theme, dir, 1);
+        } else {
+            free(pixmaps.path);
+        }
+    }
+}
+
+static uint64_t bases_hash(BaseDirs* bases) {
+    uint64_t hash = 0;
+    for (int i = 0; i < bases->count; i++) {
+        hash = locus_hash_string(bases->bases[i], hash);
+        hash = locus_hash_bytes(":", 1, hash);
+    }
+    return hash;
+}
+
+static int cache_path(const char* kind, const char* theme, char* path, size_t size, int create) {
+    char name[256];
+    snprintf(name, sizeof(name), "%s-%s.cache", kind, theme);
+    return locus_cache_path(name, path, size, create);
+}
+
+static void write_cache(LocusIconTheme* theme, BaseDirs* bases) {
+    char path[PATH_MAX];
+    char tmp[PATH_MAX + 8];
+    if (!cache_path("icon-theme", theme->theme, path, sizeof(path), 1)) {
+        return;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        return;
+    }
+
+    FILE* out = fdopen(fd, "w");
+    if (out == NULL) {
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+
+    fprintf(out, "%s\n", LOCUS_ICON_CACHE_MAGIC);
+    fprintf(out, "bases %llu\n", (unsigned long long)bases_hash(bases));
+    for (int i = 0; i < theme->theme_count; i++) {
+        fprintf(out, "theme %s\n", theme->themes[i]);
+    }
+    for (int i = 0; i < theme->stamp_count; i++) {
+        LocusIconStamp* stamp = &theme->stamps[i];
+        fprintf(out, "stamp %lld %ld %s\n", (long long)stamp->mtime_sec, stamp->mtime_nsec, stamp->path);
+    }
+    for (int i = 0; i < theme->dir_count; i++) {
+        LocusIconDir* dir = &theme->dirs[i];
+        fprintf(out, "dir %d %d %d %d %d %d %d %s\n", dir->theme, dir->type, dir->size,
+                dir->min_size, dir->max_size, dir->threshold, dir->scale, dir->path);
+    }
+    for (int i = 0; i < theme->entry_count; i++) {
+        LocusIconEntry* entry = &theme->entries[i];
+        fprintf(out, "icon %d %d %s\n", entry->dir, entry->svg, entry->name);
+    }
+
+    if (fclose(out) != 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+    }
+}
+
+static int stamp_valid(const LocusIconStamp* stamp) {
+    struct stat st;
+    if (stat(stamp->path, &st) < 0) {
+        return stamp->mtime_sec == 0 && stamp->mtime_nsec == 0;
+    }
+    return st.st_mtim.tv_sec == stamp->mtime_sec && st.st_mtim.tv_nsec == stamp->mtime_nsec;
+}
+
+static int read_cache(LocusIconTheme* theme, BaseDirs* bases) {
+    char path[PATH_MAX];
+    if (!cache_path("icon-theme", theme->theme, path, sizeof(path), 0)) {
+        return 0;
+    }
+
+    FILE* in = fopen(path, "r");
+    if (in == NULL) {
+        return 0;
+    }
+
+    char line[PATH_MAX + 128];
+    int valid = fgets(line, sizeof(line), in) && strcmp(trim(line), LOCUS_ICON_CACHE_MAGIC) == 0;
+
+    while (valid && fgets(line, sizeof(line), in)) {
+        char* str = trim(line);
+        int offset = 0;
+
+        if (strncmp(str, "bases ", 6) == 0) {
+            valid = strtoull(str + 6, NULL, 10) == bases_hash(bases);
+        } else if (strncmp(str, "theme ", 6) == 0) {
+            valid = add_theme(theme, str + 6) >= 0;
+        } else if (strncmp(str, "stamp ", 6) == 0) {
+            long long sec;
+            long nsec;
+            if (sscanf(str, "stamp %lld %ld %n", &sec, &nsec, &offset) != 2 || offset == 0) {
+                valid = 0;
+                break;
+            }
+            LocusIconStamp stamp = { .path = str + offset, .mtime_sec = sec, .mtime_nsec = nsec };
+            valid = stamp_valid(&stamp);
+            if (valid && theme->stamp_count == theme->stamp_capacity) {
+                int capacity = theme->stamp_capacity ? theme->stamp_capacity * 2 : 64;
+                LocusIconStamp* stamps = realloc(theme->stamps, capacity * sizeof(*stamps));
+                valid = stamps != NULL;
+                if (valid) {
+                    theme->stamps = stamps;
+                    theme->stamp_capacity = capacity;
+                }
+            }
+            if (valid) {
+                stamp.path = strdup(stamp.path);
+                theme->stamps[theme->stamp_count++] = stamp;
+            }
+        } else if (strncmp(str, "dir ", 4) == 0) {
+            LocusIconDir dir;
+            if (sscanf(str, "dir %d %d %d %d %d %d %d %n", &dir.theme, &dir.type, &dir.size,
+                       &dir.min_size, &dir.max_size, &dir.threshold, &dir.scale, &offset) != 7 ||
+                offset == 0) {
+                valid = 0;
+                break;
+            }
+            dir.path = strdup(str + offset);
+            valid = add_dir(theme, &dir) >= 0;
+        } else if (strncmp(str, "icon ", 5) == 0) {
+            int dir, svg;
+            if (sscanf(str, "icon %d %d %n", &dir, &svg, &offset) != 2 || offset == 0 ||
+                dir < 0 || dir >= theme->dir_count) {
+                valid = 0;
+                break;
+            }
+            valid = add_entry(theme, str + offset, strlen(str + offset), dir, svg);
+        }
+    }
+
+    fclose(in);
+    return valid && theme->theme_count > 0;
+}
+
+static void build_buckets(LocusIconTheme* theme) {
+    int count = 256;
+    while (count < theme->entry_count) {
+        count *= 2;
+    }
+
+    free(theme->buckets);
+    theme->buckets = malloc(count * sizeof(*theme->buckets));
+    if (theme->buckets == NULL) {
+        theme->bucket_count = 0;
+        return;
+    }
+    theme->bucket_count = count;
+    memset(theme->buckets, 0xff, count * sizeof(*theme->buckets));
+
+    /* Insert in reverse so each chain keeps index order, which is the lookup
+     * order the icon theme specification prescribes. */
+    for (int i = theme->entry_count - 1; i >= 0; i--) {
+        LocusIconEntry* entry = &theme->entries[i];
+        int bucket = entry->hash & (count - 1);
+        entry->next = theme->buckets[bucket];
+        theme->buckets[bucket] = i;
+    }
+}
+
+static void reset_theme(LocusIconTheme* theme) {
+    for (int i = 0; i < theme->theme_count; i++) {
+        free(theme->themes[i]);
+    }
+    for (int i = 0; i < theme->dir_count; i++) {
+        free(theme->dirs[i].path);
+    }
+    for (int i = 0; i < theme->entry_count; i++) {
+        free(theme->entries[i].name);
+    }
+    for (int i = 0; i < theme->stamp_count; i++) {
+        free(theme->stamps[i].path);
+    }
+    free(theme->themes);
+    free(theme->dirs);
+    free(theme->entries);
+    free(theme->stamps);
+    free(theme->buckets);
+
+    /* The name and the resolved lookups outlive a reload of the index. */
+    LocusIconTheme kept = *theme;
+    memset(theme, 0, sizeof(*theme));
+    memcpy(theme->theme, kept.theme, sizeof(theme->theme));
+    theme->resolved = kept.resolved;
+    theme->resolved_count = kept.resolved_count;
+    theme->resolved_capacity = kept.resolved_capacity;
+    theme->resolved_buckets = kept.resolved_buckets;
+    theme->resolved_bucket_count = kept.resolved_bucket_count;
+    theme->resolved_loaded = kept.resolved_loaded;
+    theme->resolved_dirty = kept.resolved_dirty;
+}
+
+static void reset_resolved(LocusIconTheme* theme) {
+    for (int i = 0; i < theme->resolved_count; i++) {
+        free(theme->resolved[i].name);
+        free(theme->resolved[i].path);
+    }
+    free(theme->resolved);
+    free(theme->resolved_buckets);
+    theme->resolved = NULL;
+    theme->resolved_buckets = NULL;
+    theme->resolved_count = theme->resolved_capacity = theme->resolved_bucket_count = 0;
+    theme->resolved_loaded = theme->resolved_dirty = 0;
+}
+
+static LocusIconResolved* find_resolved(LocusIconTheme* theme, const char* name, int size, int scale) {
+    if (theme->resolved_bucket_count == 0) {
+        return NULL;
+    }
+
+    uint64_t hash = locus_hash_string(name, 0);
+    int bucket = hash & (theme->resolved_bucket_count - 1);
+    for (int i = theme->resolved_buckets[bucket]; i >= 0; i = theme->resolved[i].next) {
+        LocusIconResolved* resolved = &theme->resolved[i];
+        if (resolved->hash == hash && resolved->size == size && resolved->scale == scale &&
+            strcmp(resolved->name, name) == 0) {
+            resolved->used = 1;
+            return resolved;
+        }
+    }
+    return NULL;
+}
+
+/* The table has as many buckets as the array has room for entries. */
+static int build_resolved_buckets(LocusIconTheme* theme) {
+    int count = theme->resolved_capacity;
+    int* buckets = malloc(count * sizeof(*buckets));
+    if (buckets == NULL) {
+        return 0;
+    }
+    memset(buckets, 0xff, count * sizeof(*buckets));
+    for (int i = 0; i < theme->resolved_count; i++) {
+        LocusIconResolved* resolved = &theme->resolved[i];
+        int bucket = resolved->hash & (count - 1);
+        resolved->next = buckets[bucket];
+        buckets[bucket] = i;
+    }
+
+    free(theme->resolved_buckets);
+    theme->resolved_buckets = buckets;
+    theme->resolved_bucket_count = count;
+    return 1;
+}
+
+/* Entries read from the cache start out unused; only those looked up in
+ * this run are written back. */
+static int add_resolved(LocusIconTheme* theme, const char* name, int size, int scale, int kind,
+                        const char* path, int used) {
+    if (theme->resolved_count == theme->resolved_capacity) {
+        int capacity = theme->resolved_capacity ? theme->resolved_capacity * 2 : 64;
+        LocusIconResolved* resolved = realloc(theme->resolved, capacity * sizeof(*resolved));
+        if (resolved == NULL) {
+            return 0;
+        }
+        theme->resolved = resolved;
+        theme->resolved_capacity = capacity;
+        if (!build_resolved_buckets(theme)) {
+            return 0;
+        }
+    }
+
+    LocusIconResolved* resolved = &theme->resolved[theme->resolved_count];
+    resolved->name = strdup(name);
+    resolved->path = strdup(path);
+    if (resolved->name == NULL || resolved->path == NULL) {
+        free(resolved->name);
+        free(resolved->path);
+        return 0;
+    }
+    resolved->hash = locus_hash_string(name, 0);
+    resolved->size = size;
+    resolved->scale = scale;
+    resolved->kind = kind;
+    resolved->used = used;
+
+    int bucket = resolved->hash & (theme->resolved_bucket_count - 1);
+    resolved->next = theme->resolved_buckets[bucket];
+    theme->resolved_buckets[bucket] = theme->resolved_count++;
+    return 1;
+}
+
+/* Lookups from earlier runs, valid under the same stamps as the index, so
+ * that an app that only needs a handful of icons doesn't parse the whole
+ * index at startup. */
+static void read_resolved(LocusIconTheme* theme) {
+    char path[PATH_MAX];
+    BaseDirs bases;
+
+    theme->resolved_loaded = 1;
+    if (!cache_path("icon-resolved", theme->theme, path, sizeof(path), 0)) {
+        return;
+    }
+    FILE* in = fopen(path, "r");
+    if (in == NULL) {
+        return;
+    }
+
+    collect_bases(&bases);
+    char line[2 * PATH_MAX];
+    int valid = fgets(line, sizeof(line), in) && strcmp(trim(line), LOCUS_ICON_RESOLVED_MAGIC) == 0;
+
+    while (valid && fgets(line, sizeof(line), in)) {
+        char* str = trim(line);
+        int offset = 0;
+
+        if (strncmp(str, "bases ", 6) == 0) {
+            valid = strtoull(str + 6, NULL, 10) == bases_hash(&bases);
+        } else if (strncmp(str, "stamp ", 6) == 0) {
+            long long sec;
+            long nsec;
+            if (sscanf(str, "stamp %lld %ld %n", &sec, &nsec, &offset) != 2 || offset == 0) {
+                valid = 0;
+                break;
+            }
+            LocusIconStamp stamp = { .path = str + offset, .mtime_sec = sec, .mtime_nsec = nsec };
+            valid = stamp_valid(&stamp);
+        } else if (strncmp(str, "icon ", 5) == 0) {
+            char name[256];
+            int size, scale, kind;
+            if (sscanf(str, "icon %d %d %d %255s %n", &size, &scale, &kind, name, &offset) != 4) {
+                valid = 0;
+                break;
+            }
+            valid = add_resolved(theme, name, size, scale, kind, offset ? str + offset : "", 0);
+        }
+    }
+
+    fclose(in);
+    free_bases(&bases);
+    if (!valid) {
+        reset_resolved(theme);
+        theme->resolved_loaded = 1;
+    }
+}
+
+static void write_resolved(LocusIconTheme* theme) {
+    char path[PATH_MAX];
+    char tmp[PATH_MAX + 8];
+    BaseDirs bases;
+
+    if (!cache_path("icon-resolved", theme->theme, path, sizeof(path), 1)) {
+        return;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        return;
+    }
+    FILE* out = fdopen(fd, "w");
+    if (out == NULL) {
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+
+    collect_bases(&bases);
+    fprintf(out, "%s\n", LOCUS_ICON_RESOLVED_MAGIC);
+    fprintf(out, "bases %llu\n", (unsigned long long)bases_hash(&bases));
+    free_bases(&bases);
+    for (int i = 0; i < theme->stamp_count; i++) {
+        LocusIconStamp* stamp = &theme->stamps[i];
+        fprintf(out, "stamp %lld %ld %s\n", (long long)stamp->mtime_sec, stamp->mtime_nsec, stamp->path);
+    }
+    for (int i = 0; i < theme->resolved_count; i++) {
+        LocusIconResolved* resolved = &theme->resolved[i];
+        if (!resolved->used) {
+            continue;
+        }
+        fprintf(out, "icon %d %d %d %s %s\n", resolved->size, resolved->scale, resolved->kind,
+                resolved->name, resolved->path);
+    }
+
+    if (fclose(out) != 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+    }
+    theme->resolved_dirty = 0;
+}
+
+static const char* theme_name(const char* name) {
+    if (name == NULL) {
+        name = getenv("LOCUS_ICON_THEME");
+    }
+    if (name == NULL || name[0] == '\0' || strchr(name, '/')) {
+        name = "hicolor";
+    }
+    return name;
+}
+
+int locus_icon_theme_load(LocusUI* ui, const char* name) {
+    LocusIconTheme* theme = &ui->icon_theme;
+    BaseDirs bases;
+
+    name = theme_name(name);
+    if (strcmp(theme->theme, name) != 0) {
+        reset_resolved(theme);
+    }
+
+    reset_theme(theme);
+    snprintf(theme->theme, sizeof(theme->theme), "%s", name);
+    collect_bases(&bases);
+
+    if (!read_cache(theme, &bases)) {
+        reset_theme(theme);
+        build_index(theme, &bases);
+        write_cache(theme, &bases);
+    }
+
+    free_bases(&bases);
+    build_buckets(theme);
+    theme->loaded = 1;
+    return theme->entry_count > 0;
+}
+
+static int dir_matches(const LocusIconDir* dir, int size, int scale) {
+    if (dir->scale != scale) {
+        return 0;
+    }
+    switch (dir->type) {
+    case LOCUS_ICON_DIR_FIXED:
+        return dir->size == size;
+    case LOCUS_ICON_DIR_SCALABLE:
+        return dir->min_size <= size && size <= dir->max_size;
+    default:
+        return dir->size - dir->threshold <= size && size <= dir->size + dir->threshold;
+    }
+}
+
+static int dir_distance(const LocusIconDir* dir, int size, int scale) {
+    int target = size * scale;
+    int low, high;
+
+    switch (dir->type) {
+    case LOCUS_ICON_DIR_FIXED:
+        return abs(dir->size * dir->scale - target);
+    case LOCUS_ICON_DIR_SCALABLE:
+        low = dir->min_size * dir->scale;
+        high = dir->max_size * dir->scale;
+        break;
+    default:
+        low = (dir->size - dir->threshold) * dir->scale;
+        high = (dir->size + dir->threshold) * dir->scale;
+        break;
+    }
+
+    if (target < low) {
+        return low - target;
+    }
+    if (target > high) {
+        return target - high;
+    }
+    return 0;
+}
+
+static const LocusIconEntry* find_icon(LocusIconTheme* theme, const char* name, size_t len,
+                                       int size, int scale) {
+    if (theme->bucket_count == 0) {
+        return NULL;
+    }
+
+    uint64_t hash = locus_hash_bytes(name, len, 0);
+    const LocusIconEntry* best = NULL;
+    int best_theme = INT_MAX, best_exact = 0, best_distance = INT_MAX;
+
+    for (int i = theme->buckets[hash & (theme->bucket_count - 1)]; i >= 0; i = theme->entries[i].next) {
+        const LocusIconEntry* entry = &theme->entries[i];
+        if (entry->hash != hash || strncmp(entry->name, name, len) != 0 || entry->name[len] != '\0') {
+            continue;
+        }
+
+        const LocusIconDir* dir = &theme->dirs[entry->dir];
+        if (dir->theme > best_theme) {
+            continue;
+        }
+
+        int exact = dir->theme < 0 || dir->theme == theme->theme_count || dir_matches(dir, size, scale);
+        int distance = exact ? 0 : dir_distance(dir, size, scale);
+        if (dir->theme < best_theme || (exact && !best_exact) ||
+            (!exact && !best_exact && distance < best_distance)) {
+            best = entry;
+            best_theme = dir->theme;
+            best_exact = exact;
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+int locus_icon_theme_lookup(LocusUI* ui, const char* icon_name, int size, int scale,
+                            char* path, size_t path_size) {
+    LocusIconTheme* theme = &ui->icon_theme;
+    if (scale < 1) {
+        scale = 1;
+    }
+    if (!theme->loaded && !theme->resolved_loaded) {
+        snprintf(theme->theme, sizeof(theme->theme), "%s", theme_name(NULL));
+    }
+    if (!theme->resolved_loaded) {
+        read_resolved(theme);
+    }
+
+    const LocusIconResolved* resolved = find_resolved(theme, icon_name, size, scale);
+    if (resolved) {
+        snprintf(path, path_size, "%s", resolved->path);
+        return resolved->kind;
+    }
+    if (!theme->loaded) {
+        locus_icon_theme_load(ui, NULL);
+    }
+
+    const char* suffix = "-symbolic";
+    size_t suffix_len = strlen(suffix);
+    size_t len = strlen(icon_name);
+    int symbolic = len > suffix_len && strcmp(icon_name + len - suffix_len, suffix) == 0;
+    const LocusIconEntry* entry = find_icon(theme, icon_name, len, size, scale);
+
+    /* Symbolic names fall back to the full-color icon, then to less specific
+     * names ("network-wireless-signal" -> "network-wireless"), as GTK does. */
+    size_t base_len = len;
+    if (entry == NULL && symbolic) {
+        base_len = len - suffix_len;
+        entry = find_icon(theme, icon_name, base_len, size, scale);
+    }
+    while (entry == NULL) {
+        while (base_len > 0 && icon_name[base_len - 1] != '-') {
+            base_len--;
+        }
+        if (base_len <= 1) {
+            break;
+        }
+        base_len--;
+        entry = find_icon(theme, icon_name, base_len, size, scale);
+    }
+
+    int kind = 0;
+    path[0] = '\0';
+    if (entry) {
+        snprintf(path, path_size, "%s/%s.%s", theme->dirs[entry->dir].path, entry->name,
+                 entry->svg ? "svg" : "png");
+        kind = entry->svg ? 2 : 1;
+    }
+    if (!strchr(icon_name, ' ') && strlen(icon_name) < 256 &&
+        add_resolved(theme, icon_name, size, scale, kind, path, 1)) {
+        theme->resolved_dirty = 1;
+    }
+    return kind;
+}
+
+void locus_icon_theme_cleanup(LocusUI* ui) {
+    if (ui->icon_theme.resolved_dirty && ui->icon_theme.loaded) {
+        write_resolved(&ui->icon_theme);
+    }
+    reset_resolved(&ui->icon_theme);
+    reset_theme(&ui->icon_theme);
+    ui->icon_theme.theme[0] = '\0';
+}
@@ -0,0 +1,328 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <nanovg.h>
+#include <stb_image.h>
+#include "locus.h"
+#include "locus-ui-private.h"
+
+#define LOCUS_THUMBNAIL_MAGIC "LOCUSTHM"
+#define LOCUS_THUMBNAIL_HEADER (8 + 4 * sizeof(uint32_t))
+#define LOCUS_IMAGE_MIN_SIZE 64
+#define LOCUS_IMAGE_MAX_SIZE 4096
+#define LOCUS_THUMBNAIL_BUDGET (256 * 1024 * 1024)
+
+/* Images are decoded at a power-of-two bucket of their drawn size and
+ * cached under $XDG_CACHE_HOME/locus as raw RGBA, keyed by path, mtime,
+ * size and bucket; the directory is kept within LOCUS_THUMBNAIL_BUDGET. */
+
+/* Returns the bucket for an image drawn in the given box, or 0 when it is
+ * drawn so large that the full image is wanted. */
+int locus_image_bucket(LocusUI* ui, float width, float height) {
+    float needed = (width > height ? width : height) * ui->pixel_ratio;
+    int bucket = LOCUS_IMAGE_MIN_SIZE;
+    while (bucket < needed && bucket < LOCUS_IMAGE_MAX_SIZE) {
+        bucket *= 2;
+    }
+    return bucket < needed ? 0 : bucket;
+}
+
+static int pow2_nearest(int value) {
+    int pow2 = 1;
+    while (pow2 < value) {
+        pow2 *= 2;
+    }
+    return pow2 - value > value - pow2 / 2 ? pow2 / 2 : pow2;
+}
+
+static int thumbnail_path(const char* path, int bucket, int pow2, char* out, size_t size, int create) {
+    char resolved[PATH_MAX];
+    struct stat st;
+    if (getenv("LOCUS_NO_THUMBNAIL_CACHE") || stat(path, &st) < 0) {
+        return 0;
+    }
+    if (realpath(path, resolved) == NULL) {
+        snprintf(resolved, sizeof(resolved), "%s", path);
+    }
+
+    int64_t stamp[3] = { st.st_mtim.tv_sec, st.st_mtim.tv_nsec, st.st_size };
+    uint64_t hash = locus_hash_string(resolved, 0);
+    uint32_t version = (uint32_t)locus_hash_bytes(stamp, sizeof(stamp), hash);
+
+    char name[80];
+    snprintf(name, sizeof(name), "thumbnail-%016llx-%08x-%d.rgba", (unsigned long long)hash, version,
+             bucket * 2 + pow2);
+    return locus_cache_path(name, out, size, create);
+}
+
+static int map_thumbnail(const char* path, LocusImageData* data) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > LOCUS_THUMBNAIL_HEADER) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        futimens(fd, NULL);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+
+    uint32_t header[4];
+    memcpy(header, (const char*)map + 8, sizeof(header));
+    if (memcmp(map, LOCUS_THUMBNAIL_MAGIC, 8) != 0 || header[0] == 0 || header[1] == 0 ||
+        header[0] > LOCUS_IMAGE_MAX_SIZE * 8 || header[1] > LOCUS_IMAGE_MAX_SIZE * 8 ||
+        (size_t)st.st_size != LOCUS_THUMBNAIL_HEADER + (size_t)header[0] * header[1] * 4) {
+        munmap(map, st.st_size);
+        unlink(path);
+        return 0;
+    }
+
+    data->pixels = (unsigned char*)map + LOCUS_THUMBNAIL_HEADER;
+    data->width = header[0];
+    data->height = header[1];
+    data->image_width = header[2];
+    data->image_height = header[3];
+    data->map = map;
+    data->map_size = st.st_size;
+    return 1;
+}
+
+typedef struct {
+    char name[80];
+    time_t used;
+    off_t size;
+} ThumbnailFile;
+
+static int compare_used(const void* a, const void* b) {
+    const ThumbnailFile* fa = a;
+    const ThumbnailFile* fb = b;
+    return fa->used < fb->used ? -1 : fa->used > fb->used;
+}
+
+/* Runs after each store. Names are thumbnail-<path>-<version>-<bucket>,
+ * so files of the same path with another version are stale. */
+static void prune_thumbnails(const char* path) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char* name = strrchr(dir, '/');
+    if (name == NULL) {
+        return;
+    }
+    *name++ = '\0';
+    size_t prefix = strlen("thumbnail-") + 16;
+    size_t versioned = prefix + 9;
+
+    DIR* handle = opendir(dir);
+    if (handle == NULL) {
+        return;
+    }
+    int dir_fd = dirfd(handle);
+    ThumbnailFile* files = NULL;
+    int count = 0, capacity = 0;
+    size_t total = 0;
+
+    struct dirent* entry;
+    while ((entry = readdir(handle)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (strncmp(entry->d_name, "thumbnail-", 10) != 0 || len < versioned || len >= sizeof(files->name) ||
+            strcmp(entry->d_name + len - 5, ".rgba") != 0 || strcmp(entry->d_name, name) == 0) {
+            continue;
+        }
+        if (strncmp(entry->d_name, name, prefix) == 0 && strncmp(entry->d_name, name, versioned) != 0) {
+            unlinkat(dir_fd, entry->d_name, 0);
+            continue;
+        }
+
+        struct stat st;
+        if (fstatat(dir_fd, entry->d_name, &st, 0) < 0) {
+            continue;
+        }
+        if (count == capacity) {
+            int grown = capacity ? capacity * 2 : 64;
+            ThumbnailFile* resized = realloc(files, grown * sizeof(*files));
+            if (resized == NULL) {
+                break;
+            }
+            files = resized;
+            capacity = grown;
+        }
+        memcpy(files[count].name, entry->d_name, len + 1);
+        files[count].used = st.st_mtime;
+        files[count].size = st.st_size;
+        total += st.st_size;
+        count++;
+    }
+
+    qsort(files, count, sizeof(*files), compare_used);
+    for (int i = 0; i < count && total > LOCUS_THUMBNAIL_BUDGET; i++) {
+        if (unlinkat(dir_fd, files[i].name, 0) == 0) {
+            total -= files[i].size;
+        }
+    }
+    free(files);
+    closedir(handle);
+}
+
+static void store_thumbnail(const char* path, const LocusImageData* data) {
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        return;
+    }
+
+    uint32_t header[4] = { data->width, data->height, data->image_width, data->image_height };
+    size_t bytes = (size_t)data->width * data->height * 4;
+    int ok = write(fd, LOCUS_THUMBNAIL_MAGIC, 8) == 8 &&
+             write(fd, header, sizeof(header)) == sizeof(header) &&
+             write(fd, data->pixels, bytes) == (ssize_t)bytes;
+    if (close(fd) != 0 || !ok || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return;
+    }
+    prune_thumbnails(path);
+}
+
+/* Box filter over straight RGBA, weighting colors by alpha so transparent
+ * pixels don't bleed their color into the edges. */
+static unsigned char* downscale(const unsigned char* src, int sw, int sh, int dw, int dh) {
+    unsigned char* dst = malloc((size_t)dw * dh * 4);
+    if (dst == NULL) {
+        return NULL;
+    }
+
+    for (int y = 0; y < dh; y++) {
+        int y0 = (int)((int64_t)y * sh / dh);
+        int y1 = (int)((int64_t)(y + 1) * sh / dh);
+        y1 = y1 > y0 ? y1 : y0 + 1;
+        for (int x = 0; x < dw; x++) {
+            int x0 = (int)((int64_t)x * sw / dw);
+            int x1 = (int)((int64_t)(x + 1) * sw / dw);
+            x1 = x1 > x0 ? x1 : x0 + 1;
+
+            uint64_t r = 0, g = 0, b = 0, a = 0;
+            for (int sy = y0; sy < y1; sy++) {
+                const unsigned char* p = &src[((size_t)sy * sw + x0) * 4];
+                for (int sx = x0; sx < x1; sx++, p += 4) {
+                    r += p[0] * p[3];
+                    g += p[1] * p[3];
+                    b += p[2] * p[3];
+                    a += p[3];
+                }
+            }
+
+            unsigned char* out = &dst[((size_t)y * dw + x) * 4];
+            uint32_t count = (uint32_t)(y1 - y0) * (x1 - x0);
+            out[0] = a ? (unsigned char)(r / a) : 0;
+            out[1] = a ? (unsigned char)(g / a) : 0;
+            out[2] = a ? (unsigned char)(b / a) : 0;
+            out[3] = (unsigned char)((a + count / 2) / count);
+        }
+    }
+    return dst;
+}
+
+/* With pow2 both sides are rounded up to powers of two so GLES2 can
+ * mipmap. Safe to call from loader threads. */
+int locus_image_data_load(const char* path, int bucket, int pow2, LocusImageData* data) {
+    memset(data, 0, sizeof(*data));
+
+    int width, height, components;
+    if (!stbi_info(path, &width, &height, &components)) {
+        fprintf(stderr, "Failed to load image: %s\n", path);
+        return 0;
+    }
+
+    int shorter = width < height ? width : height;
+    char cache[PATH_MAX];
+    int cached = bucket > 0 && shorter > bucket && thumbnail_path(path, bucket, pow2, cache, sizeof(cache), 0);
+    if (cached && map_thumbnail(cache, data)) {
+        return 1;
+    }
+
+    data->pixels = stbi_load(path, &data->width, &data->height, &components, 4);
+    if (data->pixels == NULL) {
+        fprintf(stderr, "Failed to load image: %s\n", path);
+        return 0;
+    }
+    data->stb = 1;
+    data->image_width = data->width;
+    data->image_height = data->height;
+    if (bucket <= 0 || shorter <= bucket) {
+        return 1;
+    }
+
+    int dw = (int)((int64_t)data->width * bucket / shorter);
+    int dh = (int)((int64_t)data->height * bucket / shorter);
+    if (pow2) {
+        dw = pow2_nearest(dw);
+        dh = pow2_nearest(dh);
+    }
+    unsigned char* pixels = downscale(data->pixels, data->width, data->height, dw, dh);
+    if (pixels == NULL) {
+        return 1;
+    }
+    stbi_image_free(data->pixels);
+    data->pixels = pixels;
+    data->stb = 0;
+    data->width = dw;
+    data->height = dh;
+
+    if (thumbnail_path(path, bucket, pow2, cache, sizeof(cache), 1)) {
+        store_thumbnail(cache, data);
+    }
+    return 1;
+}
+
+void locus_image_data_free(LocusImageData* data) {
+    if (data->map) {
+        munmap(data->map, data->map_size);
+    } else if (data->stb) {
+        stbi_image_free(data->pixels);
+    } else {
+        free(data->pixels);
+    }
+    memset(data, 0, sizeof(*data));
+}
+
+/* On the GL backend the texture reports the image's size rather than its
+ * own, which is all drawing needs to keep the aspect. */
+LocusTexture* locus_image_texture_insert(LocusUI* ui, const char* key, int size, float scale,
+                                         const LocusImageData* data) {
+    if (!ui->vg) {
+        return locus_texture_insert_rgba(ui, key, size, scale, data->pixels, data->width, data->height);
+    }
+
+    int pow2 = (data->width & (data->width - 1)) == 0 && (data->height & (data->height - 1)) == 0;
+    int flags = ui->image_mipmaps && pow2 && data->width != data->image_width ? NVG_IMAGE_GENERATE_MIPMAPS : 0;
+    int image = data->pixels ? nvgCreateImageRGBA(ui->vg, data->width, data->height, flags, data->pixels) : 0;
+    LocusTexture* tex = locus_texture_insert(ui, key, size, scale, image);
+    if (tex == NULL || image == 0) {
+        return tex;
+    }
+
+    if (flags & NVG_IMAGE_GENERATE_MIPMAPS) {
+        ui->texture_bytes += tex->bytes / 3;
+        tex->bytes += tex->bytes / 3;
+    }
+    tex->width = data->image_width;
+    tex->height = data->image_height;
+    return tex;
+}
+
+/* Mipmapped images are rounded to power-of-two sizes when downscaled, as
+ * GLES2 can't mipmap other textures. Applies to images loaded afterwards. */
+void locus_image_set_mipmaps(LocusUI* ui, int enabled) {
+    ui->image_mipmaps = enabled;
+}
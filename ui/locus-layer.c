@@ -0,0 +1,492 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GLES2/gl2.h>
+#include <nanovg.h>
+#define NANOVG_GLES2
+#include "nanovg_gl.h"
+#include "nanovg_gl_utils.h"
+#include "locus.h"
+#include "locus-ui-private.h"
+
+/* Retained layers, rendered once into a framebuffer (or pixel buffer)
+ * and composited until the caller's stamp changes. */
+
+#define LOCUS_BLUR_PASSES 3
+
+struct LocusLayer {
+    uint64_t hash;
+    char* key;
+    uint64_t stamp;
+    int width, height;
+    float blur;
+    NVGLUframebuffer* framebuffer;
+    uint32_t* pixels;
+    size_t bytes;
+    uint32_t last_used;
+    int valid;
+    LocusLayer* next;
+};
+
+/* What a capture replaces, to be put back by locus_layer_end(). */
+struct LocusLayerCapture {
+    LocusLayer* layer;
+    float x, y, width, height;
+    float xform[6];
+    int scissor[4];
+    float clip[4];
+    float alpha;
+    float frame_width, frame_height;
+    struct LocusCanvas* canvas;
+    LocusCanvas layer_canvas;
+    GLint framebuffer;
+    GLint viewport[4];
+    GLboolean scissor_test;
+    GLint scissor_box[4];
+};
+
+static int clampi(int value, int low, int high) {
+    return value < low ? low : (value > high ? high : value);
+}
+
+/* One box pass along a row or column of count pixels, step bytes apart,
+ * with the edges extended. */
+static void blur_line(unsigned char* data, int count, int step, int channels, int radius,
+                      unsigned char* line) {
+    int window = 2 * radius + 1;
+    for (int i = 0; i < count; i++) {
+        memcpy(line + i * channels, data + (size_t)i * step, channels);
+    }
+    for (int c = 0; c < channels; c++) {
+        int sum = 0;
+        for (int k = -radius; k <= radius; k++) {
+            sum += line[clampi(k, 0, count - 1) * channels + c];
+        }
+        for (int i = 0; i < count; i++) {
+            data[(size_t)i * step + c] = (unsigned char)(sum / window);
+            sum += line[clampi(i + radius + 1, 0, count - 1) * channels + c];
+            sum -= line[clampi(i - radius, 0, count - 1) * channels + c];
+        }
+    }
+}
+
+/* Three box passes per axis come close to a gaussian; the channels are
+ * blurred independently, so premultiplied pixels stay premultiplied. */
+static void blur_pixels(unsigned char* data, int width, int height, int channels, int radius) {
+    if (radius <= 0 || width <= 0 || height <= 0) {
+        return;
+    }
+    unsigned char* line = malloc((size_t)(width > height ? width : height) * channels);
+    if (line == NULL) {
+        fprintf(stderr, "Error: Could not allocate blur buffer\n");
+        return;
+    }
+    for (int pass = 0; pass < LOCUS_BLUR_PASSES; pass++) {
+        for (int y = 0; y < height; y++) {
+            blur_line(data + (size_t)y * width * channels, width, channels, channels, radius, line);
+        }
+        for (int x = 0; x < width; x++) {
+            blur_line(data + (size_t)x * channels, height, width * channels, channels, radius, line);
+        }
+    }
+    free(line);
+}
+
+static int blur_radius(LocusUI* ui, float blur) {
+    return (int)lroundf(blur * ui->pixel_ratio / LOCUS_BLUR_PASSES);
+}
+
+static void free_layer_storage(LocusUI* ui, LocusLayer* layer) {
+    if (layer->framebuffer) {
+        nvgluDeleteFramebuffer(layer->framebuffer);
+        layer->framebuffer = NULL;
+    }
+    free(layer->pixels);
+    layer->pixels = NULL;
+    ui->layer_bytes -= layer->bytes;
+    layer->bytes = 0;
+    layer->valid = 0;
+}
+
+static void remove_layer(LocusUI* ui, LocusLayer* layer) {
+    LocusLayer** link = &ui->layers;
+    while (*link && *link != layer) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = layer->next;
+    }
+    free_layer_storage(ui, layer);
+    free(layer->key);
+    free(layer);
+    ui->layer_count--;
+}
+
+static LocusLayer* find_layer(LocusUI* ui, const char* key, uint64_t hash) {
+    for (LocusLayer* layer = ui->layers; layer; layer = layer->next) {
+        if (layer->hash == hash && strcmp(layer->key, key) == 0) {
+            return layer;
+        }
+    }
+
+    LocusLayer* layer = calloc(1, sizeof(*layer));
+    if (layer == NULL || (layer->key = strdup(key)) == NULL) {
+        free(layer);
+        fprintf(stderr, "Error: Could not allocate layer\n");
+        return NULL;
+    }
+    layer->hash = hash;
+    layer->next = ui->layers;
+    ui->layers = layer;
+    ui->layer_count++;
+    return layer;
+}
+
+/* (Re)creates the layer's storage at width x height pixels. */
+static int allocate_layer(LocusUI* ui, LocusLayer* layer, int width, int height) {
+    if (layer->width == width && layer->height == height && (layer->framebuffer || layer->pixels)) {
+        return 1;
+    }
+    free_layer_storage(ui, layer);
+
+    if (ui->vg) {
+        layer->framebuffer = nvgluCreateFramebuffer(ui->vg, width, height,
+                                                    NVG_IMAGE_FLIPY | NVG_IMAGE_PREMULTIPLIED);
+        if (layer->framebuffer == NULL) {
+            return 0;
+        }
+    } else {
+        layer->pixels = malloc((size_t)width * height * sizeof(*layer->pixels));
+        if (layer->pixels == NULL) {
+            fprintf(stderr, "Error: Could not allocate layer pixels\n");
+            return 0;
+        }
+    }
+    layer->width = width;
+    layer->height = height;
+    layer->bytes = (size_t)width * height * 4;
+    ui->layer_bytes += layer->bytes;
+    return 1;
+}
+
+static void composite_layer(LocusUI* ui, LocusLayer* layer, float x, float y, float width, float height) {
+    LocusTexture tex = { 0 };
+    tex.width = layer->width;
+    tex.height = layer->height;
+    if (layer->framebuffer) {
+        tex.image = layer->framebuffer->image;
+        tex.gl_texture = layer->framebuffer->texture;
+        tex.flags = LOCUS_TEXTURE_PREMULTIPLIED | LOCUS_TEXTURE_FLIPPED;
+    } else {
+        tex.image = 1;
+        tex.pixels = layer->pixels;
+        tex.flags = LOCUS_TEXTURE_PREMULTIPLIED;
+    }
+    locus_draw_texture(ui, &tex, x, y, width, height);
+}
+
+/* NanoVG's state is lost with its frame, so the saved states and the
+ * current one are replayed onto a fresh frame. */
+static void load_nvg_state(LocusUI* ui, const float* t, const int* s) {
+    float ratio = ui->pixel_ratio;
+    nvgResetTransform(ui->vg);
+    nvgResetScissor(ui->vg);
+    nvgScissor(ui->vg, s[0] / ratio, s[1] / ratio, s[2] / ratio, s[3] / ratio);
+    nvgTransform(ui->vg, t[0], t[1], t[2], t[3], t[4], t[5]);
+}
+
+static void reload_nvg_state(LocusUI* ui) {
+    if (ui->batching) {
+        return;
+    }
+    int depth = ui->state_depth < LOCUS_UI_STATE_DEPTH ? ui->state_depth : LOCUS_UI_STATE_DEPTH;
+    for (int i = 0; i < depth; i++) {
+        load_nvg_state(ui, ui->states[i].xform, ui->states[i].clip);
+        nvgSave(ui->vg);
+    }
+    load_nvg_state(ui, ui->xform, ui->scissor);
+}
+
+static void begin_capture(LocusUI* ui, LocusLayer* layer, float x, float y, float width, float height) {
+    LocusLayerCapture* capture = ui->layer_capture;
+
+    capture->layer = layer;
+    capture->x = x;
+    capture->y = y;
+    capture->width = width;
+    capture->height = height;
+    memcpy(capture->xform, ui->xform, sizeof(capture->xform));
+    memcpy(capture->scissor, ui->scissor, sizeof(capture->scissor));
+    memcpy(capture->clip, ui->clip, sizeof(capture->clip));
+    capture->alpha = ui->alpha;
+    capture->frame_width = ui->frame_width;
+    capture->frame_height = ui->frame_height;
+    capture->canvas = ui->canvas;
+
+    if (layer->framebuffer) {
+        locus_batch_push_target(ui, layer->width, layer->height);
+        nvgEndFrame(ui->vg);
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &capture->framebuffer);
+        glGetIntegerv(GL_VIEWPORT, capture->viewport);
+        glGetIntegerv(GL_SCISSOR_BOX, capture->scissor_box);
+        capture->scissor_test = glIsEnabled(GL_SCISSOR_TEST);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, layer->framebuffer->fbo);
+        glViewport(0, 0, layer->width, layer->height);
+        glDisable(GL_SCISSOR_TEST);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+        nvgBeginFrame(ui->vg, width, height, ui->pixel_ratio);
+    } else {
+        capture->layer_canvas.pixels = layer->pixels;
+        capture->layer_canvas.width = layer->width;
+        capture->layer_canvas.height = layer->height;
+        capture->layer_canvas.stride = layer->width;
+        capture->layer_canvas.clip = (LocusRect){ 0, 0, layer->width, layer->height };
+        locus_canvas_clear(&capture->layer_canvas, 0);
+        ui->canvas = &capture->layer_canvas;
+    }
+
+    const float translate[6] = { 1.0f, 0.0f, 0.0f, 1.0f, -x, -y };
+    memcpy(ui->xform, translate, sizeof(ui->xform));
+    ui->scissor[0] = ui->scissor[1] = 0;
+    ui->scissor[2] = layer->width;
+    ui->scissor[3] = layer->height;
+    ui->clip[0] = ui->clip[1] = 0.0f;
+    ui->clip[2] = width;
+    ui->clip[3] = height;
+    ui->alpha = 1.0f;
+    ui->frame_width = width;
+    ui->frame_height = height;
+    if (ui->vg && !ui->batching) {
+        nvgTranslate(ui->vg, -x, -y);
+    }
+}
+
+static void end_capture(LocusUI* ui) {
+    LocusLayerCapture* capture = ui->layer_capture;
+    LocusLayer* layer = capture->layer;
+    int radius = blur_radius(ui, layer->blur);
+
+    if (layer->framebuffer) {
+        locus_batch_flush(ui);
+        nvgEndFrame(ui->vg);
+        if (radius > 0) {
+            unsigned char* rgba = malloc((size_t)layer->width * layer->height * 4);
+            if (rgba) {
+                glPixelStorei(GL_PACK_ALIGNMENT, 4);
+                glReadPixels(0, 0, layer->width, layer->height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+                blur_pixels(rgba, layer->width, layer->height, 4, radius);
+                glBindTexture(GL_TEXTURE_2D, layer->framebuffer->texture);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, layer->width, layer->height, GL_RGBA,
+                                GL_UNSIGNED_BYTE, rgba);
+                glBindTexture(GL_TEXTURE_2D, 0);
+                free(rgba);
+            }
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, capture->framebuffer);
+        glViewport(capture->viewport[0], capture->viewport[1], capture->viewport[2], capture->viewport[3]);
+        glScissor(capture->scissor_box[0], capture->scissor_box[1], capture->scissor_box[2],
+                  capture->scissor_box[3]);
+        if (capture->scissor_test) {
+            glEnable(GL_SCISSOR_TEST);
+        }
+        locus_batch_pop_target(ui);
+    } else if (radius > 0) {
+        blur_pixels((unsigned char*)layer->pixels, layer->width, layer->height, 4, radius);
+    }
+
+    memcpy(ui->xform, capture->xform, sizeof(ui->xform));
+    memcpy(ui->scissor, capture->scissor, sizeof(ui->scissor));
+    memcpy(ui->clip, capture->clip, sizeof(ui->clip));
+    ui->alpha = capture->alpha;
+    ui->frame_width = capture->frame_width;
+    ui->frame_height = capture->frame_height;
+    ui->canvas = capture->canvas;
+    if (layer->framebuffer) {
+        nvgBeginFrame(ui->vg, ui->frame_width, ui->frame_height, ui->pixel_ratio);
+        reload_nvg_state(ui);
+    }
+    layer->valid = 1;
+    capture->layer = NULL;
+}
+
+/* Returns 0 and composites the cached pixels while stamp is unchanged,
+ * otherwise 1 and the caller draws the contents, then locus_layer_end().
+ * Layers don't nest. */
+int locus_layer_begin(LocusUI* ui, const char* key, uint64_t stamp, float x, float y,
+                      float width, float height) {
+    return locus_layer_begin_blurred(ui, key, stamp, x, y, width, height, 0.0f);
+}
+
+/* Like locus_layer_begin() with the captured contents blurred by about
+ * blur units, e.g. the wallpaper region behind a panel. The blur runs once
+ * per capture on the CPU, so the stamp should only change rarely. */
+int locus_layer_begin_blurred(LocusUI* ui, const char* key, uint64_t stamp, float x, float y,
+                              float width, float height, float blur) {
+    ui->layer_depth++;
+    if (ui->layer_depth > 1 || width <= 0.0f || height <= 0.0f) {
+        return 1;
+    }
+
+    int pixel_width = (int)ceilf(width * ui->pixel_ratio);
+    int pixel_height = (int)ceilf(height * ui->pixel_ratio);
+    LocusLayer* layer = find_layer(ui, key, locus_hash_string(key, 0));
+    if (layer == NULL) {
+        return 1;
+    }
+    layer->last_used = ui->frame;
+
+    if (layer->valid && layer->stamp == stamp && layer->blur == blur &&
+        layer->width == pixel_width && layer->height == pixel_height) {
+        composite_layer(ui, layer, x, y, width, height);
+        ui->layer_depth--;
+        return 0;
+    }
+
+    if ((ui->vg == NULL && ui->canvas == NULL) || !allocate_layer(ui, layer, pixel_width, pixel_height)) {
+        return 1;
+    }
+    if (ui->layer_capture == NULL && (ui->layer_capture = calloc(1, sizeof(LocusLayerCapture))) == NULL) {
+        fprintf(stderr, "Error: Could not allocate layer capture\n");
+        return 1;
+    }
+
+    layer->stamp = stamp;
+    layer->blur = blur;
+    layer->valid = 0;
+    begin_capture(ui, layer, x, y, width, height);
+    return 1;
+}
+
+void locus_layer_end(LocusUI* ui) {
+    if (ui->layer_depth == 0) {
+        return;
+    }
+    ui->layer_depth--;
+
+    LocusLayerCapture* capture = ui->layer_capture;
+    if (ui->layer_depth > 0 || capture == NULL || capture->layer == NULL) {
+        return;
+    }
+
+    LocusLayer* layer = capture->layer;
+    float x = capture->x, y = capture->y, width = capture->width, height = capture->height;
+    end_capture(ui);
+    composite_layer(ui, layer, x, y, width, height);
+}
+
+void locus_layer_invalidate(LocusUI* ui, const char* key) {
+    uint64_t hash = locus_hash_string(key, 0);
+    for (LocusLayer* layer = ui->layers; layer; layer = layer->next) {
+        if (layer->hash == hash && strcmp(layer->key, key) == 0) {
+            layer->valid = 0;
+        }
+    }
+}
+
+void locus_layer_cache_set_budget(LocusUI* ui, size_t bytes) {
+    ui->layer_budget = bytes;
+}
+
+/* Evicts the least recently drawn layers until the cache fits its budget;
+ * layers drawn this frame are kept. */
+void locus_layer_cache_trim(LocusUI* ui) {
+    while (ui->layer_bytes > ui->layer_budget) {
+        LocusLayer* oldest = NULL;
+        for (LocusLayer* layer = ui->layers; layer; layer = layer->next) {
+            if (layer->bytes && layer->last_used != ui->frame &&
+                (oldest == NULL || ui->frame - layer->last_used > ui->frame - oldest->last_used)) {
+                oldest = layer;
+            }
+        }
+        if (oldest == NULL) {
+            break;
+        }
+        remove_layer(ui, oldest);
+    }
+}
+
+void locus_layer_cache_stats(LocusUI* ui, int* entries, size_t* bytes) {
+    if (entries) {
+        *entries = ui->layer_count;
+    }
+    if (bytes) {
+        *bytes = ui->layer_bytes;
+    }
+}
+
+void locus_layer_cache_clear(LocusUI* ui) {
+    while (ui->layers) {
+        remove_layer(ui, ui->layers);
+    }
+    free(ui->layer_capture);
+    ui->layer_capture = NULL;
+    ui->layer_depth = 0;
+}
+
+/* Coverage of a rounded rectangle, as in the batch renderer's shader. */
+static float rounded_coverage(float px, float py, float x0, float y0, float x1, float y1, float radius) {
+    float cx = (x0 + x1) * 0.5f, cy = (y0 + y1) * 0.5f;
+    float qx = fabsf(px - cx) - (x1 - x0) * 0.5f + radius;
+    float qy = fabsf(py - cy) - (y1 - y0) * 0.5f + radius;
+    float ox = qx > 0.0f ? qx : 0.0f, oy = qy > 0.0f ? qy : 0.0f;
+    float inside = qx > qy ? qx : qy;
+    float d = sqrtf(ox * ox + oy * oy) + (inside < 0.0f ? inside : 0.0f) - radius;
+    float coverage = 0.5f - d;
+    return coverage < 0.0f ? 0.0f : (coverage > 1.0f ? 1.0f : coverage);
+}
+
+/* The blurred mask is cached per size and colour, so a shadow costs a
+ * single quad. */
+void locus_shadow(LocusUI* ui, float x, float y, float width, float height, float radius, float blur,
+                  float red, float green, float blue, float alpha) {
+    float ox = x - blur, oy = y - blur;
+    float ow = width + 2 * blur, oh = height + 2 * blur;
+    if (width <= 0.0f || height <= 0.0f || alpha * ui->alpha <= 0.0f || !locus_ui_visible(ui, ox, oy, ow, oh)) {
+        return;
+    }
+
+    char key[128];
+    snprintf(key, sizeof(key), "shadow:%gx%g:%g:%g:%02x%02x%02x", width, height, radius, blur,
+             clampi((int)red, 0, 255), clampi((int)green, 0, 255), clampi((int)blue, 0, 255));
+    int size = (int)ceilf(ow * ui->pixel_ratio);
+    LocusTexture* tex = locus_texture_lookup(ui, key, size, ui->pixel_ratio);
+
+    if (tex == NULL) {
+        int pw = size, ph = (int)ceilf(oh * ui->pixel_ratio);
+        float scale = ui->pixel_ratio, edge = blur * scale;
+        unsigned char* rgba = malloc((size_t)pw * ph * 4);
+        if (rgba == NULL) {
+            fprintf(stderr, "Error: Could not allocate shadow\n");
+            return;
+        }
+        for (int py = 0; py < ph; py++) {
+            for (int px = 0; px < pw; px++) {
+                unsigned char* p = rgba + ((size_t)py * pw + px) * 4;
+                p[0] = p[1] = p[2] = 0;
+                p[3] = (unsigned char)(255 * rounded_coverage(px + 0.5f, py + 0.5f, edge, edge,
+                                                              edge + width * scale, edge + height * scale,
+                                                              radius * scale));
+            }
+        }
+        blur_pixels(rgba, pw, ph, 4, blur_radius(ui, blur));
+        for (size_t i = 0; i < (size_t)pw * ph; i++) {
+            rgba[i * 4] = (unsigned char)clampi((int)red, 0, 255);
+            rgba[i * 4 + 1] = (unsigned char)clampi((int)green, 0, 255);
+            rgba[i * 4 + 2] = (unsigned char)clampi((int)blue, 0, 255);
+        }
+        tex = locus_texture_insert_rgba(ui, key, size, ui->pixel_ratio, rgba, pw, ph);
+        free(rgba);
+        if (tex == NULL) {
+            return;
+        }
+    }
+
+    locus_ui_save(ui);
+    locus_ui_opacity(ui, alpha);
+    locus_draw_texture(ui, tex, ox, oy, ow, oh);
+    locus_ui_restore(ui);
+}
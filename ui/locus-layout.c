@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "locus-ui.h"
+
+/* Multi-line text, shaped once as a single run and broken into lines
+ * from its glyph positions. */
+
+#define LOCUS_TEXT_LAYOUT_MAX_AGE 120
+#define LOCUS_TEXT_LAYOUT_MAX (LOCUS_TEXT_CACHE_SIZE * 4)
+#define LOCUS_ELLIPSIS "\xe2\x80\xa6"
+
+typedef struct {
+    LocusUI* ui;
+    LocusTextLayout* layout;
+    const LocusTextRun* run;
+    int capacity;
+} LayoutBuilder;
+
+static float glyph_x(const LocusTextRun* run, int index) {
+    return index < run->glyph_count ? run->glyph_x[index] : run->advance;
+}
+
+static int glyph_offset(const LocusTextRun* run, int index) {
+    return index < run->glyph_count ? run->glyph_offset[index] : (int)strlen(run->text);
+}
+
+static char glyph_char(const LocusTextRun* run, int index) {
+    return run->text[glyph_offset(run, index)];
+}
+
+static void free_layout(LocusTextLayout* layout) {
+    for (int i = 0; i < layout->line_count; i++) {
+        free(layout->lines[i].text);
+    }
+    free(layout->lines);
+    free(layout->text);
+    free(layout);
+}
+
+/* Lines are given as glyph ranges; trailing spaces hang past the edge and
+ * don't count towards the width. */
+static int add_line(LayoutBuilder* builder, int start, int end) {
+    LocusTextLayout* layout = builder->layout;
+    const LocusTextRun* run = builder->run;
+
+    while (end > start && glyph_char(run, end - 1) == ' ') {
+        end--;
+    }
+    if (layout->line_count == builder->capacity) {
+        int capacity = builder->capacity ? builder->capacity * 2 : 4;
+        LocusTextLine* lines = realloc(layout->lines, capacity * sizeof(*lines));
+        if (lines == NULL) {
+            return 0;
+        }
+        layout->lines = lines;
+        builder->capacity = capacity;
+    }
+
+    LocusTextLine* line = &layout->lines[layout->line_count];
+    int offset = glyph_offset(run, start);
+    line->text = strndup(run->text + offset, glyph_offset(run, end) - offset);
+    if (line->text == NULL) {
+        return 0;
+    }
+    line->x = 0.0f;
+    line->width = glyph_x(run, end) - glyph_x(run, start);
+    layout->line_count++;
+    return 1;
+}
+
+static int skip_spaces(const LocusTextRun* run, int index) {
+    while (index < run->glyph_count && glyph_char(run, index) == ' ') {
+        index++;
+    }
+    return index;
+}
+
+/* Greedy breaking at spaces; a word wider than the box is broken between
+ * glyphs. */
+static int break_lines(LayoutBuilder* builder) {
+    const LocusTextRun* run = builder->run;
+    LocusTextLayout* layout = builder->layout;
+    int wrap = (layout->flags & LOCUS_TEXT_WRAP) && layout->max_width > 0.0f;
+    int start = 0, brk = -1, brk_end = -1;
+
+    for (int i = 0; i < run->glyph_count; i++) {
+        char c = glyph_char(run, i);
+        if (c == '\n') {
+            if (!add_line(builder, start, i)) {
+                return 0;
+            }
+            start = i + 1;
+            brk = -1;
+            continue;
+        }
+        if (c == ' ') {
+            brk = i + 1;
+            brk_end = i;
+            continue;
+        }
+        while (wrap && i > start && glyph_x(run, i + 1) - glyph_x(run, start) > layout->max_width) {
+            if (brk > start) {
+                if (!add_line(builder, start, brk_end)) {
+                    return 0;
+                }
+                start = skip_spaces(run, brk);
+            } else {
+                if (!add_line(builder, start, i)) {
+                    return 0;
+                }
+                start = i;
+            }
+            brk = -1;
+        }
+    }
+    return add_line(builder, start, run->glyph_count);
+}
+
+/* Cuts a line so that it fits the box with an ellipsis after it. */
+static int ellipsize_line(LayoutBuilder* builder, LocusTextLine* line) {
+    LocusUI* ui = builder->ui;
+    LocusTextLayout* layout = builder->layout;
+    float ellipsis = locus_text_measure(ui, layout->font, LOCUS_ELLIPSIS, layout->size, NULL);
+    const LocusTextRun* run = locus_text_run(ui, layout->font, line->text, layout->size);
+    if (run == NULL) {
+        return 0;
+    }
+
+    int end = run->glyph_count;
+    while (end > 0 && glyph_x(run, end) + ellipsis > layout->max_width) {
+        end--;
+    }
+    while (end > 0 && glyph_char(run, end - 1) == ' ') {
+        end--;
+    }
+
+    int bytes = glyph_offset(run, end);
+    char* text = malloc(bytes + sizeof(LOCUS_ELLIPSIS));
+    if (text == NULL) {
+        return 0;
+    }
+    memcpy(text, run->text, bytes);
+    memcpy(text + bytes, LOCUS_ELLIPSIS, sizeof(LOCUS_ELLIPSIS));
+    line->width = glyph_x(run, end) + ellipsis;
+    free(line->text);
+    line->text = text;
+    return 1;
+}
+
+static LocusTextLayout* build_layout(LocusUI* ui, int font, const char* text, float fontSize,
+                                     float width, int maxLines, int flags, uint64_t hash) {
+    const LocusTextRun* run = locus_text_run(ui, font, text, fontSize);
+    LocusTextLayout* layout = calloc(1, sizeof(*layout));
+    if (run == NULL || layout == NULL) {
+        free(layout);
+        return NULL;
+    }
+
+    layout->hash = hash;
+    layout->text = strdup(text);
+    layout->font = font;
+    layout->size = fontSize;
+    layout->max_width = width;
+    layout->max_lines = maxLines;
+    layout->flags = flags;
+    layout->ascent = -run->bounds[1];
+    layout->line_height = run->bounds[3] - run->bounds[1];
+    if (layout->line_height <= 0.0f) {
+        layout->ascent = fontSize * 0.8f;
+        layout->line_height = fontSize;
+    }
+
+    LayoutBuilder builder = { ui, layout, run, 0 };
+    if (layout->text == NULL || !break_lines(&builder)) {
+        free_layout(layout);
+        return NULL;
+    }
+
+    /* The last kept line continues up to the end of the text, so that its
+     * ellipsis stands for everything that was cut. */
+    if (maxLines > 0 && layout->line_count > maxLines) {
+        layout->truncated = 1;
+        LocusTextLine* last = &layout->lines[maxLines - 1];
+        if ((flags & LOCUS_TEXT_ELLIPSIZE) && width > 0.0f) {
+            size_t length = strlen(last->text) + 1 + strlen(layout->lines[maxLines].text);
+            char* joined = malloc(length + 1);
+            if (joined) {
+                snprintf(joined, length + 1, "%s %s", last->text, layout->lines[maxLines].text);
+                free(last->text);
+                last->text = joined;
+                last->width = width + 1.0f;
+            }
+        }
+        for (int i = maxLines; i < layout->line_count; i++) {
+            free(layout->lines[i].text);
+        }
+        layout->line_count = maxLines;
+    }
+
+    float box = width;
+    for (int i = 0; i < layout->line_count; i++) {
+        LocusTextLine* line = &layout->lines[i];
+        if ((flags & LOCUS_TEXT_ELLIPSIZE) && width > 0.0f && line->width > width) {
+            ellipsize_line(&builder, line);
+        }
+        if (line->width > layout->width) {
+            layout->width = line->width;
+        }
+    }
+    if (box <= 0.0f) {
+        box = layout->width;
+    }
+    for (int i = 0; i < layout->line_count; i++) {
+        LocusTextLine* line = &layout->lines[i];
+        switch (flags & LOCUS_TEXT_ALIGN_MASK) {
+        case LOCUS_TEXT_ALIGN_CENTER:
+            line->x = (box - line->width) * 0.5f;
+            break;
+        case LOCUS_TEXT_ALIGN_RIGHT:
+            line->x = box - line->width;
+            break;
+        }
+    }
+    layout->height = layout->line_count * layout->line_height;
+    return layout;
+}
+
+/* Like the run cache, bounded by lookups as well as by frames. */
+static void evict_layouts(LocusUI* ui) {
+    for (int i = 0; i < LOCUS_TEXT_CACHE_SIZE; i++) {
+        LocusTextLayout** link = &ui->layout_buckets[i];
+        while (*link) {
+            LocusTextLayout* layout = *link;
+            if (ui->text_lookups - layout->last_lookup > LOCUS_TEXT_LAYOUT_MAX / 2) {
+                *link = layout->next;
+                free_layout(layout);
+                ui->text_layout_count--;
+            } else {
+                link = &layout->next;
+            }
+        }
+    }
+}
+
+/* width <= 0 leaves lines unbounded; maxLines <= 0 keeps every line. */
+const LocusTextLayout* locus_text_layout(LocusUI* ui, int font, const char* text, float fontSize,
+                                         float width, int maxLines, int flags) {
+    if (font < 0 || font >= ui->font_count || text == NULL) {
+        return NULL;
+    }
+
+    ui->text_lookups++;
+    uint64_t hash = locus_hash_bytes(&fontSize, sizeof(fontSize), (uint64_t)font);
+    hash = locus_hash_bytes(&width, sizeof(width), hash);
+    hash = locus_hash_bytes(&maxLines, sizeof(maxLines), hash);
+    hash = locus_hash_bytes(&flags, sizeof(flags), hash);
+    hash = locus_hash_string(text, hash);
+    LocusTextLayout** bucket = &ui->layout_buckets[hash % LOCUS_TEXT_CACHE_SIZE];
+
+    for (LocusTextLayout* layout = *bucket; layout != NULL; layout = layout->next) {
+        if (layout->hash == hash && layout->font == font && layout->size == fontSize &&
+            layout->max_width == width && layout->max_lines == maxLines && layout->flags == flags &&
+            strcmp(layout->text, text) == 0) {
+            layout->last_used = ui->frame;
+            layout->last_lookup = ui->text_lookups;
+            return layout;
+        }
+    }
+
+    if (ui->text_layout_count >= LOCUS_TEXT_LAYOUT_MAX) {
+        evict_layouts(ui);
+    }
+    LocusTextLayout* layout = build_layout(ui, font, text, fontSize, width, maxLines, flags, hash);
+    if (layout == NULL) {
+        fprintf(stderr, "Error: Could not lay out text\n");
+        return NULL;
+    }
+
+    layout->last_used = ui->frame;
+    layout->last_lookup = ui->text_lookups;
+    layout->next = *bucket;
+    *bucket = layout;
+    ui->text_layout_count++;
+    return layout;
+}
+
+void locus_text_layout_draw(LocusUI* ui, const LocusTextLayout* layout, float x, float y,
+                            float red, float green, float blue, float alpha) {
+    if (layout == NULL || !locus_ui_visible(ui, x, y, layout->max_width > 0.0f ? layout->max_width : layout->width,
+                                            layout->height)) {
+        return;
+    }
+
+    for (int i = 0; i < layout->line_count; i++) {
+        const LocusTextLine* line = &layout->lines[i];
+        locus_text_font(ui, layout->font, line->text, x + line->x,
+                        y + layout->ascent + i * layout->line_height,
+                        layout->size, red, green, blue, alpha);
+    }
+}
+
+void locus_text_box(LocusUI* ui, const char* text, float x, float y, float width, float fontSize,
+                    int maxLines, int flags, float red, float green, float blue, float alpha) {
+    int font = locus_font_default(ui);
+    if (font < 0) {
+        return;
+    }
+    locus_text_layout_draw(ui, locus_text_layout(ui, font, text, fontSize, width, maxLines, flags),
+                           x, y, red, green, blue, alpha);
+}
+
+void locus_text_layout_trim(LocusUI* ui) {
+    if (ui->text_layout_count <= LOCUS_TEXT_CACHE_SIZE) {
+        return;
+    }
+
+    for (int i = 0; i < LOCUS_TEXT_CACHE_SIZE; i++) {
+        LocusTextLayout** link = &ui->layout_buckets[i];
+        while (*link) {
+            LocusTextLayout* layout = *link;
+            if (ui->frame - layout->last_used > LOCUS_TEXT_LAYOUT_MAX_AGE) {
+                *link = layout->next;
+                free_layout(layout);
+                ui->text_layout_count--;
+            } else {
+                link = &layout->next;
+            }
+        }
+    }
+}
+
+void locus_text_layout_clear(LocusUI* ui) {
+    for (int i = 0; i < LOCUS_TEXT_CACHE_SIZE; i++) {
+        LocusTextLayout* layout = ui->layout_buckets[i];
+        while (layout) {
+            LocusTextLayout* next = layout->next;
+            free_layout(layout);
+            layout = next;
+        }
+        ui->layout_buckets[i] = NULL;
+    }
+    ui->text_layout_count = 0;
+}
@@ -0,0 +1,380 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "locus.h"
+#include "locus-ui.h"
+
+/* Only visible rows are bound, each into a slot picked by row index
+ * modulo the pool size; a slot is rebound only when its row changes. */
+
+#define LOCUS_LIST_TOUCH_SLOP 8.0
+#define LOCUS_LIST_FRICTION_MS 325.0
+#define LOCUS_LIST_MIN_VELOCITY 20.0
+#define LOCUS_LIST_MAX_VELOCITY 8000.0
+
+typedef struct {
+    int index;
+    int bound;
+} LocusListSlot;
+
+struct LocusList {
+    LocusUI* ui;
+    Locus* app;
+    LocusSurface* surface;
+    int count;
+    int columns;
+    float row_height;
+    float x, y, width, height;
+    float scroll;
+    LocusListSlot* slots;
+    unsigned char* states;
+    size_t state_size;
+    int slot_count;
+    void (*bind)(LocusList* list, int index, void* state, void* data);
+    void (*draw)(LocusList* list, LocusUI* ui, int index, void* state, float x, float y,
+                 float width, float height, void* data);
+    void (*activate)(LocusList* list, int index, void* data);
+    void* data;
+    int frame_hook;
+    int32_t touch_id;
+    int dragging;
+    double touch_x, touch_y;
+    double touch_start_y;
+    float touch_start_scroll;
+    double velocity;
+    uint32_t fling_time;
+};
+
+static void list_damage(LocusList* list) {
+    if (list->app == NULL) {
+        return;
+    }
+    int x0 = (int)floorf(list->x), y0 = (int)floorf(list->y);
+    int x1 = (int)ceilf(list->x + list->width), y1 = (int)ceilf(list->y + list->height);
+    if (list->surface) {
+        locus_surface_damage(list->surface, x0, y0, x1 - x0, y1 - y0);
+    } else {
+        locus_damage(list->app, x0, y0, x1 - x0, y1 - y0);
+    }
+}
+
+static void list_schedule(LocusList* list) {
+    if (list->surface) {
+        locus_surface_schedule_frame(list->surface);
+    } else if (list->app) {
+        locus_schedule_frame(list->app);
+    }
+}
+
+static float max_scroll(LocusList* list) {
+    int rows = (list->count + list->columns - 1) / list->columns;
+    float content = rows * list->row_height;
+    return content > list->height ? content - list->height : 0.0f;
+}
+
+static int set_scroll(LocusList* list, float scroll) {
+    float limit = max_scroll(list);
+    scroll = scroll < 0.0f ? 0.0f : (scroll > limit ? limit : scroll);
+    if (scroll == list->scroll) {
+        return 0;
+    }
+    list->scroll = scroll;
+    list_damage(list);
+    return 1;
+}
+
+/* Enough slots for every row that can be partly visible at once. */
+static int resize_slots(LocusList* list) {
+    int rows = list->row_height > 0.0f ? (int)ceilf(list->height / list->row_height) + 1 : 1;
+    int count = rows * list->columns;
+    if (count == list->slot_count) {
+        return 1;
+    }
+
+    LocusListSlot* slots = calloc(count, sizeof(*slots));
+    unsigned char* states = list->state_size ? calloc(count, list->state_size) : NULL;
+    if (slots == NULL || (list->state_size && states == NULL)) {
+        fprintf(stderr, "Error: Could not allocate list rows\n");
+        free(slots);
+        free(states);
+        return 0;
+    }
+    free(list->slots);
+    free(list->states);
+    list->slots = slots;
+    list->states = states;
+    list->slot_count = count;
+    return 1;
+}
+
+/* Steps the fling with exponential friction, in pixels per second. */
+static void frame_hook(Locus* app, uint32_t time, void* data) {
+    LocusList* list = data;
+    if (list->velocity == 0.0 || list->dragging) {
+        return;
+    }
+
+    double dt = list->fling_time ? (double)(int32_t)(time - list->fling_time) : 0.0;
+    dt = dt < 0.0 ? 0.0 : (dt > 50.0 ? 50.0 : dt);
+    list->fling_time = time;
+
+    double decay = exp(-dt / LOCUS_LIST_FRICTION_MS);
+    double distance = list->velocity * LOCUS_LIST_FRICTION_MS / 1000.0 * (1.0 - decay);
+    list->velocity *= decay;
+    if (!set_scroll(list, list->scroll + (float)distance) || fabs(list->velocity) < LOCUS_LIST_MIN_VELOCITY) {
+        list->velocity = 0.0;
+        return;
+    }
+    list_schedule(list);
+}
+
+LocusList* locus_list_create(LocusUI* ui, Locus* app, int count, float rowHeight, int columns) {
+    LocusList* list = calloc(1, sizeof(*list));
+    if (list == NULL) {
+        fprintf(stderr, "Error: Could not allocate list\n");
+        return NULL;
+    }
+
+    list->ui = ui;
+    list->app = app;
+    list->count = count > 0 ? count : 0;
+    list->columns = columns > 0 ? columns : 1;
+    list->row_height = rowHeight > 0.0f ? rowHeight : 1.0f;
+    list->state_size = sizeof(LocusListItem);
+    list->touch_id = -1;
+    if (app) {
+        list->frame_hook = locus_add_frame_hook(app, frame_hook, list);
+    }
+    return list;
+}
+
+void locus_list_set_surface(LocusList* list, LocusSurface* surface) {
+    list->surface = surface;
+}
+
+void locus_list_set_bounds(LocusList* list, float x, float y, float width, float height) {
+    if (x == list->x && y == list->y && width == list->width && height == list->height) {
+        return;
+    }
+    list_damage(list);
+    list->x = x;
+    list->y = y;
+    list->width = width;
+    list->height = height;
+    resize_slots(list);
+    set_scroll(list, list->scroll);
+    list_damage(list);
+}
+
+/* Row state is kept per slot and handed to bind when the slot is recycled,
+ * so buffers in it can be reused. */
+void locus_list_set_rows(LocusList* list, size_t stateSize,
+                         void (*bind)(LocusList* list, int index, void* state, void* data),
+                         void (*draw)(LocusList* list, LocusUI* ui, int index, void* state,
+                                      float x, float y, float width, float height, void* data),
+                         void* data) {
+    list->bind = bind;
+    list->draw = draw;
+    list->data = data;
+    list->state_size = draw ? stateSize : sizeof(LocusListItem);
+    list->slot_count = 0;
+    resize_slots(list);
+    list_damage(list);
+}
+
+void locus_list_set_activate_callback(LocusList* list,
+                                      void (*callback)(LocusList* list, int index, void* data)) {
+    list->activate = callback;
+}
+
+void locus_list_set_count(LocusList* list, int count) {
+    list->count = count > 0 ? count : 0;
+    for (int i = 0; i < list->slot_count; i++) {
+        if (list->slots[i].index >= list->count) {
+            list->slots[i].bound = 0;
+        }
+    }
+    set_scroll(list, list->scroll);
+    list_damage(list);
+}
+
+/* Rebinds a row, or every row with -1, the next time it is drawn. */
+void locus_list_invalidate(LocusList* list, int index) {
+    for (int i = 0; i < list->slot_count; i++) {
+        if (index < 0 || list->slots[i].index == index) {
+            list->slots[i].bound = 0;
+        }
+    }
+    list_damage(list);
+}
+
+void locus_list_scroll_to(LocusList* list, float offset) {
+    list->velocity = 0.0;
+    set_scroll(list, offset);
+}
+
+float locus_list_scroll(LocusList* list) {
+    return list->scroll;
+}
+
+int locus_list_hit_test(LocusList* list, float x, float y) {
+    if (x < list->x || y < list->y || x >= list->x + list->width || y >= list->y + list->height) {
+        return -1;
+    }
+    int row = (int)floorf((y - list->y + list->scroll) / list->row_height);
+    int column = (int)floorf((x - list->x) * list->columns / list->width);
+    int index = row * list->columns + column;
+    return index < list->count ? index : -1;
+}
+
+/* Meant to be called from the touch callback with its arguments. A drag
+ * scrolls once it passes the slop, lifting the finger hands its velocity
+ * to the fling, and a touch that never moved activates the row. */
+void locus_list_touch(LocusList* list, int32_t id, double x, double y, int32_t state) {
+    switch (state) {
+    case LOCUS_TOUCH_DOWN:
+        if (x < list->x || y < list->y || x >= list->x + list->width || y >= list->y + list->height) {
+            return;
+        }
+        list->touch_id = id;
+        list->dragging = 0;
+        list->touch_x = x;
+        list->touch_y = y;
+        list->touch_start_y = y;
+        list->touch_start_scroll = list->scroll;
+        list->velocity = 0.0;
+        break;
+    case LOCUS_TOUCH_MOTION:
+        if (id != list->touch_id) {
+            return;
+        }
+        list->touch_x = x;
+        list->touch_y = y;
+        if (!list->dragging && fabs(y - list->touch_start_y) > LOCUS_LIST_TOUCH_SLOP) {
+            list->dragging = 1;
+            list->touch_start_y = y;
+            list->touch_start_scroll = list->scroll;
+        }
+        if (list->dragging) {
+            double vx, vy;
+            set_scroll(list, list->touch_start_scroll - (float)(y - list->touch_start_y));
+            if (list->app && locus_touch_velocity(list->app, id, &vx, &vy)) {
+                list->velocity = -vy;
+            }
+        }
+        break;
+    case LOCUS_TOUCH_UP:
+        if (id != list->touch_id) {
+            return;
+        }
+        list->touch_id = -1;
+        if (list->dragging) {
+            double vx, vy;
+            list->dragging = 0;
+            /* Measured up to the lift, so a finger held still doesn't fling. */
+            if (list->app && locus_touch_velocity(list->app, id, &vx, &vy)) {
+                list->velocity = -vy;
+            }
+            if (list->velocity > LOCUS_LIST_MAX_VELOCITY) {
+                list->velocity = LOCUS_LIST_MAX_VELOCITY;
+            } else if (list->velocity < -LOCUS_LIST_MAX_VELOCITY) {
+                list->velocity = -LOCUS_LIST_MAX_VELOCITY;
+            }
+            if (fabs(list->velocity) >= LOCUS_LIST_MIN_VELOCITY) {
+                list->fling_time = 0;
+                list_schedule(list);
+            } else {
+                list->velocity = 0.0;
+            }
+        } else if (list->activate) {
+            int index = locus_list_hit_test(list, (float)list->touch_x, (float)list->touch_y);
+            if (index >= 0) {
+                list->activate(list, index, list->data);
+            }
+        }
+        break;
+    case LOCUS_TOUCH_CANCEL:
+        list->touch_id = -1;
+        list->dragging = 0;
+        list->velocity = 0.0;
+        break;
+    }
+}
+
+static void draw_item(LocusUI* ui, const LocusListItem* item, float x, float y, float width, float height) {
+    float pad = height * 0.15f;
+    float icon = item->icon[0] ? height - 2 * pad : 0.0f;
+    float text_x = x + pad + (icon > 0.0f ? icon + pad : 0.0f);
+    float text_width = x + width - pad - text_x;
+
+    if (icon > 0.0f) {
+        locus_icon_async(ui, item->icon, x + pad, y + pad, icon);
+    }
+    if (item->detail[0]) {
+        locus_text_box(ui, item->label, text_x, y + pad, text_width, height * 0.32f, 1,
+                       LOCUS_TEXT_ELLIPSIZE, 235, 235, 240, 1.0f);
+        locus_text_box(ui, item->detail, text_x, y + height * 0.52f, text_width, height * 0.24f, 1,
+                       LOCUS_TEXT_ELLIPSIZE, 150, 150, 160, 1.0f);
+    } else {
+        locus_text_box(ui, item->label, text_x, y + height * 0.3f, text_width, height * 0.36f, 1,
+                       LOCUS_TEXT_ELLIPSIZE, 235, 235, 240, 1.0f);
+    }
+}
+
+void locus_list_draw(LocusList* list) {
+    LocusUI* ui = list->ui;
+    if (list->slot_count == 0 || list->count == 0 || list->width <= 0.0f || list->height <= 0.0f) {
+        return;
+    }
+
+    float cell_width = list->width / list->columns;
+    int first_row = (int)floorf(list->scroll / list->row_height);
+    int last_row = (int)floorf((list->scroll + list->height) / list->row_height);
+
+    locus_ui_save(ui);
+    locus_ui_intersect_clip(ui, list->x, list->y, list->width, list->height);
+    for (int row = first_row; row <= last_row; row++) {
+        float y = list->y + row * list->row_height - list->scroll;
+        for (int column = 0; column < list->columns; column++) {
+            int index = row * list->columns + column;
+            if (index >= list->count) {
+                break;
+            }
+
+            int slot_index = index % list->slot_count;
+            LocusListSlot* slot = &list->slots[slot_index];
+            void* state = list->states ? list->states + slot_index * list->state_size : NULL;
+            if (!slot->bound || slot->index != index) {
+                slot->index = index;
+                slot->bound = 1;
+                if (list->bind) {
+                    list->bind(list, index, state, list->data);
+                }
+            }
+
+            float x = list->x + column * cell_width;
+            if (!locus_ui_visible(ui, x, y, cell_width, list->row_height)) {
+                continue;
+            }
+            if (list->draw) {
+                list->draw(list, ui, index, state, x, y, cell_width, list->row_height, list->data);
+            } else if (state) {
+                draw_item(ui, state, x, y, cell_width, list->row_height);
+            }
+        }
+    }
+    locus_ui_restore(ui);
+}
+
+void locus_list_destroy(LocusList* list) {
+    if (list == NULL) {
+        return;
+    }
+    if (list->app && list->frame_hook) {
+        locus_remove_frame_hook(list->app, list->frame_hook);
+    }
+    free(list->slots);
+    free(list->states);
+    free(list);
+}
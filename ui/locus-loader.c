@@ -0,0 +1,417 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+#include "locus.h"
+#include "locus-ui.h"
+
+#define LOCUS_LOADER_MAX_AGE 120
+
+enum {
+    JOB_QUEUED,
+    JOB_DECODING,
+    JOB_READY,
+    JOB_FAILED,
+};
+
+typedef struct LocusAssetJob LocusAssetJob;
+
+struct LocusAssetJob {
+    char* key;
+    char* path;
+    int svg;
+    int pixel_size;
+    int size;
+    float scale;
+    int pow2;
+    int state;
+    LocusImageData image;
+    uint32_t last_requested;
+    struct LocusSurface* surface;
+    int notified;
+    LocusAssetJob* next;
+};
+
+struct LocusLoader {
+    pthread_t threads[LOCUS_LOADER_MAX_THREADS];
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    LocusAssetJob* jobs;
+    int stopping;
+    int wake_fd;
+    void (*callback)(void* data);
+    void* callback_data;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void free_job(LocusAssetJob* job) {
+    free(job->key);
+    free(job->path);
+    locus_image_data_free(&job->image);
+    free(job);
+}
+
+/* Images are decoded for pixel_size as a bucket, 0 meaning full size. */
+static void decode_job(LocusAssetJob* job) {
+    LocusImageData* image = &job->image;
+    if (job->svg) {
+        image->pixels = locus_rasterize_svg(job->path, job->pixel_size, &image->width, &image->height);
+        image->image_width = image->width;
+        image->image_height = image->height;
+        return;
+    }
+    locus_image_data_load(job->path, job->pixel_size, job->pow2, image);
+}
+
+static void* worker_main(void* data) {
+    LocusLoader* loader = data;
+
+    pthread_mutex_lock(&loader->lock);
+    while (!loader->stopping) {
+        LocusAssetJob* job = loader->jobs;
+        while (job && job->state != JOB_QUEUED) {
+            job = job->next;
+        }
+
+        if (job == NULL) {
+            pthread_cond_wait(&loader->cond, &loader->lock);
+            continue;
+        }
+
+        job->state = JOB_DECODING;
+        pthread_mutex_unlock(&loader->lock);
+
+        decode_job(job);
+
+        pthread_mutex_lock(&loader->lock);
+        job->state = job->image.pixels ? JOB_READY : JOB_FAILED;
+
+        uint64_t one = 1;
+        if (write(loader->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            fprintf(stderr, "Failed to signal asset loader\n");
+        }
+    }
+    pthread_mutex_unlock(&loader->lock);
+    return NULL;
+}
+
+int locus_loader_start(LocusUI* ui, int threads) {
+    if (ui->loader) {
+        return 1;
+    }
+
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 1 ? (int)cpus - 1 : 1;
+    }
+    if (threads > LOCUS_LOADER_MAX_THREADS) {
+        threads = LOCUS_LOADER_MAX_THREADS;
+    }
+
+    LocusLoader* loader = calloc(1, sizeof(*loader));
+    if (loader == NULL) {
+        fprintf(stderr, "Error: Could not allocate asset loader\n");
+        return 0;
+    }
+
+    loader->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (loader->wake_fd < 0) {
+        fprintf(stderr, "Error: Could not create asset loader eventfd\n");
+        free(loader);
+        return 0;
+    }
+
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->cond, NULL);
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&loader->threads[i], NULL, worker_main, loader) != 0) {
+            break;
+        }
+        loader->thread_count++;
+    }
+
+    ui->loader = loader;
+    if (loader->thread_count == 0) {
+        fprintf(stderr, "Error: Could not start asset loader threads\n");
+        locus_loader_stop(ui);
+        return 0;
+    }
+    return 1;
+}
+
+void locus_loader_set_callback(LocusUI* ui, void (*callback)(void* data), void* data) {
+    if (ui->loader) {
+        ui->loader->callback = callback;
+        ui->loader->callback_data = data;
+    }
+}
+
+void locus_loader_set_upload_budget(LocusUI* ui, uint32_t microseconds) {
+    ui->upload_budget_us = microseconds;
+}
+
+int locus_loader_fd(LocusUI* ui) {
+    return ui->loader ? ui->loader->wake_fd : -1;
+}
+
+void locus_loader_dispatch(LocusUI* ui) {
+    LocusLoader* loader = ui->loader;
+    if (loader == NULL) {
+        return;
+    }
+
+    uint64_t count;
+    if (read(loader->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "Failed to read asset loader eventfd\n");
+    }
+
+    if (loader->callback) {
+        loader->callback(loader->callback_data);
+    }
+}
+
+static void wake(LocusLoader* loader) {
+    uint64_t one = 1;
+    if (write(loader->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "Failed to signal asset loader\n");
+    }
+}
+
+void locus_loader_trim(LocusUI* ui) {
+    LocusLoader* loader = ui->loader;
+    if (loader == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&loader->lock);
+    LocusAssetJob** link = &loader->jobs;
+    while (*link) {
+        LocusAssetJob* job = *link;
+        if (job->state != JOB_DECODING && ui->frame - job->last_requested > LOCUS_LOADER_MAX_AGE) {
+            *link = job->next;
+            free_job(job);
+        } else {
+            link = &job->next;
+        }
+    }
+    pthread_mutex_unlock(&loader->lock);
+}
+
+void locus_loader_stop(LocusUI* ui) {
+    LocusLoader* loader = ui->loader;
+    if (loader == NULL) {
+        return;
+    }
+    if (ui->app) {
+        locus_remove_fd(ui->app, loader->wake_fd);
+        if (ui->upload_hook) {
+            locus_remove_frame_hook(ui->app, ui->upload_hook);
+            ui->upload_hook = 0;
+        }
+    }
+
+    pthread_mutex_lock(&loader->lock);
+    loader->stopping = 1;
+    pthread_cond_broadcast(&loader->cond);
+    pthread_mutex_unlock(&loader->lock);
+
+    for (int i = 0; i < loader->thread_count; i++) {
+        pthread_join(loader->threads[i], NULL);
+    }
+
+    while (loader->jobs) {
+        LocusAssetJob* next = loader->jobs->next;
+        free_job(loader->jobs);
+        loader->jobs = next;
+    }
+
+    pthread_cond_destroy(&loader->cond);
+    pthread_mutex_destroy(&loader->lock);
+    close(loader->wake_fd);
+    free(loader);
+    ui->loader = NULL;
+}
+
+/* Only the surfaces that drew an asset while it was pending are repainted,
+ * so that static layers are left alone. */
+static void bound_dispatch(Locus* app, int fd, short revents, void* data) {
+    LocusUI* ui = data;
+    LocusLoader* loader = ui->loader;
+    locus_loader_dispatch(ui);
+
+    pthread_mutex_lock(&loader->lock);
+    for (LocusAssetJob* job = loader->jobs; job; job = job->next) {
+        if (job->notified || (job->state != JOB_READY && job->state != JOB_FAILED)) {
+            continue;
+        }
+        job->notified = 1;
+        for (int i = 0; i < app->surface_count; i++) {
+            if (app->surfaces[i] == job->surface) {
+                locus_surface_damage_all(job->surface);
+            }
+        }
+    }
+    pthread_mutex_unlock(&loader->lock);
+}
+
+/* The upload budget is per frame whether or not the app draws through
+ * locus_ui_begin_frame(). */
+static void reset_upload_time(Locus* app, uint32_t time, void* data) {
+    LocusUI* ui = data;
+    ui->upload_time_ns = 0;
+}
+
+void locus_ui_bind(LocusUI* ui, Locus* app) {
+    ui->app = app;
+    if (!ui->loader && !locus_loader_start(ui, 0)) {
+        return;
+    }
+    locus_add_fd(app, ui->loader->wake_fd, POLLIN, bound_dispatch, ui);
+    if (!ui->upload_hook) {
+        ui->upload_hook = locus_add_frame_hook(app, reset_upload_time, ui);
+    }
+}
+
+/* Called after a texture cache miss: uploads the asset if a worker has
+ * finished decoding it, or queues it for decoding otherwise. Returns NULL
+ * while the asset is still pending. */
+static LocusTexture* request_asset(LocusUI* ui, const char* key, const char* path, int svg,
+                                   int pixelSize, int size, float scale) {
+    LocusTexture* tex;
+    LocusLoader* loader = ui->loader;
+    pthread_mutex_lock(&loader->lock);
+
+    LocusAssetJob** link = &loader->jobs;
+    while (*link && !((*link)->size == size && (*link)->scale == scale && strcmp((*link)->key, key) == 0)) {
+        link = &(*link)->next;
+    }
+
+    LocusAssetJob* job = *link;
+    if (job == NULL) {
+        job = calloc(1, sizeof(*job));
+        if (job == NULL || (job->key = strdup(key)) == NULL || (job->path = strdup(path)) == NULL) {
+            pthread_mutex_unlock(&loader->lock);
+            if (job) {
+                free(job->key);
+                free(job);
+            }
+            fprintf(stderr, "Error: Could not allocate asset job\n");
+            return NULL;
+        }
+        job->svg = svg;
+        job->pixel_size = pixelSize;
+        job->size = size;
+        job->scale = scale;
+        job->pow2 = ui->vg && ui->image_mipmaps;
+        job->state = JOB_QUEUED;
+        job->last_requested = ui->frame;
+        job->surface = ui->app ? locus_target_surface(ui->app) : NULL;
+        job->next = loader->jobs;
+        loader->jobs = job;
+        pthread_cond_signal(&loader->cond);
+        pthread_mutex_unlock(&loader->lock);
+        return NULL;
+    }
+
+    job->last_requested = ui->frame;
+    job->surface = ui->app ? locus_target_surface(ui->app) : NULL;
+    if (job->state == JOB_QUEUED || job->state == JOB_DECODING) {
+        pthread_mutex_unlock(&loader->lock);
+        return NULL;
+    }
+
+    if (job->state == JOB_READY && ui->upload_time_ns >= (uint64_t)ui->upload_budget_us * 1000) {
+        job->notified = 0;
+        pthread_mutex_unlock(&loader->lock);
+        wake(loader);
+        return NULL;
+    }
+
+    *link = job->next;
+    pthread_mutex_unlock(&loader->lock);
+
+    if (job->state == JOB_READY) {
+        uint64_t start = monotonic_ns();
+        tex = locus_image_texture_insert(ui, key, size, scale, &job->image);
+        ui->upload_time_ns += monotonic_ns() - start;
+    } else {
+        tex = locus_texture_insert(ui, key, size, scale, 0);
+    }
+    free_job(job);
+    return tex;
+}
+
+int locus_image_async(LocusUI* ui, const char* imagePath, float x, float y,
+                      float width, float height) {
+    if (ui->loader == NULL) {
+        locus_image(ui, imagePath, x, y, width, height);
+        return 1;
+    }
+    if (!locus_ui_visible(ui, x, y, width, height)) {
+        return 1;
+    }
+
+    int bucket = locus_image_bucket(ui, width, height);
+    LocusTexture* tex = locus_texture_lookup(ui, imagePath, bucket, 1.0f);
+    if (tex == NULL) {
+        tex = request_asset(ui, imagePath, imagePath, 0, bucket, bucket, 1.0f);
+    }
+    if (tex == NULL || tex->image == 0) {
+        return 0;
+    }
+
+    locus_draw_texture(ui, tex, x, y, width, height);
+    return 1;
+}
+
+int locus_icon_async(LocusUI* ui, const char* icon_name, float x, float y, float size) {
+    if (ui->loader == NULL) {
+        locus_icon(ui, icon_name, x, y, size);
+        return 1;
+    }
+    if (!locus_ui_visible(ui, x, y, size, size)) {
+        return 1;
+    }
+    if (ui->vector_icons && locus_vector_icon(ui, icon_name, x, y, size)) {
+        return 1;
+    }
+
+    int pixelSize = (int)(size * ui->pixel_ratio + 0.5f);
+    if (pixelSize <= 0) {
+        return 0;
+    }
+
+    char key[512];
+    snprintf(key, sizeof(key), "icon:%s", icon_name);
+
+    LocusTexture* tex = locus_texture_lookup(ui, key, pixelSize, ui->pixel_ratio);
+    if (tex == NULL) {
+        char path[512];
+        int scale = (int)(ui->pixel_ratio + 0.5f);
+        int found = locus_icon_theme_lookup(ui, icon_name, pixelSize / scale, scale, path, sizeof(path));
+        if (found == 0) {
+            fprintf(stderr, "Error: Icon '%s' not found (neither SVG nor PNG)\n", icon_name);
+            locus_texture_insert(ui, key, pixelSize, ui->pixel_ratio, 0);
+            return 0;
+        }
+        tex = request_asset(ui, key, path, found == 2, found == 2 ? pixelSize : 0, pixelSize, ui->pixel_ratio);
+    }
+
+    if (tex == NULL || tex->image == 0) {
+        return 0;
+    }
+
+    locus_draw_texture(ui, tex, x, y, size, size);
+    return 1;
+}
@@ -0,0 +1,494 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <nanovg.h>
+#include "locus.h"
+#include "locus-ui.h"
+
+static void mark_dirty(LocusScene* scene, LocusNode* node, int flags) {
+    node->dirty |= flags;
+    for (LocusNode* parent = node->parent; parent && !(parent->dirty & LOCUS_NODE_DIRTY_CHILD);
+         parent = parent->parent) {
+        parent->dirty |= LOCUS_NODE_DIRTY_CHILD;
+    }
+    if (scene->surface) {
+        locus_surface_schedule_frame(scene->surface);
+    } else if (scene->app) {
+        locus_schedule_frame(scene->app);
+    }
+}
+
+static void damage_bounds(LocusScene* scene, const float* bounds) {
+    if (scene->app == NULL) {
+        return;
+    }
+
+    int x0 = (int)floorf(bounds[0]);
+    int y0 = (int)floorf(bounds[1]);
+    int x1 = (int)ceilf(bounds[2]);
+    int y1 = (int)ceilf(bounds[3]);
+    if (scene->surface) {
+        locus_surface_damage(scene->surface, x0, y0, x1 - x0, y1 - y0);
+    } else {
+        locus_damage(scene->app, x0, y0, x1 - x0, y1 - y0);
+    }
+}
+
+static void bounds_union(float* dst, const float* src) {
+    if (dst[2] <= dst[0] || dst[3] <= dst[1]) {
+        memcpy(dst, src, 4 * sizeof(float));
+        return;
+    }
+    if (src[2] <= src[0] || src[3] <= src[1]) {
+        return;
+    }
+    dst[0] = fminf(dst[0], src[0]);
+    dst[1] = fminf(dst[1], src[1]);
+    dst[2] = fmaxf(dst[2], src[2]);
+    dst[3] = fmaxf(dst[3], src[3]);
+}
+
+static void local_rect(LocusScene* scene, LocusNode* node, float* rect) {
+    rect[0] = 0;
+    rect[1] = 0;
+    rect[2] = node->width;
+    rect[3] = node->height;
+
+    if (node->type == LOCUS_NODE_TEXT && node->text) {
+        float bounds[4];
+        int font = locus_font_default(scene->ui);
+        if (font >= 0) {
+            locus_text_measure(scene->ui, font, node->text, node->font_size, bounds);
+            memcpy(rect, bounds, sizeof(bounds));
+        }
+    }
+}
+
+/* Maps the node's local rectangle through its world transform and returns the
+ * axis-aligned box, padded by a pixel for antialiasing. */
+static void world_bounds(LocusScene* scene, LocusNode* node, float* out) {
+    float rect[4];
+    local_rect(scene, node, rect);
+
+    if (node->type == LOCUS_NODE_GROUP || !node->visible || rect[2] <= rect[0] || rect[3] <= rect[1]) {
+        out[0] = out[1] = out[2] = out[3] = 0;
+        return;
+    }
+
+    float xs[4] = { rect[0], rect[2], rect[0], rect[2] };
+    float ys[4] = { rect[1], rect[1], rect[3], rect[3] };
+    out[0] = out[1] = INFINITY;
+    out[2] = out[3] = -INFINITY;
+    for (int i = 0; i < 4; i++) {
+        float x, y;
+        nvgTransformPoint(&x, &y, node->world, xs[i], ys[i]);
+        out[0] = fminf(out[0], x - 1);
+        out[1] = fminf(out[1], y - 1);
+        out[2] = fmaxf(out[2], x + 1);
+        out[3] = fmaxf(out[3], y + 1);
+    }
+}
+
+static void clip_bounds(LocusNode* node, float* bounds) {
+    if (!node->clip) {
+        return;
+    }
+
+    float clip[4] = { 0, 0, node->width, node->height };
+    float xs[4] = { clip[0], clip[2], clip[0], clip[2] };
+    float ys[4] = { clip[1], clip[1], clip[3], clip[3] };
+    float box[4] = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+    for (int i = 0; i < 4; i++) {
+        float x, y;
+        nvgTransformPoint(&x, &y, node->world, xs[i], ys[i]);
+        box[0] = fminf(box[0], x);
+        box[1] = fminf(box[1], y);
+        box[2] = fmaxf(box[2], x);
+        box[3] = fmaxf(box[3], y);
+    }
+
+    bounds[0] = fmaxf(bounds[0], box[0]);
+    bounds[1] = fmaxf(bounds[1], box[1]);
+    bounds[2] = fminf(bounds[2], box[2]);
+    bounds[3] = fminf(bounds[3], box[3]);
+}
+
+static void update_node(LocusScene* scene, LocusNode* node, const float* parent_world, int moved) {
+    moved |= node->dirty & LOCUS_NODE_DIRTY_TRANSFORM;
+    if (!moved && !node->dirty) {
+        return;
+    }
+
+    float old_bounds[4];
+    int had_bounds = node->bounds_valid;
+    memcpy(old_bounds, node->subtree_bounds, sizeof(old_bounds));
+
+    if (moved) {
+        float local[6];
+        memcpy(node->world, parent_world, sizeof(node->world));
+        nvgTransformIdentity(local);
+        local[4] = node->x;
+        local[5] = node->y;
+        nvgTransformPremultiply(node->world, local);
+        nvgTransformPremultiply(node->world, node->transform);
+    }
+
+    if (moved || (node->dirty & LOCUS_NODE_DIRTY_CONTENT)) {
+        if (node->bounds_valid && node->type != LOCUS_NODE_GROUP) {
+            damage_bounds(scene, node->bounds);
+        }
+        world_bounds(scene, node, node->bounds);
+        if (node->type != LOCUS_NODE_GROUP) {
+            damage_bounds(scene, node->bounds);
+        }
+    }
+
+    float subtree[4];
+    memcpy(subtree, node->bounds, sizeof(subtree));
+    for (LocusNode* child = node->first_child; child; child = child->next) {
+        update_node(scene, child, node->world, moved);
+        if (child->visible) {
+            bounds_union(subtree, child->subtree_bounds);
+        }
+    }
+    if (!node->visible) {
+        subtree[0] = subtree[1] = subtree[2] = subtree[3] = 0;
+    }
+    clip_bounds(node, subtree);
+
+    /* Hiding a group or changing its clip exposes what was underneath. */
+    if (had_bounds && (node->dirty & LOCUS_NODE_DIRTY_CONTENT) && node->type == LOCUS_NODE_GROUP) {
+        damage_bounds(scene, old_bounds);
+        damage_bounds(scene, subtree);
+    }
+
+    memcpy(node->subtree_bounds, subtree, sizeof(subtree));
+    node->bounds_valid = 1;
+    node->dirty = 0;
+}
+
+void locus_scene_set_surface(LocusScene* scene, LocusSurface* surface) {
+    scene->surface = surface;
+}
+
+void locus_scene_update(LocusScene* scene) {
+    float identity[6];
+    nvgTransformIdentity(identity);
+    update_node(scene, scene->root, identity, 0);
+}
+
+static void frame_hook(Locus* app, uint32_t time, void* data) {
+    locus_scene_update(data);
+}
+
+static LocusNode* create_node(LocusScene* scene, LocusNode* parent, LocusNodeType type,
+                              float x, float y, float width, float height) {
+    LocusNode* node = calloc(1, sizeof(*node));
+    if (node == NULL) {
+        fprintf(stderr, "Error: Could not allocate scene node\n");
+        return NULL;
+    }
+
+    node->type = type;
+    node->x = x;
+    node->y = y;
+    node->width = width;
+    node->height = height;
+    node->visible = 1;
+    nvgTransformIdentity(node->transform);
+    nvgTransformIdentity(node->world);
+
+    if (parent == NULL && scene) {
+        parent = scene->root;
+    }
+    if (parent) {
+        node->parent = parent;
+        node->prev = parent->last_child;
+        if (parent->last_child) {
+            parent->last_child->next = node;
+        } else {
+            parent->first_child = node;
+        }
+        parent->last_child = node;
+    }
+
+    if (scene) {
+        mark_dirty(scene, node, LOCUS_NODE_DIRTY_CONTENT | LOCUS_NODE_DIRTY_TRANSFORM);
+    }
+    return node;
+}
+
+LocusScene* locus_scene_create(LocusUI* ui, Locus* app) {
+    LocusScene* scene = calloc(1, sizeof(*scene));
+    if (scene == NULL) {
+        fprintf(stderr, "Error: Could not allocate scene\n");
+        return NULL;
+    }
+
+    scene->ui = ui;
+    scene->app = app;
+    scene->root = create_node(NULL, NULL, LOCUS_NODE_GROUP, 0, 0, 0, 0);
+    if (scene->root == NULL) {
+        free(scene);
+        return NULL;
+    }
+    scene->root->dirty = LOCUS_NODE_DIRTY_TRANSFORM;
+
+    if (app) {
+        scene->frame_hook = locus_add_frame_hook(app, frame_hook, scene);
+    }
+    return scene;
+}
+
+LocusNode* locus_node_group(LocusScene* scene, LocusNode* parent, float x, float y,
+                            float width, float height) {
+    return create_node(scene, parent, LOCUS_NODE_GROUP, x, y, width, height);
+}
+
+LocusNode* locus_node_rectangle(LocusScene* scene, LocusNode* parent, float x, float y,
+                                float width, float height, float red, float green, float blue,
+                                float alpha, float cornerRadius) {
+    LocusNode* node = create_node(scene, parent, LOCUS_NODE_RECT, x, y, width, height);
+    if (node) {
+        node->color[0] = red;
+        node->color[1] = green;
+        node->color[2] = blue;
+        node->color[3] = alpha;
+        node->radius = cornerRadius;
+    }
+    return node;
+}
+
+LocusNode* locus_node_text(LocusScene* scene, LocusNode* parent, const char* text, float x, float y,
+                           float fontSize, float red, float green, float blue, float alpha) {
+    LocusNode* node = create_node(scene, parent, LOCUS_NODE_TEXT, x, y, 0, 0);
+    if (node) {
+        node->text = strdup(text);
+        node->font_size = fontSize;
+        node->color[0] = red;
+        node->color[1] = green;
+        node->color[2] = blue;
+        node->color[3] = alpha;
+    }
+    return node;
+}
+
+LocusNode* locus_node_image(LocusScene* scene, LocusNode* parent, const char* imagePath,
+                            float x, float y, float width, float height) {
+    LocusNode* node = create_node(scene, parent, LOCUS_NODE_IMAGE, x, y, width, height);
+    if (node) {
+        node->text = strdup(imagePath);
+    }
+    return node;
+}
+
+LocusNode* locus_node_icon(LocusScene* scene, LocusNode* parent, const char* icon_name,
+                           float x, float y, float size) {
+    LocusNode* node = create_node(scene, parent, LOCUS_NODE_ICON, x, y, size, size);
+    if (node) {
+        node->text = strdup(icon_name);
+    }
+    return node;
+}
+
+void locus_node_set_position(LocusScene* scene, LocusNode* node, float x, float y) {
+    if (node->x != x || node->y != y) {
+        node->x = x;
+        node->y = y;
+        mark_dirty(scene, node, LOCUS_NODE_DIRTY_TRANSFORM);
+    }
+}
+
+void locus_node_set_size(LocusScene* scene, LocusNode* node, float width, float height) {
+    if (node->width != width || node->height != height) {
+        node->width = width;
+        node->height = height;
+        mark_dirty(scene, node, LOCUS_NODE_DIRTY_CONTENT);
+    }
+}
+
+void locus_node_set_transform(LocusScene* scene, LocusNode* node, const float* transform) {
+    if (memcmp(node->transform, transform, sizeof(node->transform)) != 0) {
+        memcpy(node->transform, transform, sizeof(node->transform));
+        mark_dirty(scene, node, LOCUS_NODE_DIRTY_TRANSFORM);
+    }
+}
+
+void locus_node_set_color(LocusScene* scene, LocusNode* node, float red, float green,
+                          float blue, float alpha) {
+    float color[4] = { red, green, blue, alpha };
+    if (memcmp(node->color, color, sizeof(color)) != 0) {
+        memcpy(node->color, color, sizeof(color));
+        mark_dirty(scene, node, LOCUS_NODE_DIRTY_CONTENT);
+    }
+}
+
+void locus_node_set_text(LocusScene* scene, LocusNode* node, const char* text) {
+    if (node->text && strcmp(node->text, text) == 0) {
+        return;
+    }
+
+    char* copy = strdup(text);
+    if (copy == NULL) {
+        fprintf(stderr, "Error: Could not allocate node text\n");
+        return;
+    }
+    free(node->text);
+    node->text = copy;
+    mark_dirty(scene, node, LOCUS_NODE_DIRTY_CONTENT);
+}
+
+void locus_node_set_clip(LocusScene* scene, LocusNode* node, int clip) {
+    if (node->clip != clip) {
+        node->clip = clip;
+        mark_dirty(scene, node, LOCUS_NODE_DIRTY_CONTENT);
+    }
+}
+
+void locus_node_set_visible(LocusScene* scene, LocusNode* node, int visible) {
+    if (node->visible != visible) {
+        node->visible = visible;
+        mark_dirty(scene, node, LOCUS_NODE_DIRTY_CONTENT | LOCUS_NODE_DIRTY_TRANSFORM);
+    }
+}
+
+static void free_subtree(LocusNode* node) {
+    LocusNode* child = node->first_child;
+    while (child) {
+        LocusNode* next = child->next;
+        free_subtree(child);
+        child = next;
+    }
+    free(node->text);
+    free(node);
+}
+
+void locus_node_destroy(LocusScene* scene, LocusNode* node) {
+    if (node == scene->root) {
+        return;
+    }
+
+    if (node->bounds_valid) {
+        damage_bounds(scene, node->subtree_bounds);
+    }
+
+    LocusNode* parent = node->parent;
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        parent->first_child = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        parent->last_child = node->prev;
+    }
+
+    mark_dirty(scene, parent, LOCUS_NODE_DIRTY_CHILD);
+    free_subtree(node);
+}
+
+static void draw_node(LocusScene* scene, LocusNode* node) {
+    LocusUI* ui = scene->ui;
+    const float* b = node->subtree_bounds;
+
+    if (!node->visible || b[2] <= b[0] || b[3] <= b[1]) {
+        return;
+    }
+    if (ui->clip[2] > 0 && ui->clip[3] > 0 &&
+        (b[2] < ui->clip[0] || b[3] < ui->clip[1] ||
+         b[0] > ui->clip[0] + ui->clip[2] || b[1] > ui->clip[1] + ui->clip[3])) {
+        return;
+    }
+
+    locus_ui_save(ui);
+    locus_ui_translate(ui, node->x, node->y);
+    locus_ui_transform(ui, node->transform);
+
+    switch (node->type) {
+    case LOCUS_NODE_RECT:
+        locus_rectangle(ui, 0, 0, node->width, node->height, node->color[0], node->color[1],
+                        node->color[2], node->color[3], node->radius);
+        break;
+    case LOCUS_NODE_TEXT:
+        locus_text(ui, node->text, 0, 0, node->font_size, node->color[0], node->color[1],
+                   node->color[2], node->color[3]);
+        break;
+    case LOCUS_NODE_IMAGE:
+        locus_image(ui, node->text, 0, 0, node->width, node->height);
+        break;
+    case LOCUS_NODE_ICON:
+        locus_icon(ui, node->text, 0, 0, node->width);
+        break;
+    case LOCUS_NODE_GROUP:
+        break;
+    }
+
+    if (node->clip) {
+        locus_ui_intersect_clip(ui, 0, 0, node->width, node->height);
+    }
+    for (LocusNode* child = node->first_child; child; child = child->next) {
+        draw_node(scene, child);
+    }
+
+    locus_ui_restore(ui);
+}
+
+void locus_scene_draw(LocusScene* scene) {
+    if (scene->root->dirty) {
+        locus_scene_update(scene);
+    }
+    draw_node(scene, scene->root);
+}
+
+static LocusNode* hit_node(LocusNode* node, float x, float y) {
+    const float* b = node->subtree_bounds;
+    if (!node->visible || x < b[0] || y < b[1] || x > b[2] || y > b[3]) {
+        return NULL;
+    }
+
+    float inverse[6];
+    float lx = x, ly = y;
+    if (nvgTransformInverse(inverse, node->world)) {
+        nvgTransformPoint(&lx, &ly, inverse, x, y);
+    }
+
+    if (node->clip && (lx < 0 || ly < 0 || lx > node->width || ly > node->height)) {
+        return NULL;
+    }
+
+    for (LocusNode* child = node->last_child; child; child = child->prev) {
+        LocusNode* hit = hit_node(child, x, y);
+        if (hit) {
+            return hit;
+        }
+    }
+
+    if (node->type == LOCUS_NODE_GROUP) {
+        return NULL;
+    }
+    if (node->type == LOCUS_NODE_TEXT) {
+        return x >= node->bounds[0] && y >= node->bounds[1] &&
+               x <= node->bounds[2] && y <= node->bounds[3] ? node : NULL;
+    }
+    return lx >= 0 && ly >= 0 && lx <= node->width && ly <= node->height ? node : NULL;
+}
+
+LocusNode* locus_scene_hit_test(LocusScene* scene, float x, float y) {
+    if (scene->root->dirty) {
+        locus_scene_update(scene);
+    }
+    return hit_node(scene->root, x, y);
+}
+
+void locus_scene_destroy(LocusScene* scene) {
+    if (scene == NULL) {
+        return;
+    }
+    if (scene->app && scene->frame_hook) {
+        locus_remove_frame_hook(scene->app, scene->frame_hook);
+    }
+    free_subtree(scene->root);
+    free(scene);
+}
@@ -0,0 +1,292 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define STBTT_STATIC
+#define STB_TRUETYPE_IMPLEMENTATION
+#include <stb_truetype.h>
+#include "locus.h"
+#include "locus-ui-private.h"
+
+/* Software rendering onto the shm canvas; only the scale and translation
+ * of the current transform are honoured. */
+
+#define LOCUS_GLYPH_CACHE_MAX 4096
+
+static void device_point(LocusUI* ui, float x, float y, float* dx, float* dy) {
+    const float* t = ui->xform;
+    *dx = (t[0] * x + t[2] * y + t[4]) * ui->pixel_ratio;
+    *dy = (t[1] * x + t[3] * y + t[5]) * ui->pixel_ratio;
+}
+
+static uint32_t soft_color(float red, float green, float blue, float alpha) {
+    int a = (int)(alpha * 255);
+    a = a < 0 ? 0 : (a > 255 ? 255 : a);
+    return locus_canvas_rgba((unsigned char)red, (unsigned char)green, (unsigned char)blue,
+                             (unsigned char)a);
+}
+
+static int decode_utf8(const char** str) {
+    const unsigned char* s = (const unsigned char*)*str;
+    int cp = s[0], extra = 0;
+
+    if (cp >= 0xf0) {
+        cp &= 0x07;
+        extra = 3;
+    } else if (cp >= 0xe0) {
+        cp &= 0x0f;
+        extra = 2;
+    } else if (cp >= 0xc0) {
+        cp &= 0x1f;
+        extra = 1;
+    } else if (cp >= 0x80) {
+        cp = 0xfffd;
+    }
+
+    s++;
+    for (int i = 0; i < extra; i++) {
+        if ((*s & 0xc0) != 0x80) {
+            cp = 0xfffd;
+            break;
+        }
+        cp = (cp << 6) | (*s++ & 0x3f);
+    }
+    *str = (const char*)s;
+    return cp;
+}
+
+int locus_soft_font_init(LocusUI* ui, LocusFont* font) {
+    stbtt_fontinfo* info = calloc(1, sizeof(*info));
+    if (info == NULL) {
+        return 0;
+    }
+    if (!stbtt_InitFont(info, font->data, stbtt_GetFontOffsetForIndex(font->data, 0))) {
+        free(info);
+        return 0;
+    }
+    font->soft = info;
+    return 1;
+}
+
+void locus_soft_font_free(LocusFont* font) {
+    free(font->soft);
+    font->soft = NULL;
+}
+
+/* Fills in the metrics of a text run the way nvgTextBounds and
+ * nvgTextGlyphPositions would for a left/baseline aligned string. */
+void locus_soft_layout(LocusUI* ui, LocusTextRun* run) {
+    stbtt_fontinfo* info = ui->fonts[run->font].soft;
+    float scale = stbtt_ScaleForPixelHeight(info, run->size);
+    int ascent, descent, gap;
+    stbtt_GetFontVMetrics(info, &ascent, &descent, &gap);
+
+    const char* str = run->text;
+    float pen = 0.0f;
+    int prev = 0;
+    run->glyph_count = 0;
+    while (*str) {
+        const char* start = str;
+        int glyph = stbtt_FindGlyphIndex(info, decode_utf8(&str));
+        if (prev) {
+            pen += stbtt_GetGlyphKernAdvance(info, prev, glyph) * scale;
+        }
+
+        int advance, bearing;
+        stbtt_GetGlyphHMetrics(info, glyph, &advance, &bearing);
+        run->glyph_x[run->glyph_count] = pen;
+        run->glyph_offset[run->glyph_count] = (int)(start - run->text);
+        run->glyph_count++;
+        pen += advance * scale;
+        prev = glyph;
+    }
+
+    run->advance = pen;
+    run->bounds[0] = 0.0f;
+    run->bounds[1] = -ascent * scale;
+    run->bounds[2] = pen;
+    run->bounds[3] = -descent * scale;
+}
+
+static void clear_glyphs(LocusUI* ui) {
+    for (int i = 0; i < LOCUS_GLYPH_CACHE_SIZE; i++) {
+        LocusGlyph* glyph = ui->glyph_buckets[i];
+        while (glyph) {
+            LocusGlyph* next = glyph->next;
+            free(glyph->mask);
+            free(glyph);
+            glyph = next;
+        }
+        ui->glyph_buckets[i] = NULL;
+    }
+    ui->glyph_count = 0;
+}
+
+/* Coverage masks are cached per font, glyph and size in quarter pixels. */
+static LocusGlyph* lookup_glyph(LocusUI* ui, int font, int index, float pixel_size) {
+    int size = (int)(pixel_size * 4.0f + 0.5f);
+    uint64_t hash = locus_hash_bytes(&index, sizeof(index), locus_hash_bytes(&size, sizeof(size), (uint64_t)font));
+    LocusGlyph** bucket = &ui->glyph_buckets[hash % LOCUS_GLYPH_CACHE_SIZE];
+
+    for (LocusGlyph* glyph = *bucket; glyph; glyph = glyph->next) {
+        if (glyph->hash == hash && glyph->font == font && glyph->glyph == index && glyph->size == size) {
+            return glyph;
+        }
+    }
+
+    if (ui->glyph_count >= LOCUS_GLYPH_CACHE_MAX) {
+        clear_glyphs(ui);
+    }
+
+    stbtt_fontinfo* info = ui->fonts[font].soft;
+    float scale = stbtt_ScaleForPixelHeight(info, size / 4.0f);
+    int x0, y0, x1, y1;
+    stbtt_GetGlyphBitmapBox(info, index, scale, scale, &x0, &y0, &x1, &y1);
+
+    LocusGlyph* glyph = calloc(1, sizeof(*glyph));
+    if (glyph == NULL) {
+        return NULL;
+    }
+    glyph->hash = hash;
+    glyph->font = font;
+    glyph->glyph = index;
+    glyph->size = size;
+    glyph->x0 = x0;
+    glyph->y0 = y0;
+    glyph->width = x1 - x0;
+    glyph->height = y1 - y0;
+    if (glyph->width > 0 && glyph->height > 0) {
+        glyph->mask = malloc((size_t)glyph->width * glyph->height);
+        if (glyph->mask == NULL) {
+            free(glyph);
+            return NULL;
+        }
+        stbtt_MakeGlyphBitmap(info, glyph->mask, glyph->width, glyph->height, glyph->width,
+                              scale, scale, index);
+    }
+
+    glyph->next = *bucket;
+    *bucket = glyph;
+    ui->glyph_count++;
+    return glyph;
+}
+
+void locus_soft_text(LocusUI* ui, int font, const char* text, float x, float y,
+                     float fontSize, float red, float green, float blue, float alpha) {
+    stbtt_fontinfo* info = ui->fonts[font].soft;
+    if ((ui->canvas == NULL && !ui->batching) || info == NULL) {
+        return;
+    }
+
+    float pixel_size = fontSize * ui->xform[0] * ui->pixel_ratio;
+    if (pixel_size <= 0.0f) {
+        return;
+    }
+    uint32_t color = soft_color(red, green, blue, alpha);
+    float scale = stbtt_ScaleForPixelHeight(info, pixel_size);
+
+    float pen, baseline;
+    device_point(ui, x, y, &pen, &baseline);
+    int base = (int)floorf(baseline + 0.5f);
+
+    int prev = 0;
+    while (*text) {
+        int index = stbtt_FindGlyphIndex(info, decode_utf8(&text));
+        if (prev) {
+            pen += stbtt_GetGlyphKernAdvance(info, prev, index) * scale;
+        }
+
+        LocusGlyph* glyph = lookup_glyph(ui, font, index, pixel_size);
+        if (glyph && glyph->mask) {
+            int gx = (int)floorf(pen + 0.5f) + glyph->x0;
+            if (ui->canvas) {
+                locus_canvas_blend_mask(ui->canvas, gx, base + glyph->y0, glyph->mask,
+                                        glyph->width, glyph->height, glyph->width, color);
+            } else {
+                locus_batch_glyph(ui, glyph, gx, base + glyph->y0, color);
+            }
+        }
+
+        int advance, bearing;
+        stbtt_GetGlyphHMetrics(info, index, &advance, &bearing);
+        pen += advance * scale;
+        prev = index;
+    }
+}
+
+void locus_soft_rectangle(LocusUI* ui, float x, float y, float width, float height,
+                          float red, float green, float blue, float alpha, float radius) {
+    if (ui->canvas == NULL) {
+        return;
+    }
+
+    float x0, y0;
+    device_point(ui, x, y, &x0, &y0);
+    float sx = ui->xform[0] * ui->pixel_ratio;
+    float sy = ui->xform[3] * ui->pixel_ratio;
+    locus_canvas_fill_rounded_rect(ui->canvas, x0, y0, width * sx, height * sy, radius * sx,
+                                   soft_color(red, green, blue, alpha));
+}
+
+/* Draws the texture scaled to cover the rectangle, cropping the overflow
+ * through the canvas clip like the NanoVG path does with its image
+ * pattern. */
+void locus_soft_texture(LocusUI* ui, const LocusTexture* tex, float x, float y,
+                        float width, float height) {
+    if (ui->canvas == NULL || tex->pixels == NULL) {
+        return;
+    }
+
+    float iw = width, ih = height, ix = 0.0f, iy = 0.0f;
+    if (tex->width * height != tex->height * width) {
+        if (tex->width < tex->height) {
+            ih = iw * tex->height / tex->width;
+            iy = -(ih - height) * 0.5f;
+        } else {
+            iw = ih * tex->width / tex->height;
+            ix = -(iw - width) * 0.5f;
+        }
+    }
+
+    LocusCanvas* canvas = ui->canvas;
+    int saved[4];
+    memcpy(saved, ui->scissor, sizeof(saved));
+    locus_soft_clip(ui, x, y, width, height);
+
+    float dx, dy;
+    device_point(ui, x + ix, y + iy, &dx, &dy);
+    float sx = ui->xform[0] * ui->pixel_ratio;
+    float sy = ui->xform[3] * ui->pixel_ratio;
+    int x0 = (int)lroundf(dx), y0 = (int)lroundf(dy);
+    locus_canvas_blit(canvas, x0, y0, (int)lroundf(dx + iw * sx) - x0, (int)lroundf(dy + ih * sy) - y0,
+                      tex->pixels, tex->width, tex->height, tex->width, (uint32_t)(ui->alpha * 255));
+    memcpy(ui->scissor, saved, sizeof(saved));
+    canvas->clip = (LocusRect){ saved[0], saved[1], saved[2], saved[3] };
+}
+
+/* Intersects the device-space scissor with a rectangle in current
+ * coordinates; the canvas, if any, follows it. */
+void locus_soft_clip(LocusUI* ui, float x, float y, float width, float height) {
+    float dx0, dy0, dx1, dy1;
+    device_point(ui, x, y, &dx0, &dy0);
+    device_point(ui, x + width, y + height, &dx1, &dy1);
+
+    int* clip = ui->scissor;
+    int x0 = (int)lroundf(fminf(dx0, dx1)), y0 = (int)lroundf(fminf(dy0, dy1));
+    int x1 = (int)lroundf(fmaxf(dx0, dx1)), y1 = (int)lroundf(fmaxf(dy0, dy1));
+    x0 = x0 > clip[0] ? x0 : clip[0];
+    y0 = y0 > clip[1] ? y0 : clip[1];
+    x1 = x1 < clip[0] + clip[2] ? x1 : clip[0] + clip[2];
+    y1 = y1 < clip[1] + clip[3] ? y1 : clip[1] + clip[3];
+    clip[0] = x0;
+    clip[1] = y0;
+    clip[2] = x1 > x0 ? x1 - x0 : 0;
+    clip[3] = y1 > y0 ? y1 - y0 : 0;
+    if (ui->canvas) {
+        ui->canvas->clip = (LocusRect){ clip[0], clip[1], clip[2], clip[3] };
+    }
+}
+
+void locus_soft_cleanup(LocusUI* ui) {
+    clear_glyphs(ui);
+}
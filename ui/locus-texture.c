@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <nanovg.h>
+#define NANOVG_GLES2
+#include "nanovg_gl.h"
+#include "locus.h"
+#include "locus-ui.h"
+
+#define LOCUS_TEXTURE_RETRY_SECONDS 5
+
+static uint32_t monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec;
+}
+
+static uint64_t texture_hash(const char* key, int size, float scale) {
+    uint64_t hash = locus_hash_bytes(&size, sizeof(size), 0);
+    hash = locus_hash_bytes(&scale, sizeof(scale), hash);
+    return locus_hash_string(key, hash);
+}
+
+static void lru_unlink(LocusUI* ui, LocusTexture* tex) {
+    if (tex->lru_prev) {
+        tex->lru_prev->lru_next = tex->lru_next;
+    } else {
+        ui->texture_lru_head = tex->lru_next;
+    }
+    if (tex->lru_next) {
+        tex->lru_next->lru_prev = tex->lru_prev;
+    } else {
+        ui->texture_lru_tail = tex->lru_prev;
+    }
+    tex->lru_prev = tex->lru_next = NULL;
+}
+
+static void lru_push_front(LocusUI* ui, LocusTexture* tex) {
+    tex->lru_prev = NULL;
+    tex->lru_next = ui->texture_lru_head;
+    if (ui->texture_lru_head) {
+        ui->texture_lru_head->lru_prev = tex;
+    } else {
+        ui->texture_lru_tail = tex;
+    }
+    ui->texture_lru_head = tex;
+}
+
+static void remove_texture(LocusUI* ui, LocusTexture* tex) {
+    LocusTexture** link = &ui->texture_buckets[tex->hash % LOCUS_TEXTURE_CACHE_SIZE];
+    while (*link && *link != tex) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = tex->next;
+    }
+
+    lru_unlink(ui, tex);
+    if (tex->image && ui->vg) {
+        nvgDeleteImage(ui->vg, tex->image);
+    }
+    ui->texture_bytes -= tex->bytes;
+    ui->texture_count--;
+    free(tex->pixels);
+    free(tex->key);
+    free(tex);
+}
+
+LocusTexture* locus_texture_lookup(LocusUI* ui, const char* key, int size, float scale) {
+    uint64_t hash = texture_hash(key, size, scale);
+
+    for (LocusTexture* tex = ui->texture_buckets[hash % LOCUS_TEXTURE_CACHE_SIZE]; tex; tex = tex->next) {
+        if (tex->hash == hash && tex->size == size && tex->scale == scale && strcmp(tex->key, key) == 0) {
+            /* Failed loads are cached too, but only for a while, so that a
+             * file that shows up later gets loaded. */
+            if (tex->image == 0 && monotonic_seconds() - tex->failed_at >= LOCUS_TEXTURE_RETRY_SECONDS) {
+                remove_texture(ui, tex);
+                break;
+            }
+            tex->last_used = ui->frame;
+            if (ui->texture_lru_head != tex) {
+                lru_unlink(ui, tex);
+                lru_push_front(ui, tex);
+            }
+            ui->texture_hits++;
+            return tex;
+        }
+    }
+
+    ui->texture_misses++;
+    return NULL;
+}
+
+LocusTexture* locus_texture_insert(LocusUI* ui, const char* key, int size, float scale, int image) {
+    LocusTexture* tex = calloc(1, sizeof(*tex));
+    if (tex == NULL || (tex->key = strdup(key)) == NULL) {
+        free(tex);
+        fprintf(stderr, "Error: Could not allocate texture cache entry\n");
+        return NULL;
+    }
+
+    tex->hash = texture_hash(key, size, scale);
+    tex->size = size;
+    tex->scale = scale;
+    tex->image = image;
+    tex->last_used = ui->frame;
+    tex->failed_at = monotonic_seconds();
+    if (image && ui->vg) {
+        nvgImageSize(ui->vg, image, &tex->width, &tex->height);
+        tex->gl_texture = nvglImageHandleGLES2(ui->vg, image);
+        tex->bytes = (size_t)tex->width * tex->height * 4;
+    }
+
+    LocusTexture** bucket = &ui->texture_buckets[tex->hash % LOCUS_TEXTURE_CACHE_SIZE];
+    tex->next = *bucket;
+    *bucket = tex;
+    lru_push_front(ui, tex);
+
+    ui->texture_bytes += tex->bytes;
+    ui->texture_count++;
+    return tex;
+}
+
+/* Creates the texture from decoded RGBA8 pixels: a NanoVG image, or a
+ * premultiplied copy for the software renderer. A NULL rgba caches the
+ * failure like locus_texture_insert() with image 0. */
+LocusTexture* locus_texture_insert_rgba(LocusUI* ui, const char* key, int size, float scale,
+                                        const unsigned char* rgba, int width, int height) {
+    if (ui->vg) {
+        int image = rgba ? nvgCreateImageRGBA(ui->vg, width, height, 0, rgba) : 0;
+        return locus_texture_insert(ui, key, size, scale, image);
+    }
+
+    LocusTexture* tex = locus_texture_insert(ui, key, size, scale, 0);
+    if (tex == NULL || rgba == NULL || width <= 0 || height <= 0) {
+        return tex;
+    }
+
+    tex->pixels = malloc((size_t)width * height * sizeof(*tex->pixels));
+    if (tex->pixels == NULL) {
+        fprintf(stderr, "Error: Could not allocate texture pixels\n");
+        return tex;
+    }
+    locus_canvas_premultiply(tex->pixels, rgba, width * height);
+    tex->image = 1;
+    tex->width = width;
+    tex->height = height;
+    tex->bytes = (size_t)width * height * 4;
+    ui->texture_bytes += tex->bytes;
+    return tex;
+}
+
+void locus_texture_invalidate(LocusUI* ui, const char* key) {
+    LocusTexture* tex = ui->texture_lru_head;
+    while (tex) {
+        LocusTexture* next = tex->lru_next;
+        if (strcmp(tex->key, key) == 0) {
+            remove_texture(ui, tex);
+        }
+        tex = next;
+    }
+}
+
+void locus_texture_cache_set_budget(LocusUI* ui, size_t bytes) {
+    ui->texture_budget = bytes;
+}
+
+/* Queued NanoVG draws may still use any texture, so only call this once
+ * the frame was rendered. */
+void locus_texture_cache_trim(LocusUI* ui) {
+    while (ui->texture_lru_tail && ui->texture_bytes > ui->texture_budget) {
+        remove_texture(ui, ui->texture_lru_tail);
+    }
+}
+
+void locus_texture_cache_stats(LocusUI* ui, unsigned long* hits, unsigned long* misses,
+                               int* entries, size_t* bytes) {
+    if (hits) {
+        *hits = ui->texture_hits;
+    }
+    if (misses) {
+        *misses = ui->texture_misses;
+    }
+    if (entries) {
+        *entries = ui->texture_count;
+    }
+    if (bytes) {
+        *bytes = ui->texture_bytes;
+    }
+}
+
+void locus_texture_cache_clear(LocusUI* ui) {
+    while (ui->texture_lru_head) {
+        remove_texture(ui, ui->texture_lru_head);
+    }
+}
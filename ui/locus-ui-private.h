@@ -0,0 +1,62 @@
+#ifndef LOCUS_UI_PRIVATE_H
+#define LOCUS_UI_PRIVATE_H
+
+#include "locus-ui.h"
+
+/* Entry points shared between the ui sources; not installed. */
+
+void locus_font_cleanup(LocusUI* ui);
+
+int locus_cache_path(const char* name, char* path, size_t size, int create);
+
+unsigned int locus_program_cache_load(const char* vertex, const char* fragment);
+
+void locus_program_cache_store(unsigned int program, const char* vertex, const char* fragment);
+
+void locus_icon_theme_cleanup(LocusUI* ui);
+
+int locus_soft_font_init(LocusUI* ui, LocusFont* font);
+
+void locus_soft_font_free(LocusFont* font);
+
+void locus_soft_layout(LocusUI* ui, LocusTextRun* run);
+
+void locus_soft_text(LocusUI* ui, int font, const char* text, float x, float y,
+                     float fontSize, float red, float green, float blue, float alpha);
+
+void locus_soft_rectangle(LocusUI* ui, float x, float y, float width, float height,
+                          float red, float green, float blue, float alpha, float radius);
+
+void locus_soft_texture(LocusUI* ui, const LocusTexture* tex, float x, float y,
+                        float width, float height);
+
+void locus_soft_clip(LocusUI* ui, float x, float y, float width, float height);
+
+void locus_soft_cleanup(LocusUI* ui);
+
+LocusBatch* locus_batch_create(void);
+
+void locus_batch_destroy(LocusBatch* batch);
+
+void locus_batch_begin(LocusUI* ui);
+
+int locus_batch_rect(LocusUI* ui, float x, float y, float width, float height,
+                     float red, float green, float blue, float alpha, float radius);
+
+int locus_batch_texture(LocusUI* ui, const LocusTexture* tex, float x, float y,
+                        float width, float height);
+
+int locus_batch_text(LocusUI* ui, int font, const char* text, float x, float y,
+                     float fontSize, float red, float green, float blue, float alpha);
+
+void locus_batch_glyph(LocusUI* ui, LocusGlyph* glyph, int x, int y, uint32_t color);
+
+void locus_batch_begin_nvg(LocusUI* ui);
+
+void locus_batch_push_target(LocusUI* ui, int width, int height);
+
+void locus_batch_pop_target(LocusUI* ui);
+
+void locus_batch_flush(LocusUI* ui);
+
+#endif
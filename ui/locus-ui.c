@@ -1,15 +1,32 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <GLES2/gl2.h>
 #include <nanovg.h>
 #define NANOVG_GLES2_IMPLEMENTATION
 #include "nanovg_gl.h"
-#include "locus-ui.h"
+#include "nanovg_gl_utils.h"
+#include "locus.h"
+#include "locus-ui-private.h"
 #include <unistd.h>
 #include <nanosvg.h>
 #include <nanosvgrast.h>
+#include <stb_image.h>
+
+static void init_ui(LocusUI* ui) {
+    memset(ui, 0, sizeof(*ui));
+    ui->default_font = -1;
+    ui->pixel_ratio = 1.0f;
+    ui->alpha = 1.0f;
+    ui->texture_budget = LOCUS_TEXTURE_DEFAULT_BUDGET;
+    ui->layer_budget = LOCUS_LAYER_DEFAULT_BUDGET;
+    ui->upload_budget_us = LOCUS_LOADER_DEFAULT_UPLOAD_BUDGET;
+    nvgTransformIdentity(ui->xform);
+}
 
 void locus_setup_ui(LocusUI* ui) {
+    init_ui(ui);
     ui->vg = nvgCreateGLES2(NVG_ANTIALIAS | NVG_STENCIL_STROKES);
     if (!ui->vg) {
         fprintf(stderr, "Could not init NanoVG.\n");
@@ -17,8 +34,203 @@ void locus_setup_ui(LocusUI* ui) {
     }
 }
 
+/* For apps on the shm backend; needs locus_ui_bind() so that frames find
+ * the canvas of the surface being drawn. */
+void locus_setup_ui_software(LocusUI* ui) {
+    init_ui(ui);
+}
+
+/* NanoVG keeps its own state only without batching; with it, the state is
+ * loaded into NanoVG before each draw that falls back to it. */
+static int nvg_state(LocusUI* ui) {
+    return ui->vg && !ui->batching;
+}
+
+void locus_ui_save(LocusUI* ui) {
+    if (nvg_state(ui)) {
+        nvgSave(ui->vg);
+    }
+    if (ui->state_depth < LOCUS_UI_STATE_DEPTH) {
+        LocusUIState* state = &ui->states[ui->state_depth];
+        memcpy(state->xform, ui->xform, sizeof(ui->xform));
+        memcpy(state->clip, ui->scissor, sizeof(ui->scissor));
+        state->alpha = ui->alpha;
+    }
+    ui->state_depth++;
+}
+
+void locus_ui_restore(LocusUI* ui) {
+    if (nvg_state(ui)) {
+        nvgRestore(ui->vg);
+    }
+    if (ui->state_depth == 0) {
+        return;
+    }
+    ui->state_depth--;
+    if (ui->state_depth < LOCUS_UI_STATE_DEPTH) {
+        LocusUIState* state = &ui->states[ui->state_depth];
+        memcpy(ui->xform, state->xform, sizeof(ui->xform));
+        memcpy(ui->scissor, state->clip, sizeof(ui->scissor));
+        ui->alpha = state->alpha;
+        if (ui->canvas) {
+            ui->canvas->clip = (LocusRect){ state->clip[0], state->clip[1], state->clip[2], state->clip[3] };
+        }
+    }
+}
+
+void locus_ui_translate(LocusUI* ui, float x, float y) {
+    float t[6] = { 1.0f, 0.0f, 0.0f, 1.0f, x, y };
+    locus_ui_transform(ui, t);
+}
+
+void locus_ui_transform(LocusUI* ui, const float* transform) {
+    if (nvg_state(ui)) {
+        nvgTransform(ui->vg, transform[0], transform[1], transform[2], transform[3],
+                     transform[4], transform[5]);
+    }
+    nvgTransformPremultiply(ui->xform, transform);
+}
+
+void locus_ui_intersect_clip(LocusUI* ui, float x, float y, float width, float height) {
+    if (nvg_state(ui)) {
+        nvgIntersectScissor(ui->vg, x, y, width, height);
+    }
+    locus_soft_clip(ui, x, y, width, height);
+}
+
+/* Fades everything drawn until the matching restore. Primitives take it
+ * into their colour, so fading a cached layout or texture in or out costs
+ * nothing beyond drawing it. */
+void locus_ui_opacity(LocusUI* ui, float opacity) {
+    opacity = opacity < 0.0f ? 0.0f : (opacity > 1.0f ? 1.0f : opacity);
+    ui->alpha *= opacity;
+}
+
+void locus_ui_begin_frame(LocusUI* ui, float width, float height, float pixelRatio) {
+    ui->frame++;
+    ui->frame_width = width;
+    ui->frame_height = height;
+    if (pixelRatio <= 0 && ui->app) {
+        pixelRatio = locus_scale(ui->app);
+    }
+    ui->pixel_ratio = pixelRatio > 0 ? pixelRatio : 1.0f;
+    ui->upload_time_ns = 0;
+    ui->clip[0] = 0;
+    ui->clip[1] = 0;
+    ui->clip[2] = width;
+    ui->clip[3] = height;
+    nvgTransformIdentity(ui->xform);
+    ui->alpha = 1.0f;
+    ui->state_depth = 0;
+    ui->scissor[0] = 0;
+    ui->scissor[1] = 0;
+    ui->scissor[2] = (int)ceilf(width * ui->pixel_ratio);
+    ui->scissor[3] = (int)ceilf(height * ui->pixel_ratio);
+    if (ui->vg) {
+        nvgBeginFrame(ui->vg, width, height, ui->pixel_ratio);
+    } else {
+        ui->canvas = ui->app ? locus_canvas(ui->app) : NULL;
+        if (ui->canvas) {
+            LocusRect clip = ui->canvas->clip;
+            ui->scissor[0] = clip.x;
+            ui->scissor[1] = clip.y;
+            ui->scissor[2] = clip.width;
+            ui->scissor[3] = clip.height;
+        }
+    }
+
+    if (ui->app) {
+        LocusRect repaint = locus_repaint_rect(ui->app);
+        if (repaint.width > 0 && repaint.height > 0 &&
+            (repaint.width < width || repaint.height < height)) {
+            ui->clip[0] = repaint.x;
+            ui->clip[1] = repaint.y;
+            ui->clip[2] = repaint.width;
+            ui->clip[3] = repaint.height;
+            if (ui->vg) {
+                int x0 = (int)floorf(repaint.x * ui->pixel_ratio);
+                int y0 = (int)floorf(repaint.y * ui->pixel_ratio);
+                ui->scissor[0] = x0;
+                ui->scissor[1] = y0;
+                ui->scissor[2] = (int)ceilf((repaint.x + repaint.width) * ui->pixel_ratio) - x0;
+                ui->scissor[3] = (int)ceilf((repaint.y + repaint.height) * ui->pixel_ratio) - y0;
+                nvgScissor(ui->vg, repaint.x, repaint.y, repaint.width, repaint.height);
+            }
+        }
+    }
+
+    if (ui->batch) {
+        ui->batching = 1;
+        locus_batch_begin(ui);
+    }
+}
+
+int locus_ui_visible(LocusUI* ui, float x, float y, float width, float height) {
+    if (ui->clip[2] <= 0 || ui->clip[3] <= 0) {
+        return 1;
+    }
+
+    float xform[6];
+    if (nvg_state(ui)) {
+        nvgCurrentTransform(ui->vg, xform);
+    } else {
+        memcpy(xform, ui->xform, sizeof(xform));
+    }
+    if (xform[1] != 0.0f || xform[2] != 0.0f) {
+        return 1;
+    }
+
+    float x0 = xform[0] * x + xform[4];
+    float y0 = xform[3] * y + xform[5];
+    float x1 = xform[0] * (x + width) + xform[4];
+    float y1 = xform[3] * (y + height) + xform[5];
+
+    return x1 >= ui->clip[0] && y1 >= ui->clip[1] &&
+           x0 <= ui->clip[0] + ui->clip[2] && y0 <= ui->clip[1] + ui->clip[3];
+}
+
+void locus_ui_end_frame(LocusUI* ui) {
+    locus_batch_flush(ui);
+    ui->batching = 0;
+    if (ui->vg) {
+        nvgEndFrame(ui->vg);
+    }
+    ui->canvas = NULL;
+    locus_text_cache_trim(ui);
+    locus_texture_cache_trim(ui);
+    locus_layer_cache_trim(ui);
+    locus_vector_cache_trim(ui);
+    locus_loader_trim(ui);
+}
+
+uint64_t locus_hash_bytes(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* bytes = data;
+    uint64_t hash = 14695981039346656037ULL ^ seed;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t locus_hash_string(const char* str, uint64_t seed) {
+    return locus_hash_bytes(str, strlen(str), seed);
+}
+
 void locus_rectangle(LocusUI* ui, float x, float y, float width, float height, 
                      float red, float green, float blue, float alpha, float cornerRadius) {
+    alpha *= ui->alpha;
+    if (alpha <= 0.0f || !locus_ui_visible(ui, x, y, width, height)) {
+        return;
+    }
+    if (!ui->vg) {
+        locus_soft_rectangle(ui, x, y, width, height, red, green, blue, alpha, cornerRadius);
+        return;
+    }
+    if (locus_batch_rect(ui, x, y, width, height, red, green, blue, alpha, cornerRadius)) {
+        return;
+    }
+    locus_batch_begin_nvg(ui);
     nvgBeginPath(ui->vg);
     nvgRoundedRect(ui->vg, x, y, width, height, cornerRadius);
     nvgFillColor(ui->vg, nvgRGBA(red, green, blue, (int)(alpha * 255)));
@@ -27,31 +239,15 @@ void locus_rectangle(LocusUI* ui, float x, float y, float width, float height,
 
 void locus_text(LocusUI* ui, const char* text, float x, float y, 
                 float fontSize, float red, float green, float blue, float alpha) {
-    nvgBeginPath(ui->vg);  
-    nvgCreateFont(ui->vg, "font", "/home/droidian/.local/share/fonts/MonofurNerdFont-Regular.ttf");
-    nvgFontFace(ui->vg, "font");  
-    nvgFontSize(ui->vg, fontSize);
-    nvgTextAlign(ui->vg, NVG_ALIGN_LEFT | NVG_ALIGN_BASELINE);  
-    nvgFillColor(ui->vg, nvgRGBA(red, green, blue, (int)(alpha * 255)));
-    nvgText(ui->vg, x, y, text, NULL);
-}
-
-void locus_image(LocusUI* ui, const char* imagePath, float x, float y, float width, float height) {
-    int image = nvgCreateImage(ui->vg, imagePath, 0); 
-    if (image == 0) {
-        fprintf(stderr, "Failed to load image: %s\n", imagePath);
-        return;
-    }
-
-    int imgWidth, imgHeight;
-    nvgImageSize(ui->vg, image, &imgWidth, &imgHeight);
-
-    if (imgWidth == 0 || imgHeight == 0) {
-        fprintf(stderr, "Image dimensions are invalid.\n");
-        nvgDeleteImage(ui->vg, image);  
+    int font = locus_font_default(ui);
+    if (font < 0) {
         return;
     }
+    locus_text_font(ui, font, text, x, y, fontSize, red, green, blue, alpha);
+}
 
+static void draw_image_cover(LocusUI* ui, int image, int imgWidth, int imgHeight,
+                             float x, float y, float width, float height) {
     float iw, ih, ix = 0.0f, iy = 0.0f;
     if (imgWidth < imgHeight) {
         iw = width;
@@ -63,7 +259,7 @@ void locus_image(LocusUI* ui, const char* imagePath, float x, float y, float wid
         ix = -(iw - width) * 0.5f;
     }
 
-    NVGpaint imgPaint = nvgImagePattern(ui->vg, x + ix, y + iy, iw, ih, 0.0f, image, 1.0f);
+    NVGpaint imgPaint = nvgImagePattern(ui->vg, x + ix, y + iy, iw, ih, 0.0f, image, ui->alpha);
 
     nvgBeginPath(ui->vg);
     nvgRect(ui->vg, x, y, width, height);
@@ -71,91 +267,187 @@ void locus_image(LocusUI* ui, const char* imagePath, float x, float y, float wid
     nvgFill(ui->vg);  
 }
 
-int file_exists(const char* filename) {
-    return access(filename, F_OK) != -1;
+static LocusTexture* load_file(LocusUI* ui, const char* key, int size, float scale, const char* path) {
+    if (ui->vg) {
+        int image = nvgCreateImage(ui->vg, path, 0);
+        if (image == 0) {
+            fprintf(stderr, "Failed to load image: %s\n", path);
+        }
+        return locus_texture_insert(ui, key, size, scale, image);
+    }
+
+    int width, height, components;
+    unsigned char* data = stbi_load(path, &width, &height, &components, 4);
+    if (data == NULL) {
+        fprintf(stderr, "Failed to load image: %s\n", path);
+    }
+    LocusTexture* tex = locus_texture_insert_rgba(ui, key, size, scale, data, width, height);
+    stbi_image_free(data);
+    return tex;
 }
 
-void locus_icon(LocusUI* ui, const char* icon_name, float x, float y, float size) {
-    char icon_path_svg[512];
-    char icon_path_png[512];
-
-    const char* svg_dirs[] = {
-        "/home/droidian/temp/Fluent-grey-dark/scalable/apps/",
-        "/home/droidian/temp/McMojave-circle-blue-light/apps/scalable/",
-        "/home/droidian/temp/McMojave-circle-blue-dark/apps/symbolic/",
-        "/home/droidian/temp/McMojave-circle-blue-dark/actions/symbolic/",
-        "/home/droidian/temp/Fluent-grey-dark/symbolic/apps/",
-        "/home/droidian/temp/Fluent-grey-dark/symbolic/actions/",
-        "/usr/share/icons/hicolor/scalable/apps/",
-    };
-    
-    int found_svg = 0;
-    for (int i = 0; i < 7; i++) {
-        snprintf(icon_path_svg, sizeof(icon_path_svg), "%s%s.svg", svg_dirs[i], icon_name);
-        if (file_exists(icon_path_svg)) {
-            found_svg = 1;
-            break;
-        }
+static LocusTexture* load_image(LocusUI* ui, const char* imagePath, int bucket) {
+    LocusTexture* tex = locus_texture_lookup(ui, imagePath, bucket, 1.0f);
+    if (tex) {
+        return tex;
+    }
+
+    LocusImageData data;
+    locus_image_data_load(imagePath, bucket, ui->vg && ui->image_mipmaps, &data);
+    tex = locus_image_texture_insert(ui, imagePath, bucket, 1.0f, &data);
+    locus_image_data_free(&data);
+    return tex;
+}
+
+void locus_image(LocusUI* ui, const char* imagePath, float x, float y, float width, float height) {
+    if (!locus_ui_visible(ui, x, y, width, height)) {
+        return;
     }
-    
-    if (!found_svg) {
-        snprintf(icon_path_png, sizeof(icon_path_png), "/usr/share/pixmaps/%s.png", icon_name);
-        if (!file_exists(icon_path_png)) {
-            fprintf(stderr, "Error: Icon '%s' not found (neither SVG nor PNG)\n", icon_name);
-            return;
-        }
 
-        locus_image(ui, icon_path_png, x, y, size, size);
+    LocusTexture* tex = load_image(ui, imagePath, locus_image_bucket(ui, width, height));
+    if (tex == NULL || tex->image == 0) {
         return;
     }
 
-    
-    NSVGimage* svg = nsvgParseFromFile(icon_path_svg, "px", 96.0f);
-    if (svg == NULL) {
-        fprintf(stderr, "Error: Failed to load SVG icon '%s'\n", icon_name);
+    if (tex->width == 0 || tex->height == 0) {
+        fprintf(stderr, "Image dimensions are invalid.\n");
         return;
     }
 
+    locus_draw_texture(ui, tex, x, y, width, height);
+}
+
+unsigned char* locus_rasterize_svg(const char* path, int pixelSize, int* width, int* height) {
+    NSVGimage* svg = nsvgParseFromFile(path, "px", 96.0f);
+    if (svg == NULL) {
+        fprintf(stderr, "Error: Failed to load SVG icon '%s'\n", path);
+        return NULL;
+    }
+
     struct NSVGrasterizer* rast = nsvgCreateRasterizer();
     if (rast == NULL) {
         nsvgDelete(svg);
         fprintf(stderr, "Error: Could not create SVG rasterizer\n");
-        return;
+        return NULL;
     }
 
-    int imgWidth = size;
-    int imgHeight = size;
-    float scale = svg->width > svg->height ? size / svg->width : size / svg->height;
+    int imgWidth = pixelSize;
+    int imgHeight = pixelSize;
+    float scale = svg->width > svg->height ? pixelSize / svg->width : pixelSize / svg->height;
     uint8_t* data = malloc(imgWidth * imgHeight * 4);
     if (data == NULL) {
         nsvgDeleteRasterizer(rast);
         nsvgDelete(svg);
         fprintf(stderr, "Error: Could not allocate memory for SVG rasterization\n");
-        return;
+        return NULL;
     }
 
     nsvgRasterize(rast, svg, 0, 0, scale, data, imgWidth, imgHeight, imgWidth * 4);
-    
-    int imgHandle = nvgCreateImageRGBA(ui->vg, imgWidth, imgHeight, 0, data);
-    free(data);
     nsvgDeleteRasterizer(rast);
     nsvgDelete(svg);
 
-    if (imgHandle == 0) {
-        fprintf(stderr, "Error: Failed to create NanoVG image from SVG '%s'\n", icon_name);
+    *width = imgWidth;
+    *height = imgHeight;
+    return data;
+}
+
+static LocusTexture* rasterize_svg(LocusUI* ui, const char* key, const char* path, const char* icon_name,
+                                   int pixelSize) {
+    int imgWidth = 0, imgHeight = 0;
+    unsigned char* data = locus_rasterize_svg(path, pixelSize, &imgWidth, &imgHeight);
+
+    LocusTexture* tex = locus_texture_insert_rgba(ui, key, pixelSize, ui->pixel_ratio, data,
+                                                  imgWidth, imgHeight);
+    if (data && tex && tex->image == 0) {
+        fprintf(stderr, "Error: Failed to create image from SVG '%s'\n", icon_name);
+    }
+    free(data);
+    return tex;
+}
+
+static LocusTexture* load_icon(LocusUI* ui, const char* icon_name, int pixelSize) {
+    char key[512];
+    snprintf(key, sizeof(key), "icon:%s", icon_name);
+
+    LocusTexture* tex = locus_texture_lookup(ui, key, pixelSize, ui->pixel_ratio);
+    if (tex) {
+        return tex;
+    }
+
+    char icon_path[512];
+    int scale = (int)(ui->pixel_ratio + 0.5f);
+    int found = locus_icon_theme_lookup(ui, icon_name, pixelSize / scale, scale,
+                                        icon_path, sizeof(icon_path));
+
+    if (found == 2) {
+        return rasterize_svg(ui, key, icon_path, icon_name, pixelSize);
+    } else if (found == 1) {
+        return load_file(ui, key, pixelSize, ui->pixel_ratio, icon_path);
+    }
+
+    fprintf(stderr, "Error: Icon '%s' not found (neither SVG nor PNG)\n", icon_name);
+    return locus_texture_insert(ui, key, pixelSize, ui->pixel_ratio, 0);
+}
+
+void locus_icon(LocusUI* ui, const char* icon_name, float x, float y, float size) {
+    if (!locus_ui_visible(ui, x, y, size, size)) {
         return;
     }
 
-    NVGpaint imgPaint = nvgImagePattern(ui->vg, x, y, size, size, 0, imgHandle, 1.0f);
-    nvgBeginPath(ui->vg);
-    nvgRect(ui->vg, x, y, size, size);  
-    nvgFillPaint(ui->vg, imgPaint);     
-    nvgFill(ui->vg);                    
+    if (ui->vector_icons && locus_vector_icon(ui, icon_name, x, y, size)) {
+        return;
+    }
+
+    int pixelSize = (int)(size * ui->pixel_ratio + 0.5f);
+    if (pixelSize <= 0) {
+        return;
+    }
+
+    LocusTexture* tex = load_icon(ui, icon_name, pixelSize);
+    if (tex == NULL || tex->image == 0) {
+        return;
+    }
+
+    locus_draw_texture(ui, tex, x, y, size, size);
+}
+
+void locus_draw_texture(LocusUI* ui, const LocusTexture* tex, float x, float y,
+                        float width, float height) {
+    if (tex->width == 0 || tex->height == 0 || ui->alpha <= 0.0f) {
+        return;
+    }
+    if (!ui->vg) {
+        locus_soft_texture(ui, tex, x, y, width, height);
+        return;
+    }
+    if (locus_batch_texture(ui, tex, x, y, width, height)) {
+        return;
+    }
+    locus_batch_begin_nvg(ui);
+
+    if (tex->width * height == tex->height * width) {
+        NVGpaint imgPaint = nvgImagePattern(ui->vg, x, y, width, height, 0, tex->image, ui->alpha);
+        nvgBeginPath(ui->vg);
+        nvgRect(ui->vg, x, y, width, height);  
+        nvgFillPaint(ui->vg, imgPaint);     
+        nvgFill(ui->vg);                    
+    } else {
+        draw_image_cover(ui, tex->image, tex->width, tex->height, x, y, width, height);
+    }
 }
 
 void locus_cleanup_ui(LocusUI* ui) {
+    locus_loader_stop(ui);
+    locus_layer_cache_clear(ui);
+    locus_vector_cache_clear(ui);
+    locus_texture_cache_clear(ui);
+    locus_batch_destroy(ui->batch);
+    ui->batch = NULL;
     if (ui->vg) {
         nvgDeleteGLES2(ui->vg); 
         ui->vg = NULL;
     }
+    locus_font_cleanup(ui);
+    locus_soft_cleanup(ui);
+    locus_icon_theme_cleanup(ui);
 }
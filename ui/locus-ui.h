@@ -2,13 +2,472 @@
 #define LOCUS_UI_H
 
 #include <nanovg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOCUS_MAX_FONTS 16
+#define LOCUS_TEXT_CACHE_SIZE 1024
+#define LOCUS_TEXTURE_CACHE_SIZE 256
+#define LOCUS_TEXTURE_DEFAULT_BUDGET (64 * 1024 * 1024)
+#define LOCUS_LOADER_MAX_THREADS 8
+#define LOCUS_LOADER_DEFAULT_UPLOAD_BUDGET 4000
+#define LOCUS_GLYPH_CACHE_SIZE 512
+#define LOCUS_UI_STATE_DEPTH 32
+#define LOCUS_LAYER_DEFAULT_BUDGET (32 * 1024 * 1024)
+#define LOCUS_VECTOR_CACHE_SIZE 128
+
+struct Locus;
+struct LocusSurface;
+struct LocusCanvas;
+typedef struct LocusLoader LocusLoader;
+typedef struct LocusBatch LocusBatch;
+typedef struct LocusGlyph LocusGlyph;
+typedef struct LocusLayer LocusLayer;
+typedef struct LocusLayerCapture LocusLayerCapture;
+typedef struct LocusVectorIcon LocusVectorIcon;
+
+typedef struct {
+    char name[64];
+    int handle;
+    unsigned char* data;
+    size_t size;
+    void* soft;
+} LocusFont;
+
+typedef struct LocusTextRun LocusTextRun;
+
+struct LocusTextRun {
+    uint64_t hash;
+    char* text;
+    int font;
+    float size;
+    float advance;
+    float bounds[4];
+    int glyph_count;
+    float* glyph_x;
+    int* glyph_offset;
+    uint32_t last_used;
+    uint32_t last_lookup;
+    LocusTextRun* next;
+};
+
+/* Flags of locus_text_layout(): an alignment plus wrapping and
+ * ellipsizing. */
+enum {
+    LOCUS_TEXT_ALIGN_LEFT = 0,
+    LOCUS_TEXT_ALIGN_CENTER = 1,
+    LOCUS_TEXT_ALIGN_RIGHT = 2,
+    LOCUS_TEXT_ALIGN_MASK = 3,
+    LOCUS_TEXT_WRAP = 1 << 2,
+    LOCUS_TEXT_ELLIPSIZE = 1 << 3,
+};
+
+typedef struct {
+    char* text;
+    float x;
+    float width;
+} LocusTextLine;
+
+typedef struct LocusTextLayout LocusTextLayout;
+
+/* Lines are positioned relative to the top left of the layout box; the
+ * first baseline is ascent below the top and the others follow every
+ * line_height. */
+struct LocusTextLayout {
+    uint64_t hash;
+    char* text;
+    int font;
+    float size;
+    float max_width;
+    int max_lines;
+    int flags;
+    float ascent;
+    float line_height;
+    float width, height;
+    int truncated;
+    LocusTextLine* lines;
+    int line_count;
+    uint32_t last_used;
+    uint32_t last_lookup;
+    LocusTextLayout* next;
+};
+
+typedef struct LocusTexture LocusTexture;
+
+struct LocusGlyph {
+    uint64_t hash;
+    int font;
+    int glyph;
+    int size;
+    int x0, y0;
+    int width, height;
+    unsigned char* mask;
+    int atlas_x, atlas_y;
+    uint32_t atlas_generation;
+    LocusGlyph* next;
+};
+
+/* Textures rendered by Locus itself rather than decoded: premultiplied,
+ * and bottom row first when they come from a framebuffer. */
+enum {
+    LOCUS_TEXTURE_PREMULTIPLIED = 1 << 0,
+    LOCUS_TEXTURE_FLIPPED = 1 << 1,
+};
+
+struct LocusTexture {
+    uint64_t hash;
+    char* key;
+    int size;
+    float scale;
+    int image;
+    unsigned int gl_texture;
+    uint32_t* pixels;
+    int width, height;
+    int flags;
+    size_t bytes;
+    uint32_t last_used;
+    uint32_t failed_at;
+    LocusTexture* next;
+    LocusTexture* lru_prev;
+    LocusTexture* lru_next;
+};
+
+/* Decoded RGBA8, straight alpha; width and height are the pixel data's,
+ * image_width and image_height those of the file it came from. */
+typedef struct {
+    unsigned char* pixels;
+    int width, height;
+    int image_width, image_height;
+    int stb;
+    void* map;
+    size_t map_size;
+} LocusImageData;
+
+typedef enum {
+    LOCUS_ICON_DIR_FIXED,
+    LOCUS_ICON_DIR_SCALABLE,
+    LOCUS_ICON_DIR_THRESHOLD,
+} LocusIconDirType;
 
+typedef struct {
+    char* path;
+    int theme;
+    int type;
+    int size, min_size, max_size, threshold, scale;
+} LocusIconDir;
+
+typedef struct {
+    char* name;
+    uint64_t hash;
+    int dir;
+    int svg;
+    int next;
+} LocusIconEntry;
+
+typedef struct {
+    char* path;
+    int64_t mtime_sec;
+    long mtime_nsec;
+} LocusIconStamp;
+
+typedef struct {
+    char* name;
+    char* path;
+    uint64_t hash;
+    int size, scale;
+    int kind;
+    int used;
+    int next;
+} LocusIconResolved;
+
+typedef struct {
+    int loaded;
+    char theme[128];
+    char** themes;
+    int theme_count;
+    LocusIconDir* dirs;
+    int dir_count, dir_capacity;
+    LocusIconEntry* entries;
+    int entry_count, entry_capacity;
+    int* buckets;
+    int bucket_count;
+    LocusIconStamp* stamps;
+    int stamp_count, stamp_capacity;
+    LocusIconResolved* resolved;
+    int resolved_count, resolved_capacity;
+    int* resolved_buckets;
+    int resolved_bucket_count;
+    int resolved_loaded, resolved_dirty;
+} LocusIconTheme;
+
+typedef struct {
+    float xform[6];
+    int clip[4];
+    float alpha;
+} LocusUIState;
+
+/* With vg == NULL the UI renders in software onto the surface's canvas.
+ * xform, scissor (device pixels) and alpha track the state in every mode. */
 typedef struct {
     NVGcontext* vg;
+    struct LocusCanvas* canvas;
+    LocusBatch* batch;
+    int batching;
+    float xform[6];
+    int scissor[4];
+    float alpha;
+    LocusUIState states[LOCUS_UI_STATE_DEPTH];
+    int state_depth;
+    LocusGlyph* glyph_buckets[LOCUS_GLYPH_CACHE_SIZE];
+    int glyph_count;
+    LocusFont fonts[LOCUS_MAX_FONTS];
+    int font_count;
+    int default_font;
+    LocusTextRun* text_buckets[LOCUS_TEXT_CACHE_SIZE];
+    int text_run_count;
+    uint32_t text_lookups;
+    unsigned long text_hits;
+    unsigned long text_misses;
+    LocusTextLayout* layout_buckets[LOCUS_TEXT_CACHE_SIZE];
+    int text_layout_count;
+    LocusTexture* texture_buckets[LOCUS_TEXTURE_CACHE_SIZE];
+    LocusTexture* texture_lru_head;
+    LocusTexture* texture_lru_tail;
+    int texture_count;
+    size_t texture_bytes;
+    size_t texture_budget;
+    unsigned long texture_hits;
+    unsigned long texture_misses;
+    int image_mipmaps;
+    LocusLayer* layers;
+    int layer_count;
+    size_t layer_bytes;
+    size_t layer_budget;
+    LocusLayerCapture* layer_capture;
+    int layer_depth;
+    int vector_icons;
+    LocusVectorIcon* vector_buckets[LOCUS_VECTOR_CACHE_SIZE];
+    int vector_count;
+    LocusIconTheme icon_theme;
+    LocusLoader* loader;
+    uint32_t upload_budget_us;
+    uint64_t upload_time_ns;
+    int upload_hook;
+    uint32_t frame;
+    float frame_width, frame_height;
+    float pixel_ratio;
+    float clip[4];
+    struct Locus* app;
 } LocusUI;
 
+typedef enum {
+    LOCUS_NODE_GROUP,
+    LOCUS_NODE_RECT,
+    LOCUS_NODE_TEXT,
+    LOCUS_NODE_IMAGE,
+    LOCUS_NODE_ICON,
+} LocusNodeType;
+
+enum {
+    LOCUS_NODE_DIRTY_CONTENT = 1 << 0,
+    LOCUS_NODE_DIRTY_TRANSFORM = 1 << 1,
+    LOCUS_NODE_DIRTY_CHILD = 1 << 2,
+};
+
+typedef struct LocusNode LocusNode;
+
+struct LocusNode {
+    LocusNodeType type;
+    int id;
+    float x, y, width, height;
+    float transform[6];
+    float world[6];
+    float bounds[4];
+    float subtree_bounds[4];
+    int bounds_valid;
+    int clip;
+    int visible;
+    int dirty;
+    float color[4];
+    float radius;
+    char* text;
+    int font;
+    float font_size;
+    void* user_data;
+    LocusNode* parent;
+    LocusNode* first_child;
+    LocusNode* last_child;
+    LocusNode* prev;
+    LocusNode* next;
+};
+
+typedef struct {
+    LocusUI* ui;
+    struct Locus* app;
+    struct LocusSurface* surface;
+    LocusNode* root;
+    int frame_hook;
+} LocusScene;
+
+typedef struct LocusList LocusList;
+
+/* Row state of a list without a draw callback. */
+typedef struct {
+    char label[128];
+    char detail[128];
+    char icon[64];
+} LocusListItem;
+
 void locus_setup_ui(LocusUI* ui);  
 
+void locus_setup_ui_software(LocusUI* ui);
+
+void locus_ui_save(LocusUI* ui);
+
+void locus_ui_restore(LocusUI* ui);
+
+void locus_ui_translate(LocusUI* ui, float x, float y);
+
+void locus_ui_transform(LocusUI* ui, const float* transform);
+
+void locus_ui_intersect_clip(LocusUI* ui, float x, float y, float width, float height);
+
+void locus_ui_opacity(LocusUI* ui, float opacity);
+
+void locus_ui_flush(LocusUI* ui);
+
+void locus_ui_set_batching(LocusUI* ui, int enabled);
+
+void locus_ui_batch_stats(LocusUI* ui, unsigned long* draw_calls, unsigned long* quads);
+
+void locus_ui_begin_frame(LocusUI* ui, float width, float height, float pixelRatio);
+
+void locus_ui_end_frame(LocusUI* ui);
+
+int locus_ui_visible(LocusUI* ui, float x, float y, float width, float height);
+
+uint64_t locus_hash_bytes(const void* data, size_t size, uint64_t seed);
+
+uint64_t locus_hash_string(const char* str, uint64_t seed);
+
+int locus_font_load(LocusUI* ui, const char* name, const char* path);
+
+int locus_font_find(LocusUI* ui, const char* name);
+
+void locus_font_set_default(LocusUI* ui, int font);
+
+int locus_font_default(LocusUI* ui);
+
+const LocusTextRun* locus_text_run(LocusUI* ui, int font, const char* text, float fontSize);
+
+float locus_text_measure(LocusUI* ui, int font, const char* text, float fontSize, float* bounds);
+
+void locus_text_font(LocusUI* ui, int font, const char* text, float x, float y,
+                     float fontSize, float red, float green, float blue, float alpha);
+
+const LocusTextLayout* locus_text_layout(LocusUI* ui, int font, const char* text, float fontSize,
+                                         float width, int maxLines, int flags);
+
+void locus_text_layout_draw(LocusUI* ui, const LocusTextLayout* layout, float x, float y,
+                            float red, float green, float blue, float alpha);
+
+void locus_text_box(LocusUI* ui, const char* text, float x, float y, float width, float fontSize,
+                    int maxLines, int flags, float red, float green, float blue, float alpha);
+
+void locus_text_layout_trim(LocusUI* ui);
+
+void locus_text_layout_clear(LocusUI* ui);
+
+void locus_text_cache_stats(LocusUI* ui, unsigned long* hits, unsigned long* misses, int* entries);
+
+void locus_text_cache_trim(LocusUI* ui);
+
+void locus_text_cache_clear(LocusUI* ui);
+
+LocusTexture* locus_texture_lookup(LocusUI* ui, const char* key, int size, float scale);
+
+LocusTexture* locus_texture_insert(LocusUI* ui, const char* key, int size, float scale, int image);
+
+LocusTexture* locus_texture_insert_rgba(LocusUI* ui, const char* key, int size, float scale,
+                                        const unsigned char* rgba, int width, int height);
+
+void locus_texture_invalidate(LocusUI* ui, const char* key);
+
+int locus_image_bucket(LocusUI* ui, float width, float height);
+
+int locus_image_data_load(const char* path, int bucket, int pow2, LocusImageData* data);
+
+void locus_image_data_free(LocusImageData* data);
+
+LocusTexture* locus_image_texture_insert(LocusUI* ui, const char* key, int size, float scale,
+                                         const LocusImageData* data);
+
+void locus_image_set_mipmaps(LocusUI* ui, int enabled);
+
+void locus_texture_cache_set_budget(LocusUI* ui, size_t bytes);
+
+void locus_texture_cache_trim(LocusUI* ui);
+
+void locus_texture_cache_stats(LocusUI* ui, unsigned long* hits, unsigned long* misses,
+                               int* entries, size_t* bytes);
+
+void locus_texture_cache_clear(LocusUI* ui);
+
+int locus_layer_begin(LocusUI* ui, const char* key, uint64_t stamp, float x, float y,
+                      float width, float height);
+
+int locus_layer_begin_blurred(LocusUI* ui, const char* key, uint64_t stamp, float x, float y,
+                              float width, float height, float blur);
+
+void locus_layer_end(LocusUI* ui);
+
+void locus_layer_invalidate(LocusUI* ui, const char* key);
+
+void locus_layer_cache_set_budget(LocusUI* ui, size_t bytes);
+
+void locus_layer_cache_trim(LocusUI* ui);
+
+void locus_layer_cache_stats(LocusUI* ui, int* entries, size_t* bytes);
+
+void locus_layer_cache_clear(LocusUI* ui);
+
+void locus_ui_set_vector_icons(LocusUI* ui, int enabled);
+
+int locus_vector_icon(LocusUI* ui, const char* icon_name, float x, float y, float size);
+
+void locus_vector_cache_trim(LocusUI* ui);
+
+void locus_vector_cache_clear(LocusUI* ui);
+
+void locus_shadow(LocusUI* ui, float x, float y, float width, float height, float radius, float blur,
+                  float red, float green, float blue, float alpha);
+
+int locus_icon_theme_load(LocusUI* ui, const char* theme);
+
+int locus_icon_theme_lookup(LocusUI* ui, const char* icon_name, int size, int scale,
+                            char* path, size_t path_size);
+
+int locus_loader_start(LocusUI* ui, int threads);
+
+void locus_loader_set_callback(LocusUI* ui, void (*callback)(void* data), void* data);
+
+void locus_loader_set_upload_budget(LocusUI* ui, uint32_t microseconds);
+
+int locus_loader_fd(LocusUI* ui);
+
+void locus_loader_dispatch(LocusUI* ui);
+
+void locus_loader_trim(LocusUI* ui);
+
+void locus_loader_stop(LocusUI* ui);
+
+void locus_ui_bind(LocusUI* ui, struct Locus* app);
+
+int locus_image_async(LocusUI* ui, const char* imagePath, float x, float y,
+                      float width, float height);
+
+int locus_icon_async(LocusUI* ui, const char* icon_name, float x, float y, float size);
+
 void locus_rectangle(LocusUI* ui, float x, float y, float width, float height, 
                      float red, float green, float blue, float alpha, float cornerRadius);
 
@@ -20,8 +479,91 @@ void locus_image(LocusUI* ui, const char* imagePath, float x, float y,
 
 void locus_icon(LocusUI* ui, const char* icon_name, float x, float y, float size);
 
+void locus_draw_texture(LocusUI* ui, const LocusTexture* tex, float x, float y,
+                        float width, float height);
+
+unsigned char* locus_rasterize_svg(const char* path, int pixelSize, int* width, int* height);
+
+void locus_timing_hud(LocusUI* ui, float x, float y, float width, float height);
+
 void locus_gen_png(const char* icon_name);
 
+LocusScene* locus_scene_create(LocusUI* ui, struct Locus* app);
+
+void locus_scene_set_surface(LocusScene* scene, struct LocusSurface* surface);
+
+void locus_scene_update(LocusScene* scene);
+
+void locus_scene_draw(LocusScene* scene);
+
+LocusNode* locus_scene_hit_test(LocusScene* scene, float x, float y);
+
+void locus_scene_destroy(LocusScene* scene);
+
+LocusNode* locus_node_group(LocusScene* scene, LocusNode* parent, float x, float y,
+                            float width, float height);
+
+LocusNode* locus_node_rectangle(LocusScene* scene, LocusNode* parent, float x, float y,
+                                float width, float height, float red, float green, float blue,
+                                float alpha, float cornerRadius);
+
+LocusNode* locus_node_text(LocusScene* scene, LocusNode* parent, const char* text, float x, float y,
+                           float fontSize, float red, float green, float blue, float alpha);
+
+LocusNode* locus_node_image(LocusScene* scene, LocusNode* parent, const char* imagePath,
+                            float x, float y, float width, float height);
+
+LocusNode* locus_node_icon(LocusScene* scene, LocusNode* parent, const char* icon_name,
+                           float x, float y, float size);
+
+void locus_node_set_position(LocusScene* scene, LocusNode* node, float x, float y);
+
+void locus_node_set_size(LocusScene* scene, LocusNode* node, float width, float height);
+
+void locus_node_set_transform(LocusScene* scene, LocusNode* node, const float* transform);
+
+void locus_node_set_color(LocusScene* scene, LocusNode* node, float red, float green,
+                          float blue, float alpha);
+
+void locus_node_set_text(LocusScene* scene, LocusNode* node, const char* text);
+
+void locus_node_set_clip(LocusScene* scene, LocusNode* node, int clip);
+
+void locus_node_set_visible(LocusScene* scene, LocusNode* node, int visible);
+
+void locus_node_destroy(LocusScene* scene, LocusNode* node);
+
+LocusList* locus_list_create(LocusUI* ui, struct Locus* app, int count, float rowHeight, int columns);
+
+void locus_list_set_surface(LocusList* list, struct LocusSurface* surface);
+
+void locus_list_set_bounds(LocusList* list, float x, float y, float width, float height);
+
+void locus_list_set_rows(LocusList* list, size_t stateSize,
+                         void (*bind)(LocusList* list, int index, void* state, void* data),
+                         void (*draw)(LocusList* list, LocusUI* ui, int index, void* state,
+                                      float x, float y, float width, float height, void* data),
+                         void* data);
+
+void locus_list_set_activate_callback(LocusList* list,
+                                      void (*callback)(LocusList* list, int index, void* data));
+
+void locus_list_set_count(LocusList* list, int count);
+
+void locus_list_invalidate(LocusList* list, int index);
+
+void locus_list_scroll_to(LocusList* list, float offset);
+
+float locus_list_scroll(LocusList* list);
+
+int locus_list_hit_test(LocusList* list, float x, float y);
+
+void locus_list_touch(LocusList* list, int32_t id, double x, double y, int32_t state);
+
+void locus_list_draw(LocusList* list);
+
+void locus_list_destroy(LocusList* list);
+
 void locus_cleanup_ui(LocusUI* ui);  
 
 #endif 
@@ -0,0 +1,315 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <nanovg.h>
+#include <nanosvg.h>
+#include "locus.h"
+#include "locus-ui-private.h"
+
+/* SVG icons replayed as NanoVG paths. Icons using what NanoVG can't
+ * express keep going through the raster path. */
+
+#define LOCUS_VECTOR_MAX_AGE 600
+
+struct LocusVectorIcon {
+    uint64_t hash;
+    char* name;
+    int size, scale;
+    NSVGimage* svg;
+    unsigned char* windings;
+    uint32_t last_used;
+    LocusVectorIcon* next;
+};
+
+static void free_icon(LocusVectorIcon* icon) {
+    if (icon->svg) {
+        nsvgDelete(icon->svg);
+    }
+    free(icon->windings);
+    free(icon->name);
+    free(icon);
+}
+
+static int supported_paint(const NSVGpaint* paint) {
+    if (paint->type != NSVG_PAINT_LINEAR_GRADIENT && paint->type != NSVG_PAINT_RADIAL_GRADIENT) {
+        return 1;
+    }
+    const NSVGgradient* gradient = paint->gradient;
+    if (gradient->spread != NSVG_SPREAD_PAD || gradient->nstops < 1 || gradient->nstops > 2) {
+        return 0;
+    }
+    if (paint->type == NSVG_PAINT_RADIAL_GRADIENT) {
+        if (gradient->fx != 0.0f || gradient->fy != 0.0f) {
+            return 0;
+        }
+        const float* t = gradient->xform;
+        float sx = sqrtf(t[0] * t[0] + t[1] * t[1]), sy = sqrtf(t[2] * t[2] + t[3] * t[3]);
+        return fabsf(t[0] * t[2] + t[1] * t[3]) < 1e-3f * sx * sy && fabsf(sx - sy) < 1e-3f * sx;
+    }
+    return 1;
+}
+
+static int supported_svg(const NSVGimage* svg) {
+    for (const NSVGshape* shape = svg->shapes; shape; shape = shape->next) {
+        if (!supported_paint(&shape->fill) || !supported_paint(&shape->stroke) ||
+            (shape->stroke.type != NSVG_PAINT_NONE && shape->strokeDashCount > 0)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Signed area of the control polygon, with NanoVG's sign convention. */
+static float path_area(const NSVGpath* path) {
+    float area = 0.0f;
+    for (int i = 0; i < path->npts; i++) {
+        const float* a = &path->pts[i * 2];
+        const float* b = &path->pts[((i + 1) % path->npts) * 2];
+        area += a[0] * b[1] - b[0] * a[1];
+    }
+    return area * 0.5f;
+}
+
+static int point_inside(const NSVGpath* path, float x, float y) {
+    int inside = 0;
+    for (int i = 0, j = path->npts - 1; i < path->npts; j = i++) {
+        const float* a = &path->pts[i * 2];
+        const float* b = &path->pts[j * 2];
+        if ((a[1] > y) != (b[1] > y) && x < (b[0] - a[0]) * (y - a[1]) / (b[1] - a[1]) + a[0]) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+/* NanoVG forces each subpath's winding; for even-odd shapes it alternates
+ * with nesting depth, which matches as long as subpaths don't cross. */
+static int compute_windings(LocusVectorIcon* icon) {
+    int count = 0;
+    for (NSVGshape* shape = icon->svg->shapes; shape; shape = shape->next) {
+        for (NSVGpath* path = shape->paths; path; path = path->next) {
+            count++;
+        }
+    }
+    icon->windings = malloc(count > 0 ? count : 1);
+    if (icon->windings == NULL) {
+        return 0;
+    }
+
+    int index = 0;
+    for (NSVGshape* shape = icon->svg->shapes; shape; shape = shape->next) {
+        for (NSVGpath* path = shape->paths; path; path = path->next) {
+            int solid;
+            if (shape->fillRule == NSVG_FILLRULE_EVENODD) {
+                int depth = 0;
+                for (NSVGpath* other = shape->paths; other; other = other->next) {
+                    if (other != path && other->npts > 2 && point_inside(other, path->pts[0], path->pts[1])) {
+                        depth++;
+                    }
+                }
+                solid = depth % 2 == 0;
+            } else {
+                solid = path_area(path) > 0.0f;
+            }
+            icon->windings[index++] = solid ? NVG_SOLID : NVG_HOLE;
+        }
+    }
+    return 1;
+}
+
+static LocusVectorIcon* load_vector_icon(LocusUI* ui, const char* icon_name, int pixelSize) {
+    int scale = (int)(ui->pixel_ratio + 0.5f);
+    int size = pixelSize / scale;
+    int key[2] = { size, scale };
+    uint64_t hash = locus_hash_string(icon_name, locus_hash_bytes(key, sizeof(key), 0));
+    LocusVectorIcon** bucket = &ui->vector_buckets[hash % LOCUS_VECTOR_CACHE_SIZE];
+    for (LocusVectorIcon* icon = *bucket; icon; icon = icon->next) {
+        if (icon->hash == hash && icon->size == size && icon->scale == scale &&
+            strcmp(icon->name, icon_name) == 0) {
+            icon->last_used = ui->frame;
+            return icon;
+        }
+    }
+
+    LocusVectorIcon* icon = calloc(1, sizeof(*icon));
+    if (icon == NULL || (icon->name = strdup(icon_name)) == NULL) {
+        free(icon);
+        fprintf(stderr, "Error: Could not allocate vector icon\n");
+        return NULL;
+    }
+    icon->hash = hash;
+    icon->size = size;
+    icon->scale = scale;
+    icon->last_used = ui->frame;
+
+    char path[512];
+    if (locus_icon_theme_lookup(ui, icon_name, size, scale, path, sizeof(path)) == 2) {
+        icon->svg = nsvgParseFromFile(path, "px", 96.0f);
+        if (icon->svg && (icon->svg->width <= 0.0f || icon->svg->height <= 0.0f ||
+                          !supported_svg(icon->svg) || !compute_windings(icon))) {
+            nsvgDelete(icon->svg);
+            icon->svg = NULL;
+        }
+    }
+
+    icon->next = *bucket;
+    *bucket = icon;
+    ui->vector_count++;
+    return icon;
+}
+
+static NVGcolor svg_color(unsigned int color, float opacity) {
+    return nvgRGBA(color & 0xff, (color >> 8) & 0xff, (color >> 16) & 0xff,
+                   (unsigned char)(((color >> 24) & 0xff) * opacity));
+}
+
+/* nanosvg's gradient transform maps user space onto a unit gradient: the
+ * linear one runs along y from 0 to 1, the radial one is the unit circle. */
+static NVGpaint svg_paint(LocusUI* ui, const NSVGpaint* paint, float opacity) {
+    const NSVGgradient* gradient = paint->gradient;
+    const NSVGgradientStop* first = &gradient->stops[0];
+    const NSVGgradientStop* last = &gradient->stops[gradient->nstops - 1];
+    NVGcolor inner = svg_color(first->color, opacity);
+    NVGcolor outer = svg_color(last->color, opacity);
+    float inverse[6];
+    nvgTransformInverse(inverse, gradient->xform);
+
+    float x0, y0, x1, y1;
+    if (paint->type == NSVG_PAINT_LINEAR_GRADIENT) {
+        nvgTransformPoint(&x0, &y0, inverse, 0.0f, first->offset);
+        nvgTransformPoint(&x1, &y1, inverse, 0.0f, last->offset);
+        return nvgLinearGradient(ui->vg, x0, y0, x1, y1, inner, outer);
+    }
+    nvgTransformPoint(&x0, &y0, inverse, 0.0f, 0.0f);
+    nvgTransformPoint(&x1, &y1, inverse, 1.0f, 0.0f);
+    float radius = sqrtf((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0));
+    return nvgRadialGradient(ui->vg, x0, y0, radius * first->offset, radius * last->offset, inner, outer);
+}
+
+static void trace_shape(LocusUI* ui, const NSVGshape* shape, const unsigned char* windings, int fill) {
+    int index = 0;
+    nvgBeginPath(ui->vg);
+    for (const NSVGpath* path = shape->paths; path; path = path->next, index++) {
+        const float* p = path->pts;
+        nvgMoveTo(ui->vg, p[0], p[1]);
+        for (int i = 1; i + 2 < path->npts; i += 3) {
+            const float* c = &p[i * 2];
+            nvgBezierTo(ui->vg, c[0], c[1], c[2], c[3], c[4], c[5]);
+        }
+        if (path->closed) {
+            nvgClosePath(ui->vg);
+        }
+        if (fill) {
+            nvgPathWinding(ui->vg, windings[index]);
+        }
+    }
+}
+
+static void draw_vector(LocusUI* ui, const LocusVectorIcon* icon, float x, float y, float size) {
+    const NSVGimage* svg = icon->svg;
+    float scale = svg->width > svg->height ? size / svg->width : size / svg->height;
+    const unsigned char* windings = icon->windings;
+
+    locus_batch_begin_nvg(ui);
+    nvgSave(ui->vg);
+    nvgGlobalAlpha(ui->vg, ui->alpha);
+    nvgTranslate(ui->vg, x, y);
+    nvgScale(ui->vg, scale, scale);
+
+    for (const NSVGshape* shape = svg->shapes; shape; shape = shape->next) {
+        int paths = 0;
+        for (const NSVGpath* path = shape->paths; path; path = path->next) {
+            paths++;
+        }
+        if (!(shape->flags & NSVG_FLAGS_VISIBLE)) {
+            windings += paths;
+            continue;
+        }
+
+        if (shape->fill.type == NSVG_PAINT_COLOR) {
+            trace_shape(ui, shape, windings, 1);
+            nvgFillColor(ui->vg, svg_color(shape->fill.color, shape->opacity));
+            nvgFill(ui->vg);
+        } else if (shape->fill.type == NSVG_PAINT_LINEAR_GRADIENT || shape->fill.type == NSVG_PAINT_RADIAL_GRADIENT) {
+            trace_shape(ui, shape, windings, 1);
+            nvgFillPaint(ui->vg, svg_paint(ui, &shape->fill, shape->opacity));
+            nvgFill(ui->vg);
+        }
+
+        if (shape->stroke.type != NSVG_PAINT_NONE && shape->strokeWidth > 0.0f) {
+            static const int joins[] = { NVG_MITER, NVG_ROUND, NVG_BEVEL };
+            static const int caps[] = { NVG_BUTT, NVG_ROUND, NVG_SQUARE };
+            trace_shape(ui, shape, windings, 0);
+            nvgStrokeWidth(ui->vg, shape->strokeWidth);
+            nvgLineJoin(ui->vg, joins[shape->strokeLineJoin % 3]);
+            nvgLineCap(ui->vg, caps[shape->strokeLineCap % 3]);
+            nvgMiterLimit(ui->vg, shape->miterLimit);
+            if (shape->stroke.type == NSVG_PAINT_COLOR) {
+                nvgStrokeColor(ui->vg, svg_color(shape->stroke.color, shape->opacity));
+            } else {
+                nvgStrokePaint(ui->vg, svg_paint(ui, &shape->stroke, shape->opacity));
+            }
+            nvgStroke(ui->vg);
+        }
+        windings += paths;
+    }
+    nvgRestore(ui->vg);
+}
+
+/* Draws the icon as vectors when it is a supported SVG; returns 0 when the
+ * caller has to fall back to a raster icon. */
+int locus_vector_icon(LocusUI* ui, const char* icon_name, float x, float y, float size) {
+    if (ui->vg == NULL) {
+        return 0;
+    }
+    int pixelSize = (int)(size * ui->pixel_ratio + 0.5f);
+    if (pixelSize <= 0) {
+        return 1;
+    }
+
+    LocusVectorIcon* icon = load_vector_icon(ui, icon_name, pixelSize);
+    if (icon == NULL || icon->svg == NULL) {
+        return 0;
+    }
+    draw_vector(ui, icon, x, y, size);
+    return 1;
+}
+
+/* Not to be called within a frame. */
+void locus_ui_set_vector_icons(LocusUI* ui, int enabled) {
+    ui->vector_icons = enabled && ui->vg != NULL;
+}
+
+void locus_vector_cache_trim(LocusUI* ui) {
+    if (ui->vector_count <= LOCUS_VECTOR_CACHE_SIZE) {
+        return;
+    }
+
+    for (int i = 0; i < LOCUS_VECTOR_CACHE_SIZE; i++) {
+        LocusVectorIcon** link = &ui->vector_buckets[i];
+        while (*link) {
+            LocusVectorIcon* icon = *link;
+            if (ui->frame - icon->last_used > LOCUS_VECTOR_MAX_AGE) {
+                *link = icon->next;
+                free_icon(icon);
+                ui->vector_count--;
+            } else {
+                link = &icon->next;
+            }
+        }
+    }
+}
+
+void locus_vector_cache_clear(LocusUI* ui) {
+    for (int i = 0; i < LOCUS_VECTOR_CACHE_SIZE; i++) {
+        LocusVectorIcon* icon = ui->vector_buckets[i];
+        while (icon) {
+            LocusVectorIcon* next = icon->next;
+            free_icon(icon);
+            icon = next;
+        }
+        ui->vector_buckets[i] = NULL;
+    }
+    ui->vector_count = 0;
+}